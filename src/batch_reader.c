@@ -0,0 +1,555 @@
+#include "batch_reader.h"
+#include "logger.h"
+#include "wav_file.h"
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+
+/** The largest number of bytes requested by one read, which fits the 32-bit length of an SQE. */
+#define BATCH_READER_MAX_READ (1u << 30)
+
+
+#ifdef __linux__
+/**
+ * The rings of an io_uring, mapped from the kernel.
+ *
+ * liburing is not a dependency, so the rings are set up and driven with the raw system calls. The
+ * loader thread is the only producer of submissions and the only consumer of completions.
+ *
+ * @var fd              The file descriptor of the io_uring.
+ * @var sq_ring         The mapping of the submission queue ring.
+ * @var sq_ring_size    The size of {@code sq_ring}, in bytes.
+ * @var cq_ring         The mapping of the completion queue ring, which is {@code sq_ring} when
+ *                      the kernel maps both at once.
+ * @var cq_ring_size    The size of {@code cq_ring}, in bytes.
+ * @var sqes            The mapping of the submission queue entries.
+ * @var sqes_size       The size of {@code sqes}, in bytes.
+ * @var sq_tail         The tail of the submission queue, advanced by the loader thread.
+ * @var sq_mask         The mask of an index into the submission queue.
+ * @var sq_array        The indexes of the entries of {@code sqes} in the submission queue.
+ * @var cq_head         The head of the completion queue, advanced by the loader thread.
+ * @var cq_tail         The tail of the completion queue, advanced by the kernel.
+ * @var cq_mask         The mask of an index into the completion queue.
+ * @var cqes            The completion queue entries.
+ */
+struct batch_ring_s {
+    int fd;
+    uint8_t *sq_ring;
+    size_t sq_ring_size;
+    uint8_t *cq_ring;
+    size_t cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    _Atomic unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned *sq_array;
+    _Atomic unsigned *cq_head;
+    _Atomic unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+};
+#else
+struct batch_ring_s {
+    int fd;
+};
+#endif
+
+
+/**
+ * Sets up an io_uring for the loader thread of a reader.
+ *
+ * @return A pointer to the new ring. If the kernel does not provide io_uring (or it is not
+ *         Linux), or memory cannot be allocated, {@code NULL} is returned.
+ */
+static BatchRing *batch_ring_create(void) {
+#ifdef __linux__
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    long fd = syscall(SYS_io_uring_setup, BATCH_READER_URING_ENTRIES, &params);
+    if (fd < 0) {
+        log_debug("io_uring is not available (%s)", strerror(errno));
+        return NULL;
+    }
+
+    BatchRing *ring = (BatchRing *) calloc(1, sizeof(BatchRing));
+    if (ring == NULL) {
+        close(fd);
+        return NULL;
+    }
+    ring->fd = (int) fd;
+
+    // Since Linux 5.4, both rings are in one mapping.
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap && ring->cq_ring_size > ring->sq_ring_size) {
+        ring->sq_ring_size = ring->cq_ring_size;
+    }
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    void *sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    void *cq_ring = sq_ring;
+    if (sq_ring != MAP_FAILED && !single_mmap) {
+        cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    }
+    void *sqes = MAP_FAILED;
+    if (sq_ring != MAP_FAILED && cq_ring != MAP_FAILED) {
+        sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    }
+    if (sqes == MAP_FAILED) {
+        log_debug("cannot map the rings of io_uring (%s)", strerror(errno));
+        if (cq_ring != MAP_FAILED && cq_ring != sq_ring) {
+            munmap(cq_ring, ring->cq_ring_size);
+        }
+        if (sq_ring != MAP_FAILED) {
+            munmap(sq_ring, ring->sq_ring_size);
+        }
+        close(ring->fd);
+        free(ring);
+        return NULL;
+    }
+
+    ring->sq_ring = (uint8_t *) sq_ring;
+    ring->cq_ring = (uint8_t *) cq_ring;
+    ring->sqes = (struct io_uring_sqe *) sqes;
+    ring->sq_tail = (_Atomic unsigned *) (ring->sq_ring + params.sq_off.tail);
+    ring->sq_mask = *(unsigned *) (ring->sq_ring + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *) (ring->sq_ring + params.sq_off.array);
+    ring->cq_head = (_Atomic unsigned *) (ring->cq_ring + params.cq_off.head);
+    ring->cq_tail = (_Atomic unsigned *) (ring->cq_ring + params.cq_off.tail);
+    ring->cq_mask = *(unsigned *) (ring->cq_ring + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) (ring->cq_ring + params.cq_off.cqes);
+    return ring;
+#else
+    return NULL;
+#endif
+}
+
+
+/**
+ * Frees a ring returned by {@code batch_ring_create}, which must have no reads in flight.
+ *
+ * @param ring  The ring to free.
+ */
+static void batch_ring_free(BatchRing *ring) {
+#ifdef __linux__
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring != ring->sq_ring) {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    munmap(ring->sq_ring, ring->sq_ring_size);
+#endif
+    close(ring->fd);
+    free(ring);
+}
+
+
+#ifdef __linux__
+/**
+ * Queues a read of the rest of a file's contents, to be submitted with the next
+ * {@code io_uring_enter}.
+ *
+ * The ring has a submission entry free because no more reads than its entries are ever in flight.
+ *
+ * @param ring   The ring to queue the read on.
+ * @param file   The file to read, with its descriptor open and its contents allocated.
+ * @param index  The index of the file in the batch, which comes back with the completion.
+ */
+static void batch_ring_queue_read(BatchRing *ring, const BatchFile *file, size_t index) {
+    size_t remaining = file->size - file->bytes_read;
+    unsigned tail = atomic_load_explicit(ring->sq_tail, memory_order_relaxed);
+    unsigned slot = tail & ring->sq_mask;
+
+    struct io_uring_sqe *sqe = &ring->sqes[slot];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = file->fd;
+    sqe->addr = (uintptr_t) (file->contents + file->bytes_read);
+    sqe->len = (remaining < BATCH_READER_MAX_READ) ? remaining : BATCH_READER_MAX_READ;
+    sqe->off = file->bytes_read;
+    sqe->user_data = index;
+    ring->sq_array[slot] = slot;
+
+    // The entry must be visible to the kernel before the tail that publishes it.
+    atomic_store_explicit(ring->sq_tail, tail + 1, memory_order_release);
+}
+#endif
+
+
+/**
+ * Marks a file as loaded and wakes the threads waiting on the reader.
+ *
+ * @param reader  The reader of the file.
+ * @param file    The file, with its wave file (and samples) set if it loaded.
+ */
+static void batch_reader_finish(BatchReader *reader, BatchFile *file) {
+    pthread_mutex_lock(&reader->lock);
+    file->ready = true;
+    pthread_cond_broadcast(&reader->changed);
+    pthread_mutex_unlock(&reader->lock);
+}
+
+
+/**
+ * Parses the contents of a file that have been read, and converts them to mono samples if the
+ * reader does.
+ *
+ * @param reader  The reader of the file.
+ * @param file    The file, whose contents are passed to the wave file or freed.
+ */
+static void batch_reader_parse(BatchReader *reader, BatchFile *file) {
+    if (file->contents != NULL) {
+        file->wav_file = wav_file_parse(file->contents, file->bytes_read);
+        if (file->wav_file == NULL) {
+            free(file->contents);
+        }
+        file->contents = NULL;
+    }
+    if (file->wav_file != NULL && reader->convert_mono) {
+        file->wav_samples = wav_file_get_mono_samples(file->wav_file);
+        if (file->wav_samples == NULL) {
+            wav_file_close(file->wav_file);
+            file->wav_file = NULL;
+        }
+    }
+    batch_reader_finish(reader, file);
+}
+
+
+/**
+ * Opens a file and allocates a buffer for its whole contents.
+ *
+ * @param file  The file to open, whose descriptor, contents and size are set. If the file cannot
+ *              be opened, its error is set instead.
+ *
+ * @return Whether the file was opened.
+ */
+static bool batch_file_open(BatchFile *file) {
+    file->fd = open(file->path, O_RDONLY);
+    if (file->fd < 0) {
+        file->error = errno;
+        return false;
+    }
+
+    struct stat info;
+    int error = (fstat(file->fd, &info) != 0) ? errno : 0;
+    if (error == 0 && info.st_size <= 0) {
+        error = EINVAL;
+    }
+    if (error != 0) {
+        file->error = error;
+        close(file->fd);
+        file->fd = -1;
+        return false;
+    }
+    file->size = info.st_size;
+    file->bytes_read = 0;
+    file->contents = (uint8_t *) malloc(file->size);
+    if (file->contents == NULL) {
+        file->error = ENOMEM;
+        close(file->fd);
+        file->fd = -1;
+        return false;
+    }
+    return true;
+}
+
+
+/**
+ * Ends the read of a file, closing its descriptor and freeing its contents if the read failed.
+ *
+ * @param file   The file that was read.
+ * @param error  The error of the read, or 0 if it succeeded.
+ */
+static void batch_file_close(BatchFile *file, int error) {
+    close(file->fd);
+    file->fd = -1;
+    if (error != 0) {
+        file->error = error;
+        free(file->contents);
+        file->contents = NULL;
+    }
+}
+
+
+/**
+ * Checks whether another file may start loading, which holds while fewer than the read-ahead of
+ * files are loading or waiting to be taken. The reader's lock must be held.
+ *
+ * @param reader  The reader to check.
+ *
+ * @return Whether the file at {@code reader->next_load} may start loading.
+ */
+static bool batch_reader_can_load(const BatchReader *reader) {
+    return reader->next_load < reader->num_files &&
+        reader->next_load - reader->next_take < reader->read_ahead;
+}
+
+
+#ifdef __linux__
+/**
+ * Loads the files of a reader through its io_uring.
+ *
+ * Each time the window of files ahead opens up, the thread opens the new files and submits reads
+ * of their whole contents together. It then waits for any read to complete, and parses the file
+ * of each completed read while the rest are still being read by the kernel. A short read is
+ * resubmitted for the rest of the file.
+ *
+ * @param arg  The {@code BatchReader}.
+ *
+ * @return {@code NULL}.
+ */
+static void *batch_reader_uring_thread(void *arg) {
+    BatchReader *reader = (BatchReader *) arg;
+    BatchRing *ring = reader->ring;
+    size_t in_flight = 0;
+    unsigned to_submit = 0;
+
+    for (;;) {
+        // Claim every file that the window and the ring have room for.
+        pthread_mutex_lock(&reader->lock);
+        while (!reader->stopping && in_flight == 0 && !batch_reader_can_load(reader) &&
+               reader->next_load < reader->num_files)
+        {
+            pthread_cond_wait(&reader->changed, &reader->lock);
+        }
+        bool stopping = reader->stopping;
+        size_t first = reader->next_load;
+        while (!stopping && batch_reader_can_load(reader) &&
+               in_flight + (reader->next_load - first) < BATCH_READER_URING_ENTRIES)
+        {
+            reader->next_load++;
+        }
+        size_t last = reader->next_load;
+        pthread_mutex_unlock(&reader->lock);
+
+        if ((stopping || first == reader->num_files) && in_flight == 0) {
+            break;
+        }
+
+        for (size_t i = first; i < last; i++) {
+            BatchFile *file = &reader->files[i];
+            if (batch_file_open(file)) {
+                batch_ring_queue_read(ring, file, i);
+                to_submit++;
+                in_flight++;
+            }
+            else {
+                batch_reader_finish(reader, file);
+            }
+        }
+        if (in_flight == 0) {
+            continue;
+        }
+
+        // The kernel may take only some of the queued reads, and takes none if a signal interrupts
+        // it, so the rest stay queued for the next call.
+        long entered;
+        do {
+            entered = syscall(SYS_io_uring_enter, ring->fd, to_submit, 1,
+                              IORING_ENTER_GETEVENTS, NULL, 0);
+        } while (entered < 0 && errno == EINTR);
+        if (entered < 0) {
+            log_fatal("cannot submit reads to io_uring (%s)", strerror(errno));
+        }
+        to_submit -= entered;
+
+        unsigned head = atomic_load_explicit(ring->cq_head, memory_order_relaxed);
+        unsigned tail = atomic_load_explicit(ring->cq_tail, memory_order_acquire);
+        for (; head != tail; head++) {
+            const struct io_uring_cqe *cqe = &ring->cqes[head & ring->cq_mask];
+            BatchFile *file = &reader->files[cqe->user_data];
+            int result = cqe->res;
+            atomic_store_explicit(ring->cq_head, head + 1, memory_order_release);
+
+            // A file that shrank since it was opened ends at the shorter size.
+            if (result > 0) {
+                file->bytes_read += result;
+            }
+            if (result > 0 && file->bytes_read < file->size && !stopping) {
+                batch_ring_queue_read(ring, file, cqe->user_data);
+                to_submit++;
+                continue;
+            }
+
+            in_flight--;
+            batch_file_close(file, (result < 0) ? -result : 0);
+            if (stopping) {
+                free(file->contents);
+                file->contents = NULL;
+            }
+            batch_reader_parse(reader, file);
+        }
+    }
+
+    return NULL;
+}
+#endif
+
+
+/**
+ * Loads files of a reader with blocking reads, one file at a time per thread of the pool.
+ *
+ * @param arg  The {@code BatchReader}.
+ *
+ * @return {@code NULL}.
+ */
+static void *batch_reader_pool_thread(void *arg) {
+    BatchReader *reader = (BatchReader *) arg;
+
+    for (;;) {
+        pthread_mutex_lock(&reader->lock);
+        while (!reader->stopping && !batch_reader_can_load(reader) &&
+               reader->next_load < reader->num_files)
+        {
+            pthread_cond_wait(&reader->changed, &reader->lock);
+        }
+        if (reader->stopping || reader->next_load == reader->num_files) {
+            pthread_mutex_unlock(&reader->lock);
+            break;
+        }
+        BatchFile *file = &reader->files[reader->next_load++];
+        pthread_mutex_unlock(&reader->lock);
+
+        if (!batch_file_open(file)) {
+            batch_reader_finish(reader, file);
+            continue;
+        }
+        int error = 0;
+        while (file->bytes_read < file->size) {
+            ssize_t result = read(file->fd,
+                                  file->contents + file->bytes_read,
+                                  file->size - file->bytes_read);
+            if (result < 0 && errno == EINTR) {
+                continue;
+            }
+            if (result <= 0) {
+                error = (result < 0) ? errno : 0;
+                break;
+            }
+            file->bytes_read += result;
+        }
+        batch_file_close(file, error);
+        batch_reader_parse(reader, file);
+    }
+
+    return NULL;
+}
+
+
+BatchReader *batch_reader_create(const char *const *paths,
+                                 size_t num_paths,
+                                 size_t read_ahead,
+                                 bool convert_mono)
+{
+    assert(paths && "batch_reader_create got NULL paths");
+    assert(read_ahead > 0 && "batch_reader_create got no read-ahead");
+
+    BatchReader *reader = (BatchReader *) calloc(1, sizeof(BatchReader));
+    BatchFile *files = (BatchFile *) calloc(num_paths, sizeof(BatchFile));
+    pthread_t *threads = (pthread_t *) malloc(read_ahead * sizeof(pthread_t));
+    if (reader == NULL || files == NULL || threads == NULL) {
+        free(reader);
+        free(files);
+        free(threads);
+        return NULL;
+    }
+    for (size_t i = 0; i < num_paths; i++) {
+        files[i].path = paths[i];
+        files[i].fd = -1;
+    }
+
+    reader->files = files;
+    reader->num_files = num_paths;
+    reader->read_ahead = read_ahead;
+    reader->convert_mono = convert_mono;
+    reader->threads = threads;
+    reader->ring = batch_ring_create();
+    pthread_mutex_init(&reader->lock, NULL);
+    pthread_cond_init(&reader->changed, NULL);
+
+    // The ring needs one thread to drive it, while blocking reads need one thread per file.
+    size_t num_threads = (reader->ring != NULL) ? 1 : read_ahead;
+    for (size_t i = 0; i < num_threads; i++) {
+        void *(*loader)(void *) = batch_reader_pool_thread;
+#ifdef __linux__
+        if (reader->ring != NULL) {
+            loader = batch_reader_uring_thread;
+        }
+#endif
+        if (pthread_create(&threads[i], NULL, loader, reader) != 0) {
+            batch_reader_free(reader);
+            return NULL;
+        }
+        reader->num_threads++;
+    }
+
+    log_debug("reading %lu files ahead %s", read_ahead,
+              (reader->ring != NULL) ? "through io_uring" : "with a thread pool");
+    return reader;
+}
+
+
+BatchFile *batch_reader_next(BatchReader *reader) {
+    pthread_mutex_lock(&reader->lock);
+    if (reader->next_take == reader->num_files) {
+        pthread_mutex_unlock(&reader->lock);
+        return NULL;
+    }
+
+    BatchFile *file = &reader->files[reader->next_take];
+    while (!file->ready) {
+        pthread_cond_wait(&reader->changed, &reader->lock);
+    }
+    reader->next_take++;
+    pthread_cond_broadcast(&reader->changed);
+    pthread_mutex_unlock(&reader->lock);
+    return file;
+}
+
+
+void batch_reader_free(BatchReader *reader) {
+    pthread_mutex_lock(&reader->lock);
+    reader->stopping = true;
+    pthread_cond_broadcast(&reader->changed);
+    pthread_mutex_unlock(&reader->lock);
+    for (size_t i = 0; i < reader->num_threads; i++) {
+        pthread_join(reader->threads[i], NULL);
+    }
+
+    // Files that were loaded but not taken are still owned by the reader.
+    for (size_t i = reader->next_take; i < reader->num_files; i++) {
+        if (reader->files[i].wav_samples != NULL) {
+            wav_file_free_samples(reader->files[i].wav_samples);
+        }
+        if (reader->files[i].wav_file != NULL) {
+            wav_file_close(reader->files[i].wav_file);
+        }
+    }
+    if (reader->ring != NULL) {
+        batch_ring_free(reader->ring);
+    }
+
+    pthread_cond_destroy(&reader->changed);
+    pthread_mutex_destroy(&reader->lock);
+    free(reader->threads);
+    free(reader->files);
+    free(reader);
+}
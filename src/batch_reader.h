@@ -0,0 +1,127 @@
+#ifndef _BATCH_READER_H_
+#define _BATCH_READER_H_
+
+
+#define BATCH_READER_URING_ENTRIES 16
+
+
+#include "wav_file.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+
+typedef struct batch_file_s BatchFile;
+typedef struct batch_ring_s BatchRing;
+typedef struct batch_reader_s BatchReader;
+
+
+/**
+ * A file of a batch, as loaded by a {@code BatchReader}.
+ *
+ * @var path         The path of the file.
+ * @var wav_file     The parsed wave file, or {@code NULL} if it could not be read or parsed.
+ * @var wav_samples  The mono samples of the file, if the reader converts them, or {@code NULL}.
+ * @var error        The {@code errno} of the failed open or read of the file, or 0 if it was read
+ *                   (even if it could not be parsed).
+ * @var ready        Whether the file has been loaded (or has failed to load).
+ * @var fd           The descriptor of the file while it is read, or -1.
+ * @var contents     The buffer that the whole file is read into, which becomes the data of the
+ *                   wave file once it is parsed.
+ * @var size         The size of the file when it was opened, in bytes.
+ * @var bytes_read   The number of bytes of the file read so far.
+ */
+struct batch_file_s {
+    const char *path;
+    WavFile *wav_file;
+    WavSamples *wav_samples;
+    int error;
+    bool ready;
+    int fd;
+    uint8_t *contents;
+    size_t size;
+    size_t bytes_read;
+};
+
+
+/**
+ * A reader that loads the wave files of a batch ahead of their decoding.
+ *
+ * Up to {@code read_ahead} files past the one that was last taken are read, parsed and converted
+ * to samples in the background, so the I/O, the header parsing and the PCM conversion of the next
+ * files overlap with the decoding of the earlier ones. Files are taken in the order of their
+ * paths.
+ *
+ * @var files          The files of the batch.
+ * @var num_files      The number of entries in {@code files}.
+ * @var read_ahead     The largest number of files that are loaded or held before being taken.
+ * @var convert_mono   Whether each file is also converted to mono samples in the background.
+ * @var next_load      The index of the next file to start loading.
+ * @var next_take      The index of the next file to be taken.
+ * @var stopping       Whether the reader is being freed, which stops the loading threads.
+ * @var lock           The lock of every field that changes after the reader is created.
+ * @var changed        Signaled whenever a file is ready, is taken, or the reader is stopping.
+ * @var threads        The loading threads.
+ * @var num_threads    The number of entries in {@code threads}.
+ * @var ring           The io_uring that one loader thread submits the reads of every file to, or
+ *                     {@code NULL} if the kernel does not provide it, in which case each thread
+ *                     of a pool reads a file at a time with blocking calls.
+ */
+struct batch_reader_s {
+    BatchFile *files;
+    size_t num_files;
+    size_t read_ahead;
+    bool convert_mono;
+    size_t next_load;
+    size_t next_take;
+    bool stopping;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    pthread_t *threads;
+    size_t num_threads;
+    BatchRing *ring;
+};
+
+
+/**
+ * Creates a reader for a batch of files and starts loading the first of them.
+ *
+ * io_uring is used where the kernel provides it, and a pool of {@code read_ahead} threads
+ * otherwise.
+ *
+ * @param paths         The paths of the files, which must outlive the reader.
+ * @param num_paths     The number of entries in {@code paths}.
+ * @param read_ahead    The largest number of files to load before they are taken, at least 1.
+ * @param convert_mono  Whether to also convert each file to mono samples in the background.
+ *
+ * @return A pointer to the new reader. If memory or a thread cannot be allocated, {@code NULL} is
+ *         returned.
+ */
+BatchReader *batch_reader_create(const char *const *paths,
+                                 size_t num_paths,
+                                 size_t read_ahead,
+                                 bool convert_mono);
+
+
+/**
+ * Takes the next file of a batch, waiting for it to be loaded.
+ *
+ * @param reader  The reader to take the file from.
+ *
+ * @return The next file, whose wave file and samples the caller must free, or {@code NULL} once
+ *         every file has been taken.
+ */
+BatchFile *batch_reader_next(BatchReader *reader);
+
+
+/**
+ * Stops the loading threads of a reader returned by {@code batch_reader_create} and frees it,
+ * including the files that were loaded but not taken.
+ *
+ * @param reader  The reader to free.
+ */
+void batch_reader_free(BatchReader *reader);
+
+
+#endif  // _BATCH_READER_H_
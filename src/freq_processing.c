@@ -1,11 +1,407 @@
 #include "freq_processing.h"
+#include "precision.h"
+#include "scratch_arena.h"
+#include "spectral_kernels.h"
 #include <fftw3.h>
 #include <assert.h>
 #include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdlib.h>
 
 
+#define FFT_PLAN_CACHE_SIZE 32
+
+
+typedef struct fft_plan_entry_s FftPlanEntry;
+
+
+/**
+ * A cached DFT plan and window table for one window size and batch size, or a cached inverse DFT
+ * plan for one window size.
+ *
+ * A thread that uses an entry counts itself in {@code num_users} for as long as it executes the
+ * plan or reads the window, so the entry is never replaced under it.
+ *
+ * @var key          The window size, batch size and direction of the entry, packed by
+ *                   {@code fft_plan_key}, or 0 while the slot is empty or being replaced.
+ * @var num_users    The number of threads using the entry.
+ * @var last_used    The value of {@code fft_plan_clock} when the entry was last used.
+ * @var num_samples  The number of samples in the window the plan transforms.
+ * @var num_windows  The number of windows the plan transforms at once.
+ * @var plan         The FFTW plan, which is executed on new arrays with the same alignment.
+ * @var window       The Hann window coefficients for the window size, or {@code NULL} for an
+ *                   inverse plan.
+ */
+struct fft_plan_entry_s {
+    _Atomic uint64_t key;
+    atomic_uint num_users;
+    _Atomic uint64_t last_used;
+    size_t num_samples;
+    size_t num_windows;
+    FFTW(plan) plan;
+    Sample *window;
+};
+
+
+// The FFTW planner is not thread-safe, so plans are only ever created or destroyed while holding
+// `fft_planner_lock`. An entry's fields are only written while its key is 0 and it has no users,
+// and are published by storing its key, so lookups can read them without the lock. When the cache
+// is full, the least recently used entry without users is replaced, and the clock ticks, so the
+// entries used since then are told apart from the others.
+static unsigned fft_planner_flags = FFTW_ESTIMATE;
+static pthread_mutex_t fft_planner_lock = PTHREAD_MUTEX_INITIALIZER;
+static FftPlanEntry fft_plan_cache[FFT_PLAN_CACHE_SIZE];
+static _Atomic uint64_t fft_plan_clock = 1;
+
+
+/**
+ * Packs a window size, batch size and direction into the key of a cache entry.
+ *
+ * @param num_samples  The number of samples in the DFT window.
+ * @param num_windows  The number of windows transformed at once, under {@code 2^31}.
+ * @param inverse      Whether the plan is of the inverse DFT.
+ *
+ * @return The key, which is never 0.
+ */
+static uint64_t fft_plan_key(size_t num_samples, size_t num_windows, bool inverse) {
+    return ((uint64_t) num_samples << 32) | ((uint64_t) inverse << 31) | (uint32_t) num_windows;
+}
+
+
+/**
+ * Searches the plan cache for a key, and counts the caller as a user of the entry it finds.
+ *
+ * The user is counted before the key is checked again, and a replacement clears the key before
+ * checking for users, so either the lookup sees the replacement and moves on, or the replacement
+ * sees the user and picks another entry.
+ *
+ * @param key  The key of the window size, batch size and direction.
+ *
+ * @return The entry, which must be released with {@code release_fft_plan}, or {@code NULL} if
+ *         there is none for the key.
+ */
+static FftPlanEntry *find_fft_plan(uint64_t key) {
+    for (size_t i = 0; i < FFT_PLAN_CACHE_SIZE; i++) {
+        FftPlanEntry *entry = &fft_plan_cache[i];
+        if (atomic_load_explicit(&entry->key, memory_order_relaxed) != key) {
+            continue;
+        }
+
+        atomic_fetch_add(&entry->num_users, 1);
+        if (atomic_load(&entry->key) == key) {
+            uint64_t now = atomic_load_explicit(&fft_plan_clock, memory_order_relaxed);
+            if (atomic_load_explicit(&entry->last_used, memory_order_relaxed) != now) {
+                atomic_store_explicit(&entry->last_used, now, memory_order_relaxed);
+            }
+            return entry;
+        }
+        atomic_fetch_sub_explicit(&entry->num_users, 1, memory_order_release);
+    }
+    return NULL;
+}
+
+
+/**
+ * Stops using a cache entry returned by {@code get_fft_plan}.
+ *
+ * @param entry  The entry, or {@code NULL} for none.
+ */
+static void release_fft_plan(FftPlanEntry *entry) {
+    if (entry != NULL) {
+        atomic_fetch_sub_explicit(&entry->num_users, 1, memory_order_release);
+    }
+}
+
+
+/**
+ * Creates a DFT plan for a batch of windows, or an inverse DFT plan for one window. The planner
+ * lock must be held.
+ *
+ * The windows are stored one after another in the samples, while the bins are interleaved, with
+ * bin {@code i} of window {@code w} at index {@code i * num_windows + w}. This is the bin-major
+ * layout that {@code peak_power_bins} searches. With a single window, both layouts are the same as
+ * that of {@code fftw_plan_dft_r2c_1d}, and the inverse is that of {@code fftw_plan_dft_c2r_1d},
+ * which overwrites the bins.
+ *
+ * @param num_samples  The number of samples in each window.
+ * @param num_windows  The number of windows, which is 1 for an inverse plan.
+ * @param inverse      Whether to plan the inverse DFT, from the bins to the samples.
+ * @param samples      The array of {@code num_samples * num_windows} samples.
+ * @param bins         The array of {@code (num_samples / 2 + 1) * num_windows} bins.
+ * @param flags        The FFTW planner flags.
+ *
+ * @return The plan, or {@code NULL} if FFTW cannot create it.
+ */
+static FFTW(plan) create_fft_plan(size_t num_samples,
+                                  size_t num_windows,
+                                  bool inverse,
+                                  Sample *samples,
+                                  FFTW(complex) *bins,
+                                  unsigned flags)
+{
+    int n = (int) num_samples;
+    if (inverse) {
+        assert(num_windows == 1 && "create_fft_plan got a batch of inverse windows");
+        return FFTW(plan_dft_c2r_1d)(n, bins, samples, flags);
+    }
+    int howmany = (int) num_windows;
+    return FFTW(plan_many_dft_r2c)(1, &n, howmany, samples, NULL, 1, n, bins, NULL, howmany, 1,
+                                   flags);
+}
+
+
+/**
+ * Takes a slot of the plan cache to replace: an empty one, or else the least recently used entry
+ * without users. The planner lock must be held.
+ *
+ * @return The slot, whose key has been cleared and whose old plan has been destroyed, or
+ *         {@code NULL} if every entry is in use.
+ */
+static FftPlanEntry *evict_fft_plan(void) {
+    for (size_t i = 0; i < FFT_PLAN_CACHE_SIZE; i++) {
+        if (atomic_load_explicit(&fft_plan_cache[i].key, memory_order_relaxed) == 0) {
+            return &fft_plan_cache[i];
+        }
+    }
+
+    // An entry that gains a user while it is taken keeps its key, and the next least recently
+    // used one is tried instead.
+    bool tried[FFT_PLAN_CACHE_SIZE] = {false};
+    for (size_t attempt = 0; attempt < FFT_PLAN_CACHE_SIZE; attempt++) {
+        FftPlanEntry *oldest = NULL;
+        uint64_t oldest_used = 0;
+        for (size_t i = 0; i < FFT_PLAN_CACHE_SIZE; i++) {
+            FftPlanEntry *entry = &fft_plan_cache[i];
+            if (tried[i] || atomic_load_explicit(&entry->num_users, memory_order_relaxed) > 0) {
+                continue;
+            }
+            uint64_t last_used = atomic_load_explicit(&entry->last_used, memory_order_relaxed);
+            if (oldest == NULL || last_used < oldest_used) {
+                oldest = entry;
+                oldest_used = last_used;
+            }
+        }
+        if (oldest == NULL) {
+            return NULL;
+        }
+        tried[oldest - fft_plan_cache] = true;
+
+        uint64_t key = atomic_load_explicit(&oldest->key, memory_order_relaxed);
+        atomic_store(&oldest->key, 0);
+        if (atomic_load(&oldest->num_users) > 0) {
+            atomic_store_explicit(&oldest->key, key, memory_order_release);
+            continue;
+        }
+
+        FFTW(destroy_plan)(oldest->plan);
+        FFTW(free)(oldest->window);
+        oldest->plan = NULL;
+        oldest->window = NULL;
+        atomic_fetch_add_explicit(&fft_plan_clock, 1, memory_order_relaxed);
+        return oldest;
+    }
+    return NULL;
+}
+
+
+/**
+ * Gets the cached DFT plan and window table for a window size, or the cached inverse DFT plan,
+ * creating them if needed.
+ *
+ * Plans are created against scratch arrays from {@code fftw_malloc}, so they can be executed on
+ * any other pair of SIMD-aligned arrays (such as those from a scratch arena) with
+ * {@code fftw_execute_dft_r2c} or {@code fftw_execute_dft_c2r}. When the cache is full, the least
+ * recently used plan that no thread is using is replaced. Only if every cached plan is in use at
+ * that moment is {@code NULL} returned, and the caller must plan for itself.
+ *
+ * @param num_samples  The number of samples in the DFT window.
+ * @param num_windows  The number of windows transformed at once, which is 1 for an inverse plan.
+ * @param inverse      Whether to get the inverse DFT plan, which has no window table.
+ *
+ * @return The cached entry, which must be released with {@code release_fft_plan}, or
+ *         {@code NULL} if every entry is in use.
+ */
+static FftPlanEntry *get_fft_plan(size_t num_samples, size_t num_windows, bool inverse) {
+    uint64_t key = fft_plan_key(num_samples, num_windows, inverse);
+    FftPlanEntry *cached_entry = find_fft_plan(key);
+    if (cached_entry != NULL) {
+        return cached_entry;
+    }
+
+    // Another thread may have created the plan while we waited for the lock, so we search again
+    // before planning.
+    pthread_mutex_lock(&fft_planner_lock);
+    cached_entry = find_fft_plan(key);
+    FftPlanEntry *entry = (cached_entry == NULL) ? evict_fft_plan() : NULL;
+    if (entry == NULL) {
+        pthread_mutex_unlock(&fft_planner_lock);
+        return cached_entry;
+    }
+
+    // Planning with anything more rigorous than `FFTW_ESTIMATE` overwrites the arrays, so we
+    // plan with our own scratch arrays rather than the caller's samples.
+    size_t num_fft_samples = (num_samples / 2 + 1) * num_windows;
+    Sample *in = (Sample *) FFTW(malloc)(num_samples * num_windows * sizeof(Sample));
+    FFTW(complex) *out = (FFTW(complex) *) FFTW(malloc)(num_fft_samples * sizeof(FFTW(complex)));
+    assert(in && out && "get_fft_plan cannot malloc planning arrays");
+
+    FFTW(plan) plan =
+        create_fft_plan(num_samples, num_windows, inverse, in, out, fft_planner_flags);
+    assert(plan && "get_fft_plan cannot create plan");
+    FFTW(free)(out);
+
+    // The start of the planning input array is kept as the window table of a forward plan, which
+    // is as well aligned as the samples it is multiplied with.
+    if (inverse) {
+        FFTW(free)(in);
+        in = NULL;
+    }
+    else {
+        fill_hann_window(in, num_samples);
+    }
+
+    entry->num_samples = num_samples;
+    entry->num_windows = num_windows;
+    entry->plan = plan;
+    entry->window = in;
+    atomic_store_explicit(&entry->num_users, 1, memory_order_relaxed);
+    uint64_t now = atomic_load_explicit(&fft_plan_clock, memory_order_relaxed);
+    atomic_store_explicit(&entry->last_used, now, memory_order_relaxed);
+    atomic_store_explicit(&entry->key, key, memory_order_release);
+
+    pthread_mutex_unlock(&fft_planner_lock);
+    return entry;
+}
+
+
+/**
+ * Executes a one-off DFT plan, for when every cached plan is in use by other threads.
+ *
+ * @param num_samples  The number of samples in the DFT window.
+ * @param num_windows  The number of windows to transform at once.
+ * @param in           The windowed samples to transform.
+ * @param out          The array to place the {@code (num_samples / 2 + 1) * num_windows} complex
+ *                     bins in.
+ */
+static void execute_uncached_fft(size_t num_samples,
+                                 size_t num_windows,
+                                 Sample *in,
+                                 FFTW(complex) *out)
+{
+    pthread_mutex_lock(&fft_planner_lock);
+    FFTW(plan) plan = create_fft_plan(num_samples, num_windows, false, in, out, FFTW_ESTIMATE);
+    pthread_mutex_unlock(&fft_planner_lock);
+
+    FFTW(execute)(plan);
+
+    pthread_mutex_lock(&fft_planner_lock);
+    FFTW(destroy_plan)(plan);
+    pthread_mutex_unlock(&fft_planner_lock);
+}
+
+
+/**
+ * Creates and caches a DFT plan or inverse DFT plan, if one does not exist yet, for
+ * {@code prepare_fft_plan} and {@code prepare_matched_filter_plans}.
+ *
+ * @param num_samples  The number of samples in the DFT window.
+ * @param num_windows  The number of windows transformed at once, which is 1 for an inverse plan.
+ * @param inverse      Whether to plan the inverse DFT.
+ */
+static void prepare_cached_fft_plan(size_t num_samples, size_t num_windows, bool inverse) {
+    FftPlanEntry *entry = get_fft_plan(num_samples, num_windows, inverse);
+    if (entry != NULL) {
+        release_fft_plan(entry);
+        return;
+    }
+
+    // Every cached plan is in use, but the plan is still created once so the planner records its
+    // wisdom.
+    size_t num_fft_samples = (num_samples / 2 + 1) * num_windows;
+    Sample *in = (Sample *) FFTW(malloc)(num_samples * num_windows * sizeof(Sample));
+    FFTW(complex) *out = (FFTW(complex) *) FFTW(malloc)(num_fft_samples * sizeof(FFTW(complex)));
+    assert(in && out && "prepare_cached_fft_plan cannot malloc planning arrays");
+
+    pthread_mutex_lock(&fft_planner_lock);
+    FFTW(plan) plan =
+        create_fft_plan(num_samples, num_windows, inverse, in, out, fft_planner_flags);
+    assert(plan && "prepare_cached_fft_plan cannot create plan");
+    FFTW(destroy_plan)(plan);
+    pthread_mutex_unlock(&fft_planner_lock);
+
+    FFTW(free)(in);
+    FFTW(free)(out);
+}
+
+
+/**
+ * Calculates the DFT size of the overlap-save blocks of {@code matched_filter}.
+ *
+ * Each block of {@code fft_size} samples yields {@code fft_size - template_size + 1} correlation
+ * values that are unaffected by the circular wrap of the DFT. A DFT four or more times the
+ * template keeps most of each block useful.
+ *
+ * @param template_size  The number of samples in the template.
+ *
+ * @return The DFT size, a power of 2 of at least 256.
+ */
+static size_t matched_filter_fft_size(size_t template_size) {
+    size_t fft_size = 256;
+    while (fft_size < 4 * template_size) {
+        fft_size *= 2;
+    }
+    return fft_size;
+}
+
+
+void set_fft_planner_flags(unsigned flags) {
+    fft_planner_flags = flags;
+}
+
+
+bool import_fft_wisdom(const char *path) {
+    assert(path && "import_fft_wisdom got NULL path");
+    return FFTW(import_wisdom_from_filename)(path) != 0;
+}
+
+
+bool export_fft_wisdom(const char *path) {
+    assert(path && "export_fft_wisdom got NULL path");
+    return FFTW(export_wisdom_to_filename)(path) != 0;
+}
+
+
+void prepare_fft_plan(size_t num_samples, size_t num_windows) {
+    prepare_cached_fft_plan(num_samples, num_windows, false);
+}
+
+
+void prepare_matched_filter_plans(size_t template_size) {
+    size_t fft_size = matched_filter_fft_size(template_size);
+    prepare_cached_fft_plan(fft_size, 1, false);
+    prepare_cached_fft_plan(fft_size, 1, true);
+}
+
+
+void cleanup_fft_plans(void) {
+    pthread_mutex_lock(&fft_planner_lock);
+    for (size_t i = 0; i < FFT_PLAN_CACHE_SIZE; i++) {
+        FftPlanEntry *entry = &fft_plan_cache[i];
+        if (atomic_load_explicit(&entry->key, memory_order_relaxed) != 0) {
+            FFTW(destroy_plan)(entry->plan);
+            FFTW(free)(entry->window);
+            entry->plan = NULL;
+            entry->window = NULL;
+            atomic_store_explicit(&entry->key, 0, memory_order_relaxed);
+        }
+    }
+    FFTW(cleanup)();
+    pthread_mutex_unlock(&fft_planner_lock);
+}
+
+
 double hann_window(size_t num_samples, size_t sample_index) {
     return 0.5 * (1 - cos(2.0 * M_PI * sample_index / (num_samples - 1)));
 }
@@ -21,7 +417,7 @@ double barycentric_peak_interpolation(double *bins, size_t num_bins, size_t inde
 }
 
 
-void remove_dc_offset(double *samples, double *cleaned_samples, size_t num_samples) {
+void remove_dc_offset(Sample *samples, Sample *cleaned_samples, size_t num_samples) {
     assert(samples && "remove_dc_offset got NULL samples");
     assert(cleaned_samples && "remove_dc_offset got NULL cleaned_samples");
 
@@ -40,56 +436,319 @@ void remove_dc_offset(double *samples, double *cleaned_samples, size_t num_sampl
 }
 
 
-double peak_frequency(double *samples, size_t num_samples, uint32_t sample_rate) {
+size_t peak_frequency_scratch_size(size_t num_samples) {
+    // This mirrors the temporaries allocated by `peak_frequency`, each of which may be padded up
+    // to the arena alignment. The window table is only allocated if every cached plan is in use.
+    size_t num_fft_samples = num_samples / 2 + 1;
+    size_t size = 2 * num_samples * sizeof(Sample);
+    size += num_fft_samples * sizeof(FFTW(complex));
+    return size + 3 * SCRATCH_ARENA_ALIGNMENT;
+}
+
+
+Frequency peak_frequency(Sample *samples,
+                         size_t num_samples,
+                         uint32_t sample_rate,
+                         ScratchArena *scratch)
+{
     assert(samples && "peak_frequency got NULL samples");
+    assert(scratch && "peak_frequency got NULL scratch");
 
-    double *cleaned_samples = (double *) malloc(num_samples * sizeof(double));
-    assert(cleaned_samples && "peak_frequency cannot malloc cleaned_samples");
-    remove_dc_offset(samples, cleaned_samples, num_samples);
+    // All temporaries come from the scratch arena and are released together on return, so no
+    // heap allocation happens once the arena is large enough for the biggest window.
+    size_t scratch_mark = scratch_arena_mark(scratch);
+    const SpectralKernels *kernels = get_spectral_kernels();
+    FftPlanEntry *fft_entry = get_fft_plan(num_samples, 1, false);
 
-    double *windowed_samples = (double *) malloc(num_samples * sizeof(double));
-    assert(windowed_samples && "peak_frequency cannot malloc windowed_samples");
-    for (size_t i = 0; i < num_samples; i++) {
-        windowed_samples[i] = cleaned_samples[i] * hann_window(num_samples, i);
+    const Sample *window = NULL;
+    if (fft_entry != NULL) {
+        window = fft_entry->window;
+    }
+    else {
+        Sample *window_table =
+            (Sample *) scratch_arena_alloc(scratch, num_samples * sizeof(Sample));
+        assert(window_table && "peak_frequency cannot alloc window_table");
+        fill_hann_window(window_table, num_samples);
+        window = window_table;
     }
 
+    // The DC offset is removed and the window applied in a single pass. Without removing the DC
+    // offset, the peak could be found at 0 Hz.
+    Sample *windowed_samples =
+        (Sample *) scratch_arena_alloc(scratch, num_samples * sizeof(Sample));
+    assert(windowed_samples && "peak_frequency cannot alloc windowed_samples");
+    kernels->window_samples(samples, window, windowed_samples, num_samples);
+
     size_t num_fft_samples = num_samples / 2 + 1;
-    fftw_complex *fft = (fftw_complex *) fftw_malloc(num_fft_samples * sizeof(fftw_complex));
-    assert(fft && "peak_frequency cannot malloc fft");
+    FFTW(complex) *fft =
+        (FFTW(complex) *) scratch_arena_alloc(scratch, num_fft_samples * sizeof(FFTW(complex)));
+    assert(fft && "peak_frequency cannot alloc fft");
+
+    // The cached plan is reused when possible. Otherwise, we fall back to a one-off plan.
+    if (fft_entry != NULL) {
+        FFTW(execute_dft_r2c)(fft_entry->plan, windowed_samples, fft);
+    }
+    else {
+        execute_uncached_fft(num_samples, 1, windowed_samples, fft);
+    }
+
+    release_fft_plan(fft_entry);
+
+    // The peak is found on squared magnitudes, and only the bins around it are interpolated.
+    const Sample *bins = (const Sample *) fft;
+    size_t peak_index = kernels->peak_power_bin(bins, num_fft_samples);
+    double peak_bin = interpolate_peak_bin(bins, num_fft_samples, 1, peak_index);
+    double peak_frequency = peak_bin * sample_rate / num_samples;
+
+    scratch_arena_release(scratch, scratch_mark);
 
-    fftw_plan fft_plan = fftw_plan_dft_r2c_1d(num_samples, windowed_samples, fft, FFTW_ESTIMATE);
-    fftw_execute(fft_plan);
+    return peak_frequency;
+}
+
+
+size_t peak_frequencies_scratch_size(size_t num_samples, size_t num_windows) {
+    // This mirrors the temporaries allocated by `peak_frequencies`, as for `peak_frequency`.
+    size_t num_fft_samples = (num_samples / 2 + 1) * num_windows;
+    size_t size = num_samples * sizeof(Sample);
+    size += num_samples * num_windows * sizeof(Sample);
+    size += num_fft_samples * sizeof(FFTW(complex));
+    size += num_windows * sizeof(size_t);
+    return size + 4 * SCRATCH_ARENA_ALIGNMENT;
+}
 
-    double *magnitudes = (double *) malloc(num_fft_samples * sizeof(double));
-    assert(magnitudes && "peak_frequency cannot malloc magnitudes");
-    for (size_t i = 0; i < num_fft_samples; i++) {
-        magnitudes[i] = sqrt(fft[i][0] * fft[i][0] + fft[i][1] * fft[i][1]);
+
+void peak_frequencies(const Sample *samples,
+                      const size_t *window_starts,
+                      size_t num_windows,
+                      size_t num_samples,
+                      uint32_t sample_rate,
+                      Frequency *frequencies,
+                      ScratchArena *scratch)
+{
+    assert(samples && "peak_frequencies got NULL samples");
+    assert(window_starts && "peak_frequencies got NULL window_starts");
+    assert(frequencies && "peak_frequencies got NULL frequencies");
+    assert(scratch && "peak_frequencies got NULL scratch");
+
+    size_t scratch_mark = scratch_arena_mark(scratch);
+    const SpectralKernels *kernels = get_spectral_kernels();
+    FftPlanEntry *fft_entry = get_fft_plan(num_samples, num_windows, false);
+
+    const Sample *window = NULL;
+    if (fft_entry != NULL) {
+        window = fft_entry->window;
+    }
+    else {
+        Sample *window_table =
+            (Sample *) scratch_arena_alloc(scratch, num_samples * sizeof(Sample));
+        assert(window_table && "peak_frequencies cannot alloc window_table");
+        fill_hann_window(window_table, num_samples);
+        window = window_table;
     }
 
-    size_t peak_index = 0;
-    for (size_t i = 1; i < num_fft_samples; i++) {
-        if (magnitudes[i] > magnitudes[peak_index]) {
-            peak_index = i;
+    // Each window is cleaned and windowed into its own row of the batch, since neighboring windows
+    // may overlap in the samples.
+    Sample *windowed_samples =
+        (Sample *) scratch_arena_alloc(scratch, num_samples * num_windows * sizeof(Sample));
+    assert(windowed_samples && "peak_frequencies cannot alloc windowed_samples");
+    for (size_t w = 0; w < num_windows; w++) {
+        kernels->window_samples(&samples[window_starts[w]],
+                                window,
+                                &windowed_samples[w * num_samples],
+                                num_samples);
+    }
+
+    size_t num_fft_samples = num_samples / 2 + 1;
+    FFTW(complex) *fft = (FFTW(complex) *)
+        scratch_arena_alloc(scratch, num_fft_samples * num_windows * sizeof(FFTW(complex)));
+    assert(fft && "peak_frequencies cannot alloc fft");
+
+    // The whole batch is transformed by a single plan, which lets FFTW use its batch codelets.
+    if (fft_entry != NULL) {
+        FFTW(execute_dft_r2c)(fft_entry->plan, windowed_samples, fft);
+    }
+    else {
+        execute_uncached_fft(num_samples, num_windows, windowed_samples, fft);
+    }
+    release_fft_plan(fft_entry);
+
+    // The output is bin-major, so one pass over the bins finds the peak of every window at once.
+    size_t *peak_indices = (size_t *) scratch_arena_alloc(scratch, num_windows * sizeof(size_t));
+    assert(peak_indices && "peak_frequencies cannot alloc peak_indices");
+    const Sample *bins = (const Sample *) fft;
+    kernels->peak_power_bins(bins, num_fft_samples, num_windows, peak_indices);
+
+    for (size_t w = 0; w < num_windows; w++) {
+        double peak_bin =
+            interpolate_peak_bin(&bins[2 * w], num_fft_samples, num_windows, peak_indices[w]);
+        frequencies[w] = peak_bin * sample_rate / num_samples;
+    }
+
+    scratch_arena_release(scratch, scratch_mark);
+}
+
+
+void matched_filter(const Sample *samples,
+                    size_t num_samples,
+                    const Sample *template_real,
+                    const Sample *template_imaginary,
+                    size_t template_size,
+                    Sample *correlation,
+                    ScratchArena *scratch)
+{
+    assert(samples && "matched_filter got NULL samples");
+    assert(template_real && template_imaginary && "matched_filter got NULL template");
+    assert(correlation && "matched_filter got NULL correlation");
+    assert(scratch && "matched_filter got NULL scratch");
+    if (template_size == 0 || num_samples < template_size) {
+        return;
+    }
+
+    // Overlap-save: each block of `fft_size` samples yields `block_step` correlation values, and
+    // consecutive blocks overlap by the template.
+    size_t fft_size = matched_filter_fft_size(template_size);
+    size_t block_step = fft_size - template_size + 1;
+    size_t num_bins = fft_size / 2 + 1;
+    size_t num_positions = num_samples - template_size + 1;
+
+    // The buffers come from the scratch arena, which is as well aligned as `fftw_malloc`.
+    size_t scratch_mark = scratch_arena_mark(scratch);
+    Sample *block = (Sample *) scratch_arena_alloc(scratch, fft_size * sizeof(Sample));
+    Sample *real_output = (Sample *) scratch_arena_alloc(scratch, fft_size * sizeof(Sample));
+    Sample *imaginary_output = (Sample *) scratch_arena_alloc(scratch, fft_size * sizeof(Sample));
+    size_t spectrum_size = num_bins * sizeof(FFTW(complex));
+    FFTW(complex) *spectrum = (FFTW(complex) *) scratch_arena_alloc(scratch, spectrum_size);
+    FFTW(complex) *product = (FFTW(complex) *) scratch_arena_alloc(scratch, spectrum_size);
+    FFTW(complex) *real_template = (FFTW(complex) *) scratch_arena_alloc(scratch, spectrum_size);
+    FFTW(complex) *imaginary_template =
+        (FFTW(complex) *) scratch_arena_alloc(scratch, spectrum_size);
+    double *energy_prefix =
+        (double *) scratch_arena_alloc(scratch, (fft_size + 1) * sizeof(double));
+    assert(block && real_output && imaginary_output && spectrum && product && real_template &&
+           imaginary_template && energy_prefix && "matched_filter cannot alloc buffers");
+
+    // The plans come from the cache, unless every cached plan is in use and they are made here.
+    FftPlanEntry *forward_entry = get_fft_plan(fft_size, 1, false);
+    FftPlanEntry *inverse_entry = get_fft_plan(fft_size, 1, true);
+    FFTW(plan) forward = (forward_entry != NULL) ? forward_entry->plan : NULL;
+    FFTW(plan) inverse = (inverse_entry != NULL) ? inverse_entry->plan : NULL;
+    if (forward == NULL || inverse == NULL) {
+        pthread_mutex_lock(&fft_planner_lock);
+        if (forward == NULL) {
+            forward = create_fft_plan(fft_size, 1, false, block, spectrum, FFTW_ESTIMATE);
+        }
+        if (inverse == NULL) {
+            inverse = create_fft_plan(fft_size, 1, true, real_output, product, FFTW_ESTIMATE);
         }
+        pthread_mutex_unlock(&fft_planner_lock);
     }
+    assert(forward && inverse && "matched_filter cannot create plans");
 
-    double peak_magnitude = barycentric_peak_interpolation(magnitudes, num_fft_samples, peak_index);
-    double peak_frequency = peak_magnitude * sample_rate / num_samples;
+    // The template spectra are computed once. Correlating is multiplying by their conjugates.
+    double template_energy = 0.0;
+    const Sample *templates[2] = {template_real, template_imaginary};
+    FFTW(complex) *template_spectra[2] = {real_template, imaginary_template};
+    for (size_t t = 0; t < 2; t++) {
+        for (size_t i = 0; i < fft_size; i++) {
+            block[i] = (i < template_size) ? templates[t][i] : 0;
+        }
+        FFTW(execute_dft_r2c)(forward, block, template_spectra[t]);
+    }
+    for (size_t i = 0; i < template_size; i++) {
+        template_energy += template_real[i] * template_real[i];
+    }
 
-    free(magnitudes);
-    fftw_destroy_plan(fft_plan);
-    fftw_free(fft);
-    free(windowed_samples);
-    free(cleaned_samples);
+    for (size_t block_start = 0; block_start < num_positions; block_start += block_step) {
+        size_t block_size = num_samples - block_start;
+        if (block_size > fft_size) {
+            block_size = fft_size;
+        }
 
-    return peak_frequency;
+        // The energy of the samples under the template at each position normalizes the
+        // correlation, so a perfect match is 1 regardless of the signal level.
+        energy_prefix[0] = 0.0;
+        for (size_t i = 0; i < fft_size; i++) {
+            block[i] = (i < block_size) ? samples[block_start + i] : 0;
+            energy_prefix[i + 1] = energy_prefix[i] + (double) block[i] * block[i];
+        }
+        FFTW(execute_dft_r2c)(forward, block, spectrum);
+
+        Sample *outputs[2] = {real_output, imaginary_output};
+        for (size_t t = 0; t < 2; t++) {
+            for (size_t k = 0; k < num_bins; k++) {
+                Sample a = spectrum[k][0];
+                Sample b = spectrum[k][1];
+                Sample c = template_spectra[t][k][0];
+                Sample d = template_spectra[t][k][1];
+                product[k][0] = a * c + b * d;
+                product[k][1] = b * c - a * d;
+            }
+            FFTW(execute_dft_c2r)(inverse, product, outputs[t]);
+        }
+
+        size_t num_valid = num_positions - block_start;
+        if (num_valid > block_step) {
+            num_valid = block_step;
+        }
+        for (size_t j = 0; j < num_valid; j++) {
+            double real = real_output[j] / fft_size;
+            double imaginary = imaginary_output[j] / fft_size;
+            double energy = (energy_prefix[j + template_size] - energy_prefix[j]) * template_energy;
+            double magnitude = sqrt(real * real + imaginary * imaginary);
+            correlation[block_start + j] = energy > 0 ? magnitude / sqrt(energy) : 0;
+        }
+    }
+
+    release_fft_plan(forward_entry);
+    release_fft_plan(inverse_entry);
+    if (forward_entry == NULL || inverse_entry == NULL) {
+        pthread_mutex_lock(&fft_planner_lock);
+        if (forward_entry == NULL) {
+            FFTW(destroy_plan)(forward);
+        }
+        if (inverse_entry == NULL) {
+            FFTW(destroy_plan)(inverse);
+        }
+        pthread_mutex_unlock(&fft_planner_lock);
+    }
+
+    scratch_arena_release(scratch, scratch_mark);
+}
+
+
+SampleAccumulator tone_power(const Sample *samples,
+                             size_t num_samples,
+                             uint32_t sample_rate,
+                             Frequency frequency)
+{
+    assert(samples && "tone_power got NULL samples");
+
+    // The Goertzel recurrence is a second-order resonator at `frequency`, whose final two states
+    // give the DFT bin at that frequency.
+    double coefficient = 2.0 * cos(2.0 * M_PI * frequency / sample_rate);
+    double previous = 0.0;
+    double before_previous = 0.0;
+    for (size_t i = 0; i < num_samples; i++) {
+        double current = samples[i] + coefficient * previous - before_previous;
+        before_previous = previous;
+        previous = current;
+    }
+
+    return previous * previous + before_previous * before_previous -
+        coefficient * previous * before_previous;
 }
 
 
-bool is_frequency(double *samples, size_t num_samples, uint32_t sample_rate, double frequency) {
+bool is_frequency(Sample *samples,
+                  size_t num_samples,
+                  uint32_t sample_rate,
+                  Frequency frequency,
+                  Frequency margin,
+                  ScratchArena *scratch)
+{
     assert(samples && "is_frequency got NULL samples");
 
-    double peak = peak_frequency(samples, num_samples, sample_rate);
-    double error = fabs(peak - frequency);
-    return error < FREQ_PROCESSING_MARGIN_HZ;
+    Frequency peak = peak_frequency(samples, num_samples, sample_rate, scratch);
+    Frequency error = fabs(peak - frequency);
+    return error < margin;
 }
@@ -5,13 +5,84 @@
 #define FREQ_PROCESSING_MARGIN_HZ 50
 
 
+#include "precision.h"
+#include "scratch_arena.h"
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 
 
 /**
- * Calculates the Hann window coefficient for a given number of samples and sample index.
+ * Sets the FFTW planner rigor used for any DFT plan created after this call.
+ *
+ * The default is {@code FFTW_ESTIMATE}, which plans quickly but produces slower transforms. The
+ * more rigorous flags ({@code FFTW_MEASURE}, {@code FFTW_PATIENT}) are only worth their planning
+ * cost when the plans are reused, either through the plan cache or through wisdom saved to disk.
+ * Fixed-point builds do not use FFTW, so this and the other planner and wisdom functions do
+ * nothing there (and the imports and exports fail).
+ *
+ * @param flags  The FFTW planner flags, such as {@code FFTW_MEASURE}.
+ */
+void set_fft_planner_flags(unsigned flags);
+
+
+/**
+ * Loads previously accumulated FFTW wisdom from a file.
+ *
+ * @param path  The path to the wisdom file.
+ *
+ * @return Whether the wisdom was imported. A missing or malformed file returns false.
+ */
+bool import_fft_wisdom(const char *path);
+
+
+/**
+ * Saves all FFTW wisdom accumulated so far (including any imported wisdom) to a file.
+ *
+ * @param path  The path to the wisdom file, which is overwritten.
+ *
+ * @return Whether the wisdom was exported.
+ */
+bool export_fft_wisdom(const char *path);
+
+
+/**
+ * Creates and caches the DFT plan for a batch of windows of the given size, if one does not exist
+ * yet.
+ *
+ * Calling this ahead of time moves the planning cost out of the decoding loops, and is used to
+ * accumulate wisdom for the window sizes of each mode. When the plan cache is full, the least
+ * recently used plan that no thread is using is replaced. If every cached plan is in use, the
+ * plan is still created once so that its wisdom is recorded.
+ *
+ * @param num_samples  The number of samples in the DFT window.
+ * @param num_windows  The number of windows transformed at once, which is 1 for
+ *                     {@code peak_frequency}.
+ */
+void prepare_fft_plan(size_t num_samples, size_t num_windows);
+
+
+/**
+ * Creates and caches the DFT and inverse DFT plans that {@code matched_filter} uses for a
+ * template, if they do not exist yet, in the same way as {@code prepare_fft_plan}.
+ *
+ * @param template_size  The number of samples in the template.
+ */
+void prepare_matched_filter_plans(size_t template_size);
+
+
+/**
+ * Destroys all cached DFT plans and releases FFTW's internal memory.
+ *
+ * Wisdom should be exported before calling this function, and no other thread may be using the
+ * DFT functions while it runs. All other functions in this file are thread-safe.
+ */
+void cleanup_fft_plans(void);
+
+
+/**
+ * Calculates the Hann window coefficient for a given number of samples and sample index. It is
+ * not provided by fixed-point builds.
  *
  * @param num_samples   The number of samples in the window.
  * @param sample_index  The index of the sample of interest.
@@ -20,7 +91,8 @@ double hann_window(size_t num_samples, size_t sample_index);
 
 
 /**
- * Interpolates over a provided set of data bins to find the peak in the specified bin.
+ * Interpolates over a provided set of data bins to find the peak in the specified bin. It is not
+ * provided by fixed-point builds.
  *
  * @param bins      The sample bins from a Fourier transform.
  * @param num_bins  The number of sample bins.
@@ -38,35 +110,146 @@ double barycentric_peak_interpolation(double *bins, size_t num_bins, size_t inde
  * @param cleaned_samples  A pointer to place samples with DC offset removed.
  * @param num_samples      The size of the two sample pointers.
  */
-void remove_dc_offset(double *samples, double *cleaned_samples, size_t num_samples);
+void remove_dc_offset(Sample *samples, Sample *cleaned_samples, size_t num_samples);
+
+
+/**
+ * Calculates the number of scratch arena bytes {@code peak_frequency} needs for a window size.
+ *
+ * @param num_samples  The number of samples in the window.
+ *
+ * @return The number of bytes of scratch memory used by one call to {@code peak_frequency}.
+ */
+size_t peak_frequency_scratch_size(size_t num_samples);
 
 
 /**
  * Determines the maximum frequency magnitude in a set of samples.
  *
+ * In fixed-point builds ({@code SSTV_FIXED_POINT}), where {@code freq_processing_fixed.c} is built
+ * instead of {@code freq_processing.c} and {@code spectral_kernels.c}, the per-sample work needs
+ * no floating point unit. The DFT bins are computed with an integer Goertzel filter each, scanned
+ * outwards from a linear prediction estimate of the tone until no other bin can be the peak.
+ *
  * @param samples       The set of samples to find the peak frequency within.
  * @param num_samples   The number of samples in `samples`.
  * @param samples_rate  The sample rate in Hertz.
+ * @param scratch       The scratch arena that all temporary buffers are allocated from.
+ *
+ * @return The maximum frequency in the provided samples.
+ */
+Frequency peak_frequency(Sample *samples,
+                         size_t num_samples,
+                         uint32_t sample_rate,
+                         ScratchArena *scratch);
+
+
+/**
+ * Calculates the number of scratch arena bytes {@code peak_frequencies} needs for a batch.
+ *
+ * @param num_samples  The number of samples in each window.
+ * @param num_windows  The number of windows in the batch.
+ *
+ * @return The number of bytes of scratch memory used by one call to {@code peak_frequencies}.
+ */
+size_t peak_frequencies_scratch_size(size_t num_samples, size_t num_windows);
+
+
+/**
+ * Determines the peak frequency of each window in a batch of equally sized windows.
+ *
+ * This gives the same result as calling {@code peak_frequency} on each window, but the windows are
+ * transformed together by one batched DFT plan and their peaks are found in one vectorized pass.
+ *
+ * @param samples        The samples that the windows are taken from.
+ * @param window_starts  The index of the first sample of each window in {@code samples}.
+ * @param num_windows    The number of windows.
+ * @param num_samples    The number of samples in each window.
+ * @param sample_rate    The sample rate in Hertz.
+ * @param frequencies    The array to place the peak frequency of each window in.
+ * @param scratch        The scratch arena that all temporary buffers are allocated from.
+ */
+void peak_frequencies(const Sample *samples,
+                      const size_t *window_starts,
+                      size_t num_windows,
+                      size_t num_samples,
+                      uint32_t sample_rate,
+                      Frequency *frequencies,
+                      ScratchArena *scratch);
+
+
+/**
+ * Cross-correlates a set of samples with a complex template in one overlap-save FFT pass.
+ *
+ * The template is given as its real (cosine) and imaginary (sine) parts, so the magnitude of the
+ * correlation does not depend on the phase of the signal. Each value is normalized by the energy
+ * of the samples under the template, so a perfect match is 1 and noise is close to 0. The cost is
+ * {@code O(N log M)} for {@code N} samples and a template of {@code M} samples. The DFT plans come
+ * from the plan cache, where {@code prepare_matched_filter_plans} can create them ahead of time.
+ *
+ * @param samples             The samples to correlate.
+ * @param num_samples         The number of samples in {@code samples}.
+ * @param template_real       The real part of the template.
+ * @param template_imaginary  The imaginary part of the template.
+ * @param template_size       The number of samples in the template.
+ * @param correlation         The array to place the correlation in, with
+ *                            {@code num_samples - template_size + 1} entries. Entry {@code i} is
+ *                            the match of the template starting at {@code samples[i]}.
+ * @param scratch             The scratch arena that the blocks and spectra are allocated from.
+ */
+void matched_filter(const Sample *samples,
+                    size_t num_samples,
+                    const Sample *template_real,
+                    const Sample *template_imaginary,
+                    size_t template_size,
+                    Sample *correlation,
+                    ScratchArena *scratch);
+
+
+/**
+ * Calculates the power of a single frequency in a set of samples with the Goertzel algorithm.
+ *
+ * This costs {@code O(N)} with no transform or allocation, so it is much cheaper than
+ * {@code peak_frequency} when only a few known frequencies matter. For a pure tone at
+ * {@code frequency} that completes a whole number of cycles, the power is
+ * {@code num_samples / 2} times the energy of the samples. In fixed-point builds, the recurrence
+ * and the power are integers, in the units of the squares of the samples.
+ *
+ * @param samples      The set of samples to measure.
+ * @param num_samples  The number of samples in {@code samples}.
+ * @param sample_rate  The sample rate in Hertz.
+ * @param frequency    The frequency to measure.
  *
- * @return The maximum frequency in the provided samples, in Hertz.
+ * @return The squared magnitude of the DFT of the samples at {@code frequency}.
  */
-double peak_frequency(double *samples, size_t num_samples, uint32_t sample_rate);
+SampleAccumulator tone_power(const Sample *samples,
+                             size_t num_samples,
+                             uint32_t sample_rate,
+                             Frequency frequency);
 
 
 /**
  * Determines whether the peak frequency in a set of samples is approximately equal to a target
  * frequency.
  *
- * The error threshold allowable by this function is defined as {@code FREQ_PROCESSING_MARGIN_HZ}.
+ * The error threshold allowable by this function is {@code margin}, which is
+ * {@code FREQ_PROCESSING_MARGIN_HZ} unless the analysis parameters change it.
  *
  * @param samples       The set of samples to find the peak frequency within.
  * @param num_samples   The number of samples in `samples`.
  * @param samples_rate  The sample rate in Hertz.
  * @param frequency     The target frequency to compare against.
+ * @param margin        The largest difference from the target frequency that is close to it.
+ * @param scratch       The scratch arena that all temporary buffers are allocated from.
  *
  * @return Whether the peak frequency in the samples is close to the target frequency.
  */
-bool is_frequency(double *samples, size_t num_samples, uint32_t sample_rate, double frequency);
+bool is_frequency(Sample *samples,
+                  size_t num_samples,
+                  uint32_t sample_rate,
+                  Frequency frequency,
+                  Frequency margin,
+                  ScratchArena *scratch);
 
 
 #endif  // _FREQ_PROCESSING_H_
@@ -0,0 +1,772 @@
+#include "freq_processing.h"
+#include "precision.h"
+#include "scratch_arena.h"
+#include <assert.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+
+#define FIXED_POINT_ACOS_TABLE_BITS  10
+#define FIXED_POINT_ACOS_TABLE_SIZE  ((1 << FIXED_POINT_ACOS_TABLE_BITS) + 1)
+#define FIXED_POINT_CENTER_HZ        1900
+#define FIXED_POINT_PI_Q13           25736
+#define FIXED_POINT_MAX_SUM_BITS     47
+#define FIXED_POINT_COS_TABLE_BITS   12
+#define FIXED_POINT_COS_TABLE_SIZE   ((1 << FIXED_POINT_COS_TABLE_BITS) + 1)
+#define FIXED_POINT_DFT_MAX_SAMPLES  2048
+
+
+// The arccosine of `-1 + 2 * i / (FIXED_POINT_ACOS_TABLE_SIZE - 1)` for each index `i`, in Q16
+// radians, and the cosine of `2 pi i / (FIXED_POINT_COS_TABLE_SIZE - 1)`, in Q30. They are filled
+// in once, on first use.
+static int32_t acos_table[FIXED_POINT_ACOS_TABLE_SIZE];
+static int32_t cos_table[FIXED_POINT_COS_TABLE_SIZE];
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+
+/**
+ * Fills in {@code acos_table} and {@code cos_table}.
+ */
+static void fill_tables(void) {
+    for (size_t i = 0; i < FIXED_POINT_ACOS_TABLE_SIZE; i++) {
+        double cosine = -1.0 + 2.0 * i / (FIXED_POINT_ACOS_TABLE_SIZE - 1);
+        acos_table[i] = (int32_t) round(acos(cosine) * 65536.0);
+    }
+    for (size_t i = 0; i < FIXED_POINT_COS_TABLE_SIZE; i++) {
+        double angle = 2.0 * M_PI * i / (FIXED_POINT_COS_TABLE_SIZE - 1);
+        cos_table[i] = (int32_t) round(cos(angle) * 1073741824.0);
+    }
+}
+
+
+/**
+ * Calculates the arccosine of a Q15 value by linear interpolation in {@code acos_table}.
+ *
+ * Between neighboring table entries, the interpolation is within 1e-5 radians of the true
+ * arccosine for cosines in {@code [-0.9, 0.9]}, which is where {@code prediction_lag} keeps the
+ * SSTV band.
+ *
+ * @param cosine  The cosine, in Q15 on {@code [-32768, 32768]}.
+ *
+ * @return The angle in Q16 radians, on {@code [0, pi * 65536]}.
+ */
+static int32_t fixed_acos(int32_t cosine) {
+    pthread_once(&tables_once, fill_tables);
+
+    int32_t clamped = (cosine < -32768) ? -32768 : (cosine > 32768) ? 32768 : cosine;
+    int32_t position = clamped + 32768;
+    int32_t fraction_bits = 16 - FIXED_POINT_ACOS_TABLE_BITS;
+    int32_t index = position >> fraction_bits;
+    int32_t fraction = position & ((1 << fraction_bits) - 1);
+    if (index + 1 >= FIXED_POINT_ACOS_TABLE_SIZE) {
+        return acos_table[FIXED_POINT_ACOS_TABLE_SIZE - 1];
+    }
+
+    int32_t step = acos_table[index + 1] - acos_table[index];
+    return acos_table[index] + step * fraction / (1 << fraction_bits);
+}
+
+
+/**
+ * Calculates the cosine of a phase by linear interpolation in {@code cos_table}.
+ *
+ * @param phase  The phase, as a fraction of a full turn in units of {@code 2^-32}.
+ *
+ * @return The cosine in Q30, within 1e-6 of the true cosine.
+ */
+static int32_t fixed_cos(uint32_t phase) {
+    pthread_once(&tables_once, fill_tables);
+
+    int32_t fraction_bits = 32 - FIXED_POINT_COS_TABLE_BITS;
+    uint32_t index = phase >> fraction_bits;
+    int64_t fraction = phase & ((UINT32_C(1) << fraction_bits) - 1);
+    int64_t step = cos_table[index + 1] - cos_table[index];
+    return cos_table[index] + (int32_t) ((step * fraction) >> fraction_bits);
+}
+
+
+/**
+ * Calculates the number of significant bits of a value.
+ *
+ * @param value  The value, which is not 0.
+ *
+ * @return The position of the highest set bit, plus 1.
+ */
+static int32_t bit_length(uint64_t value) {
+    return 64 - __builtin_clzll(value);
+}
+
+
+/**
+ * Chooses the prediction lag for a sample rate.
+ *
+ * The lag is the number of samples closest to a quarter period of the middle of the SSTV band,
+ * so that the band maps to angles around pi / 2, where the arccosine is best conditioned. At any
+ * sample rate, the highest pixel frequency stays below an angle of pi, so it is not aliased.
+ *
+ * @param sample_rate  The sample rate in Hertz.
+ *
+ * @return The lag, which is at least 1.
+ */
+static size_t prediction_lag(uint32_t sample_rate) {
+    size_t lag = (sample_rate + 2 * FIXED_POINT_CENTER_HZ) / (4 * FIXED_POINT_CENTER_HZ);
+    return lag > 0 ? lag : 1;
+}
+
+
+/**
+ * Estimates the frequency of the tone in a window from its linear prediction coefficient.
+ *
+ * A sinusoid {@code x} with angular frequency {@code w} satisfies
+ * {@code x[i - lag] + x[i + lag] = 2 cos(w lag) x[i]} exactly, for any window length. The
+ * coefficient is fitted by least squares with an intercept (which absorbs any DC offset), using
+ * only integer sums, and the frequency is then the arccosine of half the coefficient. On a pure
+ * tone the estimate is exact up to the Q15 and table rounding, but noise and the second tone of a
+ * window that straddles two pixels pull it away from the DFT peak, so it only tells
+ * {@code dft_peak_frequency} where to start its scan.
+ *
+ * @param samples      The samples of the window.
+ * @param num_samples  The number of samples in the window.
+ * @param sample_rate  The sample rate in Hertz.
+ *
+ * @return The frequency in Q4 Hertz (sixteenths of a Hertz), or 0 if the window is too short or
+ *         silent.
+ */
+static int32_t prediction_frequency(const Sample *samples,
+                                    size_t num_samples,
+                                    uint32_t sample_rate)
+{
+    // Short windows use a shorter lag, since there must be at least two predictions to fit.
+    size_t lag = prediction_lag(sample_rate);
+    if (num_samples < 2 * lag + 2) {
+        lag = (num_samples > 2) ? (num_samples - 2) / 2 : 0;
+    }
+    if (lag == 0) {
+        return 0;
+    }
+
+    // Each prediction relates `u = x[i]` to `v = x[i - lag] + x[i + lag]`. The sums are centered
+    // on the integer means first, so that they stay small enough to multiply in 64 bits.
+    int64_t num_predictions = num_samples - 2 * lag;
+    int64_t sum_u = 0;
+    int64_t sum_v = 0;
+    for (size_t i = lag; i + lag < num_samples; i++) {
+        sum_u += samples[i];
+        sum_v += (int32_t) samples[i - lag] + samples[i + lag];
+    }
+    int32_t mean_u = sum_u / num_predictions;
+    int32_t mean_v = sum_v / num_predictions;
+
+    int64_t offset_u = 0;
+    int64_t offset_v = 0;
+    int64_t sum_uu = 0;
+    int64_t sum_uv = 0;
+    for (size_t i = lag; i + lag < num_samples; i++) {
+        int64_t u = samples[i] - mean_u;
+        int64_t v = (int32_t) samples[i - lag] + samples[i + lag] - mean_v;
+        offset_u += u;
+        offset_v += v;
+        sum_uu += u * u;
+        sum_uv += u * v;
+    }
+
+    // The remaining offsets are less than one per prediction, and correct for the rounding of the
+    // means. The covariance is at most the variance in magnitude, so once the variance fits in 47
+    // bits, there is room for the 15 bit shift of the Q15 ratio.
+    int64_t covariance = sum_uv - offset_u * offset_v / num_predictions;
+    int64_t variance = 2 * (sum_uu - offset_u * offset_u / num_predictions);
+    if (variance <= 0) {
+        return 0;
+    }
+    while (variance >= ((int64_t) 1 << FIXED_POINT_MAX_SUM_BITS)) {
+        covariance /= 2;
+        variance /= 2;
+    }
+    int32_t cosine = (int32_t) ((covariance * 32768) / variance);
+
+    // The angle advances by `2 pi f lag / sample_rate` per lag, so in Q4 Hertz the frequency is
+    // `angle * sample_rate / (pi * lag)` with the angle in Q16 and pi in Q13.
+    int64_t angle = fixed_acos(cosine);
+    return (int32_t) (angle * sample_rate / ((int64_t) FIXED_POINT_PI_Q13 * lag));
+}
+
+
+/**
+ * Calculates the power of one DFT bin of a window with the Goertzel algorithm.
+ *
+ * @param windowed     The windowed samples.
+ * @param num_samples  The number of samples in the window.
+ * @param bin          The index of the bin.
+ *
+ * @return The squared magnitude of the bin.
+ */
+static int64_t goertzel_power(const int32_t *windowed, size_t num_samples, size_t bin) {
+    // The coefficient is in Q30. With at most `FIXED_POINT_DFT_MAX_SAMPLES` Q15 samples, the
+    // states stay within 26 bits, so neither their products nor their squares overflow.
+    uint32_t phase = (uint32_t) (((uint64_t) bin << 32) / num_samples);
+    int64_t coefficient = 2 * (int64_t) fixed_cos(phase);
+    int64_t previous = 0;
+    int64_t before_previous = 0;
+    for (size_t i = 0; i < num_samples; i++) {
+        int64_t feedback = (coefficient * previous + ((int64_t) 1 << 29)) >> 30;
+        int64_t current = windowed[i] + feedback - before_previous;
+        before_previous = previous;
+        previous = current;
+    }
+
+    int64_t cross = (coefficient * previous + ((int64_t) 1 << 29)) >> 30;
+    int64_t power =
+        previous * previous + before_previous * before_previous - cross * before_previous;
+    return power > 0 ? power : 0;
+}
+
+
+/**
+ * Calculates the integer square root of a value with Newton's method.
+ *
+ * @param value  The value, which is not negative.
+ *
+ * @return The largest integer whose square is at most {@code value}.
+ */
+static int64_t integer_sqrt(int64_t value) {
+    if (value <= 0) {
+        return 0;
+    }
+
+    // Starting from a power of two at least as large as the root, each step moves down towards
+    // it, so the loop ends after a few steps.
+    int64_t root = (int64_t) 1 << ((bit_length(value) + 1) / 2);
+    int64_t next = (root + value / root) / 2;
+    while (next < root) {
+        root = next;
+        next = (root + value / root) / 2;
+    }
+    return root;
+}
+
+
+/**
+ * Gets the power of a DFT bin of a window, computing it on first use.
+ *
+ * @param windowed     The windowed samples.
+ * @param num_samples  The number of samples in the window.
+ * @param powers       The power of each bin so far, with -1 for bins not computed yet.
+ * @param bin          The index of the bin.
+ *
+ * @return The squared magnitude of the bin.
+ */
+static int64_t bin_power(const int32_t *windowed, size_t num_samples, int64_t *powers, size_t bin) {
+    if (powers[bin] < 0) {
+        powers[bin] = goertzel_power(windowed, num_samples, bin);
+    }
+    return powers[bin];
+}
+
+
+/**
+ * Estimates the peak frequency of a window from its DFT bins.
+ *
+ * This mirrors {@code peak_frequency} of the floating point build, for windows of any length: the
+ * DC offset is removed, the window is Hann windowed, and the peak bin is found and interpolated
+ * barycentrically with its neighbors. Windows longer than {@code FIXED_POINT_DFT_MAX_SAMPLES} are
+ * scaled down further, so that the Goertzel states cannot overflow.
+ *
+ * Scanning every bin takes {@code O(N^2)} operations, so the bins are scanned outwards from the
+ * linear prediction estimate instead. By Parseval's theorem, the powers of all the bins add up to
+ * the energy of the window, so once the peak so far has more power than all the bins not scanned
+ * yet could have together, it is the peak of the whole spectrum. For a window of one or two
+ * tones, that takes a few bins around them; only noisy windows need every bin. Either way, the
+ * result is the same as scanning every bin.
+ *
+ * @param samples      The samples of the window.
+ * @param num_samples  The number of samples in the window.
+ * @param sample_rate  The sample rate in Hertz.
+ * @param scratch      The scratch arena for the windowed samples.
+ *
+ * @return The frequency in Q4 Hertz, or 0 if the window is silent or shorter than 2 samples.
+ */
+static int32_t dft_peak_frequency(const Sample *samples,
+                                  size_t num_samples,
+                                  uint32_t sample_rate,
+                                  ScratchArena *scratch)
+{
+    if (num_samples < 2) {
+        return 0;
+    }
+
+    int32_t scale_bits = 15;
+    while ((num_samples >> (scale_bits - 15)) > FIXED_POINT_DFT_MAX_SAMPLES) {
+        scale_bits++;
+    }
+
+    int64_t sum = 0;
+    for (size_t i = 0; i < num_samples; i++) {
+        sum += samples[i];
+    }
+    int64_t mean = sum / (int64_t) num_samples;
+
+    // The energy of the window bounds the power of the bins from 0 to `num_samples / 2`. The DC
+    // and Nyquist bins are their own mirror images, so they count twice.
+    size_t scratch_mark = scratch_arena_mark(scratch);
+    int32_t *windowed = (int32_t *) scratch_arena_alloc(scratch, num_samples * sizeof(int32_t));
+    assert(windowed && "dft_peak_frequency cannot alloc windowed");
+    int64_t energy = 0;
+    int64_t dc = 0;
+    int64_t nyquist = 0;
+    for (size_t i = 0; i < num_samples; i++) {
+        uint32_t phase = (uint32_t) (((uint64_t) i << 32) / (num_samples - 1));
+        int64_t hann = ((int64_t) 1073741824 - fixed_cos(phase)) >> 16;
+        windowed[i] = (int32_t) (((samples[i] - mean) * hann) >> scale_bits);
+        energy += (int64_t) windowed[i] * windowed[i];
+        dc += windowed[i];
+        nyquist += (i % 2 == 0) ? windowed[i] : -windowed[i];
+    }
+    int64_t spectrum_power = ((int64_t) num_samples * energy + dc * dc + nyquist * nyquist) / 2;
+
+    size_t num_bins = num_samples / 2 + 1;
+    int64_t *powers = (int64_t *) scratch_arena_alloc(scratch, num_bins * sizeof(int64_t));
+    assert(powers && "dft_peak_frequency cannot alloc powers");
+    for (size_t bin = 0; bin < num_bins; bin++) {
+        powers[bin] = -1;
+    }
+
+    // The bins are scanned outwards from the estimate, until the power not scanned yet is less
+    // than the peak so far (with a margin for the rounding of the Goertzel states), or there are
+    // no bins left.
+    int64_t guess = prediction_frequency(samples, num_samples, sample_rate);
+    size_t guess_bin = (guess * num_samples + 8 * sample_rate) / (16 * sample_rate);
+    guess_bin = (guess_bin < num_bins) ? guess_bin : num_bins - 1;
+    size_t peak_bin = guess_bin;
+    int64_t peak = bin_power(windowed, num_samples, powers, guess_bin);
+    int64_t unscanned_power = spectrum_power + spectrum_power / 256 - peak;
+    for (size_t distance = 1; peak <= unscanned_power; distance++) {
+        bool below = distance <= guess_bin;
+        bool above = guess_bin + distance < num_bins;
+        if (!below && !above) {
+            break;
+        }
+
+        size_t bins[2] = {guess_bin - distance, guess_bin + distance};
+        bool in_range[2] = {below, above};
+        for (size_t i = 0; i < 2; i++) {
+            if (!in_range[i]) {
+                continue;
+            }
+            int64_t power = bin_power(windowed, num_samples, powers, bins[i]);
+            unscanned_power -= power;
+            if (power > peak) {
+                peak_bin = bins[i];
+                peak = power;
+            }
+        }
+    }
+
+    // At either end of the spectrum, the peak is its own neighbor, as in
+    // `barycentric_peak_interpolation`.
+    int64_t left = peak;
+    int64_t right = peak;
+    if (peak_bin > 0) {
+        left = bin_power(windowed, num_samples, powers, peak_bin - 1);
+    }
+    if (peak_bin + 1 < num_bins) {
+        right = bin_power(windowed, num_samples, powers, peak_bin + 1);
+    }
+    scratch_arena_release(scratch, scratch_mark);
+
+    left = integer_sqrt(left);
+    int64_t magnitude = integer_sqrt(peak);
+    right = integer_sqrt(right);
+    int64_t denominator = left + magnitude + right;
+    if (denominator <= 0) {
+        return 0;
+    }
+    int64_t numerator = (int64_t) peak_bin * denominator + right - left;
+    return (int32_t) (numerator * sample_rate * 16 / ((int64_t) num_samples * denominator));
+}
+
+
+/**
+ * Transforms a block of complex values in place with an iterative radix-2 FFT.
+ *
+ * The butterflies are not scaled, so each stage can double the magnitudes. With real and
+ * imaginary parts under {@code 2^b}, the outputs are under {@code 2^b * size * sqrt(2)}, which
+ * the caller keeps under {@code 2^31}. The twiddle factors come from {@code fixed_cos} in Q30.
+ *
+ * @param real       The real parts, transformed in place.
+ * @param imaginary  The imaginary parts, transformed in place.
+ * @param size_bits  The base-2 logarithm of the number of values.
+ * @param inverse    Whether the exponents are positive, for an unscaled inverse transform.
+ */
+static void fixed_fft(int32_t *real, int32_t *imaginary, size_t size_bits, bool inverse) {
+    size_t size = (size_t) 1 << size_bits;
+    for (size_t i = 1, j = 0; i < size; i++) {
+        size_t bit = size >> 1;
+        for (; j & bit; bit >>= 1) {
+            j ^= bit;
+        }
+        j ^= bit;
+        if (i < j) {
+            int32_t swap_real = real[i];
+            int32_t swap_imaginary = imaginary[i];
+            real[i] = real[j];
+            imaginary[i] = imaginary[j];
+            real[j] = swap_real;
+            imaginary[j] = swap_imaginary;
+        }
+    }
+
+    // The sine is the cosine a quarter turn earlier.
+    for (size_t half = 1; half < size; half *= 2) {
+        uint32_t step = (uint32_t) (((uint64_t) 1 << 32) / (2 * half));
+        for (size_t k = 0; k < half; k++) {
+            uint32_t phase = (uint32_t) k * step;
+            int64_t cosine = fixed_cos(phase);
+            int64_t sine = fixed_cos(phase - (UINT32_C(1) << 30));
+            sine = inverse ? sine : -sine;
+            for (size_t top = k; top < size; top += 2 * half) {
+                size_t bottom = top + half;
+                int64_t turned_real =
+                    (cosine * real[bottom] - sine * imaginary[bottom] + (1 << 29)) >> 30;
+                int64_t turned_imaginary =
+                    (cosine * imaginary[bottom] + sine * real[bottom] + (1 << 29)) >> 30;
+                real[bottom] = (int32_t) (real[top] - turned_real);
+                imaginary[bottom] = (int32_t) (imaginary[top] - turned_imaginary);
+                real[top] = (int32_t) (real[top] + turned_real);
+                imaginary[top] = (int32_t) (imaginary[top] + turned_imaginary);
+            }
+        }
+    }
+}
+
+
+/**
+ * Calculates the base-2 logarithm of the FFT size that {@code matched_filter} uses for a template,
+ * which is the size of the floating point build.
+ *
+ * @param template_size  The number of samples in the template.
+ *
+ * @return The base-2 logarithm of the FFT size, at least 8 and at least that of 4 templates.
+ */
+static size_t matched_filter_fft_bits(size_t template_size) {
+    size_t fft_bits = 8;
+    while (((size_t) 1 << fft_bits) < 4 * template_size) {
+        fft_bits++;
+    }
+    return fft_bits;
+}
+
+
+/**
+ * Normalizes the magnitude of a correlation by the energies of the samples and of the template.
+ *
+ * The power and the energies can each take up to 64 bits, so each is cut down to its 31 (or, for
+ * the power, 62) most significant bits before they are divided, and the bits dropped are added
+ * back as a power of two. The ratio of the powers keeps 30 significant bits either way.
+ *
+ * @param power            The squared magnitude of the correlation, before scaling.
+ * @param power_exponent   The power of two that {@code power} is scaled by to get the squared
+ *                         magnitude.
+ * @param energy           The energy of the samples under the template.
+ * @param template_energy  The energy of the real part of the template.
+ *
+ * @return The magnitude of the correlation over the square root of the product of the energies,
+ *         as a Q15 sample, which is 1 for a perfect match.
+ */
+static Sample normalize_correlation(uint64_t power,
+                                    int32_t power_exponent,
+                                    int64_t energy,
+                                    int64_t template_energy)
+{
+    if (power == 0 || energy <= 0 || template_energy <= 0) {
+        return 0;
+    }
+
+    int32_t energy_shift = (bit_length(energy) > 31) ? bit_length(energy) - 31 : 0;
+    int32_t template_shift =
+        (bit_length(template_energy) > 31) ? bit_length(template_energy) - 31 : 0;
+    uint64_t denominator =
+        (uint64_t) (energy >> energy_shift) * (uint64_t) (template_energy >> template_shift);
+    int32_t denominator_shift = (bit_length(denominator) > 31) ? bit_length(denominator) - 31 : 0;
+    denominator >>= denominator_shift;
+    int32_t power_shift = 62 - bit_length(power);
+    power = (power_shift >= 0) ? power << power_shift : power >> -power_shift;
+
+    // The ratio is in Q30, and it is at most 1 but for rounding, so it is kept to 1.
+    int32_t exponent =
+        power_exponent - power_shift + 30 - energy_shift - template_shift - denominator_shift;
+    uint64_t quotient = power / denominator;
+    uint64_t ratio = (uint64_t) 1 << 30;
+    if (exponent < 0) {
+        ratio = (exponent > -64) ? quotient >> -exponent : 0;
+    }
+    else if (exponent < 30 && quotient < ((uint64_t) 1 << (30 - exponent))) {
+        ratio = quotient << exponent;
+    }
+    ratio = (ratio < ((uint64_t) 1 << 30)) ? ratio : (uint64_t) 1 << 30;
+
+    // The square root is rounded to the nearest Q15 value, as `sample_from_double` would.
+    int64_t root = integer_sqrt(ratio);
+    root += (int64_t) ratio - root * root > root;
+    return (Sample) ((root < INT16_MAX) ? root : INT16_MAX);
+}
+
+
+void set_fft_planner_flags(unsigned flags) {
+    (void) flags;
+}
+
+
+bool import_fft_wisdom(const char *path) {
+    (void) path;
+    return false;
+}
+
+
+bool export_fft_wisdom(const char *path) {
+    (void) path;
+    return false;
+}
+
+
+void prepare_fft_plan(size_t num_samples, size_t num_windows) {
+    (void) num_samples;
+    (void) num_windows;
+}
+
+
+void prepare_matched_filter_plans(size_t template_size) {
+    (void) template_size;
+}
+
+
+void cleanup_fft_plans(void) {}
+
+
+void remove_dc_offset(Sample *samples, Sample *cleaned_samples, size_t num_samples) {
+    assert(samples && "remove_dc_offset got NULL samples");
+    assert(cleaned_samples && "remove_dc_offset got NULL cleaned_samples");
+
+    SampleAccumulator sum = 0;
+    for (size_t i = 0; i < num_samples; i++) {
+        sum += samples[i];
+    }
+    int32_t mean = (num_samples > 0) ? (int32_t) (sum / (int64_t) num_samples) : 0;
+
+    // The difference can leave the range of a sample, so it saturates.
+    for (size_t i = 0; i < num_samples; i++) {
+        int32_t cleaned = samples[i] - mean;
+        cleaned = (cleaned < INT16_MIN) ? INT16_MIN : (cleaned > INT16_MAX) ? INT16_MAX : cleaned;
+        cleaned_samples[i] = (Sample) cleaned;
+    }
+}
+
+
+size_t peak_frequency_scratch_size(size_t num_samples) {
+    // This mirrors the windowed samples and bin powers of `dft_peak_frequency`.
+    size_t size = num_samples * sizeof(int32_t) + (num_samples / 2 + 1) * sizeof(int64_t);
+    return size + 2 * SCRATCH_ARENA_ALIGNMENT;
+}
+
+
+Frequency peak_frequency(Sample *samples,
+                         size_t num_samples,
+                         uint32_t sample_rate,
+                         ScratchArena *scratch)
+{
+    assert(samples && "peak_frequency got NULL samples");
+    assert(scratch && "peak_frequency got NULL scratch");
+
+    return dft_peak_frequency(samples, num_samples, sample_rate, scratch);
+}
+
+
+size_t peak_frequencies_scratch_size(size_t num_samples, size_t num_windows) {
+    // The windows are estimated one at a time, so they share their temporaries.
+    (void) num_windows;
+    return peak_frequency_scratch_size(num_samples);
+}
+
+
+void peak_frequencies(const Sample *samples,
+                      const size_t *window_starts,
+                      size_t num_windows,
+                      size_t num_samples,
+                      uint32_t sample_rate,
+                      Frequency *frequencies,
+                      ScratchArena *scratch)
+{
+    assert(samples && "peak_frequencies got NULL samples");
+    assert(window_starts && "peak_frequencies got NULL window_starts");
+    assert(frequencies && "peak_frequencies got NULL frequencies");
+    assert(scratch && "peak_frequencies got NULL scratch");
+
+    for (size_t w = 0; w < num_windows; w++) {
+        frequencies[w] =
+            dft_peak_frequency(&samples[window_starts[w]], num_samples, sample_rate, scratch);
+    }
+}
+
+
+void matched_filter(const Sample *samples,
+                    size_t num_samples,
+                    const Sample *template_real,
+                    const Sample *template_imaginary,
+                    size_t template_size,
+                    Sample *correlation,
+                    ScratchArena *scratch)
+{
+    assert(samples && "matched_filter got NULL samples");
+    assert(template_real && "matched_filter got NULL template_real");
+    assert(template_imaginary && "matched_filter got NULL template_imaginary");
+    assert(correlation && "matched_filter got NULL correlation");
+    assert(scratch && "matched_filter got NULL scratch");
+
+    if (template_size == 0 || template_size > num_samples) {
+        return;
+    }
+
+    // Overlap-save, as in the floating point build: each block of `fft_size` samples yields
+    // `block_step` correlation values, and consecutive blocks overlap by the template. The real
+    // and imaginary parts of the template are correlated together in one complex transform, and
+    // the samples are scaled down by `input_shift` only for transforms too long to hold 16-bit
+    // samples in 31 bits.
+    size_t fft_bits = matched_filter_fft_bits(template_size);
+    size_t fft_size = (size_t) 1 << fft_bits;
+    size_t block_step = fft_size - template_size + 1;
+    size_t num_positions = num_samples - template_size + 1;
+    int32_t input_shift = (fft_bits > 15) ? (int32_t) fft_bits - 15 : 0;
+
+    size_t scratch_mark = scratch_arena_mark(scratch);
+    int32_t *template_real_spectrum =
+        (int32_t *) scratch_arena_alloc(scratch, fft_size * sizeof(int32_t));
+    int32_t *template_imaginary_spectrum =
+        (int32_t *) scratch_arena_alloc(scratch, fft_size * sizeof(int32_t));
+    int32_t *real = (int32_t *) scratch_arena_alloc(scratch, fft_size * sizeof(int32_t));
+    int32_t *imaginary = (int32_t *) scratch_arena_alloc(scratch, fft_size * sizeof(int32_t));
+    int64_t *energy_prefix =
+        (int64_t *) scratch_arena_alloc(scratch, (fft_size + 1) * sizeof(int64_t));
+    assert(template_real_spectrum && template_imaginary_spectrum && real && imaginary &&
+           energy_prefix && "matched_filter cannot alloc buffers");
+
+    // The template spectrum is taken with positive exponents, so that multiplying by it correlates
+    // with the template rather than convolving.
+    int64_t template_energy = 0;
+    for (size_t i = 0; i < fft_size; i++) {
+        template_real_spectrum[i] = (i < template_size) ? template_real[i] >> input_shift : 0;
+        template_imaginary_spectrum[i] =
+            (i < template_size) ? template_imaginary[i] >> input_shift : 0;
+    }
+    for (size_t i = 0; i < template_size; i++) {
+        template_energy += (int64_t) template_real[i] * template_real[i];
+    }
+    fixed_fft(template_real_spectrum, template_imaginary_spectrum, fft_bits, true);
+
+    for (size_t block_start = 0; block_start < num_positions; block_start += block_step) {
+        size_t block_size = num_samples - block_start;
+        if (block_size > fft_size) {
+            block_size = fft_size;
+        }
+
+        // The energy of the samples under the template at each position normalizes the
+        // correlation, so a perfect match is 1 regardless of the signal level.
+        energy_prefix[0] = 0;
+        for (size_t i = 0; i < fft_size; i++) {
+            int32_t sample = (i < block_size) ? samples[block_start + i] : 0;
+            real[i] = sample >> input_shift;
+            imaginary[i] = 0;
+            energy_prefix[i + 1] = energy_prefix[i] + (int64_t) sample * sample;
+        }
+        fixed_fft(real, imaginary, fft_bits, false);
+
+        // The products take up to 63 bits. They are scaled down by a shift chosen for the block,
+        // so that the inverse transform of the largest of them stays within 31 bits, and are
+        // computed again once the shift is known rather than kept.
+        uint64_t magnitude_bits = 0;
+        for (size_t k = 0; k < fft_size; k++) {
+            int64_t product_real = (int64_t) real[k] * template_real_spectrum[k] -
+                (int64_t) imaginary[k] * template_imaginary_spectrum[k];
+            int64_t product_imaginary = (int64_t) real[k] * template_imaginary_spectrum[k] +
+                (int64_t) imaginary[k] * template_real_spectrum[k];
+            magnitude_bits |= (uint64_t) llabs(product_real) | (uint64_t) llabs(product_imaginary);
+        }
+        int32_t product_bits = 30 - (int32_t) fft_bits;
+        int32_t product_shift = 0;
+        if (magnitude_bits > 0 && bit_length(magnitude_bits) > product_bits) {
+            product_shift = bit_length(magnitude_bits) - product_bits;
+        }
+        for (size_t k = 0; k < fft_size; k++) {
+            int64_t product_real = (int64_t) real[k] * template_real_spectrum[k] -
+                (int64_t) imaginary[k] * template_imaginary_spectrum[k];
+            int64_t product_imaginary = (int64_t) real[k] * template_imaginary_spectrum[k] +
+                (int64_t) imaginary[k] * template_real_spectrum[k];
+            real[k] = (int32_t) (product_real >> product_shift);
+            imaginary[k] = (int32_t) (product_imaginary >> product_shift);
+        }
+        fixed_fft(real, imaginary, fft_bits, true);
+
+        // The inverse transform is not divided by its size, so each output is `fft_size` times
+        // the correlation, scaled down by the shifts of the inputs and of the products.
+        int32_t power_exponent = 2 * (product_shift + 2 * input_shift - (int32_t) fft_bits);
+        size_t num_valid = num_positions - block_start;
+        if (num_valid > block_step) {
+            num_valid = block_step;
+        }
+        for (size_t j = 0; j < num_valid; j++) {
+            uint64_t power = (uint64_t) ((int64_t) real[j] * real[j]) +
+                (uint64_t) ((int64_t) imaginary[j] * imaginary[j]);
+            int64_t energy = energy_prefix[j + template_size] - energy_prefix[j];
+            correlation[block_start + j] =
+                normalize_correlation(power, power_exponent, energy, template_energy);
+        }
+    }
+
+    scratch_arena_release(scratch, scratch_mark);
+}
+
+
+SampleAccumulator tone_power(const Sample *samples,
+                             size_t num_samples,
+                             uint32_t sample_rate,
+                             Frequency frequency)
+{
+    assert(samples && "tone_power got NULL samples");
+
+    // The Goertzel recurrence runs on integers with a Q30 coefficient from the cosine table, at
+    // the phase step of the Q4 frequency as a fraction of a turn. For a tone at angle `w` per
+    // sample, the states grow by about `1 / (2 sin(w))` of its amplitude per sample, so over the
+    // sync pulses and pre-screen blocks they stay within 32 bits, and their products with the
+    // coefficient within 64 bits.
+    uint32_t phase = (uint32_t) (((int64_t) frequency << 32) / (16 * (int64_t) sample_rate));
+    int64_t coefficient = 2 * (int64_t) fixed_cos(phase);
+    int64_t previous = 0;
+    int64_t before_previous = 0;
+    for (size_t i = 0; i < num_samples; i++) {
+        int64_t feedback = (coefficient * previous + ((int64_t) 1 << 29)) >> 30;
+        int64_t current = samples[i] + feedback - before_previous;
+        before_previous = previous;
+        previous = current;
+    }
+
+    int64_t cross = (coefficient * previous + ((int64_t) 1 << 29)) >> 30;
+    int64_t power =
+        previous * previous + before_previous * before_previous - cross * before_previous;
+    return power > 0 ? power : 0;
+}
+
+
+bool is_frequency(Sample *samples,
+                  size_t num_samples,
+                  uint32_t sample_rate,
+                  Frequency frequency,
+                  Frequency margin,
+                  ScratchArena *scratch)
+{
+    assert(samples && "is_frequency got NULL samples");
+
+    Frequency peak = peak_frequency(samples, num_samples, sample_rate, scratch);
+    Frequency error = abs(peak - frequency);
+    return error < margin;
+}
@@ -0,0 +1,337 @@
+#include "image_sink.h"
+#include "logger.h"
+#include "modes.h"
+#include "png_file.h"
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+
+/** The alignment of each slot of the shared memory ring, which is a cache line. */
+#define IMAGE_SINK_SHM_ALIGN 64
+
+
+/**
+ * Rounds a size in the shared memory object up to the alignment of a slot.
+ *
+ * @param size  The size, in bytes.
+ *
+ * @return The aligned size, in bytes.
+ */
+static size_t image_sink_shm_align(size_t size) {
+    return (size + IMAGE_SINK_SHM_ALIGN - 1) / IMAGE_SINK_SHM_ALIGN * IMAGE_SINK_SHM_ALIGN;
+}
+
+
+/**
+ * Allocates a sink of a type, with its lock set up.
+ *
+ * @param type  The type of the sink.
+ *
+ * @return A pointer to the new sink, or {@code NULL} if memory cannot be allocated.
+ */
+static ImageSink *image_sink_create(ImageSinkType type) {
+    ImageSink *sink = (ImageSink *) calloc(1, sizeof(ImageSink));
+    if (sink == NULL) {
+        return NULL;
+    }
+    sink->type = type;
+    pthread_mutex_init(&sink->lock, NULL);
+    return sink;
+}
+
+
+/**
+ * Creates the shared memory object of a sink, with room for the largest image of any supported
+ * mode in each slot.
+ *
+ * @param sink  The sink, whose shared memory fields are set.
+ * @param name  The name of the object, which starts with a slash.
+ *
+ * @return Whether the object was created and mapped.
+ */
+static bool image_sink_map_shm(ImageSink *sink, const char *name) {
+    uint64_t max_pixels = 0;
+    for (size_t i = 0; i < num_sstv_modes; i++) {
+        const SstvMode *mode = &sstv_modes[i];
+        uint64_t num_pixels =
+            (uint64_t) mode->width * sstv_mode_rows_per_line(mode) * mode->height;
+        max_pixels = (num_pixels > max_pixels) ? num_pixels : max_pixels;
+    }
+    size_t slot_size = image_sink_shm_align(sizeof(ImageShmSlot) + max_pixels * sizeof(Pixel));
+    size_t header_size = image_sink_shm_align(sizeof(ImageShmHeader));
+    size_t shm_size = header_size + IMAGE_SINK_SHM_SLOTS * slot_size;
+
+    // An object left from an earlier run is replaced, so its consumer sees the new header.
+    shm_unlink(name);
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) {
+        log_warn("cannot create shared memory '%s' (%s)", name, strerror(errno));
+        return false;
+    }
+    void *mapping = MAP_FAILED;
+    if (ftruncate(fd, shm_size) == 0) {
+        mapping = mmap(NULL, shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (mapping == MAP_FAILED) {
+        log_warn("cannot map shared memory '%s' (%s)", name, strerror(errno));
+        close(fd);
+        shm_unlink(name);
+        return false;
+    }
+    close(fd);
+
+    // The object starts zeroed, so every slot has sequence number 0 until its first frame.
+    ImageShmHeader *header = (ImageShmHeader *) mapping;
+    header->num_slots = IMAGE_SINK_SHM_SLOTS;
+    header->slot_size = slot_size;
+    header->max_pixels = max_pixels;
+    atomic_store_explicit(&header->frames_done, 0, memory_order_relaxed);
+    atomic_store_explicit(&header->next_sequence, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    memcpy(header->magic, IMAGE_SINK_SHM_MAGIC, sizeof(header->magic));
+
+    sink->shm_name = strdup(name);
+    sink->shm_size = shm_size;
+    sink->shm_header = header;
+    return sink->shm_name != NULL;
+}
+
+
+/**
+ * Gets a slot of the shared memory ring of a sink.
+ *
+ * @param sink      The sink.
+ * @param sequence  The sequence number of the frame in the slot.
+ *
+ * @return The header of the slot, which its pixels follow.
+ */
+static ImageShmSlot *image_sink_shm_slot(const ImageSink *sink, uint64_t sequence) {
+    const ImageShmHeader *header = sink->shm_header;
+    size_t offset = image_sink_shm_align(sizeof(ImageShmHeader)) +
+        (sequence - 1) % header->num_slots * header->slot_size;
+    return (ImageShmSlot *) ((uint8_t *) sink->shm_header + offset);
+}
+
+
+ImageSink *image_sink_open(const char *spec) {
+    assert(spec && "image_sink_open got NULL spec");
+
+    ImageSink *sink = NULL;
+    if (strcmp(spec, "png") == 0) {
+        sink = image_sink_create(IMAGE_SINK_PNG);
+    }
+    else if (strcmp(spec, "raw") == 0 || strcmp(spec, "ppm") == 0) {
+        sink = image_sink_create((spec[0] == 'r') ? IMAGE_SINK_RAW : IMAGE_SINK_PPM);
+        if (sink != NULL) {
+            sink->stream = stdout;
+        }
+    }
+    else if (strncmp(spec, "shm:/", 5) == 0 && spec[5] != '\0' && strchr(&spec[5], '/') == NULL) {
+        sink = image_sink_create(IMAGE_SINK_SHM);
+        if (sink != NULL && !image_sink_map_shm(sink, &spec[4])) {
+            image_sink_close(sink);
+            sink = NULL;
+        }
+    }
+    return sink;
+}
+
+
+ImageSink *image_sink_create_callback(ImageSinkCallback callback, void *context, bool per_line) {
+    assert(callback && "image_sink_create_callback got NULL callback");
+
+    ImageSink *sink = image_sink_create(IMAGE_SINK_CALLBACK);
+    if (sink == NULL) {
+        return NULL;
+    }
+    sink->callback = callback;
+    sink->context = context;
+    sink->per_line = per_line;
+    return sink;
+}
+
+
+ImageFrame *image_sink_begin(ImageSink *sink, const char *name, size_t width, size_t height) {
+    assert(sink && "image_sink_begin got NULL sink");
+
+    ImageFrame *frame = (ImageFrame *) calloc(1, sizeof(ImageFrame));
+    assert(frame && "image_sink_begin cannot malloc frame");
+    frame->sink = sink;
+    frame->name = name;
+    frame->width = width;
+    frame->height = height;
+
+    switch (sink->type) {
+    case IMAGE_SINK_PNG:
+        frame->png = png_file_writer_open(width, height, name);
+        break;
+    case IMAGE_SINK_RAW:
+    case IMAGE_SINK_PPM:
+        // Images are written whole, one after another, even when they are decoded concurrently.
+        pthread_mutex_lock(&sink->lock);
+        if (sink->type == IMAGE_SINK_PPM) {
+            fprintf(sink->stream, "P6\n%lu %lu\n255\n", width, height);
+        }
+        break;
+    case IMAGE_SINK_SHM: {
+        ImageShmHeader *header = sink->shm_header;
+        if ((uint64_t) width * height > header->max_pixels) {
+            log_warn("image '%s' does not fit shared memory '%s', dropping it",
+                     name, sink->shm_name);
+            break;
+        }
+
+        // The slot is marked as being set up before its old frame is overwritten, so a consumer
+        // that is copying the old frame out sees the sequence number change.
+        uint64_t sequence = atomic_fetch_add(&header->next_sequence, 1) + 1;
+        ImageShmSlot *slot = image_sink_shm_slot(sink, sequence);
+        atomic_store_explicit(&slot->sequence, 0, memory_order_release);
+        atomic_store_explicit(&slot->rows_ready, 0, memory_order_relaxed);
+        slot->width = width;
+        slot->height = height;
+        snprintf(slot->name, sizeof(slot->name), "%s", name);
+        atomic_store_explicit(&slot->sequence, sequence, memory_order_release);
+
+        frame->slot = slot;
+        frame->pixels = (Pixel *) (slot + 1);
+        frame->num_rows = height;
+        break;
+    }
+    case IMAGE_SINK_CALLBACK:
+        if (!sink->per_line) {
+            frame->pixels = (Pixel *) malloc(width * height * sizeof(Pixel));
+            assert(frame->pixels && "image_sink_begin cannot malloc pixels");
+            frame->num_rows = height;
+        }
+        break;
+    }
+    return frame;
+}
+
+
+Pixel *image_frame_rows(ImageFrame *frame, size_t num_rows) {
+    assert(frame->rows_done + num_rows <= frame->height && "image_frame_rows got too many rows");
+
+    // An image that is held whole is converted in place, and the rest of the sinks take the rows
+    // from a buffer that is reused for every line.
+    bool whole = frame->slot != NULL ||
+        (frame->sink->type == IMAGE_SINK_CALLBACK && !frame->sink->per_line);
+    if (whole) {
+        return &frame->pixels[frame->rows_done * frame->width];
+    }
+    if (num_rows > frame->num_rows) {
+        free(frame->pixels);
+        frame->pixels = (Pixel *) malloc(num_rows * frame->width * sizeof(Pixel));
+        assert(frame->pixels && "image_frame_rows cannot malloc pixels");
+        frame->num_rows = num_rows;
+    }
+    return frame->pixels;
+}
+
+
+void image_frame_commit(ImageFrame *frame, size_t num_rows) {
+    ImageSink *sink = frame->sink;
+    switch (sink->type) {
+    case IMAGE_SINK_PNG:
+        for (size_t row = 0; row < num_rows; row++) {
+            png_file_writer_write_row(frame->png, &frame->pixels[row * frame->width]);
+        }
+        break;
+    case IMAGE_SINK_RAW:
+    case IMAGE_SINK_PPM:
+        // A pixel is packed RGB bytes, as both formats store it.
+        fwrite(frame->pixels, sizeof(Pixel), num_rows * frame->width, sink->stream);
+        break;
+    case IMAGE_SINK_SHM:
+        if (frame->slot != NULL) {
+            atomic_store_explicit(
+                &frame->slot->rows_ready, frame->rows_done + num_rows, memory_order_release);
+        }
+        break;
+    case IMAGE_SINK_CALLBACK:
+        if (sink->per_line) {
+            sink->callback(sink->context, frame, frame->rows_done, num_rows, frame->pixels);
+        }
+        break;
+    }
+    frame->rows_done += num_rows;
+}
+
+
+void image_frame_end(ImageFrame *frame) {
+    ImageSink *sink = frame->sink;
+    switch (sink->type) {
+    case IMAGE_SINK_PNG:
+        png_file_writer_close(frame->png);
+        free(frame->pixels);
+        break;
+    case IMAGE_SINK_RAW:
+    case IMAGE_SINK_PPM:
+        fflush(sink->stream);
+        pthread_mutex_unlock(&sink->lock);
+        free(frame->pixels);
+        break;
+    case IMAGE_SINK_SHM:
+        if (frame->slot != NULL) {
+            // Frames decoded concurrently may finish out of order, and the latest one wins.
+            uint64_t sequence = atomic_load_explicit(&frame->slot->sequence, memory_order_relaxed);
+            uint64_t done = atomic_load_explicit(&sink->shm_header->frames_done,
+                                                 memory_order_relaxed);
+            while (done < sequence &&
+                   !atomic_compare_exchange_weak_explicit(&sink->shm_header->frames_done,
+                                                          &done,
+                                                          sequence,
+                                                          memory_order_release,
+                                                          memory_order_relaxed))
+            {
+                continue;
+            }
+        }
+        else {
+            free(frame->pixels);
+        }
+        break;
+    case IMAGE_SINK_CALLBACK:
+        if (!sink->per_line) {
+            sink->callback(sink->context, frame, 0, frame->height, frame->pixels);
+        }
+        free(frame->pixels);
+        break;
+    }
+    free(frame);
+}
+
+
+const char *image_sink_target(const ImageSink *sink) {
+    switch (sink->type) {
+    case IMAGE_SINK_RAW:
+    case IMAGE_SINK_PPM:
+        return "standard output";
+    case IMAGE_SINK_SHM:
+        return sink->shm_name;
+    case IMAGE_SINK_CALLBACK:
+        return "callback";
+    default:
+        return "file";
+    }
+}
+
+
+void image_sink_close(ImageSink *sink) {
+    if (sink->shm_header != NULL) {
+        munmap(sink->shm_header, sink->shm_size);
+    }
+    pthread_mutex_destroy(&sink->lock);
+    free(sink->shm_name);
+    free(sink);
+}
@@ -0,0 +1,263 @@
+#ifndef _IMAGE_SINK_H_
+#define _IMAGE_SINK_H_
+
+
+#define IMAGE_SINK_SHM_SLOTS     4
+#define IMAGE_SINK_SHM_MAGIC     "SSTVFRM1"
+#define IMAGE_SINK_SHM_NAME_SIZE 256
+
+
+#include "png_file.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+
+typedef struct image_sink_s ImageSink;
+typedef struct image_frame_s ImageFrame;
+typedef struct image_shm_header_s ImageShmHeader;
+typedef struct image_shm_slot_s ImageShmSlot;
+
+
+/**
+ * An enumerator of the destinations that a sink delivers images to.
+ *
+ * @var IMAGE_SINK_PNG       A PNG file at the path of each image.
+ * @var IMAGE_SINK_RAW       The standard output, as bare packed RGB rows.
+ * @var IMAGE_SINK_PPM       The standard output, as binary PPM ({@code P6}) images.
+ * @var IMAGE_SINK_SHM       A ring of frames in a POSIX shared memory object.
+ * @var IMAGE_SINK_CALLBACK  A function of the program that the sink is created by.
+ */
+enum image_sink_type_e {
+    IMAGE_SINK_PNG,
+    IMAGE_SINK_RAW,
+    IMAGE_SINK_PPM,
+    IMAGE_SINK_SHM,
+    IMAGE_SINK_CALLBACK
+};
+typedef enum image_sink_type_e ImageSinkType;
+
+
+/**
+ * A function that a callback sink delivers the rows of its images to.
+ *
+ * @param context    The context the sink was created with.
+ * @param frame      The image that the rows belong to.
+ * @param first_row  The number of the first delivered row in the image.
+ * @param num_rows   The number of delivered rows.
+ * @param rows       The {@code num_rows * frame->width} pixels of the rows, which are only valid
+ *                   until the function returns.
+ */
+typedef void (*ImageSinkCallback)(void *context,
+                                  const ImageFrame *frame,
+                                  size_t first_row,
+                                  size_t num_rows,
+                                  const Pixel *rows);
+
+
+/**
+ * The header at the start of the shared memory object of a sink.
+ *
+ * The frame with sequence number {@code s} (from 1) is in slot {@code (s - 1) % num_slots}. The
+ * slots follow this header rounded up to 64 bytes, each {@code slot_size} bytes long.
+ * A consumer that copies a frame out should check that the slot's sequence number is unchanged
+ * afterwards, since the slot is reused by a later frame if the consumer falls behind.
+ *
+ * @var magic          The string {@code IMAGE_SINK_SHM_MAGIC}, without a trailing NUL byte.
+ * @var num_slots      The number of slots of the ring.
+ * @var slot_size      The size of each slot, with its {@code ImageShmSlot} header, in bytes.
+ * @var max_pixels     The largest number of pixels of a frame that fits in a slot.
+ * @var frames_done    The sequence number of the latest frame that was completed.
+ * @var next_sequence  The sequence number of the next frame to be started, less one.
+ */
+struct image_shm_header_s {
+    char magic[8];
+    uint32_t num_slots;
+    uint32_t slot_size;
+    uint64_t max_pixels;
+    _Atomic uint64_t frames_done;
+    _Atomic uint64_t next_sequence;
+};
+
+
+/**
+ * The header of one slot of the shared memory ring, which is followed by the packed RGB pixels of
+ * its frame, row after row.
+ *
+ * @var sequence    The sequence number of the frame in the slot, or 0 while a new frame is being
+ *                  set up in it.
+ * @var rows_ready  The number of rows of the frame written so far, so a consumer can start on the
+ *                  first rows of an image before it is complete.
+ * @var width       The number of columns of the frame.
+ * @var height      The number of rows of the frame.
+ * @var name        The path that the frame would be saved to as a PNG file, NUL-terminated.
+ */
+struct image_shm_slot_s {
+    _Atomic uint64_t sequence;
+    _Atomic uint32_t rows_ready;
+    uint32_t width;
+    uint32_t height;
+    char name[IMAGE_SINK_SHM_NAME_SIZE];
+};
+
+
+/**
+ * A destination for decoded images, which takes their RGB rows without a round trip through the
+ * filesystem (except for a PNG sink, which writes the files).
+ *
+ * The rows of an image are converted straight into memory of the sink where it can: a slot of the
+ * shared memory ring, or the image buffer of a callback, so delivering them copies nothing. Every
+ * sink receives the rows as they are decoded, and all but a whole-image callback pass them on
+ * straight away.
+ *
+ * A sink may be shared by threads that deliver different images concurrently (like the channels
+ * of a file decoded separately). The images on the standard output are written one at a time.
+ *
+ * @var type         The destination of the images.
+ * @var lock         The lock of the standard output, held from the start to the end of an image.
+ * @var stream       The stream of a raw or PPM sink.
+ * @var callback     The function of a callback sink.
+ * @var context      The context passed to {@code callback}.
+ * @var per_line     Whether {@code callback} is called with the rows of each line as they are
+ *                   delivered, or once with the whole image.
+ * @var shm_name     The name of the shared memory object.
+ * @var shm_size     The size of the mapping of the shared memory object, in bytes.
+ * @var shm_header   The mapping of the shared memory object.
+ */
+struct image_sink_s {
+    ImageSinkType type;
+    pthread_mutex_t lock;
+    FILE *stream;
+    ImageSinkCallback callback;
+    void *context;
+    bool per_line;
+    char *shm_name;
+    size_t shm_size;
+    ImageShmHeader *shm_header;
+};
+
+
+/**
+ * One image being delivered to a sink.
+ *
+ * @var sink       The sink of the image.
+ * @var name       The path that the image would be saved to as a PNG file.
+ * @var width      The number of columns of the image.
+ * @var height     The number of rows of the image.
+ * @var rows_done  The number of rows delivered so far.
+ * @var pixels     The memory that rows are converted into: the whole image for a shared memory
+ *                 slot or a whole-image callback, and otherwise a buffer of the next rows.
+ * @var num_rows   The number of rows that {@code pixels} holds.
+ * @var png        The writer of a PNG sink.
+ * @var slot       The slot of the image in a shared memory sink, or {@code NULL} if the image
+ *                 does not fit one and is dropped.
+ */
+struct image_frame_s {
+    ImageSink *sink;
+    const char *name;
+    size_t width;
+    size_t height;
+    size_t rows_done;
+    Pixel *pixels;
+    size_t num_rows;
+    PngWriter *png;
+    ImageShmSlot *slot;
+};
+
+
+/**
+ * Opens a sink from a command line specification.
+ *
+ * @param spec  One of {@code "png"}, {@code "raw"}, {@code "ppm"} or {@code "shm:/name"} for
+ *              a shared memory object named {@code /name}, which is created (or replaced) with
+ *              room for {@code IMAGE_SINK_SHM_SLOTS} frames of the largest supported mode.
+ *
+ * @return A pointer to the new sink. If the specification is unknown or the shared memory object
+ *         cannot be created, {@code NULL} is returned.
+ */
+ImageSink *image_sink_open(const char *spec);
+
+
+/**
+ * Creates a sink that delivers images to a function, for programs that decode in process.
+ *
+ * The function is called on the thread that saves each image, which differs between images, and
+ * may be called concurrently for images that are decoded concurrently.
+ *
+ * @param callback  The function to deliver the images to.
+ * @param context   The context to pass to {@code callback}.
+ * @param per_line  Whether to call {@code callback} with the rows of each line as soon as they are
+ *                  decoded, rather than once with the whole image.
+ *
+ * @return A pointer to the new sink. If memory cannot be allocated, {@code NULL} is returned.
+ */
+ImageSink *image_sink_create_callback(ImageSinkCallback callback, void *context, bool per_line);
+
+
+/**
+ * Starts delivering an image to a sink.
+ *
+ * @param sink    The sink to deliver the image to.
+ * @param name    The path that the image would be saved to as a PNG file, which must outlive the
+ *                image.
+ * @param width   The number of columns of the image.
+ * @param height  The number of rows of the image.
+ *
+ * @return A pointer to the image, whose rows are delivered with {@code image_frame_rows} and
+ *         {@code image_frame_commit}, and which is finished with {@code image_frame_end}.
+ */
+ImageFrame *image_sink_begin(ImageSink *sink, const char *name, size_t width, size_t height);
+
+
+/**
+ * Gets the memory to convert the next rows of an image into.
+ *
+ * @param frame     The image.
+ * @param num_rows  The number of rows, which must not go past the height of the image.
+ *
+ * @return The memory for the {@code num_rows * frame->width} pixels of the rows.
+ */
+Pixel *image_frame_rows(ImageFrame *frame, size_t num_rows);
+
+
+/**
+ * Delivers the rows of an image that were converted into the memory of {@code image_frame_rows}.
+ *
+ * @param frame     The image.
+ * @param num_rows  The number of rows, as passed to {@code image_frame_rows}.
+ */
+void image_frame_commit(ImageFrame *frame, size_t num_rows);
+
+
+/**
+ * Finishes delivering an image, after its last row, and frees it.
+ *
+ * @param frame  The image returned by {@code image_sink_begin}.
+ */
+void image_frame_end(ImageFrame *frame);
+
+
+/**
+ * Describes where a sink delivers images, for messages.
+ *
+ * @param sink  The sink.
+ *
+ * @return A description like {@code "standard output"}, which lives as long as the sink.
+ */
+const char *image_sink_target(const ImageSink *sink);
+
+
+/**
+ * Closes a sink returned by {@code image_sink_open} or {@code image_sink_create_callback}. A
+ * shared memory object is left in place for its consumer, which removes it with
+ * {@code shm_unlink}.
+ *
+ * @param sink  The sink to close.
+ */
+void image_sink_close(ImageSink *sink);
+
+
+#endif  // _IMAGE_SINK_H_
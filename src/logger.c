@@ -1,12 +1,550 @@
 #include "logger.h"
+#include "spsc_ring.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 
 bool logger_verbose = false;
+FILE *logger_stream = NULL;
+LoggerFormat logger_format = LOGGER_FORMAT_TEXT;
+
+
+typedef struct logger_record_s LoggerRecord;
+typedef struct logger_buffer_s LoggerBuffer;
+
+
+/**
+ * One message in the ring of a thread, which is one slot of the ring.
+ *
+ * @var sequence    The order of the message among those of every thread.
+ * @var time_sec    The time of the real-time clock when the message was logged.
+ * @var site        The site that logged the message.
+ * @var level       The level of the message.
+ * @var thread      The number of the thread that logged the message, from 1 in the order that
+ *                  threads first log.
+ * @var suppressed  The number of messages of the site dropped by the rate limit before this one.
+ * @var message     The formatted message, NUL-terminated and truncated to fit the record of
+ *                  {@code LOGGER_RECORD_SIZE} bytes.
+ */
+struct logger_record_s {
+    uint64_t sequence;
+    double time_sec;
+    const LoggerSite *site;
+    int level;
+    unsigned thread;
+    unsigned suppressed;
+    char message[LOGGER_RECORD_SIZE - 40];
+};
+_Static_assert(sizeof(LoggerRecord) == LOGGER_RECORD_SIZE, "LoggerRecord must fill its slot");
+
+
+/**
+ * The ring that one thread logs into. Rings are kept until the logger stops, and the ring of a
+ * thread that has exited is taken over by the next new thread.
+ *
+ * @var ring     The messages, pushed by the thread that owns the buffer and popped by whichever
+ *               thread holds {@code logger_drain_lock}.
+ * @var in_use   Whether a running thread owns the buffer.
+ * @var dropped  The number of messages dropped because the ring was full, since the last time the
+ *               count was printed.
+ * @var next     The next buffer in the list of every buffer.
+ */
+struct logger_buffer_s {
+    SpscRing *ring;
+    atomic_bool in_use;
+    atomic_uint dropped;
+    LoggerBuffer *next;
+};
+
+
+/** The list of every buffer, which is only ever pushed to until the logger stops. */
+static _Atomic(LoggerBuffer *) logger_buffers = NULL;
+
+
+/** The list of sites that have dropped messages, to report them when the logger stops. */
+static _Atomic(LoggerSite *) logger_sites = NULL;
+
+
+/** The buffer of the calling thread, or {@code NULL} before it first logs. */
+static _Thread_local LoggerBuffer *logger_thread_buffer = NULL;
+
+
+/** The number of the calling thread, or 0 before it first logs. */
+static _Thread_local unsigned logger_thread_number = 0;
+
+
+/** The number of threads that have logged. */
+static atomic_uint logger_num_threads = 0;
+
+
+/** The sequence number of the next message. */
+static atomic_uint_least64_t logger_next_sequence = 0;
+
+
+/** Whether messages are printed by the background thread. */
+static atomic_bool logger_running = false;
+
+
+/** Whether the background thread should stop. */
+static atomic_bool logger_stopping = false;
+
+
+/** The background thread. */
+static pthread_t logger_thread;
+
+
+/** The key whose destructor hands a thread's buffer back when the thread exits. */
+static pthread_key_t logger_buffer_key;
+
+
+/**
+ * The lock of the consumer side of every ring and of the stream, held while records are popped and
+ * printed and while a message is printed directly.
+ */
+static pthread_mutex_t logger_drain_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/** The records popped in one pass of {@code logger_drain}, kept between passes. */
+static LoggerRecord *logger_drain_records = NULL;
+
+
+/** The number of entries of {@code logger_drain_records}. */
+static size_t logger_drain_capacity = 0;
+
+
+/** The names of the levels, as printed. */
+static const char *const logger_level_names[] = {"DEBUG", "INFO", "WARN", "ERROR", "FATAL"};
 
 
 void logger_set_verbosity(bool verbose) {
     logger_verbose = verbose;
 }
+
+
+void logger_set_stream(FILE *stream) {
+    logger_stream = stream;
+}
+
+
+void logger_set_format(LoggerFormat format) {
+    logger_format = format;
+}
+
+
+/**
+ * Hands the buffer of a thread that is exiting back, so a later thread can take it over.
+ *
+ * @param buffer  The buffer of the thread.
+ */
+static void logger_release_buffer(void *buffer) {
+    atomic_store_explicit(&((LoggerBuffer *) buffer)->in_use, false, memory_order_release);
+}
+
+
+/**
+ * Gets the buffer of the calling thread, taking over the buffer of an exited thread or creating a
+ * new one the first time the thread logs.
+ *
+ * @return The buffer, or {@code NULL} if memory cannot be allocated.
+ */
+static LoggerBuffer *logger_acquire_buffer(void) {
+    if (logger_thread_buffer != NULL) {
+        return logger_thread_buffer;
+    }
+
+    // Only a ring that has been emptied is taken over, so short-lived threads do not pile their
+    // messages into one ring while the background thread catches up.
+    LoggerBuffer *buffer = atomic_load_explicit(&logger_buffers, memory_order_acquire);
+    for (; buffer != NULL; buffer = buffer->next) {
+        bool in_use = false;
+        size_t head = atomic_load_explicit(&buffer->ring->head, memory_order_relaxed);
+        size_t tail = atomic_load_explicit(&buffer->ring->tail, memory_order_relaxed);
+        if (head == tail && atomic_compare_exchange_strong_explicit(
+                &buffer->in_use, &in_use, true, memory_order_acquire, memory_order_relaxed))
+        {
+            break;
+        }
+    }
+
+    if (buffer == NULL) {
+        buffer = (LoggerBuffer *) calloc(1, sizeof(LoggerBuffer));
+        SpscRing *ring = spsc_ring_create(LOGGER_RING_SLOTS, sizeof(LoggerRecord));
+        if (buffer == NULL || ring == NULL) {
+            free(buffer);
+            if (ring != NULL) {
+                spsc_ring_free(ring);
+            }
+            return NULL;
+        }
+        buffer->ring = ring;
+        atomic_init(&buffer->in_use, true);
+        atomic_init(&buffer->dropped, 0);
+        buffer->next = atomic_load_explicit(&logger_buffers, memory_order_relaxed);
+        while (!atomic_compare_exchange_weak_explicit(
+                   &logger_buffers, &buffer->next, buffer, memory_order_release,
+                   memory_order_relaxed))
+        {
+            continue;
+        }
+    }
+
+    pthread_setspecific(logger_buffer_key, buffer);
+    logger_thread_buffer = buffer;
+    return buffer;
+}
+
+
+/**
+ * Gets the time of the real-time clock, which messages are stamped with.
+ *
+ * @return The time in seconds since the epoch.
+ */
+static double logger_time_sec(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+
+/**
+ * Counts a message against the rate limit of its site.
+ *
+ * @param site        The site of the message.
+ * @param suppressed  Set to the number of messages of the site dropped since the last one
+ *                    printed, if the message may be printed.
+ *
+ * @return Whether the message may be printed.
+ */
+static bool logger_site_allow(LoggerSite *site, unsigned *suppressed) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+
+    // The first message of a new second opens its window. Another thread may count a message
+    // against the old window in between, which only lets a message or two more through.
+    int64_t window = atomic_load_explicit(&site->window, memory_order_relaxed);
+    if (window != (int64_t) now.tv_sec &&
+        atomic_compare_exchange_strong_explicit(
+            &site->window, &window, (int64_t) now.tv_sec, memory_order_relaxed,
+            memory_order_relaxed))
+    {
+        atomic_store_explicit(&site->count, 0, memory_order_relaxed);
+    }
+
+    if (atomic_fetch_add_explicit(&site->count, 1, memory_order_relaxed) < LOGGER_SITE_RATE) {
+        *suppressed = atomic_exchange_explicit(&site->suppressed, 0, memory_order_relaxed);
+        return true;
+    }
+
+    atomic_fetch_add_explicit(&site->suppressed, 1, memory_order_relaxed);
+    bool registered = false;
+    if (atomic_compare_exchange_strong_explicit(
+            &site->registered, &registered, true, memory_order_relaxed, memory_order_relaxed))
+    {
+        site->next = atomic_load_explicit(&logger_sites, memory_order_relaxed);
+        while (!atomic_compare_exchange_weak_explicit(
+                   &logger_sites, &site->next, site, memory_order_release, memory_order_relaxed))
+        {
+            continue;
+        }
+    }
+    return false;
+}
+
+
+/**
+ * Gets the name of a source file without its directories.
+ *
+ * @param path  The path of the file, as in {@code __FILE__}.
+ *
+ * @return The name of the file, which is part of {@code path}.
+ */
+static const char *logger_file_name(const char *path) {
+    const char *slash = strrchr(path, '/');
+    return (slash != NULL) ? slash + 1 : path;
+}
+
+
+/**
+ * Prints a string as the contents of a JSON string, escaping the characters that must be.
+ *
+ * @param stream  The stream to print to.
+ * @param text    The string to print.
+ */
+static void logger_print_json_string(FILE *stream, const char *text) {
+    for (const unsigned char *c = (const unsigned char *) text; *c != '\0'; c++) {
+        if (*c == '"' || *c == '\\') {
+            fprintf(stream, "\\%c", *c);
+        }
+        else if (*c < 0x20) {
+            fprintf(stream, "\\u%04x", *c);
+        }
+        else {
+            fputc(*c, stream);
+        }
+    }
+}
+
+
+/**
+ * Prints one message to the stream, in the format of the logger. The caller must hold
+ * {@code logger_drain_lock} while the background thread runs.
+ *
+ * @param record  The message.
+ */
+static void logger_print_record(const LoggerRecord *record) {
+    FILE *stream = LOGGER_STREAM;
+    if (logger_format == LOGGER_FORMAT_TEXT) {
+        fprintf(stream, "%-5s  %s", logger_level_names[record->level], record->message);
+        if (record->suppressed > 0) {
+            fprintf(stream, " (%u more suppressed)", record->suppressed);
+        }
+        fputc('\n', stream);
+        return;
+    }
+
+    // The time keeps microseconds, which orders the messages of a run and matches them to events
+    // elsewhere on the host.
+    static const char *const json_levels[] = {"debug", "info", "warn", "error", "fatal"};
+    fprintf(stream, "{\"time\":%.6f,\"level\":\"%s\",\"thread\":%u,\"source\":\"",
+            record->time_sec, json_levels[record->level], record->thread);
+    if (record->site != NULL) {
+        logger_print_json_string(stream, logger_file_name(record->site->file));
+        fprintf(stream, ":%d", record->site->line);
+    }
+    fprintf(stream, "\",\"message\":\"");
+    logger_print_json_string(stream, record->message);
+    fputc('"', stream);
+    if (record->suppressed > 0) {
+        fprintf(stream, ",\"suppressed\":%u", record->suppressed);
+    }
+    fprintf(stream, "}\n");
+}
+
+
+/**
+ * Compares two records by their sequence numbers, for {@code qsort}.
+ *
+ * @param a  The first record.
+ * @param b  The second record.
+ *
+ * @return A negative value if {@code a} was logged first, and a positive value otherwise.
+ */
+static int logger_compare_records(const void *a, const void *b) {
+    uint64_t sequence_a = ((const LoggerRecord *) a)->sequence;
+    uint64_t sequence_b = ((const LoggerRecord *) b)->sequence;
+    return (sequence_a > sequence_b) - (sequence_a < sequence_b);
+}
+
+
+/**
+ * Gets the next free entry of the records of a pass of {@code logger_drain}, growing them if they
+ * are full.
+ *
+ * @param num_records  The number of records taken so far in the pass.
+ *
+ * @return The entry at {@code num_records}.
+ */
+static LoggerRecord *logger_drain_slot(size_t num_records) {
+    if (num_records == logger_drain_capacity) {
+        size_t capacity = (logger_drain_capacity > 0) ? 2 * logger_drain_capacity
+                                                      : LOGGER_RING_SLOTS;
+        LoggerRecord *records =
+            (LoggerRecord *) realloc(logger_drain_records, capacity * sizeof(LoggerRecord));
+        assert(records && "logger_drain_slot cannot realloc records");
+        logger_drain_records = records;
+        logger_drain_capacity = capacity;
+    }
+    return &logger_drain_records[num_records];
+}
+
+
+/**
+ * Prints the messages in every ring, in the order they were logged. The caller must hold
+ * {@code logger_drain_lock}.
+ *
+ * @return Whether any message was printed.
+ */
+static bool logger_drain(void) {
+    size_t num_records = 0;
+    LoggerBuffer *buffer = atomic_load_explicit(&logger_buffers, memory_order_acquire);
+    for (; buffer != NULL; buffer = buffer->next) {
+        // The records of the rings are merged, so each pass takes at most a ring's worth from each
+        // and the next pass takes the rest.
+        for (size_t i = 0; i < LOGGER_RING_SLOTS; i++) {
+            if (!spsc_ring_try_pop(buffer->ring, logger_drain_slot(num_records))) {
+                break;
+            }
+            num_records++;
+        }
+
+        // A count of dropped messages stands in for them, at the end of the pass.
+        unsigned dropped = atomic_exchange_explicit(&buffer->dropped, 0, memory_order_relaxed);
+        if (dropped > 0) {
+            LoggerRecord *record = logger_drain_slot(num_records++);
+            memset(record, 0, sizeof(LoggerRecord));
+            record->sequence = UINT64_MAX;
+            record->time_sec = logger_time_sec();
+            record->level = LOGGER_LEVEL_WARN;
+            snprintf(record->message, sizeof(record->message),
+                     "dropped %u message(s) of a thread whose log was full", dropped);
+        }
+    }
+    if (num_records == 0) {
+        return false;
+    }
+
+    qsort(logger_drain_records, num_records, sizeof(LoggerRecord), logger_compare_records);
+    for (size_t i = 0; i < num_records; i++) {
+        logger_print_record(&logger_drain_records[i]);
+    }
+    fflush(LOGGER_STREAM);
+    return true;
+}
+
+
+/**
+ * Prints the messages of every thread until the logger stops.
+ *
+ * @param arg  Unused.
+ *
+ * @return {@code NULL}.
+ */
+static void *logger_flush_messages(void *arg) {
+    (void) arg;
+    struct timespec interval = {0, LOGGER_FLUSH_INTERVAL_MS * 1000000L};
+    while (!atomic_load_explicit(&logger_stopping, memory_order_acquire)) {
+        pthread_mutex_lock(&logger_drain_lock);
+        bool printed = logger_drain();
+        pthread_mutex_unlock(&logger_drain_lock);
+        if (!printed) {
+            nanosleep(&interval, NULL);
+        }
+    }
+    return NULL;
+}
+
+
+void logger_write(LoggerSite *site, int level, const char *format, ...) {
+    // Errors are never rate limited, and messages over the limit are dropped before the cost of
+    // formatting them.
+    unsigned suppressed = 0;
+    if (level < LOGGER_LEVEL_ERROR && !logger_site_allow(site, &suppressed)) {
+        return;
+    }
+
+    LoggerRecord record;
+    if (logger_thread_number == 0) {
+        logger_thread_number = atomic_fetch_add(&logger_num_threads, 1) + 1;
+    }
+    record.sequence = atomic_fetch_add_explicit(&logger_next_sequence, 1, memory_order_relaxed);
+    record.site = site;
+    record.level = level;
+    record.thread = logger_thread_number;
+    record.suppressed = suppressed;
+    record.time_sec = logger_time_sec();
+
+    va_list args;
+    va_start(args, format);
+    vsnprintf(record.message, sizeof(record.message), format, args);
+    va_end(args);
+
+    // Without the background thread, or for an error, the message is printed before returning.
+    // An error that ends the program must not be lost in a ring.
+    if (!atomic_load_explicit(&logger_running, memory_order_acquire) ||
+        level >= LOGGER_LEVEL_ERROR)
+    {
+        pthread_mutex_lock(&logger_drain_lock);
+        if (atomic_load_explicit(&logger_running, memory_order_relaxed)) {
+            while (logger_drain()) {
+                continue;
+            }
+        }
+        logger_print_record(&record);
+        fflush(LOGGER_STREAM);
+        pthread_mutex_unlock(&logger_drain_lock);
+        return;
+    }
+
+    LoggerBuffer *buffer = logger_acquire_buffer();
+    if (buffer == NULL || !spsc_ring_try_push(buffer->ring, &record)) {
+        if (buffer != NULL) {
+            atomic_fetch_add_explicit(&buffer->dropped, 1, memory_order_relaxed);
+        }
+    }
+}
+
+
+bool logger_start(void) {
+    if (atomic_load(&logger_running)) {
+        return true;
+    }
+
+    static bool registered = false;
+    if (!registered) {
+        if (pthread_key_create(&logger_buffer_key, logger_release_buffer) != 0) {
+            return false;
+        }
+        atexit(logger_stop);
+        registered = true;
+    }
+
+    atomic_store(&logger_stopping, false);
+    if (pthread_create(&logger_thread, NULL, logger_flush_messages, NULL) != 0) {
+        return false;
+    }
+    atomic_store(&logger_running, true);
+    return true;
+}
+
+
+void logger_flush(void) {
+    if (!atomic_load(&logger_running)) {
+        return;
+    }
+
+    pthread_mutex_lock(&logger_drain_lock);
+    while (logger_drain()) {
+        continue;
+    }
+    pthread_mutex_unlock(&logger_drain_lock);
+}
+
+
+void logger_stop(void) {
+    if (atomic_exchange(&logger_running, false)) {
+        atomic_store(&logger_stopping, true);
+        pthread_join(logger_thread, NULL);
+        pthread_mutex_lock(&logger_drain_lock);
+        while (logger_drain()) {
+            continue;
+        }
+        pthread_mutex_unlock(&logger_drain_lock);
+    }
+
+    // Each site that dropped messages since its last one gets a message of its own for them.
+    LoggerSite *site = atomic_exchange(&logger_sites, NULL);
+    for (; site != NULL; site = site->next) {
+        unsigned suppressed = atomic_exchange(&site->suppressed, 0);
+        atomic_store(&site->registered, false);
+        if (suppressed > 0) {
+            LoggerRecord record = {0};
+            record.time_sec = logger_time_sec();
+            record.site = site;
+            record.level = LOGGER_LEVEL_WARN;
+            record.thread = logger_thread_number;
+            snprintf(record.message, sizeof(record.message),
+                     "suppressed %u message(s) from %s:%d over the rate limit",
+                     suppressed, logger_file_name(site->file), site->line);
+            logger_print_record(&record);
+        }
+    }
+    fflush(LOGGER_STREAM);
+}
@@ -2,11 +2,75 @@
 #define _LOGGER_H_
 
 
+#define LOGGER_LEVEL_DEBUG 0
+#define LOGGER_LEVEL_INFO  1
+#define LOGGER_LEVEL_WARN  2
+#define LOGGER_LEVEL_ERROR 3
+#define LOGGER_LEVEL_FATAL 4
+
+/** Messages below this level are compiled out, along with the formatting of their arguments. */
+#ifndef SSTV_LOG_LEVEL
+#define SSTV_LOG_LEVEL LOGGER_LEVEL_DEBUG
+#endif
+
+#define LOGGER_RECORD_SIZE       512
+#define LOGGER_RING_SLOTS        128
+#define LOGGER_SITE_RATE         100
+#define LOGGER_FLUSH_INTERVAL_MS 5
+
+
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 
 
+typedef struct logger_site_s LoggerSite;
+
+
+/**
+ * An enumerator of the formats that messages are printed in.
+ *
+ * @var LOGGER_FORMAT_TEXT  The level and the message, one per line.
+ * @var LOGGER_FORMAT_JSON  One JSON object per line, with the time, level, thread and source line
+ *                          of the message as separate keys.
+ */
+enum logger_format_e {
+    LOGGER_FORMAT_TEXT,
+    LOGGER_FORMAT_JSON
+};
+typedef enum logger_format_e LoggerFormat;
+
+
+/**
+ * One call of a logging macro in the source, which is rate limited on its own.
+ *
+ * Each site may print {@code LOGGER_SITE_RATE} messages per second, counted over all threads.
+ * Messages past that are counted and dropped before they are formatted, and the count is printed
+ * with the next message of the site (or when the logger stops).
+ *
+ * @var file        The source file of the call.
+ * @var line        The line of the call.
+ * @var window      The second of the monotonic clock that {@code count} is for.
+ * @var count       The number of messages of the site in {@code window}.
+ * @var suppressed  The number of messages dropped since the last one printed.
+ * @var registered  Whether the site is in the list of sites that dropped messages.
+ * @var next        The next site in that list.
+ */
+struct logger_site_s {
+    const char *file;
+    int line;
+    _Atomic int64_t window;
+    atomic_uint count;
+    atomic_uint suppressed;
+    atomic_bool registered;
+    LoggerSite *next;
+};
+
+
 extern bool logger_verbose;
+extern FILE *logger_stream;
+extern LoggerFormat logger_format;
 
 
 /**
@@ -17,36 +81,97 @@ extern bool logger_verbose;
 void logger_set_verbosity(bool verbose);
 
 
-#define LOG_PRINT_HELPER(severity, format, ...)                 \
-    printf("%-5s  " format "\n%s", severity, __VA_ARGS__)
+/**
+ * Sets the stream that messages are printed to, which is the standard output by default.
+ *
+ * @param stream  The stream to print messages to, or {@code NULL} for the standard output.
+ */
+void logger_set_stream(FILE *stream);
+
+
+/**
+ * Sets the format that messages are printed in, which is {@code LOGGER_FORMAT_TEXT} by default.
+ *
+ * @param format  The format to print messages in.
+ */
+void logger_set_format(LoggerFormat format);
+
+
+/**
+ * Starts printing messages from a background thread, so a slow stream does not hold up the
+ * threads that log them.
+ *
+ * Until then (and after {@code logger_stop}), every message is printed by the thread that logs it.
+ * Afterwards, each thread copies its messages into a lock-free ring of its own, which the
+ * background thread empties every {@code LOGGER_FLUSH_INTERVAL_MS} into the stream, in the order
+ * they were logged. A message that finds its thread's ring full is dropped, and the number of
+ * dropped messages is printed in its place. Errors are printed straight away, after the messages
+ * before them. The logger is stopped when the program exits.
+ *
+ * @return Whether the background thread was started.
+ */
+bool logger_start(void);
+
+
+/**
+ * Prints every message that has been logged so far, before something else is printed to the
+ * stream directly.
+ */
+void logger_flush(void);
+
+
+/**
+ * Stops the background thread after printing every message logged so far, and prints how many
+ * messages of each site were dropped by the rate limit since its last message.
+ */
+void logger_stop(void);
+
+
+/**
+ * Logs a message. This is called through the logging macros, which give each call its own site.
+ *
+ * @param site    The site of the call.
+ * @param level   The level of the message, one of the {@code LOGGER_LEVEL_*} values.
+ * @param format  The {@code printf} format of the message.
+ */
+void logger_write(LoggerSite *site, int level, const char *format, ...)
+    __attribute__((format(printf, 3, 4)));
+
 
-#define LOG_PRINT(severity, ...)                \
-    LOG_PRINT_HELPER(severity, __VA_ARGS__, "")
+/** The stream that messages are printed to. */
+#define LOGGER_STREAM ((logger_stream != NULL) ? logger_stream : stdout)
+
+
+#define LOG_PRINT(level, ...)                                                 \
+    {                                                                         \
+        static LoggerSite logger_site = {.file = __FILE__, .line = __LINE__}; \
+        logger_write(&logger_site, level, __VA_ARGS__);                       \
+    }
 
-#define log_debug(...)                          \
-    if (logger_verbose) {                       \
-        LOG_PRINT("DEBUG", __VA_ARGS__);        \
+#define log_debug(...)                                                        \
+    if (SSTV_LOG_LEVEL <= LOGGER_LEVEL_DEBUG && logger_verbose) {             \
+        LOG_PRINT(LOGGER_LEVEL_DEBUG, __VA_ARGS__);                           \
     }
 
-#define log_info(...)                           \
-    {                                           \
-        LOG_PRINT("INFO", __VA_ARGS__);         \
+#define log_info(...)                                                         \
+    if (SSTV_LOG_LEVEL <= LOGGER_LEVEL_INFO) {                                \
+        LOG_PRINT(LOGGER_LEVEL_INFO, __VA_ARGS__);                            \
     }
 
-#define log_warn(...)                           \
-    {                                           \
-        LOG_PRINT("WARN", __VA_ARGS__);         \
+#define log_warn(...)                                                         \
+    if (SSTV_LOG_LEVEL <= LOGGER_LEVEL_WARN) {                                \
+        LOG_PRINT(LOGGER_LEVEL_WARN, __VA_ARGS__);                            \
     }
 
-#define log_error(...)                           \
-    {                                            \
-        LOG_PRINT("ERROR", __VA_ARGS__);         \
+#define log_error(...)                                                        \
+    if (SSTV_LOG_LEVEL <= LOGGER_LEVEL_ERROR) {                               \
+        LOG_PRINT(LOGGER_LEVEL_ERROR, __VA_ARGS__);                           \
     }
 
-#define log_fatal(...)                          \
-    {                                           \
-        LOG_PRINT("FATAL", __VA_ARGS__);        \
-        exit(1);                                \
+#define log_fatal(...)                                                        \
+    {                                                                         \
+        LOG_PRINT(LOGGER_LEVEL_FATAL, __VA_ARGS__);                           \
+        exit(1);                                                              \
     }
 
 
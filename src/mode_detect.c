@@ -0,0 +1,254 @@
+#include "logger.h"
+#include "mode_detect.h"
+#include "modes.h"
+#include "precision.h"
+#include "scratch_arena.h"
+#include "sstv_processing.h"
+#include "stft_cache.h"
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+
+/** The number of line period skews tried on each side of the nominal line period of a mode. */
+#define MODE_DETECT_SKEW_STEPS 5
+
+
+typedef struct mode_fold_s ModeFold;
+
+
+/**
+ * The best fit of the sync frames of a stretch of samples to one line period.
+ *
+ * @var contrast       The fraction of the frames in the sync-wide phase window that are at the sync
+ *                     frequency, less the fraction of the other frames that are.
+ * @var period_frames  The line period that the frames were folded at, in (fractional) frames.
+ * @var phase          The first bin of the phase window, in frames after the first frame.
+ */
+struct mode_fold_s {
+    double contrast;
+    double period_frames;
+    size_t phase;
+};
+
+
+/**
+ * Folds the frames at the sync frequency at one line period, and finds the phase window with the
+ * highest contrast.
+ *
+ * @param is_sync        Whether each frame is at the sync frequency.
+ * @param num_frames     The number of entries in {@code is_sync}.
+ * @param period_frames  The line period to fold at, in (fractional) frames.
+ * @param sync_frames    The width of the phase window, which is the number of frames that fit in a
+ *                       sync pulse.
+ * @param bin_hits       An array of at least {@code ceil(period_frames)} entries to count the
+ *                       frames at the sync frequency of each phase bin in.
+ * @param bin_totals     An array of at least {@code ceil(period_frames)} entries to count the
+ *                       frames of each phase bin in.
+ *
+ * @return The best fit of the phase window.
+ */
+static ModeFold fold_sync_frames(const bool *is_sync,
+                                 size_t num_frames,
+                                 double period_frames,
+                                 size_t sync_frames,
+                                 size_t *bin_hits,
+                                 size_t *bin_totals)
+{
+    size_t num_bins = ceil(period_frames);
+    for (size_t bin = 0; bin < num_bins; bin++) {
+        bin_hits[bin] = 0;
+        bin_totals[bin] = 0;
+    }
+
+    size_t total_hits = 0;
+    for (size_t frame = 0; frame < num_frames; frame++) {
+        size_t bin = fmod(frame, period_frames);
+        bin_hits[bin] += is_sync[frame];
+        bin_totals[bin]++;
+        total_hits += is_sync[frame];
+    }
+
+    // The window slides around the profile, so a sync that straddles the end of the period is
+    // still counted as one.
+    size_t window_hits = 0;
+    size_t window_totals = 0;
+    for (size_t bin = 0; bin < sync_frames; bin++) {
+        window_hits += bin_hits[bin % num_bins];
+        window_totals += bin_totals[bin % num_bins];
+    }
+
+    ModeFold best = {-1.0, period_frames, 0};
+    for (size_t phase = 0; phase < num_bins; phase++) {
+        size_t out_totals = num_frames - window_totals;
+        if (window_totals > 0 && out_totals > 0) {
+            double contrast = (double) window_hits / window_totals -
+                (double) (total_hits - window_hits) / out_totals;
+            if (contrast > best.contrast) {
+                best.contrast = contrast;
+                best.phase = phase;
+            }
+        }
+
+        size_t next = (phase + sync_frames) % num_bins;
+        window_hits = window_hits + bin_hits[next] - bin_hits[phase];
+        window_totals = window_totals + bin_totals[next] - bin_totals[phase];
+    }
+
+    return best;
+}
+
+
+/**
+ * Orders two candidates by decreasing confidence, then by increasing porch frequency error.
+ *
+ * @param a  The first {@code ModeCandidate}.
+ * @param b  The second {@code ModeCandidate}.
+ *
+ * @return A negative value if {@code a} ranks first, a positive value if {@code b} does, and 0
+ *         if they rank the same.
+ */
+static int compare_candidates(const void *a, const void *b) {
+    const ModeCandidate *candidate_a = (const ModeCandidate *) a;
+    const ModeCandidate *candidate_b = (const ModeCandidate *) b;
+    if (candidate_a->confidence != candidate_b->confidence) {
+        return (candidate_a->confidence > candidate_b->confidence) ? -1 : 1;
+    }
+
+    double error_a = fabs(candidate_a->porch_hz - candidate_a->mode->porch_hz);
+    double error_b = fabs(candidate_b->porch_hz - candidate_b->mode->porch_hz);
+    return (error_a > error_b) - (error_a < error_b);
+}
+
+
+size_t detect_sstv_modes(SstvSession *session, size_t search_start, ModeCandidate *candidates) {
+    assert(session && "detect_sstv_modes got NULL session");
+    assert(candidates && "detect_sstv_modes got NULL candidates");
+
+    // Extract information used throughout the function.
+    const WavSamples *wav_samples = session->wav_samples;
+    uint32_t sample_rate = wav_samples->sample_rate;
+    size_t num_samples = wav_samples->num_samples;
+    StftCache *cache = session->stft_cache;
+    size_t hop_size = cache->hop_size;
+    Frequency margin = frequency_from_double(session->params.margin_hz);
+
+    // Every mode is measured from the same frames, with the window of the sync search of the mode
+    // with the shortest sync pulse, so every sync pulse fills at least one frame.
+    double min_sync_time_sec = sstv_modes[0].sync_time_sec;
+    double max_period_sec = 0;
+    for (size_t i = 0; i < num_sstv_modes; i++) {
+        const SstvMode *mode = &sstv_modes[i];
+        double period_sec = mode->sync_time_sec + mode->porch_time_sec +
+            mode->pixel_time_sec * mode->width * mode->num_channels;
+        min_sync_time_sec = fmin(min_sync_time_sec, mode->sync_time_sec);
+        max_period_sec = fmax(max_period_sec, period_sec);
+    }
+    size_t window_size = round(min_sync_time_sec * session->params.sync_start_ratio * sample_rate);
+    if (window_size == 0) {
+        window_size = 1;
+    }
+
+    size_t first_frame = stft_cache_frame_at(cache, search_start);
+    size_t num_frames = round(MODE_DETECT_TIME_SEC * sample_rate / hop_size);
+    size_t max_frames =
+        (num_samples >= window_size) ? (num_samples - window_size) / hop_size + 1 : 0;
+    if (first_frame >= max_frames) {
+        return 0;
+    }
+    if (num_frames > max_frames - first_frame) {
+        num_frames = max_frames - first_frame;
+    }
+    size_t max_bins = ceil(max_period_sec * (1.0 + MODE_DETECT_MAX_SKEW) * sample_rate / hop_size);
+    if (num_frames < 2 * max_bins) {
+        return 0;
+    }
+
+    // The frames are transformed with the same arena, above these arrays, so they are released
+    // together at the end.
+    ScratchArena *scratch = session->scratch;
+    size_t scratch_mark = scratch_arena_mark(scratch);
+    Frequency *frequencies =
+        (Frequency *) scratch_arena_alloc(scratch, num_frames * sizeof(Frequency));
+    bool *is_sync = (bool *) scratch_arena_alloc(scratch, num_frames * sizeof(bool));
+    size_t *bin_hits = (size_t *) scratch_arena_alloc(scratch, max_bins * sizeof(size_t));
+    size_t *bin_totals = (size_t *) scratch_arena_alloc(scratch, max_bins * sizeof(size_t));
+    assert(frequencies && "detect_sstv_modes cannot alloc frequencies");
+    assert(is_sync && "detect_sstv_modes cannot alloc is_sync");
+    assert(bin_hits && "detect_sstv_modes cannot alloc bin_hits");
+    assert(bin_totals && "detect_sstv_modes cannot alloc bin_totals");
+    for (size_t frame = 0; frame < num_frames; frame++) {
+        frequencies[frame] =
+            stft_cache_peak_frequency(cache, first_frame + frame, window_size, scratch);
+    }
+
+    for (size_t i = 0; i < num_sstv_modes; i++) {
+        const SstvMode *mode = &sstv_modes[i];
+        size_t sync_size = round(mode->sync_time_sec * sample_rate);
+        size_t sync_frames =
+            (sync_size > window_size) ? (sync_size - window_size) / hop_size + 1 : 1;
+        double period_sec = mode->sync_time_sec + mode->porch_time_sec +
+            mode->pixel_time_sec * mode->width * mode->num_channels;
+        Frequency sync_hz = frequency_from_double(mode->sync_hz);
+        for (size_t frame = 0; frame < num_frames; frame++) {
+            is_sync[frame] = frequencies[frame] - sync_hz <= margin &&
+                sync_hz - frequencies[frame] <= margin;
+        }
+
+        // The skew steps are fine enough that a sync pulse drifts by less than a frame over the
+        // measured samples between two of them.
+        ModeFold best = {-1.0, 0, 0};
+        for (int step = -MODE_DETECT_SKEW_STEPS; step <= MODE_DETECT_SKEW_STEPS; step++) {
+            double skew = 1.0 + MODE_DETECT_MAX_SKEW * step / MODE_DETECT_SKEW_STEPS;
+            double period_frames = period_sec * skew * sample_rate / hop_size;
+            ModeFold fold = fold_sync_frames(
+                is_sync, num_frames, period_frames, sync_frames, bin_hits, bin_totals);
+            if (fold.contrast > best.contrast) {
+                best = fold;
+            }
+        }
+
+        // The frequencies are measured at the best phase: within the sync pulses, and in the
+        // frames that start where they end.
+        size_t num_bins = ceil(best.period_frames);
+        size_t porch_bin = (best.phase + (size_t) round((double) sync_size / hop_size)) % num_bins;
+        double sync_sum = 0;
+        double porch_sum = 0;
+        size_t num_sync = 0;
+        size_t num_porch = 0;
+        size_t first_sync = num_frames;
+        for (size_t frame = 0; frame < num_frames; frame++) {
+            size_t bin = fmod(frame, best.period_frames);
+            size_t offset = (bin + num_bins - best.phase) % num_bins;
+            if (offset < sync_frames && is_sync[frame]) {
+                sync_sum += frequency_to_double(frequencies[frame]);
+                num_sync++;
+            }
+            if (bin == best.phase && first_sync == num_frames) {
+                first_sync = frame;
+            }
+            if (bin == porch_bin) {
+                porch_sum += frequency_to_double(frequencies[frame]);
+                num_porch++;
+            }
+        }
+
+        ModeCandidate *candidate = &candidates[i];
+        candidate->mode = mode;
+        candidate->confidence = fmax(0.0, best.contrast);
+        candidate->line_period_sec = best.period_frames * hop_size / sample_rate;
+        candidate->sync_hz = (num_sync > 0) ? sync_sum / num_sync : 0;
+        candidate->porch_hz = (num_porch > 0) ? porch_sum / num_porch : 0;
+        candidate->sync_start = (first_frame + first_sync) * hop_size;
+        log_debug("mode %s fits with confidence %.2f, line period %.6fs, sync %.0f Hz, "
+                  "porch %.0f Hz",
+                  mode->name, candidate->confidence, candidate->line_period_sec,
+                  candidate->sync_hz, candidate->porch_hz);
+    }
+
+    scratch_arena_release(scratch, scratch_mark);
+
+    qsort(candidates, num_sstv_modes, sizeof(ModeCandidate), compare_candidates);
+    return num_sstv_modes;
+}
@@ -0,0 +1,69 @@
+#ifndef _MODE_DETECT_H_
+#define _MODE_DETECT_H_
+
+
+#define MODE_DETECT_TIME_SEC        4.0
+#define MODE_DETECT_MAX_SKEW        0.005
+#define MODE_DETECT_MIN_CONFIDENCE  0.5
+
+
+#include "modes.h"
+#include "sstv_processing.h"
+#include <stdlib.h>
+
+
+typedef struct mode_candidate_s ModeCandidate;
+
+
+/**
+ * A mode that a stretch of samples may be encoded in, as measured from its line timing.
+ *
+ * @var mode             The SSTV mode.
+ * @var confidence       How well the sync pulses in the samples fit the mode, on the interval
+ *                       {@code [0, 1]}: the fraction of the mode's sync frames at its best phase
+ *                       that have the sync tone, less the fraction of the other frames that do.
+ * @var line_period_sec  The measured time from one sync pulse to the next, which is the mode's
+ *                       line time scaled by the skew of the sample rate that fits best.
+ * @var sync_hz          The mean peak frequency of the frames within the sync pulses, in Hertz.
+ * @var porch_hz         The mean peak frequency of the frames that start at the end of the sync
+ *                       pulses, in Hertz. For a porch shorter than the window of a frame, it is
+ *                       pulled towards the frequencies of the first pixels.
+ * @var sync_start       The start of the first sync pulse at or after the start of the search.
+ */
+struct mode_candidate_s {
+    const SstvMode *mode;
+    double confidence;
+    double line_period_sec;
+    double sync_hz;
+    double porch_hz;
+    size_t sync_start;
+};
+
+
+/**
+ * Ranks every supported mode by how well it fits the line timing of a stretch of samples, for a
+ * transmission whose VIS code is missing or corrupt.
+ *
+ * The peak frequency of every frame of the session's STFT cache in the {@code
+ * MODE_DETECT_TIME_SEC} after {@code search_start} is read once, with a window of the sync search
+ * of the mode with the shortest sync pulse. For each mode, the frames at the sync frequency are
+ * folded at its line period, scaled by up to {@code MODE_DETECT_MAX_SKEW} for a sample rate that
+ * is off, and the confidence is the contrast of the best sync-wide phase of the folded profile.
+ * A mode whose line period does not match the samples smears its sync pulses over the whole
+ * profile, so its confidence is close to 0. This costs one transform per frame, which is much
+ * less than a decode of the image with each mode.
+ *
+ * @param session       The decode session with the samples to measure.
+ * @param search_start  The first sample to measure, which should be within the image data.
+ * @param candidates    The array to place one candidate per entry of {@code sstv_modes} in, with
+ *                      {@code num_sstv_modes} entries, in order of decreasing confidence. Modes of
+ *                      the same confidence are ordered by how close their porch frequency is to
+ *                      the measured one.
+ *
+ * @return The number of candidates placed in {@code candidates}, which is 0 if there are not
+ *         enough samples after {@code search_start} for two lines of any mode.
+ */
+size_t detect_sstv_modes(SstvSession *session, size_t search_start, ModeCandidate *candidates);
+
+
+#endif  // _MODE_DETECT_H_
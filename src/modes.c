@@ -1,4 +1,5 @@
 #include "modes.h"
+#include <assert.h>
 #include <stdint.h>
 #include <stdlib.h>
 
@@ -23,10 +24,11 @@ const SstvMode sstv_modes[] = {
 };
 
 
-const SstvMode *get_sstv_mode(uint8_t vis) {
-    size_t num_modes = sizeof(sstv_modes) / sizeof(SstvMode);
+const size_t num_sstv_modes = sizeof(sstv_modes) / sizeof(SstvMode);
+
 
-    for (size_t i = 0; i < num_modes; i++) {
+const SstvMode *get_sstv_mode(uint8_t vis) {
+    for (size_t i = 0; i < num_sstv_modes; i++) {
         if (sstv_modes[i].vis == vis) {
             return &sstv_modes[i];
         }
@@ -34,3 +36,15 @@ const SstvMode *get_sstv_mode(uint8_t vis) {
 
     return NULL;
 }
+
+
+size_t sstv_mode_rows_per_line(const SstvMode *mode) {
+    assert(mode && "sstv_mode_rows_per_line got NULL mode");
+
+    switch (mode->color_space) {
+    case Y1_CR_CB_Y2:
+        // The two luminance channels each make a row, and share the chrominance channels.
+        return 2;
+    }
+    return 1;
+}
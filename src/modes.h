@@ -72,6 +72,10 @@ struct sstv_mode_s {
 extern const SstvMode sstv_modes[];
 
 
+/** The number of entries in {@code sstv_modes}. */
+extern const size_t num_sstv_modes;
+
+
 /**
  * Gets an {@code SstvMode} structure for the provided VIS code.
  *
@@ -82,4 +86,16 @@ extern const SstvMode sstv_modes[];
 const SstvMode *get_sstv_mode(uint8_t vis);
 
 
+/**
+ * Gets the number of rows of the image that each line transmitted in an SSTV mode holds, from the
+ * color space of the mode.
+ *
+ * @param mode  The SSTV mode.
+ *
+ * @return The number of rows per line, which is 2 for the {@code Y1_CR_CB_Y2} color space of PD
+ *         modes.
+ */
+size_t sstv_mode_rows_per_line(const SstvMode *mode);
+
+
 #endif  // _MODES_H_
@@ -0,0 +1,208 @@
+#include "logger.h"
+#include "perf_counters.h"
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+
+/** The name of each stage, as printed. */
+static const char *perf_stage_names[PERF_NUM_STAGES] = {
+    "read", "prescreen", "headers", "sync", "pixels", "save", "channels"
+};
+
+
+#ifdef __linux__
+/** The generalized hardware event of each {@code PerfEvent}. */
+static const uint64_t perf_event_configs[PERF_NUM_EVENTS] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_BRANCH_MISSES,
+};
+#endif
+
+
+/**
+ * Gets the time of a monotonic clock.
+ *
+ * @return The time of the clock in seconds, from an arbitrary start.
+ */
+static double perf_time_sec(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+
+/**
+ * Reads every open counter, scaled up for the time it was not scheduled on the processor when
+ * there are more counters than the processor can count at once.
+ *
+ * @param counters  The counters to read.
+ * @param values    The array to place the value of each event in, which is 0 for an event whose
+ *                  counter is not open.
+ */
+static void read_counters(const PerfCounters *counters, uint64_t *values) {
+    for (size_t event = 0; event < PERF_NUM_EVENTS; event++) {
+        values[event] = 0;
+
+        // The value is followed by the time the counter was enabled and the time it was running.
+        uint64_t data[3];
+        if (counters->fds[event] < 0 ||
+            read(counters->fds[event], data, sizeof(data)) != (ssize_t) sizeof(data))
+        {
+            continue;
+        }
+        values[event] = data[0];
+        if (data[2] > 0 && data[2] < data[1]) {
+            values[event] = (uint64_t) ((double) data[0] * data[1] / data[2]);
+        }
+    }
+}
+
+
+PerfCounters *perf_counters_open(void) {
+    PerfCounters *counters = (PerfCounters *) calloc(1, sizeof(PerfCounters));
+    if (counters == NULL) {
+        return NULL;
+    }
+
+    int error = ENOSYS;
+    for (size_t event = 0; event < PERF_NUM_EVENTS; event++) {
+        counters->fds[event] = -1;
+#ifdef __linux__
+        // Only user space is counted, which an unprivileged process may do at the default
+        // paranoia level, and threads created later are included through `inherit'.
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = perf_event_configs[event];
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        attr.inherit = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        long fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (fd < 0) {
+            error = errno;
+            continue;
+        }
+        counters->fds[event] = (int) fd;
+        counters->available = true;
+#endif
+    }
+
+    if (!counters->available) {
+        log_warn("hardware event counters are not available (%s), keeping timings only",
+                 strerror(error));
+    }
+    counters->open_time_sec = perf_time_sec();
+    read_counters(counters, counters->open_counts);
+    return counters;
+}
+
+
+void perf_counters_start(PerfCounters *counters, PerfStage stage) {
+    if (counters == NULL) {
+        return;
+    }
+
+    // The counters are read before the clock, and the other way around when the stage stops, so
+    // neither includes the other's system call.
+    read_counters(counters, counters->start_counts[stage]);
+    counters->start_time[stage] = perf_time_sec();
+}
+
+
+void perf_counters_stop(PerfCounters *counters, PerfStage stage) {
+    if (counters == NULL) {
+        return;
+    }
+
+    counters->stage_time[stage] += perf_time_sec() - counters->start_time[stage];
+    uint64_t values[PERF_NUM_EVENTS];
+    read_counters(counters, values);
+    for (size_t event = 0; event < PERF_NUM_EVENTS; event++) {
+        uint64_t start = counters->start_counts[stage][event];
+        counters->stage_counts[stage][event] += values[event] - start;
+    }
+    counters->stage_calls[stage]++;
+}
+
+
+/**
+ * Prints one row of the table of {@code perf_counters_print}.
+ *
+ * @param name       The name of the row.
+ * @param time_sec   The time of the row, in seconds.
+ * @param counts     The count of each event of the row.
+ * @param available  Whether the events were counted.
+ */
+static void print_row(const char *name,
+                      double time_sec,
+                      const uint64_t *counts,
+                      bool available)
+{
+    if (!available) {
+        log_info("%-9s  %9.1f", name, time_sec * 1000);
+        return;
+    }
+
+    double cycles = counts[PERF_EVENT_CYCLES];
+    double instructions = counts[PERF_EVENT_INSTRUCTIONS];
+    double kilo_instructions = instructions / 1000;
+    log_info("%-9s  %9.1f  %9.1f  %9.1f  %5.2f  %10.2f  %11.2f",
+             name,
+             time_sec * 1000,
+             cycles / 1e6,
+             instructions / 1e6,
+             (cycles > 0) ? instructions / cycles : 0,
+             (kilo_instructions > 0) ? counts[PERF_EVENT_CACHE_MISSES] / kilo_instructions : 0,
+             (kilo_instructions > 0) ? counts[PERF_EVENT_BRANCH_MISSES] / kilo_instructions : 0);
+}
+
+
+void perf_counters_print(const PerfCounters *counters) {
+    if (counters->available) {
+        log_info("%-9s  %9s  %9s  %9s  %5s  %10s  %11s",
+                 "stage", "time (ms)", "Mcycles", "Minstr", "IPC", "cache MPKI", "branch MPKI");
+    }
+    else {
+        log_info("%-9s  %9s", "stage", "time (ms)");
+    }
+
+    for (size_t stage = 0; stage < PERF_NUM_STAGES; stage++) {
+        if (counters->stage_calls[stage] > 0) {
+            print_row(perf_stage_names[stage],
+                      counters->stage_time[stage],
+                      counters->stage_counts[stage],
+                      counters->available);
+        }
+    }
+
+    // The total includes the work between the stages, like planning the DFTs of a mode.
+    uint64_t totals[PERF_NUM_EVENTS];
+    read_counters(counters, totals);
+    for (size_t event = 0; event < PERF_NUM_EVENTS; event++) {
+        totals[event] -= counters->open_counts[event];
+    }
+    print_row("total", perf_time_sec() - counters->open_time_sec, totals, counters->available);
+}
+
+
+void perf_counters_close(PerfCounters *counters) {
+    for (size_t event = 0; event < PERF_NUM_EVENTS; event++) {
+        if (counters->fds[event] >= 0) {
+            close(counters->fds[event]);
+        }
+    }
+    free(counters);
+}
@@ -0,0 +1,139 @@
+#ifndef _PERF_COUNTERS_H_
+#define _PERF_COUNTERS_H_
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+
+typedef struct perf_counters_s PerfCounters;
+
+
+/**
+ * An enumerator of the hardware events that are counted.
+ *
+ * @var PERF_EVENT_CYCLES          CPU cycles.
+ * @var PERF_EVENT_INSTRUCTIONS    Retired instructions.
+ * @var PERF_EVENT_CACHE_MISSES    Last level cache misses.
+ * @var PERF_EVENT_BRANCH_MISSES   Mispredicted branches.
+ * @var PERF_NUM_EVENTS            The number of events.
+ */
+enum perf_event_e {
+    PERF_EVENT_CYCLES,
+    PERF_EVENT_INSTRUCTIONS,
+    PERF_EVENT_CACHE_MISSES,
+    PERF_EVENT_BRANCH_MISSES,
+    PERF_NUM_EVENTS
+};
+typedef enum perf_event_e PerfEvent;
+
+
+/**
+ * An enumerator of the stages of a decode that the events and time are attributed to.
+ *
+ * @var PERF_STAGE_READ       Reading the wave file and converting its samples.
+ * @var PERF_STAGE_PRESCREEN  The pre-screen for header tones.
+ * @var PERF_STAGE_HEADERS    The header search, the VIS code and the mode detection.
+ * @var PERF_STAGE_SYNC       The sync search of each line of an image.
+ * @var PERF_STAGE_PIXELS     The pixels of each line of an image.
+ * @var PERF_STAGE_SAVE       Waiting for the PNG encoder to finish an image. The encoder's own
+ *                            events are in this stage or in the pixels of the last line, whichever
+ *                            is running when its thread exits.
+ * @var PERF_STAGE_CHANNELS   Decoding the channels of a file separately, which run concurrently
+ *                            and so are not split into the other stages.
+ * @var PERF_NUM_STAGES       The number of stages.
+ */
+enum perf_stage_e {
+    PERF_STAGE_READ,
+    PERF_STAGE_PRESCREEN,
+    PERF_STAGE_HEADERS,
+    PERF_STAGE_SYNC,
+    PERF_STAGE_PIXELS,
+    PERF_STAGE_SAVE,
+    PERF_STAGE_CHANNELS,
+    PERF_NUM_STAGES
+};
+typedef enum perf_stage_e PerfStage;
+
+
+/**
+ * Hardware event counters and wall-clock timings of each stage of a decode.
+ *
+ * The events are counted with Linux {@code perf_event_open}, in user space only, for the thread
+ * that opened the counters and every thread it creates afterwards. The events of a thread are
+ * added to the counters when the thread exits, so a stage that joins its threads (like the
+ * segmented searches) includes their events. A stage is started and stopped on the thread that
+ * opened the counters, and stages must not overlap.
+ *
+ * When the counters cannot be opened (on another system, or without permission), only the
+ * timings are kept.
+ *
+ * @var fds            The file descriptor of the counter of each event, or -1 if it is not open.
+ * @var available      Whether any counter is open.
+ * @var open_time_sec  The time that the counters were opened, on a monotonic clock.
+ * @var open_counts    The value of each counter when it was opened.
+ * @var start_time     The time that each stage was last started.
+ * @var start_counts   The value of each counter when each stage was last started.
+ * @var stage_time     The total time of each stage, in seconds.
+ * @var stage_counts   The total count of each event in each stage.
+ * @var stage_calls    The number of times each stage was stopped.
+ */
+struct perf_counters_s {
+    int fds[PERF_NUM_EVENTS];
+    bool available;
+    double open_time_sec;
+    uint64_t open_counts[PERF_NUM_EVENTS];
+    double start_time[PERF_NUM_STAGES];
+    uint64_t start_counts[PERF_NUM_STAGES][PERF_NUM_EVENTS];
+    double stage_time[PERF_NUM_STAGES];
+    uint64_t stage_counts[PERF_NUM_STAGES][PERF_NUM_EVENTS];
+    size_t stage_calls[PERF_NUM_STAGES];
+};
+
+
+/**
+ * Opens the event counters on the calling thread.
+ *
+ * @return A pointer to the new counters, which only keep timings if the events cannot be counted.
+ *         If memory cannot be allocated, {@code NULL} is returned.
+ */
+PerfCounters *perf_counters_open(void);
+
+
+/**
+ * Starts a stage.
+ *
+ * @param counters  The counters to attribute the stage to, or {@code NULL} to do nothing.
+ * @param stage     The stage to start.
+ */
+void perf_counters_start(PerfCounters *counters, PerfStage stage);
+
+
+/**
+ * Stops a stage, adding the time and the events since it was started to its totals.
+ *
+ * @param counters  The counters that the stage was started with, or {@code NULL} to do nothing.
+ * @param stage     The stage to stop.
+ */
+void perf_counters_stop(PerfCounters *counters, PerfStage stage);
+
+
+/**
+ * Prints the time, instructions per cycle, and cache and branch misses per thousand instructions
+ * of each stage that ran, and of everything since the counters were opened.
+ *
+ * @param counters  The counters to print.
+ */
+void perf_counters_print(const PerfCounters *counters);
+
+
+/**
+ * Closes the counters returned by {@code perf_counters_open}.
+ *
+ * @param counters  The counters to close.
+ */
+void perf_counters_close(PerfCounters *counters);
+
+
+#endif  // _PERF_COUNTERS_H_
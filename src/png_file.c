@@ -9,7 +9,7 @@
 #include <stdlib.h>
 
 
-void png_file_save(const Pixel *pixels, size_t width, size_t height, const char *path) {
+PngWriter *png_file_writer_open(size_t width, size_t height, const char *path) {
     FILE *file = fopen(path, "wb");
     if (file == NULL) {
         log_fatal("cannot open output file '%s'", path);
@@ -43,21 +43,59 @@ void png_file_save(const Pixel *pixels, size_t width, size_t height, const char
                  PNG_FILTER_TYPE_DEFAULT);
     png_write_info(png, info);
 
+    PngWriter *writer = (PngWriter *) malloc(sizeof(PngWriter));
     png_bytep row = (png_bytep) malloc(3 * width * sizeof(png_byte));
-    for (size_t y = 0; y < height; y++) {
-        for (size_t x = 0; x < width; x++) {
-            row[x * 3 + 0] = pixels[y * width + x].red;
-            row[x * 3 + 1] = pixels[y * width + x].green;
-            row[x * 3 + 2] = pixels[y * width + x].blue;
-        }
-        png_write_row(png, row);
+    assert(writer && row && "png_file_writer_open cannot malloc writer");
+    writer->file = file;
+    writer->png = png;
+    writer->info = info;
+    writer->row = row;
+    writer->width = width;
+    writer->height = height;
+    writer->rows_written = 0;
+    return writer;
+}
+
+
+void png_file_writer_write_row(PngWriter *writer, const Pixel *pixels) {
+    assert(writer->rows_written < writer->height && "png_file_writer_write_row got too many rows");
+
+    if (setjmp(png_jmpbuf(writer->png))) {
+        log_fatal("error during png file creation");
+    }
+
+    for (size_t x = 0; x < writer->width; x++) {
+        writer->row[x * 3 + 0] = pixels[x].red;
+        writer->row[x * 3 + 1] = pixels[x].green;
+        writer->row[x * 3 + 2] = pixels[x].blue;
+    }
+    png_write_row(writer->png, writer->row);
+    writer->rows_written++;
+}
+
+
+void png_file_writer_close(PngWriter *writer) {
+    assert(writer->rows_written == writer->height && "png_file_writer_close got too few rows");
+
+    if (setjmp(png_jmpbuf(writer->png))) {
+        log_fatal("error during png file creation");
     }
 
-    png_write_end(png, NULL);
+    png_write_end(writer->png, NULL);
+
+    free(writer->row);
+    png_destroy_write_struct(&writer->png, &writer->info);
+    fclose(writer->file);
+    free(writer);
+}
+
 
-    free(row);
-    png_destroy_write_struct(&png, &info);
-    fclose(file);
+void png_file_save(const Pixel *pixels, size_t width, size_t height, const char *path) {
+    PngWriter *writer = png_file_writer_open(width, height, path);
+    for (size_t y = 0; y < height; y++) {
+        png_file_writer_write_row(writer, &pixels[y * width]);
+    }
+    png_file_writer_close(writer);
 }
 
 
@@ -74,38 +112,69 @@ Pixel *png_file_y1crcby2_to_rgb(const uint8_t *image_data, const SstvMode *mode)
 
     Pixel *pixels = (Pixel *) malloc(width * image_height * sizeof(Pixel));
 
-    // For each row in the raw data, we get the four channels (CbCr and both luminance channels).
+    // Each row in the raw data has the four channels (CbCr and both luminance channels).
     for (size_t r = 0; r < data_height; r++) {
         size_t line_offset = r * num_channels * width;
-        const uint8_t *y1_data = &image_data[line_offset + 0 * width];
-        const uint8_t *cr_data = &image_data[line_offset + 1 * width];
-        const uint8_t *cb_data = &image_data[line_offset + 2 * width];
-        const uint8_t *y2_data = &image_data[line_offset + 3 * width];
-
-        // For each pixel in the image, we get the YCbCr values for both lines. We then convert
-        // to the RGB color space and set the pixels in the same column on consecutive rows.
-        for (size_t c = 0; c < width; c++) {
-            uint8_t y1_value = y1_data[c];
-            uint8_t cr_value = cr_data[c];
-            uint8_t cb_value = cb_data[c];
-            uint8_t y2_value = y2_data[c];
-
-            Pixel pixel1 = png_file_ycbcr_pixel(y1_value, cb_value, cr_value);
-            Pixel pixel2 = png_file_ycbcr_pixel(y2_value, cb_value, cr_value);
-            pixels[    (2 * r) * width + c] = pixel1;
-            pixels[(2 * r + 1) * width + c] = pixel2;
-        }
+        png_file_y1crcby2_line_to_rgb(&image_data[line_offset], width, &pixels[2 * r * width]);
     }
 
     return pixels;
 }
 
 
+void png_file_y1crcby2_line_to_rgb(const uint8_t *line_data, size_t width, Pixel *pixels) {
+    const uint8_t *y1_data = &line_data[0 * width];
+    const uint8_t *cr_data = &line_data[1 * width];
+    const uint8_t *cb_data = &line_data[2 * width];
+    const uint8_t *y2_data = &line_data[3 * width];
+
+    // For each pixel in the line, we get the YCbCr values for both rows. We then convert to the
+    // RGB color space and set the pixels in the same column on consecutive rows.
+    for (size_t c = 0; c < width; c++) {
+        uint8_t y1_value = y1_data[c];
+        uint8_t cr_value = cr_data[c];
+        uint8_t cb_value = cb_data[c];
+        uint8_t y2_value = y2_data[c];
+
+        pixels[        c] = png_file_ycbcr_pixel(y1_value, cb_value, cr_value);
+        pixels[width + c] = png_file_ycbcr_pixel(y2_value, cb_value, cr_value);
+    }
+}
+
+
+#ifdef SSTV_FIXED_POINT
+/**
+ * Rounds a Q16 color value to an integer and clamps it to a color channel.
+ *
+ * @param value  The color value in Q16.
+ *
+ * @return The value of the channel on the interval {@code [0, 255]}.
+ */
+static uint8_t png_file_clamp_q16(int32_t value) {
+    int32_t rounded = (value + (1 << 15)) >> 16;
+    return (rounded < 0) ? 0 : (rounded > 255) ? 255 : rounded;
+}
+#endif
+
+
 Pixel png_file_ycbcr_pixel(uint8_t y, uint8_t cb, uint8_t cr) {
+#ifdef SSTV_FIXED_POINT
+    // The same conversion with the coefficients in Q16, which is within one level of the floating
+    // point one (they only differ when the exact value is within 1/65536 of a rounding boundary).
+    int32_t y_q16 = (int32_t) y << 16;
+    int32_t cb_offset = cb - 128;
+    int32_t cr_offset = cr - 128;
+    Pixel pixel = {
+        .red   = png_file_clamp_q16(y_q16 + 91881 * cr_offset),
+        .green = png_file_clamp_q16(y_q16 - 22554 * cb_offset - 46802 * cr_offset),
+        .blue  = png_file_clamp_q16(y_q16 + 116130 * cb_offset),
+    };
+#else
     Pixel pixel = {
         .red   = fmin(fmax(round(y + 1.40200 * (cr - 128.0)),                          0.0), 255.0),
         .green = fmin(fmax(round(y - 0.34414 * (cb - 128.0) - 0.71414 * (cr - 128.0)), 0.0), 255.0),
         .blue  = fmin(fmax(round(y + 1.77200 * (cb - 128.0)),                          0.0), 255.0),
     };
+#endif
     return pixel;
 }
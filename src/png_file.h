@@ -4,9 +4,12 @@
 
 #include "modes.h"
 #include <stdint.h>
+#include <stdio.h>
+#include <png.h>
 
 
 typedef struct pixel_s Pixel;
+typedef struct png_writer_s PngWriter;
 
 
 /**
@@ -23,6 +26,57 @@ struct pixel_s {
 };
 
 
+/**
+ * A PNG file that is written one row at a time.
+ *
+ * @var file         The file being written.
+ * @var png          The libpng write structure.
+ * @var info         The libpng info structure.
+ * @var row          A buffer for one row of packed RGB bytes.
+ * @var width        The number of columns in the image.
+ * @var height       The number of rows in the image.
+ * @var rows_written The number of rows written so far.
+ */
+struct png_writer_s {
+    FILE *file;
+    png_structp png;
+    png_infop info;
+    png_bytep row;
+    size_t width;
+    size_t height;
+    size_t rows_written;
+};
+
+
+/**
+ * Creates a PNG file and writes its header, so its rows can be written as they are produced.
+ *
+ * @param width   The number of columns in the image.
+ * @param height  The number of rows in the image.
+ * @param path    The path to the image file to save as.
+ *
+ * @return A pointer to the writer.
+ */
+PngWriter *png_file_writer_open(size_t width, size_t height, const char *path);
+
+
+/**
+ * Writes the next row of a PNG file.
+ *
+ * @param writer  The writer of the file.
+ * @param pixels  The {@code width} pixels of the row.
+ */
+void png_file_writer_write_row(PngWriter *writer, const Pixel *pixels);
+
+
+/**
+ * Finishes a PNG file after its last row, closes it and frees the writer.
+ *
+ * @param writer  The writer of the file, which must have written every row.
+ */
+void png_file_writer_close(PngWriter *writer);
+
+
 /**
  * Saves a 2-dimensional array of pixels to a PNG file.
  *
@@ -45,6 +99,17 @@ void png_file_save(const Pixel *pixels, size_t width, size_t height, const char
 Pixel *png_file_y1crcby2_to_rgb(const uint8_t *image_data, const SstvMode *mode);
 
 
+/**
+ * Converts one line of raw SSTV image data that is in the Y1CRCBY2 color space to the two rows of
+ * RGB pixels that it encodes.
+ *
+ * @param line_data  The {@code 4 * width} values of the line, with the channels in order.
+ * @param width      The number of pixels in each channel of the line.
+ * @param pixels     The array to place the {@code 2 * width} pixels of the two rows in.
+ */
+void png_file_y1crcby2_line_to_rgb(const uint8_t *line_data, size_t width, Pixel *pixels);
+
+
 /**
  * Converts a YCbCr color value to a single RGB pixel.
  *
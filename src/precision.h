@@ -0,0 +1,117 @@
+#ifndef _PRECISION_H_
+#define _PRECISION_H_
+
+
+#include <stdint.h>
+
+
+/**
+ * The numeric precision of the processing pipeline.
+ *
+ * Audio samples, window tables and DFT data use the {@code Sample} type, which is {@code double}
+ * by default. Building with {@code SSTV_SINGLE_PRECISION} defined (the CMake option of the same
+ * name) switches the pipeline to {@code float} and the single-precision FFTW library. This halves
+ * the memory for samples and doubles the number of SIMD lanes, while 16-bit audio and 8-bit pixel
+ * values gain nothing from the extra precision.
+ *
+ * Building with {@code SSTV_FIXED_POINT} defined instead keeps samples as Q15 {@code int16_t}
+ * values (full scale is 32768) and replaces the DFT with the integer frequency estimators of
+ * {@code freq_processing_fixed.c}, so the per-sample work needs no floating point unit at all and
+ * FFTW is not linked.
+ *
+ * The {@code FFTW} macro names the FFTW function or type of the selected precision, e.g.
+ * {@code FFTW(plan)} is {@code fftw_plan} or {@code fftwf_plan}. It is not defined for fixed-point
+ * builds. {@code SampleAccumulator} is a type that sums of samples and their squares can be
+ * accumulated in without overflow.
+ *
+ * Frequencies estimated from the samples use the {@code Frequency} type, which is a {@code double}
+ * number of Hertz, or in fixed-point builds an {@code int32_t} number of sixteenths of a Hertz
+ * (Q4), so that they reach the pixel values without a floating point operation.
+ */
+#if defined(SSTV_FIXED_POINT)
+typedef int16_t Sample;
+typedef int64_t SampleAccumulator;
+typedef int32_t Frequency;
+#define SAMPLE_FULL_SCALE 32768.0
+#define FREQUENCY_SCALE 16.0
+#elif defined(SSTV_SINGLE_PRECISION)
+#include <fftw3.h>
+typedef float Sample;
+typedef double SampleAccumulator;
+typedef double Frequency;
+#define SAMPLE_FULL_SCALE 1.0
+#define FREQUENCY_SCALE 1.0
+#define FFTW(name) fftwf_##name
+#else
+#include <fftw3.h>
+typedef double Sample;
+typedef double SampleAccumulator;
+typedef double Frequency;
+#define SAMPLE_FULL_SCALE 1.0
+#define FREQUENCY_SCALE 1.0
+#define FFTW(name) fftw_##name
+#endif
+
+
+/**
+ * Converts a value on {@code [-1, 1]} to a sample, saturating at the limits of fixed-point
+ * samples.
+ *
+ * @param value  The value to convert.
+ *
+ * @return The sample for {@code value}.
+ */
+static inline Sample sample_from_double(double value) {
+#ifdef SSTV_FIXED_POINT
+    double scaled = value * SAMPLE_FULL_SCALE;
+    scaled = (scaled < INT16_MIN) ? INT16_MIN : (scaled > INT16_MAX) ? INT16_MAX : scaled;
+    return (Sample) (scaled < 0 ? scaled - 0.5 : scaled + 0.5);
+#else
+    return (Sample) value;
+#endif
+}
+
+
+/**
+ * Converts a sample to a value on {@code [-1, 1]}.
+ *
+ * @param sample  The sample to convert.
+ *
+ * @return The value of {@code sample}.
+ */
+static inline double sample_to_double(Sample sample) {
+    return sample / SAMPLE_FULL_SCALE;
+}
+
+
+/**
+ * Converts a frequency in Hertz to a {@code Frequency}, rounding to the nearest sixteenth of a
+ * Hertz in fixed-point builds.
+ *
+ * @param hz  The frequency in Hertz.
+ *
+ * @return The {@code Frequency} for {@code hz}.
+ */
+static inline Frequency frequency_from_double(double hz) {
+#ifdef SSTV_FIXED_POINT
+    double scaled = hz * FREQUENCY_SCALE;
+    return (Frequency) (scaled < 0 ? scaled - 0.5 : scaled + 0.5);
+#else
+    return hz;
+#endif
+}
+
+
+/**
+ * Converts a {@code Frequency} to Hertz.
+ *
+ * @param frequency  The frequency to convert.
+ *
+ * @return The frequency in Hertz.
+ */
+static inline double frequency_to_double(Frequency frequency) {
+    return frequency / FREQUENCY_SCALE;
+}
+
+
+#endif  // _PRECISION_H_
@@ -0,0 +1,106 @@
+#include "freq_processing.h"
+#include "logger.h"
+#include "modes.h"
+#include "precision.h"
+#include "prescreen.h"
+#include "scratch_arena.h"
+#include "sstv_processing.h"
+#include "wav_file.h"
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+
+/**
+ * Calculates the fraction of the energy of a block of samples that is at a tone.
+ *
+ * @param block        The samples of the block.
+ * @param block_size   The number of samples in the block.
+ * @param energy       The energy of the block, without its DC offset.
+ * @param sample_rate  The sample rate in Hertz.
+ * @param frequency    The frequency of the tone.
+ *
+ * @return The fraction of the energy at the tone, which is close to 1 for a pure tone.
+ */
+static double block_tone_ratio(const Sample *block,
+                               size_t block_size,
+                               double energy,
+                               uint32_t sample_rate,
+                               Frequency frequency)
+{
+    if (energy <= 0) {
+        return 0;
+    }
+
+    double power = tone_power(block, block_size, sample_rate, frequency);
+    return 2.0 * power / (block_size * energy);
+}
+
+
+bool prescreen_has_leader(SstvSession *session, const PrescreenThresholds *thresholds) {
+    assert(session && "prescreen_has_leader got NULL session");
+    assert(thresholds && "prescreen_has_leader got NULL thresholds");
+
+    if (thresholds->tone_ratio <= 0) {
+        return true;
+    }
+
+    const WavSamples *wav_samples = session->wav_samples;
+    uint32_t sample_rate = wav_samples->sample_rate;
+    size_t num_samples = wav_samples->num_samples;
+    size_t block_size = round(PRESCREEN_BLOCK_TIME_SEC * sample_rate);
+    size_t leader_blocks = round(SSTV_LEADER_TIME_SEC / PRESCREEN_BLOCK_TIME_SEC);
+    size_t min_leader_blocks = ceil(thresholds->leader_time_sec / PRESCREEN_BLOCK_TIME_SEC);
+    if (block_size == 0) {
+        return true;
+    }
+
+    // Whether each of the last `leader_blocks` blocks was dominated by the leader tone, as a ring
+    // indexed by block number, and how many of them were.
+    ScratchArena *scratch = session->scratch;
+    size_t scratch_mark = scratch_arena_mark(scratch);
+    bool *is_leader = (bool *) scratch_arena_alloc(scratch, leader_blocks * sizeof(bool));
+    assert(is_leader && "prescreen_has_leader cannot alloc is_leader");
+    for (size_t i = 0; i < leader_blocks; i++) {
+        is_leader[i] = false;
+    }
+    size_t num_leader = 0;
+
+    Frequency break_hz = frequency_from_double(SSTV_BREAK_HZ);
+    Frequency leader_hz = frequency_from_double(SSTV_LEADER_HZ);
+    bool found = false;
+    size_t num_blocks = num_samples / block_size;
+    for (size_t block_num = 0; block_num < num_blocks && !found; block_num++) {
+        const Sample *block = &wav_samples->samples[block_num * block_size];
+
+        SampleAccumulator sum = 0;
+        SampleAccumulator sum_squares = 0;
+        for (size_t i = 0; i < block_size; i++) {
+            sum += block[i];
+            sum_squares += (SampleAccumulator) block[i] * block[i];
+        }
+        double energy = (double) sum_squares - (double) sum * sum / block_size;
+
+        // A break after enough of a leader is the pattern we are looking for. Otherwise, this
+        // block replaces the oldest one in the leader-long stretch.
+        double break_ratio =
+            block_tone_ratio(block, block_size, energy, sample_rate, break_hz);
+        if (break_ratio >= thresholds->tone_ratio && num_leader >= min_leader_blocks) {
+            log_debug("pre-screen found a leader ending at %.2fs",
+                      (double) block_num * block_size / sample_rate);
+            found = true;
+        }
+
+        double leader_ratio =
+            block_tone_ratio(block, block_size, energy, sample_rate, leader_hz);
+        bool *oldest = &is_leader[block_num % leader_blocks];
+        num_leader -= *oldest;
+        *oldest = leader_ratio >= thresholds->tone_ratio;
+        num_leader += *oldest;
+    }
+
+    scratch_arena_release(scratch, scratch_mark);
+    return found;
+}
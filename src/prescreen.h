@@ -0,0 +1,56 @@
+#ifndef _PRESCREEN_H_
+#define _PRESCREEN_H_
+
+
+#define PRESCREEN_DEFAULT_TONE_RATIO       0.1
+#define PRESCREEN_DEFAULT_LEADER_TIME_SEC  0.15
+#define PRESCREEN_BLOCK_TIME_SEC           0.01
+
+
+#include "sstv_processing.h"
+#include <stdbool.h>
+#include <stdlib.h>
+
+
+typedef struct prescreen_thresholds_s PrescreenThresholds;
+
+
+/**
+ * The thresholds of the pre-screen for SSTV content.
+ *
+ * @var tone_ratio       The fraction of a block's energy that must be at a tone for the block to
+ *                       count as that tone, on the interval {@code (0, 1]}. A value of 0 or less
+ *                       disables the pre-screen.
+ * @var leader_time_sec  The minimum time of leader tone, in seconds, in the leader-long stretch
+ *                       before a break tone.
+ */
+struct prescreen_thresholds_s {
+    double tone_ratio;
+    double leader_time_sec;
+};
+
+
+/**
+ * Determines whether a set of samples may contain an SSTV transmission.
+ *
+ * The samples are split into 10ms blocks, and the energy of the leader (1900 Hz) and break
+ * (1200 Hz) tones in each block is measured with the Goertzel algorithm relative to the block's
+ * total energy. The samples pass if any block dominated by the break tone follows at least
+ * {@code leader_time_sec} of leader-dominated blocks within one leader time, which is the pattern
+ * at the end of each leader of a calibration header. This takes a few multiplications per sample
+ * and ends at the first match, so a recording without SSTV is rejected in a small fraction of the
+ * time of a full header search.
+ *
+ * The pre-screen is deliberately lenient: it can pass samples without a header (e.g. an image
+ * with a lot of mid-gray), which are then rejected by the header search, but it should never
+ * reject a header that the search would find.
+ *
+ * @param session     The decode session with the samples to screen.
+ * @param thresholds  The thresholds to screen with.
+ *
+ * @return Whether the samples may contain an SSTV header.
+ */
+bool prescreen_has_leader(SstvSession *session, const PrescreenThresholds *thresholds);
+
+
+#endif  // _PRESCREEN_H_
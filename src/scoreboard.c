@@ -0,0 +1,702 @@
+#include "logger.h"
+#include "modes.h"
+#include "png_file.h"
+#include "precision.h"
+#include "scoreboard.h"
+#include "sstv_processing.h"
+#include "wav_file.h"
+#include <assert.h>
+#include <ctype.h>
+#include <limits.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/** The name of the numeric precision of the build, which baselines are kept separately for. */
+#if defined(SSTV_FIXED_POINT)
+#define SCOREBOARD_PRECISION "fixed"
+#elif defined(SSTV_SINGLE_PRECISION)
+#define SCOREBOARD_PRECISION "single"
+#else
+#define SCOREBOARD_PRECISION "double"
+#endif
+
+
+/** The frequency of a logical 1 bit of the VIS code, in Hertz. A 0 bit is 200 Hz higher. */
+#define SCOREBOARD_VIS_ONE_HZ 1100
+
+
+/** The side of the square windows of the structural similarity, in pixels. */
+#define SCOREBOARD_SSIM_WINDOW 8
+
+
+const ScoreboardCase scoreboard_cases[] = {
+    {"clean-11025",   11025, INFINITY,  0.0   },
+    {"clean-22050",   22050, INFINITY,  0.0   },
+    {"snr20-11025",   11025, 20.0,      0.0   },
+    {"snr10-11025",   11025, 10.0,      0.0   },
+    {"snr3-11025",    11025, 3.0,       0.0   },
+    {"slow500-11025", 11025, INFINITY,  0.0005},
+    {"fast500-11025", 11025, INFINITY, -0.0005},
+};
+
+
+const size_t num_scoreboard_cases = sizeof(scoreboard_cases) / sizeof(ScoreboardCase);
+
+
+const ScoreboardCase *get_scoreboard_case(const char *name) {
+    for (size_t i = 0; i < num_scoreboard_cases; i++) {
+        if (strcmp(scoreboard_cases[i].name, name) == 0) {
+            return &scoreboard_cases[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+typedef struct tone_writer_s ToneWriter;
+
+
+/**
+ * A phase-continuous oscillator that writes the tones of a transmission.
+ *
+ * @var signal       The samples written so far.
+ * @var capacity     The number of entries of {@code signal}.
+ * @var num_samples  The number of samples written so far.
+ * @var sample_rate  The sample rate, in Hertz.
+ * @var time_scale   The factor that every duration is stretched by.
+ * @var phase        The phase of the oscillator, in radians.
+ * @var carry        The fraction of a sample that the tones so far have been short by, so the
+ *                   timing does not drift with rounding.
+ */
+struct tone_writer_s {
+    double *signal;
+    size_t capacity;
+    size_t num_samples;
+    uint32_t sample_rate;
+    double time_scale;
+    double phase;
+    double carry;
+};
+
+
+/**
+ * Writes a tone, or silence.
+ *
+ * @param writer        The oscillator.
+ * @param frequency     The frequency of the tone in Hertz, or 0 for silence.
+ * @param duration_sec  The duration of the tone before it is stretched.
+ */
+static void write_tone(ToneWriter *writer, double frequency, double duration_sec) {
+    writer->carry += duration_sec * writer->time_scale * writer->sample_rate;
+    size_t num_samples = (size_t) floor(writer->carry);
+    writer->carry -= num_samples;
+
+    double step = 2 * M_PI * frequency / writer->sample_rate;
+    for (size_t i = 0; i < num_samples && writer->num_samples < writer->capacity; i++) {
+        writer->phase = fmod(writer->phase + step, 2 * M_PI);
+        writer->signal[writer->num_samples++] =
+            (frequency > 0) ? SCOREBOARD_AMPLITUDE * sin(writer->phase) : 0.0;
+    }
+}
+
+
+/**
+ * Draws a normally distributed number from a xorshift generator, with the Box-Muller transform.
+ *
+ * @param state  The state of the generator, which must not be 0.
+ *
+ * @return The number, with a mean of 0 and a variance of 1.
+ */
+static double next_gaussian(uint64_t *state) {
+    double uniform[2];
+    for (size_t i = 0; i < 2; i++) {
+        *state ^= *state >> 12;
+        *state ^= *state << 25;
+        *state ^= *state >> 27;
+        uint64_t bits = *state * 0x2545F4914F6CDD1Dull;
+        uniform[i] = ((bits >> 11) + 1) * 0x1.0p-53;
+    }
+    return sqrt(-2 * log(uniform[0])) * cos(2 * M_PI * uniform[1]);
+}
+
+
+uint8_t *scoreboard_test_image(const SstvMode *mode) {
+    assert(mode->color_space == Y1_CR_CB_Y2 && "Expected Y1CRCBY2 color space");
+
+    size_t width = mode->width;
+    size_t line_size = width * mode->num_channels;
+    uint8_t *image_data = (uint8_t *) malloc(line_size * mode->height);
+    assert(image_data && "scoreboard_test_image cannot malloc image_data");
+
+    // Checkered blocks with a ramp across each, which runs the other way on the second row of each
+    // line, and color that varies slowly across and down the image. Detail much finer than the
+    // blocks would not survive the lower sample rates, and only add a constant to every score.
+    for (size_t line = 0; line < mode->height; line++) {
+        uint8_t *line_data = &image_data[line * line_size];
+        for (size_t x = 0; x < width; x++) {
+            int block = ((x / 40 + line / 31) % 2) ? 150 : 40;
+            line_data[0 * width + x] = block + (x % 40) * 2;
+            line_data[1 * width + x] = 128 + 70 * sin(2 * M_PI * x / width);
+            line_data[2 * width + x] = 128 + 70 * cos(2 * M_PI * line / mode->height);
+            line_data[3 * width + x] = block + (39 - x % 40) * 2;
+        }
+    }
+    return image_data;
+}
+
+
+/**
+ * Gets the time of a transmission, before it is stretched and without its lead-in and lead-out.
+ *
+ * @param mode  The mode of the transmission.
+ *
+ * @return The time of the transmission, in seconds.
+ */
+static double transmission_time_sec(const SstvMode *mode) {
+    double line_time_sec = mode->sync_time_sec + mode->porch_time_sec +
+        mode->pixel_time_sec * mode->width * mode->num_channels;
+    double header_time_sec =
+        2 * SSTV_LEADER_TIME_SEC + SSTV_BREAK_TIME_SEC + (CHAR_BIT + 2) * SSTV_BIT_TIME_SEC;
+    return header_time_sec + line_time_sec * mode->height;
+}
+
+
+/**
+ * Starts the tones of a recording, with room for a number of seconds of them.
+ *
+ * @param test_case  The condition to receive the recording in.
+ * @param time_sec   The time of the recording, before it is stretched.
+ *
+ * @return The oscillator, whose signal must be freed.
+ */
+static ToneWriter tone_writer_create(const ScoreboardCase *test_case, double time_sec) {
+    ToneWriter writer = {0};
+    writer.sample_rate = test_case->sample_rate;
+    writer.time_scale = 1.0 + test_case->drift;
+    writer.capacity = ceil(time_sec * (1.0 + fabs(test_case->drift)) * writer.sample_rate) + 1;
+    writer.signal = (double *) malloc(writer.capacity * sizeof(double));
+    assert(writer.signal && "tone_writer_create cannot malloc signal");
+    return writer;
+}
+
+
+/**
+ * Writes a transmission of an image, followed by {@code SCOREBOARD_LEAD_TIME_SEC} of silence.
+ *
+ * @param writer      The oscillator.
+ * @param mode        The mode of the transmission.
+ * @param image_data  The image data to transmit.
+ */
+static void write_transmission(ToneWriter *writer,
+                               const SstvMode *mode,
+                               const uint8_t *image_data)
+{
+    size_t width = mode->width;
+    uint16_t num_channels = mode->num_channels;
+
+    // The calibration header, then the VIS code with its least significant bit first and an even
+    // parity bit, between the start and stop bits.
+    write_tone(writer, SSTV_LEADER_HZ, SSTV_LEADER_TIME_SEC);
+    write_tone(writer, SSTV_BREAK_HZ, SSTV_BREAK_TIME_SEC);
+    write_tone(writer, SSTV_LEADER_HZ, SSTV_LEADER_TIME_SEC);
+    write_tone(writer, SSTV_BREAK_HZ, SSTV_BIT_TIME_SEC);
+    uint8_t vis_p_code = mode->vis | (__builtin_parity(mode->vis) << (CHAR_BIT - 1));
+    for (size_t i = 0; i < CHAR_BIT; i++) {
+        bool bit = (vis_p_code >> i) & 1;
+        write_tone(writer, bit ? SCOREBOARD_VIS_ONE_HZ : SCOREBOARD_VIS_ONE_HZ + 200,
+                   SSTV_BIT_TIME_SEC);
+    }
+    write_tone(writer, SSTV_BREAK_HZ, SSTV_BIT_TIME_SEC);
+
+    // Each value maps onto the pixel band the way that the decoder maps it back.
+    double pixel_range_hz = mode->pixel_max_hz - mode->pixel_min_hz;
+    for (size_t line = 0; line < mode->height; line++) {
+        const uint8_t *line_data = &image_data[line * width * num_channels];
+        write_tone(writer, mode->sync_hz, mode->sync_time_sec);
+        write_tone(writer, mode->porch_hz, mode->porch_time_sec);
+        for (size_t i = 0; i < width * num_channels; i++) {
+            double frequency = mode->pixel_min_hz + line_data[i] * pixel_range_hz / 256.0;
+            write_tone(writer, frequency, mode->pixel_time_sec);
+        }
+    }
+    write_tone(writer, 0, SCOREBOARD_LEAD_TIME_SEC);
+}
+
+
+/**
+ * Adds the noise of a case to the tones of a recording, and converts them to samples.
+ *
+ * @param test_case  The condition to receive the recording in.
+ * @param writer     The oscillator, whose signal is freed.
+ *
+ * @return The samples of the recording, which must be freed with {@code wav_file_free_samples}.
+ */
+static WavSamples *tone_writer_finish(const ScoreboardCase *test_case, ToneWriter *writer) {
+    // The power of a sine wave is half the square of its amplitude.
+    double signal_power = SCOREBOARD_AMPLITUDE * SCOREBOARD_AMPLITUDE / 2;
+    double noise_sigma =
+        isinf(test_case->snr_db) ? 0.0 : sqrt(signal_power / pow(10.0, test_case->snr_db / 10));
+    uint64_t state = SCOREBOARD_SEED;
+
+    WavSamples *wav_samples = (WavSamples *) malloc(sizeof(WavSamples));
+    Sample *samples = (Sample *) malloc(writer->num_samples * sizeof(Sample));
+    assert(wav_samples && "tone_writer_finish cannot malloc wav_samples");
+    assert(samples && "tone_writer_finish cannot malloc samples");
+    for (size_t i = 0; i < writer->num_samples; i++) {
+        double noise = (noise_sigma > 0) ? noise_sigma * next_gaussian(&state) : 0.0;
+        samples[i] = sample_from_double(fmin(fmax(writer->signal[i] + noise, -1.0), 1.0));
+    }
+    free(writer->signal);
+    writer->signal = NULL;
+
+    wav_samples->num_samples = writer->num_samples;
+    wav_samples->sample_rate = writer->sample_rate;
+    wav_samples->samples = samples;
+    return wav_samples;
+}
+
+
+WavSamples *scoreboard_generate(const ScoreboardCase *test_case,
+                                const SstvMode *mode,
+                                const uint8_t *image_data)
+{
+    double time_sec = 2 * SCOREBOARD_LEAD_TIME_SEC + transmission_time_sec(mode);
+    ToneWriter writer = tone_writer_create(test_case, time_sec);
+    write_tone(&writer, 0, SCOREBOARD_LEAD_TIME_SEC);
+    write_transmission(&writer, mode, image_data);
+    return tone_writer_finish(test_case, &writer);
+}
+
+
+WavSamples *scoreboard_generate_every_mode(const ScoreboardCase *test_case) {
+    // Each transmission is followed by silence, which is the lead-in of the next one.
+    double time_sec = SCOREBOARD_LEAD_TIME_SEC;
+    for (size_t i = 0; i < num_sstv_modes; i++) {
+        time_sec += transmission_time_sec(&sstv_modes[i]) + SCOREBOARD_LEAD_TIME_SEC;
+    }
+
+    ToneWriter writer = tone_writer_create(test_case, time_sec);
+    write_tone(&writer, 0, SCOREBOARD_LEAD_TIME_SEC);
+    for (size_t i = 0; i < num_sstv_modes; i++) {
+        uint8_t *image_data = scoreboard_test_image(&sstv_modes[i]);
+        write_transmission(&writer, &sstv_modes[i], image_data);
+        free(image_data);
+    }
+    return tone_writer_finish(test_case, &writer);
+}
+
+
+double scoreboard_psnr(const Pixel *expected, const Pixel *actual, size_t num_pixels) {
+    static const Pixel black = {0, 0, 0};
+    double squared_error = 0;
+    for (size_t i = 0; i < num_pixels; i++) {
+        const Pixel *a = &expected[i];
+        const Pixel *b = (actual != NULL) ? &actual[i] : &black;
+        double red = (double) a->red - b->red;
+        double green = (double) a->green - b->green;
+        double blue = (double) a->blue - b->blue;
+        squared_error += red * red + green * green + blue * blue;
+    }
+
+    double mean_squared_error = squared_error / (3.0 * num_pixels);
+    if (mean_squared_error == 0) {
+        return 99.0;
+    }
+    return fmin(99.0, 10 * log10(255.0 * 255.0 / mean_squared_error));
+}
+
+
+/**
+ * Computes the luminance of a pixel, with the weights of ITU-R BT.601.
+ *
+ * @param pixel  The pixel, or {@code NULL} for a black pixel.
+ *
+ * @return The luminance, on the interval {@code [0, 255]}.
+ */
+static double pixel_luma(const Pixel *pixel) {
+    if (pixel == NULL) {
+        return 0.0;
+    }
+    return 0.299 * pixel->red + 0.587 * pixel->green + 0.114 * pixel->blue;
+}
+
+
+double scoreboard_ssim(const Pixel *expected, const Pixel *actual, size_t width, size_t height) {
+    // The constants keep the ratios stable in flat windows, as in Wang et al. (2004).
+    const double c1 = (0.01 * 255) * (0.01 * 255);
+    const double c2 = (0.03 * 255) * (0.03 * 255);
+    const size_t size = SCOREBOARD_SSIM_WINDOW;
+    const size_t step = SCOREBOARD_SSIM_WINDOW / 2;
+
+    double total = 0;
+    size_t num_windows = 0;
+    for (size_t top = 0; top + size <= height; top += step) {
+        for (size_t left = 0; left + size <= width; left += step) {
+            double sum_a = 0, sum_b = 0, sum_aa = 0, sum_bb = 0, sum_ab = 0;
+            for (size_t row = top; row < top + size; row++) {
+                for (size_t column = left; column < left + size; column++) {
+                    size_t i = row * width + column;
+                    double a = pixel_luma(&expected[i]);
+                    double b = pixel_luma((actual != NULL) ? &actual[i] : NULL);
+                    sum_a += a;
+                    sum_b += b;
+                    sum_aa += a * a;
+                    sum_bb += b * b;
+                    sum_ab += a * b;
+                }
+            }
+
+            double n = size * size;
+            double mean_a = sum_a / n;
+            double mean_b = sum_b / n;
+            double variance_a = sum_aa / n - mean_a * mean_a;
+            double variance_b = sum_bb / n - mean_b * mean_b;
+            double covariance = sum_ab / n - mean_a * mean_b;
+            total += ((2 * mean_a * mean_b + c1) * (2 * covariance + c2)) /
+                ((mean_a * mean_a + mean_b * mean_b + c1) * (variance_a + variance_b + c2));
+            num_windows++;
+        }
+    }
+    return (num_windows > 0) ? total / num_windows : 0.0;
+}
+
+
+ScoreboardBaseline *scoreboard_baseline_load(const char *path) {
+    ScoreboardBaseline *baseline = (ScoreboardBaseline *) calloc(1, sizeof(ScoreboardBaseline));
+    if (baseline == NULL) {
+        return NULL;
+    }
+
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return baseline;
+    }
+
+    // Each line is a key and its values, and lines starting with `#' are comments.
+    char line[256];
+    size_t capacity = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (line[0] == '#' || line[0] == '\n') {
+            continue;
+        }
+
+        ScoreboardEntry entry;
+        char format[32];
+        snprintf(format, sizeof(format), "%%%ds %%lf %%lf", SCOREBOARD_KEY_SIZE - 1);
+        if (sscanf(line, format, entry.key, &entry.psnr_db, &entry.ssim) != 3) {
+            log_warn("cannot parse scoreboard baseline line: %s", line);
+            fclose(file);
+            scoreboard_baseline_free(baseline);
+            return NULL;
+        }
+
+        if (baseline->num_entries == capacity) {
+            capacity = (capacity > 0) ? 2 * capacity : 64;
+            ScoreboardEntry *entries = (ScoreboardEntry *) realloc(
+                baseline->entries, capacity * sizeof(ScoreboardEntry));
+            if (entries == NULL) {
+                fclose(file);
+                scoreboard_baseline_free(baseline);
+                return NULL;
+            }
+            baseline->entries = entries;
+        }
+        baseline->entries[baseline->num_entries++] = entry;
+    }
+
+    fclose(file);
+    return baseline;
+}
+
+
+bool scoreboard_baseline_save(const ScoreboardBaseline *baseline, const char *path) {
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        return false;
+    }
+
+    fprintf(file, "# precision/mode/case/preset/estimator psnr_db ssim\n");
+    for (size_t i = 0; i < baseline->num_entries; i++) {
+        const ScoreboardEntry *entry = &baseline->entries[i];
+        fprintf(file, "%s %.2f %.4f\n", entry->key, entry->psnr_db, entry->ssim);
+    }
+    return fclose(file) == 0;
+}
+
+
+/**
+ * Finds the entry of a configuration in a baseline. When updating, the entry is set to the values
+ * of a result, and added if it is not there yet.
+ *
+ * @param baseline  The baseline.
+ * @param result    The result of the configuration.
+ * @param update    Whether to record the result in the entry.
+ *
+ * @return The entry, or {@code NULL} if it is not there and the baseline is not being updated.
+ */
+static const ScoreboardEntry *baseline_entry(ScoreboardBaseline *baseline,
+                                             const ScoreboardResult *result,
+                                             bool update)
+{
+    // The key has the name of the mode without spaces or capitals, so "PD 120" becomes "pd120".
+    char mode_name[sizeof(result->mode->name)];
+    size_t name_length = 0;
+    for (const char *c = result->mode->name; *c != '\0'; c++) {
+        if (*c != ' ') {
+            mode_name[name_length++] = tolower((unsigned char) *c);
+        }
+    }
+    mode_name[name_length] = '\0';
+
+    char key[SCOREBOARD_KEY_SIZE];
+    snprintf(key, sizeof(key), "%s/%s/%s/%s/%s", SCOREBOARD_PRECISION, mode_name,
+             result->test_case->name, result->preset, result->estimator);
+
+    ScoreboardEntry *entry = NULL;
+    for (size_t i = 0; i < baseline->num_entries && entry == NULL; i++) {
+        if (strcmp(baseline->entries[i].key, key) == 0) {
+            entry = &baseline->entries[i];
+        }
+    }
+    if (!update) {
+        return entry;
+    }
+
+    if (entry == NULL) {
+        ScoreboardEntry *entries = (ScoreboardEntry *) realloc(
+            baseline->entries, (baseline->num_entries + 1) * sizeof(ScoreboardEntry));
+        assert(entries && "baseline_entry cannot realloc entries");
+        baseline->entries = entries;
+        entry = &entries[baseline->num_entries++];
+        snprintf(entry->key, sizeof(entry->key), "%s", key);
+    }
+    entry->psnr_db = result->psnr_db;
+    entry->ssim = result->ssim;
+    baseline->modified = true;
+    return entry;
+}
+
+
+size_t scoreboard_report(const ScoreboardResult *results,
+                         size_t num_results,
+                         ScoreboardBaseline *baseline,
+                         bool update)
+{
+    log_info("%-7s  %-13s  %-8s  %-7s  %9s  %6s  %6s  %9s  %9s  %s",
+             "mode", "case", "preset", "sync", "time (ms)", "PSNR", "SSIM", "base PSNR",
+             "base SSIM", "status");
+
+    // The baseline values are printed before an update replaces them.
+    size_t num_failures = 0;
+    for (size_t i = 0; i < num_results; i++) {
+        const ScoreboardResult *result = &results[i];
+        const ScoreboardEntry *entry = baseline_entry(baseline, result, false);
+        bool missing = entry == NULL;
+        bool regressed = !missing &&
+            (result->psnr_db < entry->psnr_db - SCOREBOARD_PSNR_TOLERANCE_DB ||
+             result->ssim < entry->ssim - SCOREBOARD_SSIM_TOLERANCE);
+        double base_psnr_db = missing ? NAN : entry->psnr_db;
+        double base_ssim = missing ? NAN : entry->ssim;
+
+        const char *status;
+        if (update) {
+            status = missing ? "recorded" : "updated";
+        }
+        else {
+            status = missing ? "MISSING" : regressed ? "REGRESSED" : "ok";
+            num_failures += missing || regressed;
+        }
+        if (update) {
+            baseline_entry(baseline, result, true);
+        }
+
+        log_info("%-7s  %-13s  %-8s  %-7s  %9.1f  %6.2f  %6.4f  %9.2f  %9.4f  %s%s",
+                 result->mode->name, result->test_case->name, result->preset, result->estimator,
+                 result->time_sec * 1000, result->psnr_db, result->ssim,
+                 base_psnr_db, base_ssim, status, result->found ? "" : ", no image");
+    }
+
+    // The summary has one row per preset and estimator, in the order they were first run.
+    log_info("%-8s  %-7s  %9s  %9s  %9s", "preset", "sync", "time (ms)", "mean PSNR", "mean SSIM");
+    for (size_t i = 0; i < num_results; i++) {
+        bool seen = false;
+        for (size_t j = 0; j < i && !seen; j++) {
+            seen = strcmp(results[j].preset, results[i].preset) == 0 &&
+                strcmp(results[j].estimator, results[i].estimator) == 0;
+        }
+        if (seen) {
+            continue;
+        }
+
+        double time_sec = 0, psnr_db = 0, ssim = 0;
+        size_t count = 0;
+        for (size_t j = i; j < num_results; j++) {
+            if (strcmp(results[j].preset, results[i].preset) == 0 &&
+                strcmp(results[j].estimator, results[i].estimator) == 0)
+            {
+                time_sec += results[j].time_sec;
+                psnr_db += results[j].psnr_db;
+                ssim += results[j].ssim;
+                count++;
+            }
+        }
+        log_info("%-8s  %-7s  %9.1f  %9.2f  %9.4f",
+                 results[i].preset, results[i].estimator,
+                 time_sec * 1000, psnr_db / count, ssim / count);
+    }
+
+    return num_failures;
+}
+
+
+typedef struct scoreboard_capture_s ScoreboardCapture;
+
+
+/**
+ * The image that a decode of the scoreboard delivered to its callback sink.
+ *
+ * @var pixels  The pixels of the image, or {@code NULL} if none was delivered.
+ * @var width   The number of columns of the image.
+ * @var height  The number of rows of the image.
+ */
+struct scoreboard_capture_s {
+    Pixel *pixels;
+    size_t width;
+    size_t height;
+};
+
+
+/**
+ * Keeps a copy of the image that a decode delivered, replacing any earlier one.
+ *
+ * @param context    The capture to keep the image in.
+ * @param frame      The image.
+ * @param first_row  The number of the first delivered row, which is 0 for a whole image.
+ * @param num_rows   The number of rows of the image.
+ * @param rows       The pixels of the image.
+ */
+static void capture_image(void *context,
+                          const ImageFrame *frame,
+                          size_t first_row,
+                          size_t num_rows,
+                          const Pixel *rows)
+{
+    ScoreboardCapture *capture = (ScoreboardCapture *) context;
+    size_t num_pixels = num_rows * frame->width;
+    free(capture->pixels);
+    capture->pixels = (Pixel *) malloc(num_pixels * sizeof(Pixel));
+    assert(capture->pixels && "capture_image cannot malloc pixels");
+    memcpy(capture->pixels, rows, num_pixels * sizeof(Pixel));
+    capture->width = frame->width;
+    capture->height = num_rows;
+    (void) first_row;
+}
+
+
+bool scoreboard_run(const char *baseline_path,
+                    bool update,
+                    const char *const *param_sets,
+                    size_t num_param_sets,
+                    ScoreboardDecode decode,
+                    void *context)
+{
+    static const SyncMethod sync_methods[] = {SSTV_SYNC_TONE, SSTV_SYNC_MATCHED};
+    static const char *const sync_names[] = {"tone", "matched"};
+    size_t num_results = num_sstv_modes * num_scoreboard_cases * num_sstv_presets * 2;
+    ScoreboardResult *results = (ScoreboardResult *) malloc(num_results * sizeof(ScoreboardResult));
+    assert(results && "scoreboard_run cannot malloc results");
+
+    ScoreboardCapture capture = {NULL, 0, 0};
+    ImageSink *sink = image_sink_create_callback(capture_image, &capture, false);
+    if (sink == NULL) {
+        log_fatal("cannot create scoreboard sink");
+    }
+
+    size_t result_index = 0;
+    for (size_t m = 0; m < num_sstv_modes; m++) {
+        const SstvMode *mode = &sstv_modes[m];
+        uint8_t *image_data = scoreboard_test_image(mode);
+        Pixel *expected = png_file_y1crcby2_to_rgb(image_data, mode);
+        size_t width = mode->width;
+        size_t height = sstv_mode_rows_per_line(mode) * mode->height;
+
+        for (size_t i = 0; i < num_scoreboard_cases; i++) {
+            const ScoreboardCase *test_case = &scoreboard_cases[i];
+            WavSamples *wav_samples = scoreboard_generate(test_case, mode, image_data);
+
+            for (size_t j = 0; j < num_sstv_presets; j++) {
+                SstvParams params = sstv_presets[j].params;
+                for (size_t k = 0; k < num_param_sets; k++) {
+                    sstv_params_set(&params, param_sets[k]);
+                }
+
+                for (size_t k = 0; k < 2; k++) {
+                    log_info("scoring mode '%s' in case '%s' with preset '%s' and %s sync...",
+                             mode->name, test_case->name, sstv_presets[j].name, sync_names[k]);
+                    double start_sec = sstv_monotonic_time_sec();
+                    bool found = decode(context, wav_samples, &params, sync_methods[k], sink);
+                    double time_sec = sstv_monotonic_time_sec() - start_sec;
+
+                    // An image of the wrong size (of another mode) scores as black as a missing
+                    // one.
+                    const Pixel *actual = NULL;
+                    if (found && capture.width == width && capture.height == height) {
+                        actual = capture.pixels;
+                    }
+                    ScoreboardResult *result = &results[result_index++];
+                    result->mode = mode;
+                    result->test_case = test_case;
+                    result->preset = sstv_presets[j].name;
+                    result->estimator = sync_names[k];
+                    result->found = actual != NULL;
+                    result->time_sec = time_sec;
+                    result->psnr_db = scoreboard_psnr(expected, actual, width * height);
+                    result->ssim = scoreboard_ssim(expected, actual, width, height);
+
+                    free(capture.pixels);
+                    capture.pixels = NULL;
+                }
+            }
+            wav_file_free_samples(wav_samples);
+        }
+        free(expected);
+        free(image_data);
+    }
+    image_sink_close(sink);
+
+    ScoreboardBaseline *baseline = scoreboard_baseline_load(baseline_path);
+    if (baseline == NULL) {
+        log_fatal("cannot load scoreboard baseline '%s'", baseline_path);
+    }
+    size_t num_failures = scoreboard_report(results, num_results, baseline, update);
+    bool passed = num_failures == 0;
+    if (update) {
+        passed = scoreboard_baseline_save(baseline, baseline_path);
+        if (passed) {
+            log_info("saved scoreboard baseline to '%s'", baseline_path);
+        }
+        else {
+            log_error("cannot save scoreboard baseline to '%s'", baseline_path);
+        }
+    }
+    else if (num_failures > 0) {
+        log_error("%lu of %lu results are missing from the baseline or fell below it (record "
+                  "them with `--update')", num_failures, num_results);
+    }
+
+    scoreboard_baseline_free(baseline);
+    free(results);
+    return passed;
+}
+
+
+void scoreboard_baseline_free(ScoreboardBaseline *baseline) {
+    free(baseline->entries);
+    free(baseline);
+}
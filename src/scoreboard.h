@@ -0,0 +1,279 @@
+#ifndef _SCOREBOARD_H_
+#define _SCOREBOARD_H_
+
+
+#define SCOREBOARD_LEAD_TIME_SEC      0.5
+#define SCOREBOARD_AMPLITUDE          0.5
+#define SCOREBOARD_SEED               0x5357u
+#define SCOREBOARD_PSNR_TOLERANCE_DB  0.5
+#define SCOREBOARD_SSIM_TOLERANCE     0.01
+#define SCOREBOARD_KEY_SIZE           96
+
+
+#include "image_sink.h"
+#include "modes.h"
+#include "png_file.h"
+#include "sstv_params.h"
+#include "wav_file.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+
+typedef struct scoreboard_case_s ScoreboardCase;
+typedef struct scoreboard_result_s ScoreboardResult;
+typedef struct scoreboard_entry_s ScoreboardEntry;
+typedef struct scoreboard_baseline_s ScoreboardBaseline;
+
+
+/**
+ * A function that decodes the first transmission in a recording the way that a program would,
+ * for {@code scoreboard_run} to score.
+ *
+ * @param context      The context given to {@code scoreboard_run}.
+ * @param wav_samples  The samples of the recording.
+ * @param params       The analysis parameters to decode with.
+ * @param sync_method  How to find the sync pulse of each line.
+ * @param sink         The sink to deliver the decoded image to.
+ *
+ * @return Whether an image was decoded.
+ */
+typedef bool (*ScoreboardDecode)(void *context,
+                                 const WavSamples *wav_samples,
+                                 const SstvParams *params,
+                                 SyncMethod sync_method,
+                                 ImageSink *sink);
+
+
+/**
+ * A condition that a generated transmission is received in.
+ *
+ * @var name         The name of the case, as printed and kept in baselines.
+ * @var sample_rate  The sample rate of the recording, in Hertz.
+ * @var snr_db       The ratio of the power of the signal to that of the white noise added to it
+ *                   over the whole band of the recording, in decibels, or {@code INFINITY} for
+ *                   no noise.
+ * @var drift        The fraction that the transmitter's clock runs slow by (or fast by, if
+ *                   negative), which stretches every tone of the transmission.
+ */
+struct scoreboard_case_s {
+    const char *name;
+    uint32_t sample_rate;
+    double snr_db;
+    double drift;
+};
+
+
+/**
+ * The quality and speed of one decode of a generated transmission.
+ *
+ * @var mode       The mode of the transmission.
+ * @var test_case  The condition of the transmission.
+ * @var preset     The name of the preset of the analysis parameters.
+ * @var estimator  The name of the sync method.
+ * @var found      Whether an image was decoded. Without one, the image is taken to be black.
+ * @var time_sec   The time of the decode, including its header search.
+ * @var psnr_db    The peak signal-to-noise ratio of the decoded image against the transmitted
+ *                 one over every color channel, in decibels (99 for identical images).
+ * @var ssim       The mean structural similarity of the luminance of the decoded image against
+ *                 the transmitted one, on the interval {@code [-1, 1]} (1 for identical images).
+ */
+struct scoreboard_result_s {
+    const SstvMode *mode;
+    const ScoreboardCase *test_case;
+    const char *preset;
+    const char *estimator;
+    bool found;
+    double time_sec;
+    double psnr_db;
+    double ssim;
+};
+
+
+/**
+ * The stored quality of one configuration.
+ *
+ * @var key      The precision of the build, mode, case, preset and estimator, separated by
+ *               slashes.
+ * @var psnr_db  The stored peak signal-to-noise ratio.
+ * @var ssim     The stored structural similarity.
+ */
+struct scoreboard_entry_s {
+    char key[SCOREBOARD_KEY_SIZE];
+    double psnr_db;
+    double ssim;
+};
+
+
+/**
+ * The stored quality of every configuration run before, which a run must not fall below.
+ *
+ * @var entries      The entries, in the order they were added.
+ * @var num_entries  The number of entries in {@code entries}.
+ * @var modified     Whether entries were added or changed since the baseline was loaded.
+ */
+struct scoreboard_baseline_s {
+    ScoreboardEntry *entries;
+    size_t num_entries;
+    bool modified;
+};
+
+
+/** The conditions that every preset and estimator is run in. */
+extern const ScoreboardCase scoreboard_cases[];
+
+
+/** The number of entries in {@code scoreboard_cases}. */
+extern const size_t num_scoreboard_cases;
+
+
+/**
+ * Gets a {@code ScoreboardCase} structure by name.
+ *
+ * @param name  The name of the case.
+ *
+ * @return The case named {@code name}, or {@code NULL} if there is none.
+ */
+const ScoreboardCase *get_scoreboard_case(const char *name);
+
+
+/**
+ * Creates the image data of the test image of a mode, with ramps and sharp edges in luminance and
+ * smooth gradients in color.
+ *
+ * @param mode  The mode to create the image for, which must be in the Y1CRCBY2 color space.
+ *
+ * @return The {@code width * num_channels * height} values of the image data, in the layout that
+ *         {@code decode_image_data} returns.
+ */
+uint8_t *scoreboard_test_image(const SstvMode *mode);
+
+
+/**
+ * Generates a recording of a transmission of an image: a calibration header and VIS code,
+ * followed by the lines of the image, with a lead-in and lead-out of {@code
+ * SCOREBOARD_LEAD_TIME_SEC} of silence. The tones are phase-continuous, and the noise is the same
+ * on every run.
+ *
+ * @param test_case   The condition to receive the transmission in.
+ * @param mode        The mode of the transmission.
+ * @param image_data  The image data to transmit.
+ *
+ * @return The samples of the recording, which must be freed with {@code wav_file_free_samples}.
+ */
+WavSamples *scoreboard_generate(const ScoreboardCase *test_case,
+                                const SstvMode *mode,
+                                const uint8_t *image_data);
+
+
+/**
+ * Generates a recording of one transmission of the test image in each supported mode, in the
+ * order of {@code sstv_modes}, each of them as {@code scoreboard_generate} would generate it.
+ *
+ * @param test_case  The condition to receive the transmissions in.
+ *
+ * @return The samples of the recording, which must be freed with {@code wav_file_free_samples}.
+ */
+WavSamples *scoreboard_generate_every_mode(const ScoreboardCase *test_case);
+
+
+/**
+ * Computes the peak signal-to-noise ratio of an image against a reference over every channel.
+ *
+ * @param expected    The pixels of the reference image.
+ * @param actual      The pixels of the image to score, or {@code NULL} for a black image.
+ * @param num_pixels  The number of pixels of each image.
+ *
+ * @return The ratio in decibels, which is 99 if the images are identical.
+ */
+double scoreboard_psnr(const Pixel *expected, const Pixel *actual, size_t num_pixels);
+
+
+/**
+ * Computes the mean structural similarity of the luminance of an image against a reference, over
+ * 8x8 windows that overlap by half.
+ *
+ * @param expected  The pixels of the reference image.
+ * @param actual    The pixels of the image to score, or {@code NULL} for a black image.
+ * @param width     The number of columns of each image.
+ * @param height    The number of rows of each image.
+ *
+ * @return The mean similarity, which is 1 if the images are identical.
+ */
+double scoreboard_ssim(const Pixel *expected, const Pixel *actual, size_t width, size_t height);
+
+
+/**
+ * Loads the baseline of earlier runs from a file.
+ *
+ * @param path  The path of the file, which may not exist yet.
+ *
+ * @return A pointer to the baseline, which is empty if the file does not exist. If the file
+ *         cannot be parsed or memory cannot be allocated, {@code NULL} is returned.
+ */
+ScoreboardBaseline *scoreboard_baseline_load(const char *path);
+
+
+/**
+ * Saves a baseline to a file, one entry per line.
+ *
+ * @param baseline  The baseline to save.
+ * @param path      The path of the file.
+ *
+ * @return Whether the file was saved.
+ */
+bool scoreboard_baseline_save(const ScoreboardBaseline *baseline, const char *path);
+
+
+/**
+ * Prints the speed and quality of each result against its baseline, then a summary of each
+ * preset and estimator over every mode and case.
+ *
+ * @param results      The results of a run.
+ * @param num_results  The number of entries in {@code results}.
+ * @param baseline     The baseline to compare the results with.
+ * @param update       Whether to record each result as its baseline, rather than to check it.
+ *
+ * @return The number of results that have no baseline, or whose PSNR or SSIM fell below it by
+ *         more than {@code SCOREBOARD_PSNR_TOLERANCE_DB} or {@code SCOREBOARD_SSIM_TOLERANCE}.
+ *         When updating, 0 is returned.
+ */
+size_t scoreboard_report(const ScoreboardResult *results,
+                         size_t num_results,
+                         ScoreboardBaseline *baseline,
+                         bool update);
+
+
+/**
+ * Decodes a transmission of the test image of each supported mode in each case, with each preset
+ * and estimator, then reports the results against a baseline.
+ *
+ * @param baseline_path   The path of the baseline file.
+ * @param update          Whether to record the results as the baseline and save it, rather than
+ *                        to check them against it.
+ * @param param_sets      The overrides of the analysis parameters, as {@code name=value}, that
+ *                        apply to every preset.
+ * @param num_param_sets  The number of entries in {@code param_sets}.
+ * @param decode          The function that decodes each transmission.
+ * @param context         The context to pass to {@code decode}.
+ *
+ * @return Whether every result had a baseline and none fell below it, or when updating, whether
+ *         the baseline was saved.
+ */
+bool scoreboard_run(const char *baseline_path,
+                    bool update,
+                    const char *const *param_sets,
+                    size_t num_param_sets,
+                    ScoreboardDecode decode,
+                    void *context);
+
+
+/**
+ * Frees a baseline returned by {@code scoreboard_baseline_load}.
+ *
+ * @param baseline  The baseline to free.
+ */
+void scoreboard_baseline_free(ScoreboardBaseline *baseline);
+
+
+#endif  // _SCOREBOARD_H_
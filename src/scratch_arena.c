@@ -0,0 +1,128 @@
+#include "scratch_arena.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+
+/**
+ * Rounds a size or offset up to the next multiple of the arena alignment.
+ *
+ * @param size  The value to round.
+ *
+ * @return The smallest multiple of {@code SCRATCH_ARENA_ALIGNMENT} not less than {@code size}.
+ */
+static size_t scratch_arena_align(size_t size) {
+    return (size + SCRATCH_ARENA_ALIGNMENT - 1) & ~((size_t) SCRATCH_ARENA_ALIGNMENT - 1);
+}
+
+
+/**
+ * Appends a new chunk to the end of a scratch arena.
+ *
+ * @param arena     The arena to grow.
+ * @param capacity  The minimum number of bytes in the new chunk.
+ *
+ * @return Whether the chunk could be allocated.
+ */
+static bool scratch_arena_grow(ScratchArena *arena, size_t capacity) {
+    if (arena->num_chunks >= SCRATCH_ARENA_MAX_CHUNKS) {
+        return false;
+    }
+
+    capacity = scratch_arena_align(capacity);
+    uint8_t *base = (uint8_t *) aligned_alloc(SCRATCH_ARENA_ALIGNMENT, capacity);
+    if (base == NULL) {
+        return false;
+    }
+
+    size_t start = 0;
+    if (arena->num_chunks > 0) {
+        ScratchChunk *last = &arena->chunks[arena->num_chunks - 1];
+        start = last->start + last->capacity;
+    }
+
+    arena->chunks[arena->num_chunks].base = base;
+    arena->chunks[arena->num_chunks].start = start;
+    arena->chunks[arena->num_chunks].capacity = capacity;
+    arena->num_chunks++;
+    arena->num_heap_allocations++;
+    return true;
+}
+
+
+ScratchArena *scratch_arena_create(size_t capacity) {
+    ScratchArena *arena = (ScratchArena *) calloc(1, sizeof(ScratchArena));
+    if (arena == NULL) {
+        return NULL;
+    }
+
+    if (capacity > 0 && !scratch_arena_grow(arena, capacity)) {
+        free(arena);
+        return NULL;
+    }
+    return arena;
+}
+
+
+void *scratch_arena_alloc(ScratchArena *arena, size_t size) {
+    assert(arena && "scratch_arena_alloc got NULL arena");
+
+    size = scratch_arena_align(size > 0 ? size : 1);
+
+    // Find the chunk that contains the next free byte. If the allocation does not fit in the rest
+    // of that chunk, the remainder is skipped and the allocation moves to the start of the next
+    // chunk, which is created if it does not exist yet. Chunks only ever grow, so later chunks are
+    // at least as large as the request that created them.
+    for (size_t i = 0; i < arena->num_chunks; i++) {
+        ScratchChunk *chunk = &arena->chunks[i];
+        size_t chunk_end = chunk->start + chunk->capacity;
+        if (arena->used >= chunk_end) {
+            continue;
+        }
+
+        size_t offset = arena->used < chunk->start ? chunk->start : arena->used;
+        if (offset + size <= chunk_end) {
+            arena->used = offset + size;
+            if (arena->used > arena->peak) {
+                arena->peak = arena->used;
+            }
+            return &chunk->base[offset - chunk->start];
+        }
+        arena->used = chunk_end;
+    }
+
+    size_t capacity = size;
+    if (arena->num_chunks > 0 && 2 * arena->chunks[arena->num_chunks - 1].capacity > size) {
+        capacity = 2 * arena->chunks[arena->num_chunks - 1].capacity;
+    }
+    if (!scratch_arena_grow(arena, capacity)) {
+        return NULL;
+    }
+    return scratch_arena_alloc(arena, size);
+}
+
+
+size_t scratch_arena_mark(const ScratchArena *arena) {
+    assert(arena && "scratch_arena_mark got NULL arena");
+    return arena->used;
+}
+
+
+void scratch_arena_release(ScratchArena *arena, size_t mark) {
+    assert(arena && "scratch_arena_release got NULL arena");
+    assert(mark <= arena->used && "scratch_arena_release got a mark after the current position");
+    arena->used = mark;
+}
+
+
+void scratch_arena_free(ScratchArena *arena) {
+    if (arena == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < arena->num_chunks; i++) {
+        free(arena->chunks[i].base);
+    }
+    free(arena);
+}
@@ -0,0 +1,107 @@
+#ifndef _SCRATCH_ARENA_H_
+#define _SCRATCH_ARENA_H_
+
+
+#define SCRATCH_ARENA_ALIGNMENT 64
+#define SCRATCH_ARENA_MAX_CHUNKS 16
+
+
+#include <stdint.h>
+#include <stdlib.h>
+
+
+typedef struct scratch_chunk_s ScratchChunk;
+typedef struct scratch_arena_s ScratchArena;
+
+
+/**
+ * A single contiguous block of memory owned by a scratch arena.
+ *
+ * @var base      The start of the block, aligned to {@code SCRATCH_ARENA_ALIGNMENT}.
+ * @var start     The logical offset of the block in the arena (the sum of the previous capacities).
+ * @var capacity  The number of bytes in the block.
+ */
+struct scratch_chunk_s {
+    uint8_t *base;
+    size_t start;
+    size_t capacity;
+};
+
+
+/**
+ * A bump allocator for short-lived temporaries in the decoding hot path.
+ *
+ * Memory is handed out in order and returned all at once by rewinding to a mark. Chunks are never
+ * freed until the arena is, so once the arena has grown to fit the largest working set, it serves
+ * every later request without touching the heap.
+ *
+ * @var chunks                The chunks of the arena, in logical order.
+ * @var num_chunks            The number of chunks in use.
+ * @var used                  The logical offset of the next free byte.
+ * @var peak                  The largest value {@code used} has reached.
+ * @var num_heap_allocations  The number of times a chunk was allocated from the heap.
+ */
+struct scratch_arena_s {
+    ScratchChunk chunks[SCRATCH_ARENA_MAX_CHUNKS];
+    size_t num_chunks;
+    size_t used;
+    size_t peak;
+    size_t num_heap_allocations;
+};
+
+
+/**
+ * Creates a scratch arena with a single chunk of the given size.
+ *
+ * @param capacity  The initial number of bytes in the arena, ideally enough for the largest
+ *                  working set so the arena never grows.
+ *
+ * @return A pointer to the new arena. If memory cannot be allocated, {@code NULL} is returned.
+ */
+ScratchArena *scratch_arena_create(size_t capacity);
+
+
+/**
+ * Allocates uninitialized memory from a scratch arena.
+ *
+ * The returned pointer is aligned to {@code SCRATCH_ARENA_ALIGNMENT} bytes, which is enough for
+ * any SIMD load and matches the alignment FFTW plans are created with. If the arena is full, a new
+ * chunk is allocated from the heap and counted in {@code num_heap_allocations}.
+ *
+ * @param arena  The arena to allocate from.
+ * @param size   The number of bytes to allocate.
+ *
+ * @return A pointer to the memory, valid until the arena is released to an earlier mark. If a new
+ *         chunk is needed and cannot be allocated, {@code NULL} is returned.
+ */
+void *scratch_arena_alloc(ScratchArena *arena, size_t size);
+
+
+/**
+ * Gets the current position of a scratch arena, to later release all memory allocated after it.
+ *
+ * @param arena  The arena to mark.
+ *
+ * @return The mark, to be passed to {@code scratch_arena_release}.
+ */
+size_t scratch_arena_mark(const ScratchArena *arena);
+
+
+/**
+ * Releases all memory allocated from a scratch arena since the provided mark.
+ *
+ * @param arena  The arena to release memory in.
+ * @param mark   A mark previously returned by {@code scratch_arena_mark}.
+ */
+void scratch_arena_release(ScratchArena *arena, size_t mark);
+
+
+/**
+ * Frees a scratch arena and all of its chunks.
+ *
+ * @param arena  The arena to free.
+ */
+void scratch_arena_free(ScratchArena *arena);
+
+
+#endif  // _SCRATCH_ARENA_H_
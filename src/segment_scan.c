@@ -0,0 +1,544 @@
+#include "logger.h"
+#include "segment_scan.h"
+#include "sstv_processing.h"
+#include "stft_cache.h"
+#include "wav_file.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+
+typedef struct scan_worker_s ScanWorker;
+typedef struct scan_pool_s ScanPool;
+typedef struct scan_thread_s ScanThread;
+
+
+/**
+ * One thread of a segmented scan, with its own deque of segments and list of matches.
+ *
+ * The deque holds the slots {@code [front, back)}, where slot {@code k} is the segment
+ * {@code 1 + index + k * num_workers}, so the segments are dealt out round-robin and every worker
+ * starts near the beginning of the range. The owner pops from the front (its earliest segment) and
+ * thieves steal from the back (its latest segment).
+ *
+ * @var pool          The pool the worker belongs to.
+ * @var index         The index of the worker in the pool.
+ * @var lock          The lock protecting {@code front} and {@code back}.
+ * @var front         The first slot in the deque.
+ * @var back          The slot after the last one in the deque.
+ * @var matches       The matching frames found by the worker, in exhaustive scans.
+ * @var num_matches   The number of frames in {@code matches}.
+ * @var max_matches   The capacity of {@code matches}.
+ */
+struct scan_worker_s {
+    ScanPool *pool;
+    size_t index;
+    pthread_mutex_t lock;
+    size_t front;
+    size_t back;
+    size_t *matches;
+    size_t num_matches;
+    size_t max_matches;
+};
+
+
+/**
+ * The shared state of a segmented scan.
+ *
+ * @var wav_samples   The samples being scanned.
+ * @var scan          The scan being run.
+ * @var hop_size      The number of samples between frames, for progress messages.
+ * @var num_segments  The total number of segments, including the first one.
+ * @var exhaustive    Whether every match is gathered rather than just the first.
+ * @var first_match   The earliest matching frame found so far, or {@code SIZE_MAX}.
+ * @var workers       The workers of the pool. Worker 0 is the calling thread, and worker
+ *                    {@code i + 1} is helper thread {@code i} of the session.
+ * @var num_workers   The number of workers in the pool.
+ */
+struct scan_pool_s {
+    const WavSamples *wav_samples;
+    const SegmentScan *scan;
+    size_t hop_size;
+    size_t num_segments;
+    bool exhaustive;
+    atomic_size_t first_match;
+    ScanWorker *workers;
+    size_t num_workers;
+};
+
+
+/**
+ * A helper thread of the segmented scans of a session, which keeps its own session between scans.
+ *
+ * @var threads    The helper threads the thread belongs to.
+ * @var index      The index of the thread, which runs worker {@code index + 1} of each scan.
+ * @var thread     The thread.
+ * @var session    The decode session of the thread, over the samples of the calling session.
+ * @var last_scan  The number of the last scan the thread has seen.
+ */
+struct scan_thread_s {
+    ScanThreads *threads;
+    size_t index;
+    pthread_t thread;
+    SstvSession *session;
+    size_t last_scan;
+};
+
+
+/**
+ * The helper threads of the segmented scans of a session.
+ *
+ * The threads are started by the first scan that needs them, and then wait for the next scan
+ * until the session is freed, so a scan that does not end in its first segment (like a sync
+ * search after a lost line) only costs a wakeup. Their sessions keep their STFT caches and scratch
+ * arenas from one scan to the next.
+ *
+ * @var lock         The lock protecting {@code pool}, {@code num_scans}, {@code num_running} and
+ *                   {@code stopping}.
+ * @var scan_ready   The condition the threads wait on for the next scan or for being stopped.
+ * @var scan_done    The condition the calling thread waits on for the threads to finish a scan.
+ * @var pool         The pool of the scan being run, or {@code NULL} between scans.
+ * @var num_scans    The number of scans handed to the threads so far.
+ * @var num_running  The number of threads still running the current scan.
+ * @var stopping     Whether the threads should exit.
+ * @var threads      The threads that have been started.
+ * @var num_threads  The number of entries in {@code threads}.
+ */
+struct scan_threads_s {
+    pthread_mutex_t lock;
+    pthread_cond_t scan_ready;
+    pthread_cond_t scan_done;
+    ScanPool *pool;
+    size_t num_scans;
+    size_t num_running;
+    bool stopping;
+    ScanThread **threads;
+    size_t num_threads;
+};
+
+
+/**
+ * Lowers the earliest match of a pool to a frame, if the frame is earlier.
+ *
+ * @param pool   The pool to update.
+ * @param frame  The matching frame.
+ */
+static void scan_pool_record_first(ScanPool *pool, size_t frame) {
+    // A failed exchange reloads `current`, so this retries until the stored match is no later.
+    size_t current = atomic_load(&pool->first_match);
+    while (frame < current) {
+        if (atomic_compare_exchange_weak(&pool->first_match, &current, frame)) {
+            break;
+        }
+    }
+}
+
+
+/**
+ * Appends a matching frame to the matches of a worker.
+ *
+ * @param worker  The worker that found the match.
+ * @param frame   The matching frame.
+ */
+static void scan_worker_record_match(ScanWorker *worker, size_t frame) {
+    if (worker->num_matches == worker->max_matches) {
+        worker->max_matches = worker->max_matches == 0 ? 16 : 2 * worker->max_matches;
+        worker->matches =
+            (size_t *) realloc(worker->matches, worker->max_matches * sizeof(size_t));
+        assert(worker->matches && "scan_worker_record_match cannot realloc matches");
+    }
+    worker->matches[worker->num_matches++] = frame;
+}
+
+
+/**
+ * Tests every frame of one segment.
+ *
+ * When only the first match is wanted, the segment stops at the earliest match found by any
+ * worker, since no later frame can change the result.
+ *
+ * @param pool     The pool running the scan.
+ * @param worker   The worker scanning the segment.
+ * @param session  The decode session of the worker.
+ * @param segment  The index of the segment to scan.
+ */
+static void scan_segment(ScanPool *pool, ScanWorker *worker, SstvSession *session, size_t segment)
+{
+    const SegmentScan *scan = pool->scan;
+    size_t start_frame = scan->start_frame + segment * scan->segment_frames;
+    size_t end_frame = start_frame + scan->segment_frames;
+    if (end_frame > scan->end_frame) {
+        end_frame = scan->end_frame;
+    }
+
+    if (!pool->exhaustive && start_frame >= atomic_load(&pool->first_match)) {
+        return;
+    }
+
+    if (segment > 0 && scan->description != NULL) {
+        const WavSamples *wav_samples = pool->wav_samples;
+        double start_time = (double) (start_frame * pool->hop_size) / wav_samples->sample_rate;
+        log_info("searching for %s at time %5.1fs", scan->description, start_time);
+    }
+
+    for (size_t frame = start_frame; frame < end_frame; frame++) {
+        if (!pool->exhaustive && frame >= atomic_load_explicit(&pool->first_match,
+                                                               memory_order_relaxed))
+        {
+            return;
+        }
+
+        if (scan->predicate(session, frame, scan->context)) {
+            if (pool->exhaustive) {
+                scan_worker_record_match(worker, frame);
+            }
+            else {
+                scan_pool_record_first(pool, frame);
+                return;
+            }
+        }
+    }
+}
+
+
+/**
+ * Gets the next segment for a worker, from its own deque or by stealing from another worker.
+ *
+ * @param pool     The pool running the scan.
+ * @param worker   The worker to get a segment for.
+ * @param segment  A location to place the index of the segment at.
+ *
+ * @return Whether a segment was found. If not, every segment has been taken.
+ */
+static bool scan_pool_next_segment(ScanPool *pool, ScanWorker *worker, size_t *segment) {
+    for (size_t i = 0; i < pool->num_workers; i++) {
+        ScanWorker *victim = &pool->workers[(worker->index + i) % pool->num_workers];
+        bool own_deque = victim == worker;
+
+        pthread_mutex_lock(&victim->lock);
+        bool found = victim->front < victim->back;
+        size_t slot = 0;
+        if (found) {
+            slot = own_deque ? victim->front++ : --victim->back;
+        }
+        pthread_mutex_unlock(&victim->lock);
+
+        if (found) {
+            *segment = 1 + victim->index + slot * pool->num_workers;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/**
+ * Runs a worker until every segment of its pool has been taken.
+ *
+ * @param pool     The pool running the scan.
+ * @param worker   The worker to run.
+ * @param session  The decode session of the worker.
+ */
+static void scan_worker_run(ScanPool *pool, ScanWorker *worker, SstvSession *session) {
+    size_t segment;
+    while (scan_pool_next_segment(pool, worker, &segment)) {
+        scan_segment(pool, worker, session, segment);
+    }
+}
+
+
+/**
+ * The entry point of a helper thread, which runs its worker of each scan until it is stopped.
+ *
+ * @param arg  The {@code ScanThread} to run.
+ *
+ * @return {@code NULL}.
+ */
+static void *scan_thread_run(void *arg) {
+    ScanThread *thread = (ScanThread *) arg;
+    ScanThreads *threads = thread->threads;
+
+    pthread_mutex_lock(&threads->lock);
+    while (true) {
+        while (!threads->stopping && threads->num_scans == thread->last_scan) {
+            pthread_cond_wait(&threads->scan_ready, &threads->lock);
+        }
+        if (threads->stopping) {
+            break;
+        }
+
+        // A scan with fewer workers than there are threads leaves the rest of them waiting.
+        thread->last_scan = threads->num_scans;
+        ScanPool *pool = threads->pool;
+        if (thread->index + 1 >= pool->num_workers) {
+            continue;
+        }
+        pthread_mutex_unlock(&threads->lock);
+
+        scan_worker_run(pool, &pool->workers[thread->index + 1], thread->session);
+
+        pthread_mutex_lock(&threads->lock);
+        threads->num_running--;
+        if (threads->num_running == 0) {
+            pthread_cond_signal(&threads->scan_done);
+        }
+    }
+    pthread_mutex_unlock(&threads->lock);
+    return NULL;
+}
+
+
+/**
+ * Starts helper threads for a session until it has a number of them, each with its own session.
+ *
+ * @param session      The decode session of the calling thread.
+ * @param num_threads  The number of helper threads wanted.
+ * @param window_size  The number of samples in the DFT window of the scan that needs them.
+ *
+ * @return The number of helper threads the session has, which is less than {@code num_threads}
+ *         if a thread or its session could not be created.
+ */
+static size_t scan_threads_start(SstvSession *session, size_t num_threads, size_t window_size) {
+    ScanThreads *threads = session->scan_threads;
+    if (threads == NULL) {
+        threads = (ScanThreads *) calloc(1, sizeof(ScanThreads));
+        assert(threads && "scan_threads_start cannot calloc threads");
+        pthread_mutex_init(&threads->lock, NULL);
+        pthread_cond_init(&threads->scan_ready, NULL);
+        pthread_cond_init(&threads->scan_done, NULL);
+        session->scan_threads = threads;
+    }
+    if (threads->num_threads >= num_threads) {
+        return threads->num_threads;
+    }
+
+    // No scan is running, so the threads only read their own entries, which do not move when the
+    // array of pointers to them grows.
+    size_t threads_size = num_threads * sizeof(ScanThread *);
+    threads->threads = (ScanThread **) realloc(threads->threads, threads_size);
+    assert(threads->threads && "scan_threads_start cannot realloc threads");
+    while (threads->num_threads < num_threads) {
+        ScanThread *thread = (ScanThread *) malloc(sizeof(ScanThread));
+        assert(thread && "scan_threads_start cannot malloc thread");
+        thread->threads = threads;
+        thread->index = threads->num_threads;
+        thread->session = sstv_session_create_helper(session, window_size);
+        thread->last_scan = threads->num_scans;
+        if (thread->session == NULL ||
+            pthread_create(&thread->thread, NULL, scan_thread_run, thread) != 0)
+        {
+            log_warn("cannot create scan thread %lu, its segments will be stolen",
+                     thread->index + 1);
+            sstv_session_free(thread->session);
+            free(thread);
+            break;
+        }
+        threads->threads[threads->num_threads++] = thread;
+    }
+    return threads->num_threads;
+}
+
+
+/**
+ * Compares two frame indices for {@code qsort}.
+ *
+ * @param a  The first frame index.
+ * @param b  The second frame index.
+ *
+ * @return A negative, zero, or positive value if {@code a} is before, at, or after {@code b}.
+ */
+static int compare_frames(const void *a, const void *b) {
+    size_t frame_a = *(const size_t *) a;
+    size_t frame_b = *(const size_t *) b;
+    return (frame_a > frame_b) - (frame_a < frame_b);
+}
+
+
+/**
+ * Runs a scan over all its segments, placing the results in the pool.
+ *
+ * @param session     The decode session of the calling thread.
+ * @param scan        The scan to run.
+ * @param exhaustive  Whether every match is gathered rather than just the first.
+ * @param pool        The pool to initialize and run. It must be cleaned up with
+ *                    {@code scan_pool_free}.
+ */
+static void scan_pool_run(SstvSession *session,
+                          const SegmentScan *scan,
+                          bool exhaustive,
+                          ScanPool *pool)
+{
+    assert(session && "scan_pool_run got NULL session");
+    assert(scan && "scan_pool_run got NULL scan");
+    assert(scan->segment_frames > 0 && "scan_pool_run got zero segment_frames");
+
+    size_t num_frames = 0;
+    if (scan->end_frame > scan->start_frame) {
+        num_frames = scan->end_frame - scan->start_frame;
+    }
+    size_t num_segments = (num_frames + scan->segment_frames - 1) / scan->segment_frames;
+    size_t num_pooled_segments = num_segments > 1 ? num_segments - 1 : 0;
+
+    pool->wav_samples = session->wav_samples;
+    pool->scan = scan;
+    pool->hop_size = session->stft_cache->hop_size;
+    pool->num_segments = num_segments;
+    pool->exhaustive = exhaustive;
+    atomic_init(&pool->first_match, SIZE_MAX);
+
+    // The calling thread is always worker 0, so it can finish the scan by itself if no other
+    // thread could be created.
+    size_t num_workers = scan->num_threads;
+    if (num_workers > num_pooled_segments) {
+        num_workers = num_pooled_segments;
+    }
+    if (num_workers == 0) {
+        num_workers = 1;
+    }
+    pool->num_workers = num_workers;
+    pool->workers = (ScanWorker *) calloc(num_workers, sizeof(ScanWorker));
+    assert(pool->workers && "scan_pool_run cannot calloc workers");
+
+    for (size_t i = 0; i < num_workers; i++) {
+        ScanWorker *worker = &pool->workers[i];
+        worker->pool = pool;
+        worker->index = i;
+        pthread_mutex_init(&worker->lock, NULL);
+        worker->front = 0;
+        worker->back = i < num_pooled_segments ?
+            (num_pooled_segments - i + num_workers - 1) / num_workers : 0;
+    }
+
+    // Most searches end within the first segment (e.g. the sync search at the start of every line),
+    // so it is scanned before any thread is started.
+    ScanWorker *caller = &pool->workers[0];
+    if (num_segments > 0) {
+        scan_segment(pool, caller, session, 0);
+    }
+    if (num_pooled_segments == 0 || (!exhaustive && atomic_load(&pool->first_match) != SIZE_MAX)) {
+        return;
+    }
+
+    if (num_workers == 1) {
+        scan_worker_run(pool, caller, session);
+        return;
+    }
+
+    // The workers without a thread have their segments stolen by the others.
+    size_t num_threads = scan_threads_start(session, num_workers - 1, scan->window_size);
+    size_t num_running = (num_threads < num_workers - 1) ? num_threads : num_workers - 1;
+    ScanThreads *threads = session->scan_threads;
+    pthread_mutex_lock(&threads->lock);
+    threads->pool = pool;
+    threads->num_scans++;
+    threads->num_running = num_running;
+    pthread_cond_broadcast(&threads->scan_ready);
+    pthread_mutex_unlock(&threads->lock);
+
+    scan_worker_run(pool, caller, session);
+
+    pthread_mutex_lock(&threads->lock);
+    while (threads->num_running > 0) {
+        pthread_cond_wait(&threads->scan_done, &threads->lock);
+    }
+    threads->pool = NULL;
+    pthread_mutex_unlock(&threads->lock);
+
+    // The frames the threads transformed are where the caller searches next, e.g. the rest of
+    // the header after a match, so they are copied into its cache.
+    for (size_t i = 0; i < num_running; i++) {
+        stft_cache_merge(session->stft_cache, threads->threads[i]->session->stft_cache);
+    }
+}
+
+
+/**
+ * Frees the workers of a pool run by {@code scan_pool_run}.
+ *
+ * @param pool  The pool to clean up.
+ */
+static void scan_pool_free(ScanPool *pool) {
+    for (size_t i = 0; i < pool->num_workers; i++) {
+        pthread_mutex_destroy(&pool->workers[i].lock);
+        free(pool->workers[i].matches);
+    }
+    free(pool->workers);
+}
+
+
+size_t segment_scan_first(SstvSession *session, const SegmentScan *scan) {
+    ScanPool pool;
+    scan_pool_run(session, scan, false, &pool);
+    size_t first_match = atomic_load(&pool.first_match);
+    scan_pool_free(&pool);
+
+    return first_match == SIZE_MAX ? (size_t) SSTV_PROCESSING_NOT_FOUND : first_match;
+}
+
+
+size_t segment_scan_all(SstvSession *session,
+                        const SegmentScan *scan,
+                        size_t skip_frames,
+                        size_t **matches)
+{
+    assert(matches && "segment_scan_all got NULL matches");
+
+    ScanPool pool;
+    scan_pool_run(session, scan, true, &pool);
+
+    size_t num_candidates = 0;
+    for (size_t i = 0; i < pool.num_workers; i++) {
+        num_candidates += pool.workers[i].num_matches;
+    }
+
+    size_t *candidates = (size_t *) malloc((num_candidates + 1) * sizeof(size_t));
+    assert(candidates && "segment_scan_all cannot malloc candidates");
+    size_t num_copied = 0;
+    for (size_t i = 0; i < pool.num_workers; i++) {
+        for (size_t j = 0; j < pool.workers[i].num_matches; j++) {
+            candidates[num_copied++] = pool.workers[i].matches[j];
+        }
+    }
+    scan_pool_free(&pool);
+
+    // A target matches at several consecutive frames, and the serial scan would resume after the
+    // end of the first of them. Keeping only matches at least `skip_frames` after the last one kept
+    // reproduces that.
+    qsort(candidates, num_candidates, sizeof(size_t), compare_frames);
+    size_t num_matches = 0;
+    for (size_t i = 0; i < num_candidates; i++) {
+        if (num_matches == 0 || candidates[i] >= candidates[num_matches - 1] + skip_frames) {
+            candidates[num_matches++] = candidates[i];
+        }
+    }
+
+    *matches = candidates;
+    return num_matches;
+}
+
+
+void segment_scan_threads_free(ScanThreads *threads) {
+    if (threads == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&threads->lock);
+    threads->stopping = true;
+    pthread_cond_broadcast(&threads->scan_ready);
+    pthread_mutex_unlock(&threads->lock);
+
+    for (size_t i = 0; i < threads->num_threads; i++) {
+        ScanThread *thread = threads->threads[i];
+        pthread_join(thread->thread, NULL);
+        sstv_session_free(thread->session);
+        free(thread);
+    }
+    pthread_cond_destroy(&threads->scan_ready);
+    pthread_cond_destroy(&threads->scan_done);
+    pthread_mutex_destroy(&threads->lock);
+    free(threads->threads);
+    free(threads);
+}
@@ -0,0 +1,108 @@
+#ifndef _SEGMENT_SCAN_H_
+#define _SEGMENT_SCAN_H_
+
+
+#include "sstv_processing.h"
+#include "wav_file.h"
+#include <stdbool.h>
+#include <stdlib.h>
+
+
+typedef struct segment_scan_s SegmentScan;
+
+
+/**
+ * A test of whether a search target starts at a frame of a session's STFT cache.
+ *
+ * The predicate may read samples past its frame (e.g. the whole header that starts there), but its
+ * result must only depend on the samples, so that any session over the same samples agrees.
+ *
+ * @param session  The decode session to test with. Each thread of a scan has its own session.
+ * @param frame    The index of the frame to test.
+ * @param context  The context of the scan.
+ *
+ * @return Whether the target starts at {@code frame}.
+ */
+typedef bool (*SegmentScanPredicate)(SstvSession *session, size_t frame, const void *context);
+
+
+/**
+ * A linear search over a range of frames that can be split into segments and run concurrently.
+ *
+ * The frames are split into consecutive segments of {@code segment_frames} frames. A predicate at
+ * the last frame of a segment reads as far past it as the longest target, so the samples read for
+ * neighboring segments overlap by that much and a target straddling two segments is still found
+ * by the segment it starts in.
+ *
+ * @var predicate       The test for whether the target starts at a frame.
+ * @var context         The context passed to {@code predicate}.
+ * @var start_frame     The first frame to test.
+ * @var end_frame       The frame after the last one to test.
+ * @var segment_frames  The number of frames in each segment.
+ * @var window_size     The number of samples in the DFT window of the predicate, which the scratch
+ *                      arenas of the helper threads are sized for.
+ * @var num_threads     The maximum number of threads to scan with.
+ * @var description     A description of the target for progress messages.
+ */
+struct segment_scan_s {
+    SegmentScanPredicate predicate;
+    const void *context;
+    size_t start_frame;
+    size_t end_frame;
+    size_t segment_frames;
+    size_t window_size;
+    size_t num_threads;
+    const char *description;
+};
+
+
+/**
+ * Finds the first frame in a range that the predicate of a scan holds for.
+ *
+ * The first segment is scanned on the calling thread with {@code session}, since most searches end
+ * within it. The rest are distributed round-robin over the calling thread and up to
+ * {@code num_threads - 1} helper threads of the session, that steal segments from each other when
+ * they run out. The helper threads are started by the first scan that needs them, each with its
+ * own session, and wait for the next scan until {@code session} is freed. The frames they
+ * transform are copied into the STFT cache of {@code session} after the scan. Once a match
+ * is found, no frame after it is tested, and the scan ends when every segment before it is done.
+ * The result is the same as that of a serial scan for any number of threads.
+ *
+ * @param session  The decode session of the calling thread.
+ * @param scan     The scan to run.
+ *
+ * @return The first matching frame, or {@code SSTV_PROCESSING_NOT_FOUND} if there is none.
+ */
+size_t segment_scan_first(SstvSession *session, const SegmentScan *scan);
+
+
+/**
+ * Finds every non-overlapping target in a range of frames.
+ *
+ * Every segment is scanned like in {@code segment_scan_first}, but without stopping at the first
+ * match. The matches are then merged so that each one is at least {@code skip_frames} after the
+ * previous one, which is the same result as repeating a serial scan after the end of each target.
+ *
+ * @param session      The decode session of the calling thread.
+ * @param scan         The scan to run.
+ * @param skip_frames  The number of frames a target occupies.
+ * @param matches      A location to place a pointer to the array of matching frames at. The array
+ *                     must be freed by the caller, even if there are no matches.
+ *
+ * @return The number of matching frames placed in {@code *matches}.
+ */
+size_t segment_scan_all(SstvSession *session,
+                        const SegmentScan *scan,
+                        size_t skip_frames,
+                        size_t **matches);
+
+
+/**
+ * Stops the helper threads of the scans of a session and frees their sessions.
+ *
+ * @param threads  The {@code scan_threads} of the session, or {@code NULL} if it has none.
+ */
+void segment_scan_threads_free(ScanThreads *threads);
+
+
+#endif  // _SEGMENT_SCAN_H_
@@ -0,0 +1,474 @@
+#include "logger.h"
+#include "modes.h"
+#include "scoreboard.h"
+#include "soak.h"
+#include "sstv_processing.h"
+#include "wav_file.h"
+#include <assert.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+
+/**
+ * Gets the bucket of a histogram that a value goes in.
+ *
+ * @param value_sec  The value, in seconds.
+ *
+ * @return The index of the bucket.
+ */
+static size_t soak_histogram_bucket(double value_sec) {
+    if (!(value_sec > SOAK_HISTOGRAM_MIN_SEC)) {
+        return 0;
+    }
+
+    double position = log10(value_sec / SOAK_HISTOGRAM_MIN_SEC) * SOAK_HISTOGRAM_STEPS;
+    if (position >= SOAK_HISTOGRAM_BUCKETS - 1) {
+        return SOAK_HISTOGRAM_BUCKETS - 1;
+    }
+    return (size_t) position;
+}
+
+
+void soak_histogram_add(SoakHistogram *histogram, double value_sec) {
+    histogram->counts[soak_histogram_bucket(value_sec)]++;
+    histogram->num_values++;
+    histogram->sum_sec += value_sec;
+    if (value_sec > histogram->max_sec) {
+        histogram->max_sec = value_sec;
+    }
+}
+
+
+void soak_histogram_merge(SoakHistogram *into, const SoakHistogram *from) {
+    for (size_t i = 0; i < SOAK_HISTOGRAM_BUCKETS; i++) {
+        into->counts[i] += from->counts[i];
+    }
+    into->num_values += from->num_values;
+    into->sum_sec += from->sum_sec;
+    if (from->max_sec > into->max_sec) {
+        into->max_sec = from->max_sec;
+    }
+}
+
+
+double soak_histogram_percentile(const SoakHistogram *histogram, double fraction) {
+    if (histogram->num_values == 0) {
+        return 0;
+    }
+
+    // The percentile is the value of the `rank`th smallest value, counted from 1.
+    uint64_t rank = ceil(fraction * histogram->num_values);
+    if (rank == 0) {
+        rank = 1;
+    }
+    uint64_t count = 0;
+    size_t bucket;
+    for (bucket = 0; bucket < SOAK_HISTOGRAM_BUCKETS - 1; bucket++) {
+        count += histogram->counts[bucket];
+        if (count >= rank) {
+            break;
+        }
+    }
+
+    double upper_sec =
+        SOAK_HISTOGRAM_MIN_SEC * pow(10.0, (double) (bucket + 1) / SOAK_HISTOGRAM_STEPS);
+    return (upper_sec < histogram->max_sec) ? upper_sec : histogram->max_sec;
+}
+
+
+void soak_memory_add(SoakMemory *memory, double time_sec, size_t bytes) {
+    if (bytes > memory->peak_bytes) {
+        memory->peak_bytes = bytes;
+    }
+    if (memory->stride == 0) {
+        memory->stride = 1;
+    }
+
+    // Only every `stride`th offered sample is kept, which doubles each time the samples fill up.
+    if (memory->num_offered++ % memory->stride != 0) {
+        return;
+    }
+    if (memory->num_samples == SOAK_MEMORY_SAMPLES) {
+        for (size_t i = 0; i < SOAK_MEMORY_SAMPLES / 2; i++) {
+            memory->times_sec[i] = memory->times_sec[2 * i];
+            memory->bytes[i] = memory->bytes[2 * i];
+        }
+        memory->num_samples = SOAK_MEMORY_SAMPLES / 2;
+        memory->stride *= 2;
+        memory->num_offered = 1;
+    }
+    memory->times_sec[memory->num_samples] = time_sec;
+    memory->bytes[memory->num_samples] = bytes;
+    memory->num_samples++;
+}
+
+
+double soak_memory_growth(const SoakMemory *memory) {
+    if (memory->num_samples < 4) {
+        return 0;
+    }
+
+    size_t first = memory->num_samples / 2;
+    size_t num_fit = memory->num_samples - first;
+    double mean_time = 0;
+    double mean_bytes = 0;
+    for (size_t i = first; i < memory->num_samples; i++) {
+        mean_time += memory->times_sec[i];
+        mean_bytes += memory->bytes[i];
+    }
+    mean_time /= num_fit;
+    mean_bytes /= num_fit;
+
+    double covariance = 0;
+    double variance = 0;
+    for (size_t i = first; i < memory->num_samples; i++) {
+        double time_offset = memory->times_sec[i] - mean_time;
+        covariance += time_offset * (memory->bytes[i] - mean_bytes);
+        variance += time_offset * time_offset;
+    }
+    return (variance > 0) ? covariance / variance : 0;
+}
+
+
+size_t soak_resident_bytes(void) {
+    FILE *file = fopen("/proc/self/statm", "r");
+    if (file == NULL) {
+        return 0;
+    }
+
+    unsigned long size_pages;
+    unsigned long resident_pages;
+    int num_read = fscanf(file, "%lu %lu", &size_pages, &resident_pages);
+    fclose(file);
+    if (num_read != 2) {
+        return 0;
+    }
+    return resident_pages * (size_t) sysconf(_SC_PAGESIZE);
+}
+
+
+void soak_receiver_add_header_time(SoakReceiver *receiver,
+                                   SstvSession *session,
+                                   double header_sec)
+{
+    if (session->replay_rate > 0) {
+        session->replay_start_sec += header_sec;
+    }
+    receiver->pass_delay_sec += header_sec;
+
+    pthread_mutex_lock(&receiver->lock);
+    receiver->header_sec += header_sec;
+    pthread_mutex_unlock(&receiver->lock);
+}
+
+
+void soak_receiver_add_image(SoakReceiver *receiver, size_t num_lines) {
+    pthread_mutex_lock(&receiver->lock);
+    for (size_t data_line = 0; data_line < num_lines; data_line++) {
+        if (receiver->line_latencies[data_line] >= 0) {
+            soak_histogram_add(&receiver->latencies, receiver->line_latencies[data_line]);
+        }
+    }
+    receiver->num_images++;
+    pthread_mutex_unlock(&receiver->lock);
+}
+
+
+/**
+ * Discards the rows of an image that a receiver decoded.
+ *
+ * @param context    Unused.
+ * @param frame      Unused.
+ * @param first_row  Unused.
+ * @param num_rows   Unused.
+ * @param rows       Unused.
+ */
+static void soak_discard_rows(void *context,
+                              const ImageFrame *frame,
+                              size_t first_row,
+                              size_t num_rows,
+                              const Pixel *rows)
+{
+    (void) context;
+    (void) frame;
+    (void) first_row;
+    (void) num_rows;
+    (void) rows;
+}
+
+
+/**
+ * Replays the recording of a receiver until the end of the test, decoding each pass.
+ *
+ * @param arg  The receiver.
+ *
+ * @return {@code NULL}.
+ */
+static void *soak_receiver_run(void *arg) {
+    SoakReceiver *receiver = (SoakReceiver *) arg;
+    const WavSamples *wav_samples = receiver->wav_samples;
+    double audio_sec = (double) wav_samples->num_samples / wav_samples->sample_rate;
+
+    // The passes follow each other in one stream, so a receiver that falls behind starts its next
+    // pass after the samples of it arrived, and its latencies grow with the backlog. The stream is
+    // delayed by the header search of each pass, which runs before its samples start to arrive.
+    double stream_start_sec = sstv_monotonic_time_sec();
+    for (size_t pass = 0; pass == 0 || sstv_monotonic_time_sec() < receiver->end_sec; pass++) {
+        double pass_start_sec = sstv_monotonic_time_sec();
+        SstvSession *session = sstv_session_create(wav_samples, receiver->params);
+        if (session == NULL) {
+            log_fatal("cannot create soak decode session");
+        }
+        session->num_scan_threads = receiver->num_threads;
+        session->line_latencies = receiver->line_latencies;
+        if (receiver->speed > 0) {
+            session->replay_rate = wav_samples->sample_rate * receiver->speed;
+            session->replay_start_sec = stream_start_sec + pass * audio_sec / receiver->speed;
+        }
+        receiver->pass_delay_sec = 0;
+
+        pthread_mutex_lock(&receiver->lock);
+        size_t num_images = receiver->num_images;
+        pthread_mutex_unlock(&receiver->lock);
+        receiver->decode(receiver->context, session, receiver->sink, receiver);
+        pthread_mutex_lock(&receiver->lock);
+        num_images = receiver->num_images - num_images;
+        pthread_mutex_unlock(&receiver->lock);
+        if (num_images == 0) {
+            log_warn("soak pass %lu decoded no images", pass);
+        }
+
+        // A pass lasts until its last sample arrives, so the next one does not start early.
+        sstv_session_wait_for_sample(session, wav_samples->num_samples);
+        double busy_sec = sstv_monotonic_time_sec() - pass_start_sec - session->replay_wait_sec -
+            receiver->pass_delay_sec;
+        sstv_session_free(session);
+        stream_start_sec += receiver->pass_delay_sec;
+
+        pthread_mutex_lock(&receiver->lock);
+        receiver->audio_sec += audio_sec;
+        receiver->busy_sec += busy_sec;
+        receiver->num_passes++;
+        pthread_mutex_unlock(&receiver->lock);
+    }
+
+    atomic_fetch_add(receiver->num_done, 1);
+    return NULL;
+}
+
+
+/**
+ * Prints the progress of a soak test, or its results once it has finished.
+ *
+ * @param receivers      The receivers of the test.
+ * @param num_receivers  The number of entries in {@code receivers}.
+ * @param elapsed_sec    The time since the test started.
+ * @param memory         The samples of the resident memory so far.
+ * @param final          Whether the test has finished.
+ */
+static void soak_report(SoakReceiver *receivers,
+                        size_t num_receivers,
+                        double elapsed_sec,
+                        const SoakMemory *memory,
+                        bool final)
+{
+    SoakHistogram latencies = {0};
+    double audio_sec = 0;
+    double busy_sec = 0;
+    double header_sec = 0;
+    size_t num_passes = 0;
+    size_t num_images = 0;
+    for (size_t i = 0; i < num_receivers; i++) {
+        SoakReceiver *receiver = &receivers[i];
+        pthread_mutex_lock(&receiver->lock);
+        soak_histogram_merge(&latencies, &receiver->latencies);
+        audio_sec += receiver->audio_sec;
+        busy_sec += receiver->busy_sec;
+        header_sec += receiver->header_sec;
+        num_passes += receiver->num_passes;
+        num_images += receiver->num_images;
+        pthread_mutex_unlock(&receiver->lock);
+    }
+
+    // The real-time factor is the time that a receiver is busy per second of audio, and the
+    // header searches are a phase of their own before each replay.
+    double rtf = (audio_sec > 0) ? busy_sec / audio_sec : 0;
+    double resident_mb = memory->bytes[memory->num_samples - 1] / 1e6;
+    if (!final) {
+        log_info("soak at %.0f s: %lu passes, %lu images, real-time factor %.3f, line latency "
+                 "p50 %.1f ms, p99 %.1f ms, max %.1f ms, resident %.1f MB",
+                 elapsed_sec, num_passes, num_images, rtf,
+                 soak_histogram_percentile(&latencies, 0.5) * 1e3,
+                 soak_histogram_percentile(&latencies, 0.99) * 1e3,
+                 latencies.max_sec * 1e3,
+                 resident_mb);
+        return;
+    }
+
+    double mean_ms = 0;
+    if (latencies.num_values > 0) {
+        mean_ms = latencies.sum_sec / latencies.num_values * 1e3;
+    }
+    log_info("soak of %lu receiver(s) over %.1f s: %lu passes over %.1f s of audio, %lu images",
+             num_receivers, elapsed_sec, num_passes, audio_sec, num_images);
+    log_info("real-time factor: %.4f (%.1fx faster than real time)",
+             rtf, (rtf > 0) ? 1 / rtf : 0);
+    log_info("header search: %.2f s, %.1f ms per pass, not counted in the real-time factor",
+             header_sec, (num_passes > 0) ? header_sec / num_passes * 1e3 : 0);
+    log_info("line latency of %lu lines: mean %.2f ms, p50 %.2f ms, p90 %.2f ms, p99 %.2f ms, "
+             "p99.9 %.2f ms, max %.2f ms",
+             (size_t) latencies.num_values, mean_ms,
+             soak_histogram_percentile(&latencies, 0.5) * 1e3,
+             soak_histogram_percentile(&latencies, 0.9) * 1e3,
+             soak_histogram_percentile(&latencies, 0.99) * 1e3,
+             soak_histogram_percentile(&latencies, 0.999) * 1e3,
+             latencies.max_sec * 1e3);
+    log_info("resident memory: %.1f MB at the start, %.1f MB at the end, %.1f MB at the peak",
+             memory->bytes[0] / 1e6, resident_mb, memory->peak_bytes / 1e6);
+
+    // The memory rises and falls with each pass, so its growth is only told apart from that over
+    // several passes.
+    if (num_passes >= SOAK_GROWTH_PASSES * num_receivers) {
+        log_info("resident memory grew %.2f MB/hour after warming up",
+                 soak_memory_growth(memory) * 3600 / 1e6);
+    }
+    else {
+        log_info("resident memory growth needs %d passes per receiver to be estimated",
+                 SOAK_GROWTH_PASSES);
+    }
+
+    // Each receiver decodes on one thread at a time, so a host keeps up with about as many
+    // receivers as its processors can run at the measured factor.
+    long num_processors = sysconf(_SC_NPROCESSORS_ONLN);
+    if (rtf > 0 && num_processors > 0) {
+        log_info("at this real-time factor, %ld processor(s) keep up with about %.0f receivers",
+                 num_processors, floor(num_processors / rtf));
+    }
+}
+
+
+bool soak_run(const char *input_path,
+              double speed,
+              size_t num_receivers,
+              double time_sec,
+              size_t num_threads,
+              const SstvParams *params,
+              SoakDecode decode,
+              void *context)
+{
+    // Without a recording, the clean transmissions of the scoreboard are replayed.
+    WavSamples *wav_samples;
+    if (input_path != NULL) {
+        WavFile *wav_file = wav_file_open(input_path);
+        if (wav_file == NULL) {
+            log_fatal("cannot open wave audio file '%s'", input_path);
+        }
+        wav_samples = wav_file_get_mono_samples(wav_file);
+        if (wav_samples == NULL) {
+            log_fatal("cannot extract mono samples from wave audio file '%s'", input_path);
+        }
+        wav_file_close(wav_file);
+    }
+    else {
+        wav_samples = scoreboard_generate_every_mode(&scoreboard_cases[0]);
+    }
+
+    // The images are discarded, line by line as they are decoded.
+    ImageSink *sink = image_sink_create_callback(soak_discard_rows, NULL, true);
+    if (sink == NULL) {
+        log_fatal("cannot create soak sink");
+    }
+
+    size_t max_height = 0;
+    for (size_t i = 0; i < num_sstv_modes; i++) {
+        if (sstv_modes[i].height > max_height) {
+            max_height = sstv_modes[i].height;
+        }
+    }
+
+    // The receivers share the search threads, and the plans are made before any of them starts.
+    size_t receiver_threads = num_threads / num_receivers;
+    for (size_t i = 0; i < num_sstv_modes; i++) {
+        prepare_mode_fft_plans(&sstv_modes[i], wav_samples->sample_rate, params);
+    }
+
+    double audio_sec = (double) wav_samples->num_samples / wav_samples->sample_rate;
+    if (speed > 0) {
+        log_info("soaking %lu receiver(s) with %.1f s of audio replayed at %.2fx real time",
+                 num_receivers, audio_sec, speed);
+    }
+    else {
+        log_info("soaking %lu receiver(s) with %.1f s of audio decoded as fast as possible",
+                 num_receivers, audio_sec);
+    }
+    double start_sec = sstv_monotonic_time_sec();
+    SoakMemory memory = {0};
+    soak_memory_add(&memory, 0, soak_resident_bytes());
+
+    atomic_size_t num_done = 0;
+    SoakReceiver *receivers = (SoakReceiver *) calloc(num_receivers, sizeof(SoakReceiver));
+    assert(receivers && "soak_run cannot calloc receivers");
+    for (size_t i = 0; i < num_receivers; i++) {
+        SoakReceiver *receiver = &receivers[i];
+        receiver->wav_samples = wav_samples;
+        receiver->params = params;
+        receiver->decode = decode;
+        receiver->context = context;
+        receiver->sink = sink;
+        receiver->num_threads = (receiver_threads > 0) ? receiver_threads : 1;
+        receiver->speed = speed;
+        receiver->end_sec = start_sec + time_sec;
+        receiver->num_done = &num_done;
+        receiver->line_latencies = (double *) malloc(max_height * sizeof(double));
+        assert(receiver->line_latencies && "soak_run cannot malloc line_latencies");
+        pthread_mutex_init(&receiver->lock, NULL);
+        if (pthread_create(&receiver->thread, NULL, soak_receiver_run, receiver) != 0) {
+            log_fatal("cannot create soak receiver thread %lu", i);
+        }
+    }
+
+    // The memory is sampled often, so its growth is fit over many points even in a short test.
+    double next_report_sec = start_sec + SOAK_REPORT_SEC;
+    struct timespec poll = {0, (long) (SOAK_POLL_SEC * 1e9)};
+    while (atomic_load(&num_done) < num_receivers) {
+        nanosleep(&poll, NULL);
+        double now_sec = sstv_monotonic_time_sec();
+        soak_memory_add(&memory, now_sec - start_sec, soak_resident_bytes());
+        if (now_sec >= next_report_sec) {
+            soak_report(receivers, num_receivers, now_sec - start_sec, &memory, false);
+            next_report_sec += SOAK_REPORT_SEC;
+        }
+    }
+
+    for (size_t i = 0; i < num_receivers; i++) {
+        pthread_join(receivers[i].thread, NULL);
+    }
+    double elapsed_sec = sstv_monotonic_time_sec() - start_sec;
+    soak_memory_add(&memory, elapsed_sec, soak_resident_bytes());
+    soak_report(receivers, num_receivers, elapsed_sec, &memory, true);
+
+    // A receiver kept up when it was busy for less time than the samples took to arrive.
+    bool kept_up = true;
+    for (size_t i = 0; i < num_receivers; i++) {
+        SoakReceiver *receiver = &receivers[i];
+        if (speed > 0 && receiver->busy_sec * speed > receiver->audio_sec) {
+            kept_up = false;
+        }
+        pthread_mutex_destroy(&receiver->lock);
+        free(receiver->line_latencies);
+    }
+    if (!kept_up) {
+        log_error("receivers fell behind the replay at %.2fx speed", speed);
+    }
+
+    free(receivers);
+    image_sink_close(sink);
+    wav_file_free_samples(wav_samples);
+    return kept_up;
+}
@@ -0,0 +1,259 @@
+#ifndef _SOAK_H_
+#define _SOAK_H_
+
+
+#define SOAK_HISTOGRAM_MIN_SEC  1e-6
+#define SOAK_HISTOGRAM_DECADES  9
+#define SOAK_HISTOGRAM_STEPS    20
+#define SOAK_HISTOGRAM_BUCKETS  (SOAK_HISTOGRAM_DECADES * SOAK_HISTOGRAM_STEPS + 1)
+#define SOAK_MEMORY_SAMPLES     256
+#define SOAK_REPORT_SEC         10.0
+#define SOAK_POLL_SEC           0.1
+#define SOAK_GROWTH_PASSES      4
+
+
+#include "image_sink.h"
+#include "sstv_params.h"
+#include "sstv_processing.h"
+#include "wav_file.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+
+typedef struct soak_histogram_s SoakHistogram;
+typedef struct soak_memory_s SoakMemory;
+typedef struct soak_receiver_s SoakReceiver;
+
+
+/**
+ * A function that decodes every transmission in the samples of a session the way that a program
+ * would, for a receiver of {@code soak_run}. It calls {@code soak_receiver_add_header_time} after
+ * searching for the headers and {@code soak_receiver_add_image} after each image.
+ *
+ * @param context   The context given to {@code soak_run}.
+ * @param session   The session, whose samples arrive at the speed of the test and whose
+ *                  {@code line_latencies} are set.
+ * @param sink      The sink to deliver the decoded images to, which discards them.
+ * @param receiver  The receiver that the session belongs to.
+ */
+typedef void (*SoakDecode)(void *context,
+                           SstvSession *session,
+                           ImageSink *sink,
+                           SoakReceiver *receiver);
+
+
+/**
+ * A histogram of latencies with buckets of a fixed relative width, so it takes the same memory
+ * however long a soak test runs.
+ *
+ * Bucket {@code i} holds the values below {@code SOAK_HISTOGRAM_MIN_SEC * 10^((i + 1) /
+ * SOAK_HISTOGRAM_STEPS)}, which is about 12% wider than the bucket before it, from
+ * {@code SOAK_HISTOGRAM_MIN_SEC} over {@code SOAK_HISTOGRAM_DECADES} decades. The first bucket
+ * also holds smaller values and the last one larger values.
+ *
+ * @var counts      The number of values in each bucket.
+ * @var num_values  The number of values in every bucket.
+ * @var sum_sec     The sum of the values.
+ * @var max_sec     The largest value, which is kept exactly.
+ */
+struct soak_histogram_s {
+    uint64_t counts[SOAK_HISTOGRAM_BUCKETS];
+    uint64_t num_values;
+    double sum_sec;
+    double max_sec;
+};
+
+
+/**
+ * The resident memory of the process over a soak test, sampled at a fixed number of times.
+ *
+ * When the samples are full, every other one is dropped and only every other later sample is
+ * kept, so they always span the whole test.
+ *
+ * @var times_sec    The time of each sample, from the start of the test.
+ * @var bytes        The resident memory at each sample.
+ * @var num_samples  The number of entries in {@code times_sec} and {@code bytes}.
+ * @var stride       The number of offered samples that each kept sample stands for.
+ * @var num_offered  The number of samples offered since the last one that was kept.
+ * @var peak_bytes   The largest resident memory of every offered sample.
+ */
+struct soak_memory_s {
+    double times_sec[SOAK_MEMORY_SAMPLES];
+    size_t bytes[SOAK_MEMORY_SAMPLES];
+    size_t num_samples;
+    size_t stride;
+    size_t num_offered;
+    size_t peak_bytes;
+};
+
+
+/**
+ * One receiver of a soak test, which replays a recording over and over on its own thread as if
+ * it were being received, and decodes every transmission in it.
+ *
+ * @var thread          The thread of the receiver.
+ * @var wav_samples     The samples of the recording, which every receiver shares.
+ * @var params          The analysis parameters of the decode.
+ * @var decode          The function that decodes each pass.
+ * @var context         The context to pass to {@code decode}.
+ * @var sink            The sink of the decoded images, which every receiver shares.
+ * @var num_threads     The maximum number of threads for the header and sync searches.
+ * @var speed           How many times faster than real time the samples arrive, or 0 for
+ *                      them to be there from the start.
+ * @var end_sec         The time of {@code sstv_monotonic_time_sec} after which no pass starts.
+ * @var num_done        The number of receivers that have finished, which they share.
+ * @var line_latencies  The latency of each line of the image being decoded.
+ * @var pass_delay_sec  The time that the header search of the current pass delayed its replay by.
+ * @var lock            The lock of the statistics below, which the main thread reports.
+ * @var latencies       The latency of every line decoded so far.
+ * @var audio_sec       The time of the audio replayed so far.
+ * @var busy_sec        The time spent on it, without the time waited for samples to arrive and
+ *                      the time of the header searches.
+ * @var header_sec      The time of the header searches so far.
+ * @var num_passes      The number of passes over the recording so far.
+ * @var num_images      The number of images decoded so far.
+ */
+struct soak_receiver_s {
+    pthread_t thread;
+    const WavSamples *wav_samples;
+    const SstvParams *params;
+    SoakDecode decode;
+    void *context;
+    ImageSink *sink;
+    size_t num_threads;
+    double speed;
+    double end_sec;
+    atomic_size_t *num_done;
+    double *line_latencies;
+    double pass_delay_sec;
+    pthread_mutex_t lock;
+    SoakHistogram latencies;
+    double audio_sec;
+    double busy_sec;
+    double header_sec;
+    size_t num_passes;
+    size_t num_images;
+};
+
+
+/**
+ * Adds a latency to a histogram.
+ *
+ * @param histogram  The histogram to add to.
+ * @param value_sec  The latency, in seconds.
+ */
+void soak_histogram_add(SoakHistogram *histogram, double value_sec);
+
+
+/**
+ * Adds every value of one histogram to another.
+ *
+ * @param into  The histogram to add to.
+ * @param from  The histogram to add.
+ */
+void soak_histogram_merge(SoakHistogram *into, const SoakHistogram *from);
+
+
+/**
+ * Gets a percentile of the values of a histogram, as the upper edge of the bucket it falls in.
+ *
+ * @param histogram  The histogram.
+ * @param fraction   The fraction of the values at or below the percentile, on {@code [0, 1]}.
+ *
+ * @return The percentile in seconds, which is no more than the largest value, or 0 for an empty
+ *         histogram.
+ */
+double soak_histogram_percentile(const SoakHistogram *histogram, double fraction);
+
+
+/**
+ * Offers a sample of the resident memory to the samples of a soak test.
+ *
+ * @param memory    The samples.
+ * @param time_sec  The time of the sample, from the start of the test, which must not be before
+ *                  that of the last sample.
+ * @param bytes     The resident memory.
+ */
+void soak_memory_add(SoakMemory *memory, double time_sec, size_t bytes);
+
+
+/**
+ * Estimates how fast the resident memory grows once the test has warmed up, by a least-squares
+ * fit over the later half of the samples. The first half is left out, since the caches and DFT
+ * plans of the decode fill up there.
+ *
+ * @param memory  The samples.
+ *
+ * @return The growth in bytes per second, which is negative if the memory shrank, or 0 with
+ *         fewer than four samples.
+ */
+double soak_memory_growth(const SoakMemory *memory);
+
+
+/**
+ * Gets the resident memory of the process from {@code /proc/self/statm}.
+ *
+ * @return The resident memory in bytes, or 0 if it cannot be read.
+ */
+size_t soak_resident_bytes(void);
+
+
+/**
+ * Counts the time of the header search of a pass of a receiver, which runs over the whole
+ * recording before the replay of the pass starts.
+ *
+ * The header search is reported on its own rather than in the real-time factor, and the samples of
+ * the pass start to arrive when it ends, so the latencies of the lines do not include it.
+ *
+ * @param receiver    The receiver.
+ * @param session     The session of the pass, whose replay is delayed by the search.
+ * @param header_sec  The time of the search.
+ */
+void soak_receiver_add_header_time(SoakReceiver *receiver,
+                                   SstvSession *session,
+                                   double header_sec);
+
+
+/**
+ * Counts an image that a receiver decoded, with the latencies of its lines in the
+ * {@code line_latencies} of the receiver. Lines with a negative latency were not decoded.
+ *
+ * @param receiver   The receiver.
+ * @param num_lines  The number of lines of image data of the image.
+ */
+void soak_receiver_add_image(SoakReceiver *receiver, size_t num_lines);
+
+
+/**
+ * Runs a soak test, in which receivers replay a recording over and over on their own threads as
+ * if it were being received, and decode every transmission in it. Progress is reported every
+ * {@code SOAK_REPORT_SEC}, and the latency, real-time factor and memory growth at the end.
+ *
+ * @param input_path     The path of the wave file to replay, or {@code NULL} to replay the clean
+ *                       transmissions of the scoreboard in every supported mode.
+ * @param speed          How many times faster than real time the samples arrive, or 0 for them
+ *                       to be there from the start.
+ * @param num_receivers  The number of receivers.
+ * @param time_sec       The time after which no receiver starts another pass, or 0 for one pass.
+ * @param num_threads    The number of threads for the header and sync searches that the receivers
+ *                       share.
+ * @param params         The analysis parameters of the decode.
+ * @param decode         The function that decodes each pass.
+ * @param context        The context to pass to {@code decode}.
+ *
+ * @return Whether every receiver kept up with the replay.
+ */
+bool soak_run(const char *input_path,
+              double speed,
+              size_t num_receivers,
+              double time_sec,
+              size_t num_threads,
+              const SstvParams *params,
+              SoakDecode decode,
+              void *context);
+
+
+#endif  // _SOAK_H_
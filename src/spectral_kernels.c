@@ -0,0 +1,878 @@
+#include "freq_processing.h"
+#include "logger.h"
+#include "spectral_kernels.h"
+#include <assert.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SPECTRAL_KERNELS_X86 1
+#include <immintrin.h>
+#else
+#define SPECTRAL_KERNELS_X86 0
+#endif
+
+
+void fill_hann_window(Sample *window, size_t num_samples) {
+    assert(window && "fill_hann_window got NULL window");
+
+    for (size_t i = 0; i < num_samples; i++) {
+        window[i] = hann_window(num_samples, i);
+    }
+}
+
+
+/**
+ * Calculates the magnitude of one complex DFT bin.
+ *
+ * @param bins   The interleaved real and imaginary parts of the DFT bins.
+ * @param index  The index of the complex bin.
+ *
+ * @return The magnitude of {@code bins[index]}.
+ */
+static double bin_magnitude(const Sample *bins, size_t index) {
+    double real = bins[2 * index];
+    double imaginary = bins[2 * index + 1];
+    return sqrt(real * real + imaginary * imaginary);
+}
+
+
+double interpolate_peak_bin(const Sample *bins,
+                            size_t num_bins,
+                            size_t bin_stride,
+                            size_t index)
+{
+    assert(bins && "interpolate_peak_bin got NULL bins");
+
+    // Only the three magnitudes used by the interpolation need a square root. Neighbors outside
+    // the bins are clamped to the peak itself, as in `barycentric_peak_interpolation`.
+    double peak = bin_magnitude(bins, index * bin_stride);
+    double left_neighbor =
+        (index == 0) ? peak : bin_magnitude(bins, (index - 1) * bin_stride);
+    double right_neighbor =
+        (index + 1 >= num_bins) ? peak : bin_magnitude(bins, (index + 1) * bin_stride);
+
+    double denominator = left_neighbor + peak + right_neighbor;
+    return denominator == 0 ? 0 : (right_neighbor - left_neighbor) / denominator + index;
+}
+
+
+static void window_samples_scalar(const Sample *samples,
+                                  const Sample *window,
+                                  Sample *windowed_samples,
+                                  size_t num_samples)
+{
+    double mean = 0.0;
+    for (size_t i = 0; i < num_samples; i++) {
+        mean += samples[i];
+    }
+    mean /= num_samples;
+
+    // Subtracting the mean and applying the window in the same pass means the samples are only
+    // read twice, and the window coefficients come from a table instead of a call to `cos`.
+    for (size_t i = 0; i < num_samples; i++) {
+        windowed_samples[i] = (samples[i] - mean) * window[i];
+    }
+}
+
+
+static size_t peak_power_bin_scalar(const Sample *bins, size_t num_bins) {
+    // Squared magnitudes have the same ordering as magnitudes, so no square root is needed.
+    size_t peak_index = 0;
+    Sample peak_power = bins[0] * bins[0] + bins[1] * bins[1];
+    for (size_t i = 1; i < num_bins; i++) {
+        Sample power = bins[2 * i] * bins[2 * i] + bins[2 * i + 1] * bins[2 * i + 1];
+        if (power > peak_power) {
+            peak_power = power;
+            peak_index = i;
+        }
+    }
+    return peak_index;
+}
+
+
+/**
+ * Reduces per-lane peak candidates from a vectorized search to a single peak bin.
+ *
+ * Each lane holds the largest power it has seen and the lowest index with that power. The lanes
+ * are then compared, with ties going to the lowest index. Bins past the last full vector (the
+ * tail) are compared in order, which preserves the same tie-breaking as the scalar search.
+ *
+ * @param lane_powers   The largest power found by each lane.
+ * @param lane_indices  The bin index of the largest power in each lane.
+ * @param num_lanes     The number of lanes in the vector.
+ * @param bins          The interleaved complex bins.
+ * @param tail_start    The index of the first bin not processed by the vector loop.
+ * @param num_bins      The number of complex bins.
+ *
+ * @return The index of the bin with the largest power.
+ */
+static size_t reduce_peak_lanes(const Sample *lane_powers,
+                                const Sample *lane_indices,
+                                size_t num_lanes,
+                                const Sample *bins,
+                                size_t tail_start,
+                                size_t num_bins)
+{
+    size_t peak_index = 0;
+    Sample peak_power = -1.0;
+    for (size_t lane = 0; lane < num_lanes; lane++) {
+        size_t lane_index = (size_t) lane_indices[lane];
+        if (lane_powers[lane] > peak_power ||
+            (lane_powers[lane] == peak_power && lane_index < peak_index))
+        {
+            peak_power = lane_powers[lane];
+            peak_index = lane_index;
+        }
+    }
+
+    for (size_t i = tail_start; i < num_bins; i++) {
+        Sample power = bins[2 * i] * bins[2 * i] + bins[2 * i + 1] * bins[2 * i + 1];
+        if (power > peak_power) {
+            peak_power = power;
+            peak_index = i;
+        }
+    }
+    return peak_index;
+}
+
+
+/**
+ * Finds the peak power bin of each window in a batch, starting at a given window.
+ *
+ * This is the scalar search of {@code peak_power_bins}, which the vectorized kernels use for the
+ * windows past their last full vector.
+ *
+ * @param bins          The interleaved complex bins, with bin {@code i} of window {@code w} at
+ *                      complex index {@code i * num_windows + w}.
+ * @param num_bins      The number of complex bins per window.
+ * @param num_windows   The number of windows in the batch.
+ * @param first_window  The first window to search.
+ * @param peak_indices  The array to place the peak bin index of each window in.
+ */
+static void peak_power_bins_from(const Sample *bins,
+                                 size_t num_bins,
+                                 size_t num_windows,
+                                 size_t first_window,
+                                 size_t *peak_indices)
+{
+    for (size_t w = first_window; w < num_windows; w++) {
+        size_t peak_index = 0;
+        Sample peak_power = -1.0;
+        for (size_t i = 0; i < num_bins; i++) {
+            const Sample *bin = &bins[2 * (i * num_windows + w)];
+            Sample power = bin[0] * bin[0] + bin[1] * bin[1];
+            if (power > peak_power) {
+                peak_power = power;
+                peak_index = i;
+            }
+        }
+        peak_indices[w] = peak_index;
+    }
+}
+
+
+static void peak_power_bins_scalar(const Sample *bins,
+                                   size_t num_bins,
+                                   size_t num_windows,
+                                   size_t *peak_indices)
+{
+    peak_power_bins_from(bins, num_bins, num_windows, 0, peak_indices);
+}
+
+
+#if SPECTRAL_KERNELS_X86
+
+
+#ifdef SSTV_SINGLE_PRECISION
+
+
+__attribute__((target("sse2")))
+static void window_samples_sse2(const float *samples,
+                                const float *window,
+                                float *windowed_samples,
+                                size_t num_samples)
+{
+    size_t i = 0;
+    __m128 sum = _mm_setzero_ps();
+    for (; i + 4 <= num_samples; i += 4) {
+        sum = _mm_add_ps(sum, _mm_loadu_ps(&samples[i]));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, sum);
+    float mean = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    for (; i < num_samples; i++) {
+        mean += samples[i];
+    }
+    mean /= num_samples;
+
+    __m128 mean_vector = _mm_set1_ps(mean);
+    for (i = 0; i + 4 <= num_samples; i += 4) {
+        __m128 cleaned = _mm_sub_ps(_mm_loadu_ps(&samples[i]), mean_vector);
+        _mm_storeu_ps(&windowed_samples[i], _mm_mul_ps(cleaned, _mm_loadu_ps(&window[i])));
+    }
+    for (; i < num_samples; i++) {
+        windowed_samples[i] = (samples[i] - mean) * window[i];
+    }
+}
+
+
+__attribute__((target("sse2")))
+static size_t peak_power_bin_sse2(const float *bins, size_t num_bins) {
+    // Each iteration loads four complex bins. The shuffles gather the squared real and imaginary
+    // parts so the powers come out in bin order. Blends are done with masks, as in the double
+    // precision kernel.
+    __m128 peak_powers = _mm_set1_ps(-1.0f);
+    __m128 peak_indices = _mm_setzero_ps();
+    __m128 indices = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+    __m128 step = _mm_set1_ps(4.0f);
+
+    size_t i = 0;
+    for (; i + 4 <= num_bins; i += 4) {
+        __m128 first = _mm_loadu_ps(&bins[2 * i]);
+        __m128 second = _mm_loadu_ps(&bins[2 * i + 4]);
+        first = _mm_mul_ps(first, first);
+        second = _mm_mul_ps(second, second);
+        __m128 powers = _mm_add_ps(_mm_shuffle_ps(first, second, _MM_SHUFFLE(2, 0, 2, 0)),
+                                   _mm_shuffle_ps(first, second, _MM_SHUFFLE(3, 1, 3, 1)));
+
+        __m128 greater = _mm_cmpgt_ps(powers, peak_powers);
+        peak_powers = _mm_or_ps(_mm_and_ps(greater, powers), _mm_andnot_ps(greater, peak_powers));
+        peak_indices = _mm_or_ps(_mm_and_ps(greater, indices),
+                                 _mm_andnot_ps(greater, peak_indices));
+        indices = _mm_add_ps(indices, step);
+    }
+
+    float lane_powers[4];
+    float lane_indices[4];
+    _mm_storeu_ps(lane_powers, peak_powers);
+    _mm_storeu_ps(lane_indices, peak_indices);
+    return reduce_peak_lanes(lane_powers, lane_indices, 4, bins, i, num_bins);
+}
+
+
+__attribute__((target("sse2")))
+static void peak_power_bins_sse2(const float *bins,
+                                 size_t num_bins,
+                                 size_t num_windows,
+                                 size_t *peak_indices)
+{
+    // The batch is laid out bin-major, so the same bin of four consecutive windows is contiguous
+    // and the powers are computed exactly as in `peak_power_bin_sse2`, with one window per lane.
+    size_t w = 0;
+    for (; w + 4 <= num_windows; w += 4) {
+        __m128 peak_powers = _mm_set1_ps(-1.0f);
+        __m128 peak_bins = _mm_setzero_ps();
+        for (size_t i = 0; i < num_bins; i++) {
+            __m128 first = _mm_loadu_ps(&bins[2 * (i * num_windows + w)]);
+            __m128 second = _mm_loadu_ps(&bins[2 * (i * num_windows + w) + 4]);
+            first = _mm_mul_ps(first, first);
+            second = _mm_mul_ps(second, second);
+            __m128 powers = _mm_add_ps(_mm_shuffle_ps(first, second, _MM_SHUFFLE(2, 0, 2, 0)),
+                                       _mm_shuffle_ps(first, second, _MM_SHUFFLE(3, 1, 3, 1)));
+
+            __m128 greater = _mm_cmpgt_ps(powers, peak_powers);
+            __m128 index = _mm_set1_ps((float) i);
+            peak_powers = _mm_or_ps(_mm_and_ps(greater, powers),
+                                    _mm_andnot_ps(greater, peak_powers));
+            peak_bins = _mm_or_ps(_mm_and_ps(greater, index), _mm_andnot_ps(greater, peak_bins));
+        }
+
+        float lane_bins[4];
+        _mm_storeu_ps(lane_bins, peak_bins);
+        for (size_t lane = 0; lane < 4; lane++) {
+            peak_indices[w + lane] = (size_t) lane_bins[lane];
+        }
+    }
+    peak_power_bins_from(bins, num_bins, num_windows, w, peak_indices);
+}
+
+
+__attribute__((target("avx2")))
+static void window_samples_avx2(const float *samples,
+                                const float *window,
+                                float *windowed_samples,
+                                size_t num_samples)
+{
+    size_t i = 0;
+    __m256 sum = _mm256_setzero_ps();
+    for (; i + 8 <= num_samples; i += 8) {
+        sum = _mm256_add_ps(sum, _mm256_loadu_ps(&samples[i]));
+    }
+    float lanes[8];
+    _mm256_storeu_ps(lanes, sum);
+    float mean = ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) +
+                 ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+    for (; i < num_samples; i++) {
+        mean += samples[i];
+    }
+    mean /= num_samples;
+
+    __m256 mean_vector = _mm256_set1_ps(mean);
+    for (i = 0; i + 8 <= num_samples; i += 8) {
+        __m256 cleaned = _mm256_sub_ps(_mm256_loadu_ps(&samples[i]), mean_vector);
+        __m256 coefficients = _mm256_loadu_ps(&window[i]);
+        _mm256_storeu_ps(&windowed_samples[i], _mm256_mul_ps(cleaned, coefficients));
+    }
+    for (; i < num_samples; i++) {
+        windowed_samples[i] = (samples[i] - mean) * window[i];
+    }
+}
+
+
+__attribute__((target("avx2")))
+static size_t peak_power_bin_avx2(const float *bins, size_t num_bins) {
+    // Each iteration loads eight complex bins. The shuffles work within 128-bit halves, so the
+    // powers come out in the order [0, 1, 4, 5, 2, 3, 6, 7], and the index vector follows suit.
+    __m256 peak_powers = _mm256_set1_ps(-1.0f);
+    __m256 peak_indices = _mm256_setzero_ps();
+    __m256 indices = _mm256_set_ps(7.0f, 6.0f, 3.0f, 2.0f, 5.0f, 4.0f, 1.0f, 0.0f);
+    __m256 step = _mm256_set1_ps(8.0f);
+
+    size_t i = 0;
+    for (; i + 8 <= num_bins; i += 8) {
+        __m256 first = _mm256_loadu_ps(&bins[2 * i]);
+        __m256 second = _mm256_loadu_ps(&bins[2 * i + 8]);
+        first = _mm256_mul_ps(first, first);
+        second = _mm256_mul_ps(second, second);
+        __m256 powers = _mm256_add_ps(_mm256_shuffle_ps(first, second, _MM_SHUFFLE(2, 0, 2, 0)),
+                                      _mm256_shuffle_ps(first, second, _MM_SHUFFLE(3, 1, 3, 1)));
+
+        __m256 greater = _mm256_cmp_ps(powers, peak_powers, _CMP_GT_OQ);
+        peak_powers = _mm256_blendv_ps(peak_powers, powers, greater);
+        peak_indices = _mm256_blendv_ps(peak_indices, indices, greater);
+        indices = _mm256_add_ps(indices, step);
+    }
+
+    float lane_powers[8];
+    float lane_indices[8];
+    _mm256_storeu_ps(lane_powers, peak_powers);
+    _mm256_storeu_ps(lane_indices, peak_indices);
+    return reduce_peak_lanes(lane_powers, lane_indices, 8, bins, i, num_bins);
+}
+
+
+__attribute__((target("avx2")))
+static void peak_power_bins_avx2(const float *bins,
+                                 size_t num_bins,
+                                 size_t num_windows,
+                                 size_t *peak_indices)
+{
+    // As in `peak_power_bin_avx2`, the lanes hold windows in the order [0, 1, 4, 5, 2, 3, 6, 7].
+    static const size_t lane_windows[8] = {0, 1, 4, 5, 2, 3, 6, 7};
+
+    size_t w = 0;
+    for (; w + 8 <= num_windows; w += 8) {
+        __m256 peak_powers = _mm256_set1_ps(-1.0f);
+        __m256 peak_bins = _mm256_setzero_ps();
+        for (size_t i = 0; i < num_bins; i++) {
+            __m256 first = _mm256_loadu_ps(&bins[2 * (i * num_windows + w)]);
+            __m256 second = _mm256_loadu_ps(&bins[2 * (i * num_windows + w) + 8]);
+            first = _mm256_mul_ps(first, first);
+            second = _mm256_mul_ps(second, second);
+            __m256 powers =
+                _mm256_add_ps(_mm256_shuffle_ps(first, second, _MM_SHUFFLE(2, 0, 2, 0)),
+                              _mm256_shuffle_ps(first, second, _MM_SHUFFLE(3, 1, 3, 1)));
+
+            __m256 greater = _mm256_cmp_ps(powers, peak_powers, _CMP_GT_OQ);
+            peak_powers = _mm256_blendv_ps(peak_powers, powers, greater);
+            peak_bins = _mm256_blendv_ps(peak_bins, _mm256_set1_ps((float) i), greater);
+        }
+
+        float lane_bins[8];
+        _mm256_storeu_ps(lane_bins, peak_bins);
+        for (size_t lane = 0; lane < 8; lane++) {
+            peak_indices[w + lane_windows[lane]] = (size_t) lane_bins[lane];
+        }
+    }
+    peak_power_bins_from(bins, num_bins, num_windows, w, peak_indices);
+}
+
+
+__attribute__((target("avx512f")))
+static void window_samples_avx512(const float *samples,
+                                  const float *window,
+                                  float *windowed_samples,
+                                  size_t num_samples)
+{
+    size_t i = 0;
+    __m512 sum = _mm512_setzero_ps();
+    for (; i + 16 <= num_samples; i += 16) {
+        sum = _mm512_add_ps(sum, _mm512_loadu_ps(&samples[i]));
+    }
+    float mean = _mm512_reduce_add_ps(sum);
+    for (; i < num_samples; i++) {
+        mean += samples[i];
+    }
+    mean /= num_samples;
+
+    __m512 mean_vector = _mm512_set1_ps(mean);
+    for (i = 0; i + 16 <= num_samples; i += 16) {
+        __m512 cleaned = _mm512_sub_ps(_mm512_loadu_ps(&samples[i]), mean_vector);
+        __m512 coefficients = _mm512_loadu_ps(&window[i]);
+        _mm512_storeu_ps(&windowed_samples[i], _mm512_mul_ps(cleaned, coefficients));
+    }
+    for (; i < num_samples; i++) {
+        windowed_samples[i] = (samples[i] - mean) * window[i];
+    }
+}
+
+
+__attribute__((target("avx512f")))
+static size_t peak_power_bin_avx512(const float *bins, size_t num_bins) {
+    // Each iteration loads sixteen complex bins into two registers, then gathers the real and
+    // imaginary parts into their own registers so the powers come out in bin order.
+    __m512i real_lanes =
+        _mm512_set_epi32(30, 28, 26, 24, 22, 20, 18, 16, 14, 12, 10, 8, 6, 4, 2, 0);
+    __m512i imaginary_lanes =
+        _mm512_set_epi32(31, 29, 27, 25, 23, 21, 19, 17, 15, 13, 11, 9, 7, 5, 3, 1);
+    __m512 peak_powers = _mm512_set1_ps(-1.0f);
+    __m512 peak_indices = _mm512_setzero_ps();
+    __m512 indices = _mm512_set_ps(15.0f, 14.0f, 13.0f, 12.0f, 11.0f, 10.0f, 9.0f, 8.0f,
+                                   7.0f, 6.0f, 5.0f, 4.0f, 3.0f, 2.0f, 1.0f, 0.0f);
+    __m512 step = _mm512_set1_ps(16.0f);
+
+    size_t i = 0;
+    for (; i + 16 <= num_bins; i += 16) {
+        __m512 first = _mm512_loadu_ps(&bins[2 * i]);
+        __m512 second = _mm512_loadu_ps(&bins[2 * i + 16]);
+        __m512 real = _mm512_permutex2var_ps(first, real_lanes, second);
+        __m512 imaginary = _mm512_permutex2var_ps(first, imaginary_lanes, second);
+        __m512 powers = _mm512_add_ps(_mm512_mul_ps(real, real),
+                                      _mm512_mul_ps(imaginary, imaginary));
+
+        __mmask16 greater = _mm512_cmp_ps_mask(powers, peak_powers, _CMP_GT_OQ);
+        peak_powers = _mm512_mask_blend_ps(greater, peak_powers, powers);
+        peak_indices = _mm512_mask_blend_ps(greater, peak_indices, indices);
+        indices = _mm512_add_ps(indices, step);
+    }
+
+    float lane_powers[16];
+    float lane_indices[16];
+    _mm512_storeu_ps(lane_powers, peak_powers);
+    _mm512_storeu_ps(lane_indices, peak_indices);
+    return reduce_peak_lanes(lane_powers, lane_indices, 16, bins, i, num_bins);
+}
+
+
+__attribute__((target("avx512f")))
+static void peak_power_bins_avx512(const float *bins,
+                                   size_t num_bins,
+                                   size_t num_windows,
+                                   size_t *peak_indices)
+{
+    __m512i real_lanes =
+        _mm512_set_epi32(30, 28, 26, 24, 22, 20, 18, 16, 14, 12, 10, 8, 6, 4, 2, 0);
+    __m512i imaginary_lanes =
+        _mm512_set_epi32(31, 29, 27, 25, 23, 21, 19, 17, 15, 13, 11, 9, 7, 5, 3, 1);
+
+    size_t w = 0;
+    for (; w + 16 <= num_windows; w += 16) {
+        __m512 peak_powers = _mm512_set1_ps(-1.0f);
+        __m512 peak_bins = _mm512_setzero_ps();
+        for (size_t i = 0; i < num_bins; i++) {
+            __m512 first = _mm512_loadu_ps(&bins[2 * (i * num_windows + w)]);
+            __m512 second = _mm512_loadu_ps(&bins[2 * (i * num_windows + w) + 16]);
+            __m512 real = _mm512_permutex2var_ps(first, real_lanes, second);
+            __m512 imaginary = _mm512_permutex2var_ps(first, imaginary_lanes, second);
+            __m512 powers = _mm512_add_ps(_mm512_mul_ps(real, real),
+                                          _mm512_mul_ps(imaginary, imaginary));
+
+            __mmask16 greater = _mm512_cmp_ps_mask(powers, peak_powers, _CMP_GT_OQ);
+            peak_powers = _mm512_mask_blend_ps(greater, peak_powers, powers);
+            peak_bins = _mm512_mask_blend_ps(greater, peak_bins, _mm512_set1_ps((float) i));
+        }
+
+        float lane_bins[16];
+        _mm512_storeu_ps(lane_bins, peak_bins);
+        for (size_t lane = 0; lane < 16; lane++) {
+            peak_indices[w + lane] = (size_t) lane_bins[lane];
+        }
+    }
+    peak_power_bins_from(bins, num_bins, num_windows, w, peak_indices);
+}
+
+
+#else
+
+
+__attribute__((target("sse2")))
+static void window_samples_sse2(const double *samples,
+                                const double *window,
+                                double *windowed_samples,
+                                size_t num_samples)
+{
+    size_t i = 0;
+    __m128d sum = _mm_setzero_pd();
+    for (; i + 2 <= num_samples; i += 2) {
+        sum = _mm_add_pd(sum, _mm_loadu_pd(&samples[i]));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, sum);
+    double mean = lanes[0] + lanes[1];
+    for (; i < num_samples; i++) {
+        mean += samples[i];
+    }
+    mean /= num_samples;
+
+    __m128d mean_vector = _mm_set1_pd(mean);
+    for (i = 0; i + 2 <= num_samples; i += 2) {
+        __m128d cleaned = _mm_sub_pd(_mm_loadu_pd(&samples[i]), mean_vector);
+        _mm_storeu_pd(&windowed_samples[i], _mm_mul_pd(cleaned, _mm_loadu_pd(&window[i])));
+    }
+    for (; i < num_samples; i++) {
+        windowed_samples[i] = (samples[i] - mean) * window[i];
+    }
+}
+
+
+__attribute__((target("sse2")))
+static size_t peak_power_bin_sse2(const double *bins, size_t num_bins) {
+    // Each iteration loads two complex bins and computes both powers at once. Lane 0 always holds
+    // even bins and lane 1 odd bins. SSE2 has no blend instruction, so blends are done with masks.
+    __m128d peak_powers = _mm_set1_pd(-1.0);
+    __m128d peak_indices = _mm_setzero_pd();
+    __m128d indices = _mm_set_pd(1.0, 0.0);
+    __m128d step = _mm_set1_pd(2.0);
+
+    size_t i = 0;
+    for (; i + 2 <= num_bins; i += 2) {
+        __m128d first = _mm_loadu_pd(&bins[2 * i]);
+        __m128d second = _mm_loadu_pd(&bins[2 * i + 2]);
+        first = _mm_mul_pd(first, first);
+        second = _mm_mul_pd(second, second);
+        __m128d powers = _mm_add_pd(_mm_unpacklo_pd(first, second),
+                                    _mm_unpackhi_pd(first, second));
+
+        __m128d greater = _mm_cmpgt_pd(powers, peak_powers);
+        peak_powers = _mm_or_pd(_mm_and_pd(greater, powers), _mm_andnot_pd(greater, peak_powers));
+        peak_indices = _mm_or_pd(_mm_and_pd(greater, indices),
+                                 _mm_andnot_pd(greater, peak_indices));
+        indices = _mm_add_pd(indices, step);
+    }
+
+    double lane_powers[2];
+    double lane_indices[2];
+    _mm_storeu_pd(lane_powers, peak_powers);
+    _mm_storeu_pd(lane_indices, peak_indices);
+    return reduce_peak_lanes(lane_powers, lane_indices, 2, bins, i, num_bins);
+}
+
+
+__attribute__((target("sse2")))
+static void peak_power_bins_sse2(const double *bins,
+                                 size_t num_bins,
+                                 size_t num_windows,
+                                 size_t *peak_indices)
+{
+    // The batch is laid out bin-major, so the same bin of two consecutive windows is contiguous
+    // and the powers are computed exactly as in `peak_power_bin_sse2`, with one window per lane.
+    size_t w = 0;
+    for (; w + 2 <= num_windows; w += 2) {
+        __m128d peak_powers = _mm_set1_pd(-1.0);
+        __m128d peak_bins = _mm_setzero_pd();
+        for (size_t i = 0; i < num_bins; i++) {
+            __m128d first = _mm_loadu_pd(&bins[2 * (i * num_windows + w)]);
+            __m128d second = _mm_loadu_pd(&bins[2 * (i * num_windows + w) + 2]);
+            first = _mm_mul_pd(first, first);
+            second = _mm_mul_pd(second, second);
+            __m128d powers = _mm_add_pd(_mm_unpacklo_pd(first, second),
+                                        _mm_unpackhi_pd(first, second));
+
+            __m128d greater = _mm_cmpgt_pd(powers, peak_powers);
+            __m128d index = _mm_set1_pd((double) i);
+            peak_powers = _mm_or_pd(_mm_and_pd(greater, powers),
+                                    _mm_andnot_pd(greater, peak_powers));
+            peak_bins = _mm_or_pd(_mm_and_pd(greater, index), _mm_andnot_pd(greater, peak_bins));
+        }
+
+        double lane_bins[2];
+        _mm_storeu_pd(lane_bins, peak_bins);
+        peak_indices[w] = (size_t) lane_bins[0];
+        peak_indices[w + 1] = (size_t) lane_bins[1];
+    }
+    peak_power_bins_from(bins, num_bins, num_windows, w, peak_indices);
+}
+
+
+__attribute__((target("avx2")))
+static void window_samples_avx2(const double *samples,
+                                const double *window,
+                                double *windowed_samples,
+                                size_t num_samples)
+{
+    size_t i = 0;
+    __m256d sum = _mm256_setzero_pd();
+    for (; i + 4 <= num_samples; i += 4) {
+        sum = _mm256_add_pd(sum, _mm256_loadu_pd(&samples[i]));
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, sum);
+    double mean = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    for (; i < num_samples; i++) {
+        mean += samples[i];
+    }
+    mean /= num_samples;
+
+    __m256d mean_vector = _mm256_set1_pd(mean);
+    for (i = 0; i + 4 <= num_samples; i += 4) {
+        __m256d cleaned = _mm256_sub_pd(_mm256_loadu_pd(&samples[i]), mean_vector);
+        __m256d coefficients = _mm256_loadu_pd(&window[i]);
+        _mm256_storeu_pd(&windowed_samples[i], _mm256_mul_pd(cleaned, coefficients));
+    }
+    for (; i < num_samples; i++) {
+        windowed_samples[i] = (samples[i] - mean) * window[i];
+    }
+}
+
+
+__attribute__((target("avx2")))
+static size_t peak_power_bin_avx2(const double *bins, size_t num_bins) {
+    // Each iteration loads four complex bins. The horizontal add works within 128-bit halves, so
+    // the powers come out in the order [0, 2, 1, 3], and the index vector follows the same order.
+    __m256d peak_powers = _mm256_set1_pd(-1.0);
+    __m256d peak_indices = _mm256_setzero_pd();
+    __m256d indices = _mm256_set_pd(3.0, 1.0, 2.0, 0.0);
+    __m256d step = _mm256_set1_pd(4.0);
+
+    size_t i = 0;
+    for (; i + 4 <= num_bins; i += 4) {
+        __m256d first = _mm256_loadu_pd(&bins[2 * i]);
+        __m256d second = _mm256_loadu_pd(&bins[2 * i + 4]);
+        __m256d powers = _mm256_hadd_pd(_mm256_mul_pd(first, first),
+                                        _mm256_mul_pd(second, second));
+
+        __m256d greater = _mm256_cmp_pd(powers, peak_powers, _CMP_GT_OQ);
+        peak_powers = _mm256_blendv_pd(peak_powers, powers, greater);
+        peak_indices = _mm256_blendv_pd(peak_indices, indices, greater);
+        indices = _mm256_add_pd(indices, step);
+    }
+
+    double lane_powers[4];
+    double lane_indices[4];
+    _mm256_storeu_pd(lane_powers, peak_powers);
+    _mm256_storeu_pd(lane_indices, peak_indices);
+    return reduce_peak_lanes(lane_powers, lane_indices, 4, bins, i, num_bins);
+}
+
+
+__attribute__((target("avx2")))
+static void peak_power_bins_avx2(const double *bins,
+                                 size_t num_bins,
+                                 size_t num_windows,
+                                 size_t *peak_indices)
+{
+    // As in `peak_power_bin_avx2`, the lanes hold windows in the order [0, 2, 1, 3].
+    static const size_t lane_windows[4] = {0, 2, 1, 3};
+
+    size_t w = 0;
+    for (; w + 4 <= num_windows; w += 4) {
+        __m256d peak_powers = _mm256_set1_pd(-1.0);
+        __m256d peak_bins = _mm256_setzero_pd();
+        for (size_t i = 0; i < num_bins; i++) {
+            __m256d first = _mm256_loadu_pd(&bins[2 * (i * num_windows + w)]);
+            __m256d second = _mm256_loadu_pd(&bins[2 * (i * num_windows + w) + 4]);
+            __m256d powers = _mm256_hadd_pd(_mm256_mul_pd(first, first),
+                                            _mm256_mul_pd(second, second));
+
+            __m256d greater = _mm256_cmp_pd(powers, peak_powers, _CMP_GT_OQ);
+            peak_powers = _mm256_blendv_pd(peak_powers, powers, greater);
+            peak_bins = _mm256_blendv_pd(peak_bins, _mm256_set1_pd((double) i), greater);
+        }
+
+        double lane_bins[4];
+        _mm256_storeu_pd(lane_bins, peak_bins);
+        for (size_t lane = 0; lane < 4; lane++) {
+            peak_indices[w + lane_windows[lane]] = (size_t) lane_bins[lane];
+        }
+    }
+    peak_power_bins_from(bins, num_bins, num_windows, w, peak_indices);
+}
+
+
+__attribute__((target("avx512f")))
+static void window_samples_avx512(const double *samples,
+                                  const double *window,
+                                  double *windowed_samples,
+                                  size_t num_samples)
+{
+    size_t i = 0;
+    __m512d sum = _mm512_setzero_pd();
+    for (; i + 8 <= num_samples; i += 8) {
+        sum = _mm512_add_pd(sum, _mm512_loadu_pd(&samples[i]));
+    }
+    double mean = _mm512_reduce_add_pd(sum);
+    for (; i < num_samples; i++) {
+        mean += samples[i];
+    }
+    mean /= num_samples;
+
+    __m512d mean_vector = _mm512_set1_pd(mean);
+    for (i = 0; i + 8 <= num_samples; i += 8) {
+        __m512d cleaned = _mm512_sub_pd(_mm512_loadu_pd(&samples[i]), mean_vector);
+        __m512d coefficients = _mm512_loadu_pd(&window[i]);
+        _mm512_storeu_pd(&windowed_samples[i], _mm512_mul_pd(cleaned, coefficients));
+    }
+    for (; i < num_samples; i++) {
+        windowed_samples[i] = (samples[i] - mean) * window[i];
+    }
+}
+
+
+__attribute__((target("avx512f")))
+static size_t peak_power_bin_avx512(const double *bins, size_t num_bins) {
+    // Each iteration loads eight complex bins into two registers, then gathers the real and
+    // imaginary parts into their own registers so the powers come out in bin order.
+    __m512i real_lanes = _mm512_set_epi64(14, 12, 10, 8, 6, 4, 2, 0);
+    __m512i imaginary_lanes = _mm512_set_epi64(15, 13, 11, 9, 7, 5, 3, 1);
+    __m512d peak_powers = _mm512_set1_pd(-1.0);
+    __m512d peak_indices = _mm512_setzero_pd();
+    __m512d indices = _mm512_set_pd(7.0, 6.0, 5.0, 4.0, 3.0, 2.0, 1.0, 0.0);
+    __m512d step = _mm512_set1_pd(8.0);
+
+    size_t i = 0;
+    for (; i + 8 <= num_bins; i += 8) {
+        __m512d first = _mm512_loadu_pd(&bins[2 * i]);
+        __m512d second = _mm512_loadu_pd(&bins[2 * i + 8]);
+        __m512d real = _mm512_permutex2var_pd(first, real_lanes, second);
+        __m512d imaginary = _mm512_permutex2var_pd(first, imaginary_lanes, second);
+        __m512d powers = _mm512_add_pd(_mm512_mul_pd(real, real),
+                                       _mm512_mul_pd(imaginary, imaginary));
+
+        __mmask8 greater = _mm512_cmp_pd_mask(powers, peak_powers, _CMP_GT_OQ);
+        peak_powers = _mm512_mask_blend_pd(greater, peak_powers, powers);
+        peak_indices = _mm512_mask_blend_pd(greater, peak_indices, indices);
+        indices = _mm512_add_pd(indices, step);
+    }
+
+    double lane_powers[8];
+    double lane_indices[8];
+    _mm512_storeu_pd(lane_powers, peak_powers);
+    _mm512_storeu_pd(lane_indices, peak_indices);
+    return reduce_peak_lanes(lane_powers, lane_indices, 8, bins, i, num_bins);
+}
+
+
+__attribute__((target("avx512f")))
+static void peak_power_bins_avx512(const double *bins,
+                                   size_t num_bins,
+                                   size_t num_windows,
+                                   size_t *peak_indices)
+{
+    __m512i real_lanes = _mm512_set_epi64(14, 12, 10, 8, 6, 4, 2, 0);
+    __m512i imaginary_lanes = _mm512_set_epi64(15, 13, 11, 9, 7, 5, 3, 1);
+
+    size_t w = 0;
+    for (; w + 8 <= num_windows; w += 8) {
+        __m512d peak_powers = _mm512_set1_pd(-1.0);
+        __m512d peak_bins = _mm512_setzero_pd();
+        for (size_t i = 0; i < num_bins; i++) {
+            __m512d first = _mm512_loadu_pd(&bins[2 * (i * num_windows + w)]);
+            __m512d second = _mm512_loadu_pd(&bins[2 * (i * num_windows + w) + 8]);
+            __m512d real = _mm512_permutex2var_pd(first, real_lanes, second);
+            __m512d imaginary = _mm512_permutex2var_pd(first, imaginary_lanes, second);
+            __m512d powers = _mm512_add_pd(_mm512_mul_pd(real, real),
+                                           _mm512_mul_pd(imaginary, imaginary));
+
+            __mmask8 greater = _mm512_cmp_pd_mask(powers, peak_powers, _CMP_GT_OQ);
+            peak_powers = _mm512_mask_blend_pd(greater, peak_powers, powers);
+            peak_bins = _mm512_mask_blend_pd(greater, peak_bins, _mm512_set1_pd((double) i));
+        }
+
+        double lane_bins[8];
+        _mm512_storeu_pd(lane_bins, peak_bins);
+        for (size_t lane = 0; lane < 8; lane++) {
+            peak_indices[w + lane] = (size_t) lane_bins[lane];
+        }
+    }
+    peak_power_bins_from(bins, num_bins, num_windows, w, peak_indices);
+}
+
+
+#endif  // SSTV_SINGLE_PRECISION
+
+
+#endif  // SPECTRAL_KERNELS_X86
+
+
+static const SpectralKernels scalar_kernels = {
+    .name            = "scalar",
+    .window_samples  = window_samples_scalar,
+    .peak_power_bin  = peak_power_bin_scalar,
+    .peak_power_bins = peak_power_bins_scalar,
+};
+
+#if SPECTRAL_KERNELS_X86
+static const SpectralKernels sse2_kernels = {
+    .name            = "sse2",
+    .window_samples  = window_samples_sse2,
+    .peak_power_bin  = peak_power_bin_sse2,
+    .peak_power_bins = peak_power_bins_sse2,
+};
+
+static const SpectralKernels avx2_kernels = {
+    .name            = "avx2",
+    .window_samples  = window_samples_avx2,
+    .peak_power_bin  = peak_power_bin_avx2,
+    .peak_power_bins = peak_power_bins_avx2,
+};
+
+static const SpectralKernels avx512_kernels = {
+    .name            = "avx512",
+    .window_samples  = window_samples_avx512,
+    .peak_power_bin  = peak_power_bin_avx512,
+    .peak_power_bins = peak_power_bins_avx512,
+};
+#endif  // SPECTRAL_KERNELS_X86
+
+
+static const SpectralKernels *selected_kernels = NULL;
+static pthread_once_t selected_kernels_once = PTHREAD_ONCE_INIT;
+
+
+/**
+ * Selects the best set of spectral kernels for the CPU and stores it in {@code selected_kernels}.
+ *
+ * The kernels are listed from most to least preferred. The first one the CPU supports is chosen,
+ * unless the {@code SSTV_SPECTRAL_KERNELS} environment variable names a specific supported set,
+ * which is useful for comparing the kernels on one machine.
+ */
+static void select_spectral_kernels(void) {
+    const SpectralKernels *candidates[4];
+    size_t num_candidates = 0;
+#if SPECTRAL_KERNELS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        candidates[num_candidates++] = &avx512_kernels;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        candidates[num_candidates++] = &avx2_kernels;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        candidates[num_candidates++] = &sse2_kernels;
+    }
+#endif
+    candidates[num_candidates++] = &scalar_kernels;
+
+    const SpectralKernels *selected = candidates[0];
+    const char *requested = getenv("SSTV_SPECTRAL_KERNELS");
+    if (requested != NULL) {
+        for (size_t i = 0; i < num_candidates; i++) {
+            if (strcmp(candidates[i]->name, requested) == 0) {
+                selected = candidates[i];
+            }
+        }
+    }
+
+    log_debug("using %s spectral kernels", selected->name);
+    selected_kernels = selected;
+}
+
+
+const SpectralKernels *get_spectral_kernels(void) {
+    pthread_once(&selected_kernels_once, select_spectral_kernels);
+    return selected_kernels;
+}
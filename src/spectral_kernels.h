@@ -0,0 +1,83 @@
+#ifndef _SPECTRAL_KERNELS_H_
+#define _SPECTRAL_KERNELS_H_
+
+
+#include "precision.h"
+#include <stdlib.h>
+
+
+typedef struct spectral_kernels_s SpectralKernels;
+
+
+/**
+ * A set of implementations for the per-window work around the DFT.
+ *
+ * One set exists for each instruction set the program was compiled for. The best set supported by
+ * the CPU is selected at runtime, so the same binary runs at full speed on any x86 machine.
+ *
+ * @var name             A human-readable name for the instruction set of the kernels.
+ * @var window_samples   Removes the DC offset from {@code num_samples} samples and multiplies them
+ *                       by a window table, placing the result in {@code windowed_samples}.
+ * @var peak_power_bin   Finds the index of the complex bin with the largest squared magnitude in
+ *                       an array of interleaved real and imaginary parts. Ties go to the lowest
+ *                       index.
+ * @var peak_power_bins  Finds the peak power bin of each window in a batch, as
+ *                       {@code peak_power_bin} does for one window. The bins are laid out
+ *                       bin-major, with bin {@code i} of window {@code w} at complex index
+ *                       {@code i * num_windows + w}, so the same bin of consecutive windows is
+ *                       contiguous and each lane of a vector follows one window.
+ */
+struct spectral_kernels_s {
+    const char *name;
+    void (*window_samples)(const Sample *samples,
+                           const Sample *window,
+                           Sample *windowed_samples,
+                           size_t num_samples);
+    size_t (*peak_power_bin)(const Sample *bins, size_t num_bins);
+    void (*peak_power_bins)(const Sample *bins,
+                            size_t num_bins,
+                            size_t num_windows,
+                            size_t *peak_indices);
+};
+
+
+/**
+ * Gets the best set of spectral kernels supported by the CPU.
+ *
+ * The CPU is only inspected on the first call, and the same set is returned afterwards.
+ *
+ * @return The spectral kernels to use.
+ */
+const SpectralKernels *get_spectral_kernels(void);
+
+
+/**
+ * Fills a table with the Hann window coefficients for a window size.
+ *
+ * @param window       The array to fill, with at least {@code num_samples} entries.
+ * @param num_samples  The number of samples in the window.
+ */
+void fill_hann_window(Sample *window, size_t num_samples);
+
+
+/**
+ * Interpolates the fractional index of a spectral peak from complex DFT bins.
+ *
+ * This is the barycentric interpolation of {@code barycentric_peak_interpolation}, but only the
+ * magnitudes of the peak bin and its two neighbors are computed.
+ *
+ * @param bins        The interleaved real and imaginary parts of the DFT bins.
+ * @param num_bins    The number of complex bins.
+ * @param bin_stride  The distance between consecutive bins, in complex values. This is 1 for a
+ *                    single window and the number of windows for a bin-major batch.
+ * @param index       The index of the peak bin, as returned by {@code peak_power_bin}.
+ *
+ * @return The interpolated (fractional) bin index of the peak.
+ */
+double interpolate_peak_bin(const Sample *bins,
+                            size_t num_bins,
+                            size_t bin_stride,
+                            size_t index);
+
+
+#endif  // _SPECTRAL_KERNELS_H_
@@ -0,0 +1,103 @@
+#include "spsc_ring.h"
+#include <assert.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/** The number of times a blocked push or pop retries before yielding the processor. */
+#define SPSC_RING_SPIN_COUNT 64
+
+
+/**
+ * Waits a little before a blocked push or pop retries.
+ *
+ * The first retries spin, since the other stage usually frees a slot or publishes a block within
+ * microseconds. After that, the processor is yielded so a stalled stage does not burn a core.
+ *
+ * @param num_retries  The number of retries so far.
+ */
+static void spsc_ring_backoff(size_t num_retries) {
+    if (num_retries >= SPSC_RING_SPIN_COUNT) {
+        sched_yield();
+    }
+}
+
+
+SpscRing *spsc_ring_create(size_t num_slots, size_t slot_size) {
+    assert(num_slots > 0 && (num_slots & (num_slots - 1)) == 0 &&
+           "spsc_ring_create needs a power of 2 slots");
+
+    // The counters are aligned to cache lines, so the ring itself must be too.
+    SpscRing *ring = (SpscRing *) aligned_alloc(SPSC_RING_CACHE_LINE_SIZE, sizeof(SpscRing));
+    uint8_t *slots = (uint8_t *) malloc(num_slots * slot_size);
+    if (ring == NULL || slots == NULL) {
+        free(ring);
+        free(slots);
+        return NULL;
+    }
+
+    ring->slots = slots;
+    ring->slot_size = slot_size;
+    ring->num_slots = num_slots;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    return ring;
+}
+
+
+bool spsc_ring_try_push(SpscRing *ring, const void *block) {
+    // Only the producer writes `head`, so its own value needs no ordering. `tail` is acquired so
+    // that the consumer is done reading a slot before it is overwritten.
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail == ring->num_slots) {
+        return false;
+    }
+
+    size_t slot = head & (ring->num_slots - 1);
+    memcpy(&ring->slots[slot * ring->slot_size], block, ring->slot_size);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return true;
+}
+
+
+bool spsc_ring_try_pop(SpscRing *ring, void *block) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (head == tail) {
+        return false;
+    }
+
+    size_t slot = tail & (ring->num_slots - 1);
+    memcpy(block, &ring->slots[slot * ring->slot_size], ring->slot_size);
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+
+void spsc_ring_push(SpscRing *ring, const void *block) {
+    for (size_t num_retries = 0; !spsc_ring_try_push(ring, block); num_retries++) {
+        spsc_ring_backoff(num_retries);
+    }
+}
+
+
+void spsc_ring_pop(SpscRing *ring, void *block) {
+    for (size_t num_retries = 0; !spsc_ring_try_pop(ring, block); num_retries++) {
+        spsc_ring_backoff(num_retries);
+    }
+}
+
+
+void spsc_ring_free(SpscRing *ring) {
+    if (ring == NULL) {
+        return;
+    }
+
+    free(ring->slots);
+    free(ring);
+}
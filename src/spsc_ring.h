@@ -0,0 +1,102 @@
+#ifndef _SPSC_RING_H_
+#define _SPSC_RING_H_
+
+
+#define SPSC_RING_CACHE_LINE_SIZE 64
+
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+
+typedef struct spsc_ring_s SpscRing;
+
+
+/**
+ * A bounded, lock-free queue of fixed-size blocks between one producer thread and one consumer
+ * thread, which connects two stages of a pipeline.
+ *
+ * Blocks are copied into and out of a ring of slots. The producer only writes {@code head} and the
+ * consumer only writes {@code tail}, so neither needs a lock: a block is published by the release
+ * store of {@code head} after it is copied, and a slot is handed back by the release store of
+ * {@code tail} after it is read. The two counters are on separate cache lines so the threads do not
+ * contend for one line. A full ring makes the producer wait, which keeps a fast stage from running
+ * arbitrarily far ahead of a slow one.
+ *
+ * @var slots      The storage of the slots, {@code num_slots * slot_size} bytes.
+ * @var slot_size  The number of bytes in each block.
+ * @var num_slots  The number of slots, which is a power of 2.
+ * @var head       The number of blocks pushed, written only by the producer.
+ * @var tail       The number of blocks popped, written only by the consumer.
+ */
+struct spsc_ring_s {
+    uint8_t *slots;
+    size_t slot_size;
+    size_t num_slots;
+    _Alignas(SPSC_RING_CACHE_LINE_SIZE) atomic_size_t head;
+    _Alignas(SPSC_RING_CACHE_LINE_SIZE) atomic_size_t tail;
+};
+
+
+/**
+ * Creates an empty ring.
+ *
+ * @param num_slots  The number of blocks the ring can hold, which must be a power of 2.
+ * @param slot_size  The number of bytes in each block.
+ *
+ * @return A pointer to the new ring. If memory cannot be allocated, {@code NULL} is returned.
+ */
+SpscRing *spsc_ring_create(size_t num_slots, size_t slot_size);
+
+
+/**
+ * Copies a block into a ring, if it has a free slot. Only the producer thread may call this.
+ *
+ * @param ring   The ring to push to.
+ * @param block  The block of {@code ring->slot_size} bytes to push.
+ *
+ * @return Whether the block was pushed, which it is not if the ring is full.
+ */
+bool spsc_ring_try_push(SpscRing *ring, const void *block);
+
+
+/**
+ * Copies the oldest block out of a ring, if it has one. Only the consumer thread may call this.
+ *
+ * @param ring   The ring to pop from.
+ * @param block  The location to copy the block of {@code ring->slot_size} bytes to.
+ *
+ * @return Whether a block was popped, which it is not if the ring is empty.
+ */
+bool spsc_ring_try_pop(SpscRing *ring, void *block);
+
+
+/**
+ * Copies a block into a ring, waiting for a free slot if it is full.
+ *
+ * @param ring   The ring to push to.
+ * @param block  The block of {@code ring->slot_size} bytes to push.
+ */
+void spsc_ring_push(SpscRing *ring, const void *block);
+
+
+/**
+ * Copies the oldest block out of a ring, waiting for one if it is empty.
+ *
+ * @param ring   The ring to pop from.
+ * @param block  The location to copy the block of {@code ring->slot_size} bytes to.
+ */
+void spsc_ring_pop(SpscRing *ring, void *block);
+
+
+/**
+ * Frees a ring returned by {@code spsc_ring_create}.
+ *
+ * @param ring  The ring to free.
+ */
+void spsc_ring_free(SpscRing *ring);
+
+
+#endif  // _SPSC_RING_H_
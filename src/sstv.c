@@ -1,11 +1,28 @@
+#include "batch_reader.h"
+#include "freq_processing.h"
+#include "image_sink.h"
 #include "logger.h"
+#include "mode_detect.h"
 #include "modes.h"
+#include "perf_counters.h"
 #include "png_file.h"
+#include "prescreen.h"
+#include "scoreboard.h"
+#include "sstv_index.h"
+#include "sstv_params.h"
+#include "soak.h"
 #include "sstv_processing.h"
 #include "wav_file.h"
+#ifndef SSTV_FIXED_POINT
 #include <fftw3.h>
+#endif
+#include <assert.h>
+#include <getopt.h>
 #include <limits.h>
 #include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -13,120 +30,1590 @@
 #include <unistd.h>
 
 
+/** The exit status when no SSTV transmission is found, as opposed to 1 for other errors. */
+#define SSTV_EXIT_NO_SSTV 2
+
+
+/**
+ * The number of lines of image data that the decoder can run ahead of the PNG encoder by. One
+ * line of image data is {@code sstv_mode_rows_per_line} rows of the image.
+ */
+#define SSTV_LINE_RING_SLOTS 16
+
+
+/** The number of files of a batch that are read ahead of the one being decoded. */
+#define SSTV_BATCH_READ_AHEAD 4
+
+
+/** Sample rates that wisdom is generated for with `-W`, covering common wave audio recordings. */
+static const uint32_t wisdom_sample_rates[] = {8000, 11025, 12000, 16000, 22050, 44100, 48000};
+
+
 void usage(const char *error) {
     if (error != NULL) {
         printf("error: %s\n", error);
     }
 
-    printf("usage: sstv [-a sample] [-c code] [-o path] [-v] path\n");
+    printf("usage: sstv [-a sample] [-c code] [-i | -I] [-j threads] [-l seconds] [-m]\n");
+    printf("            [-o path] [-s] [-t ratio] [-v] [-w path] [-x] [--deadline seconds]\n");
+    printf("            [--checkpoint seconds] [--log-format format] [--perf]\n");
+    printf("            [--preset name] [--preview step] [--set name=value]... [--sink spec]\n");
+    printf("            path...\n");
+    printf("       sstv -W -w path\n");
+    printf("       sstv --generate case -o path\n");
+    printf("       sstv [-j threads] [-w path] [--set name=value]... [--update]\n");
+    printf("            --scoreboard path\n");
+    printf("       sstv [-a sample] [-j threads] [-m] [-w path] [--preset name]\n");
+    printf("            [--preview step] [--receivers count] [--set name=value]...\n");
+    printf("            [--soak-time seconds] --soak speed [path]\n");
     printf("\n");
     printf("options:\n");
-    printf("  -a sample  align the image decoding start by the specified sample count\n");
-    printf("  -c code    force the use of the specified VIS code and begin parsing at the\n");
-    printf("             offset specified with `-a' (or 0 by default)\n");
-    printf("  -h         print this message and exit\n");
-    printf("  -o path    specify the output path for the image file (default .)\n");
-    printf("  -v         print verbose debug messages about program execution\n");
+    printf("  -a sample   align the image decoding start by the specified sample count\n");
+    printf("  -c code     force the use of the specified VIS code and begin parsing at the\n");
+    printf("              offset specified with `-a' (or 0 by default)\n");
+    printf("  -h          print this message and exit\n");
+    printf("  -i          keep an index of the headers and line starts found in `path' in\n");
+    printf("              `path%s', and reuse it while `path' is unchanged\n",
+           SSTV_INDEX_EXTENSION);
+    printf("  -I          like `-i', and also keep the decoded image data in the index, so\n");
+    printf("              images can be saved again without reading `path'\n");
+    printf("  -j threads  search for headers and sync pulses with up to the specified number of\n");
+    printf("              threads (default the number of online processors)\n");
+    printf("  -l seconds  the minimum leader tone time for the pre-screen to pass (default %.2f)\n",
+           PRESCREEN_DEFAULT_LEADER_TIME_SEC);
+    printf("  -m          find the sync pulse of each line with a matched filter over the whole\n");
+    printf("              image, which is more robust in noise\n");
+    printf("  -o path     specify the output path for the image file (default .)\n");
+    printf("  -s          decode each channel of a multi-channel file separately and\n");
+    printf("              concurrently, saving one image per channel with a `-chN' suffix\n");
+    printf("  -t ratio    the fraction of a 10ms block's energy that must be at a header tone\n");
+    printf("              for the pre-screen to count it, or 0 to disable the pre-screen\n");
+    printf("              (default %.2f)\n", PRESCREEN_DEFAULT_TONE_RATIO);
+    printf("  -v          print verbose debug messages about program execution\n");
+    printf("  -w path     load FFTW wisdom from the specified file and save new wisdom to it on\n");
+    printf("              exit, which enables more rigorous (and faster) DFT plans\n");
+    printf("  -W          generate wisdom for every supported mode and common sample rate into\n");
+    printf("              the file specified with `-w', then exit\n");
+    printf("  -x          decode every transmission in the file, saving one image per\n");
+    printf("              transmission with a `-N' suffix\n");
+    printf("  --checkpoint seconds\n");
+    printf("              like `-i', and also save the progress of the header search and of\n");
+    printf("              each image to the index at most every specified time, so a decode\n");
+    printf("              that is killed resumes from there when run again\n");
+    printf("  --deadline seconds\n");
+    printf("              save an image within the specified time from the start, decoding\n");
+    printf("              lines more cheaply as time runs short and leaving them black once it\n");
+    printf("              is up\n");
+    printf("  --generate case\n");
+    printf("              write the transmissions of the named scoreboard case, such as\n");
+    printf("              `clean-11025' or `snr10-11025', in every supported mode to a 16-bit\n");
+    printf("              wave file at the output path, then exit\n");
+    printf("  --log-format format\n");
+    printf("              print messages as `text' (default) or as `json' objects, one per\n");
+    printf("              line, with the time, level, thread and source line of each\n");
+    printf("  --perf      count cycles, instructions, cache misses and branch misses of each\n");
+    printf("              stage of the decode where the system permits it, and print them\n");
+    printf("              with the time of each stage\n");
+    printf("  --preset name\n");
+    printf("              use the analysis parameters of the named preset, one of `fast',\n");
+    printf("              `balanced' and `robust' (default `%s')\n", SSTV_PARAMS_DEFAULT_PRESET);
+    printf("  --preview step\n");
+    printf("              save a thumbnail of every step-th pixel and line, decoded without\n");
+    printf("              a sync search after the first line\n");
+    printf("  --receivers count\n");
+    printf("              replay a soak test to the specified number of receivers at once\n");
+    printf("              (default 1)\n");
+    printf("  --scoreboard path\n");
+    printf("              decode generated transmissions in noise, clock drift and at other\n");
+    printf("              sample rates with every preset and sync method, print the time and\n");
+    printf("              image quality of each, and compare them with the baseline in `path',\n");
+    printf("              failing on any result that is missing from it, then exit\n");
+    printf("  --set name=value\n");
+    printf("              override one analysis parameter of the preset: header_window_sec,\n");
+    printf("              hop_time_sec, sync_start_ratio, sync_end_ratio, sync_end_step,\n");
+    printf("              sync_track_ratio, pixel_window_scale or margin_hz\n");
+    printf("  --sink spec\n");
+    printf("              deliver images as `png' files at the output path (default), as `raw'\n");
+    printf("              RGB or `ppm' images on the standard output with messages on the\n");
+    printf("              standard error, or to a ring of frames in the shared memory object\n");
+    printf("              named by `shm:/name', written line by line as they are decoded\n");
+    printf("  --soak speed\n");
+    printf("              replay `path' (or a generated transmission) as if it were received\n");
+    printf("              at the specified multiple of real time, or as fast as possible for\n");
+    printf("              0, decode every image in it and discard them, and print the real-time\n");
+    printf("              factor, line latency percentiles and memory growth, then exit\n");
+    printf("  --soak-time seconds\n");
+    printf("              replay a soak test over and over until the specified time has\n");
+    printf("              passed (default one pass)\n");
+    printf("  --update    record the results of a scoreboard run in its baseline instead of\n");
+    printf("              comparing them with it\n");
     printf("\n");
     printf("arguments:\n");
-    printf("  path       the path to the wave audio file to decode\n");
+    printf("  path        the path to the wave audio file to decode, or several paths to decode\n");
+    printf("              as a batch, saving each image with the name of its file as a suffix\n");
+    printf("              and reading the next files ahead of the decode\n");
+    printf("\n");
+    printf("exit status:\n");
+    printf("  0 if an image was decoded, %d if no SSTV transmission was found, and 1 otherwise\n",
+           SSTV_EXIT_NO_SSTV);
+    printf("  (for a batch, 0 if an image was decoded from any file, for the scoreboard,\n");
+    printf("  0 if every result met its baseline, and for a soak test, 0 if every\n");
+    printf("  receiver kept up with the replay, and 1 otherwise)\n");
     exit(error != NULL);
 }
 
 
-void sstv_decode_and_save(const char *input_path,
+typedef struct decode_options_s DecodeOptions;
+typedef struct channel_job_s ChannelJob;
+typedef struct png_job_s PngJob;
+typedef struct checkpoint_target_s CheckpointTarget;
+
+
+/**
+ * The command line options that control how a wave file is decoded.
+ *
+ * @var align_add       The sample count to align the image decoding start by.
+ * @var force_vis_code  The VIS code to force, or a negative value to decode it from the samples.
+ * @var split_channels  Whether to decode each channel of a multi-channel file separately.
+ * @var num_threads     The maximum number of threads for the header and sync searches.
+ * @var decode_all      Whether to decode every transmission rather than just the first.
+ * @var sync_method     How to find the sync pulse of each line.
+ * @var params          The analysis parameters of the preset, with any overrides.
+ * @var prescreen       The thresholds of the pre-screen that runs before the header search.
+ * @var preview_step    The step between decoded pixels and lines, which is 1 for a full decode.
+ * @var use_index       Whether to load and save an index next to the input file.
+ * @var index_data      Whether to keep the decoded image data in the index.
+ * @var deadline_sec    The time of {@code sstv_monotonic_time_sec} by which each image should be
+ *                      saved, or 0 for no deadline.
+ * @var checkpoint_sec  The minimum time between two checkpoints saved to the index, or 0 for no
+ *                      checkpoints.
+ * @var perf            The counters that each stage of the decode is attributed to, or
+ *                      {@code NULL} to not count them.
+ * @var sink            The destination of the decoded images.
+ */
+struct decode_options_s {
+    size_t align_add;
+    int force_vis_code;
+    bool split_channels;
+    size_t num_threads;
+    bool decode_all;
+    SyncMethod sync_method;
+    SstvParams params;
+    PrescreenThresholds prescreen;
+    size_t preview_step;
+    bool use_index;
+    bool index_data;
+    double deadline_sec;
+    double checkpoint_sec;
+    PerfCounters *perf;
+    ImageSink *sink;
+};
+
+
+/**
+ * The arguments of a thread that decodes one channel of a multi-channel wave file.
+ *
+ * @var wav_samples  The samples of the channel.
+ * @var input_path   The path of the wave file.
+ * @var index_path   The path of the channel's index.
+ * @var output_path  The path to save the channel's image to.
+ * @var options      The decoding options.
+ * @var found        Whether an SSTV transmission was found in the channel, set by the thread.
+ */
+struct channel_job_s {
+    const WavSamples *wav_samples;
+    const char *input_path;
+    char index_path[PATH_MAX];
+    char output_path[PATH_MAX];
+    const DecodeOptions *options;
+    bool found;
+};
+
+
+/**
+ * The arguments of a thread that converts the colors of an image and delivers it to a sink (which
+ * encodes it to a PNG file by default) while the image is being decoded.
+ *
+ * @var line_ring    The ring that the decoder pushes each line of image data to.
+ * @var image_mode   The layout of the image data, which is reduced for previews.
+ * @var sink         The sink to deliver the image to.
+ * @var output_path  The path to save the image to.
+ */
+struct png_job_s {
+    SpscRing *line_ring;
+    SstvMode image_mode;
+    ImageSink *sink;
+    const char *output_path;
+};
+
+
+/**
+ * The context of the checkpoints of a decode, which are recorded in its index and saved.
+ *
+ * @var index        The index to record the progress in.
+ * @var index_path   The path to save the index to.
+ * @var input_path   The path of the input file that the index is for.
+ * @var image_start  The sample the decoding of the current image started from.
+ * @var vis_code     The VIS code of the mode of the current image.
+ * @var line_starts  The line starts of the current image, or {@code NULL} if no image is being
+ *                   decoded.
+ */
+struct checkpoint_target_s {
+    SstvIndex *index;
+    const char *index_path;
+    const char *input_path;
+    size_t image_start;
+    uint8_t vis_code;
+    const double *line_starts;
+};
+
+
+void sstv_output_path_with_suffix(const char *output_path,
+                                  const char *suffix,
+                                  char *buffer,
+                                  size_t buffer_size)
+{
+    // The suffix goes before the extension of the file name (if there is one), so that
+    // "dir/result.png" becomes "dir/result-suffix.png".
+    const char *file_name = strrchr(output_path, '/');
+    file_name = (file_name == NULL) ? output_path : file_name + 1;
+    const char *extension = strrchr(file_name, '.');
+    if (extension == NULL || extension == file_name) {
+        extension = output_path + strlen(output_path);
+    }
+
+    int stem_length = (int) (extension - output_path);
+    int length =
+        snprintf(buffer, buffer_size, "%.*s-%s%s", stem_length, output_path, suffix, extension);
+    if (length < 0 || (size_t) length >= buffer_size) {
+        log_fatal("output path '%s' is too long", output_path);
+    }
+}
+
+
+SstvMode sstv_image_layout(const SstvMode *mode, size_t preview_step) {
+    // A preview has the layout of the mode, but only one in `preview_step` pixels and lines.
+    SstvMode image_mode = *mode;
+    image_mode.width = (mode->width + preview_step - 1) / preview_step;
+    image_mode.height = (mode->height + preview_step - 1) / preview_step;
+    return image_mode;
+}
+
+
+void sstv_log_saved(const ImageSink *sink, size_t preview_step, const char *output_path) {
+    const char *kind = (preview_step > 1) ? "preview" : "image";
+    if (sink->type == IMAGE_SINK_PNG) {
+        log_info("saved %s to '%s'", kind, output_path);
+    }
+    else {
+        log_info("sent %s '%s' to %s", kind, output_path, image_sink_target(sink));
+    }
+}
+
+
+void sstv_save_image_data(const uint8_t *image_data,
+                          const SstvMode *mode,
+                          size_t preview_step,
+                          ImageSink *sink,
+                          const char *output_path)
+{
+    SstvMode image_mode = sstv_image_layout(mode, preview_step);
+    size_t width = image_mode.width;
+    size_t line_size = width * image_mode.num_channels;
+    size_t rows_per_line = sstv_mode_rows_per_line(mode);
+    ImageFrame *frame =
+        image_sink_begin(sink, output_path, width, rows_per_line * image_mode.height);
+    for (size_t data_line = 0; data_line < image_mode.height; data_line++) {
+        Pixel *rows = image_frame_rows(frame, rows_per_line);
+        png_file_y1crcby2_line_to_rgb(&image_data[data_line * line_size], width, rows);
+        image_frame_commit(frame, rows_per_line);
+    }
+    image_frame_end(frame);
+    sstv_log_saved(sink, preview_step, output_path);
+}
+
+
+void *sstv_save_image_lines(void *arg) {
+    PngJob *job = (PngJob *) arg;
+    size_t width = job->image_mode.width;
+    size_t data_height = job->image_mode.height;
+
+    uint8_t *line_data = (uint8_t *) malloc(job->line_ring->slot_size);
+    if (line_data == NULL) {
+        log_fatal("cannot allocate image line for '%s'", job->output_path);
+    }
+
+    // Each line of image data is converted straight into the memory of the sink and delivered as
+    // soon as the line is decoded.
+    size_t rows_per_line = sstv_mode_rows_per_line(&job->image_mode);
+    ImageFrame *frame =
+        image_sink_begin(job->sink, job->output_path, width, rows_per_line * data_height);
+    for (size_t data_line = 0; data_line < data_height; data_line++) {
+        spsc_ring_pop(job->line_ring, line_data);
+        png_file_y1crcby2_line_to_rgb(line_data, width, image_frame_rows(frame, rows_per_line));
+        image_frame_commit(frame, rows_per_line);
+    }
+    image_frame_end(frame);
+
+    free(line_data);
+    return NULL;
+}
+
+
+size_t sstv_image_start(uint32_t sample_rate, size_t vis_start, size_t align_add) {
+    return align_add + vis_start + round(SSTV_BIT_TIME_SEC * (CHAR_BIT+1) * sample_rate);
+}
+
+
+bool sstv_detect_mode(SstvSession *session, size_t search_start, ModeCandidate *best) {
+    ModeCandidate *candidates = (ModeCandidate *) malloc(num_sstv_modes * sizeof(ModeCandidate));
+    assert(candidates && "sstv_detect_mode cannot malloc candidates");
+
+    size_t num_candidates = detect_sstv_modes(session, search_start, candidates);
+    bool found = num_candidates > 0 && candidates[0].confidence >= MODE_DETECT_MIN_CONFIDENCE;
+    if (found) {
+        *best = candidates[0];
+        log_info("detected mode %s from the line timing with confidence %.2f",
+                 best->mode->name, best->confidence);
+    }
+    else {
+        log_debug("no mode fits the line timing after sample %lu", search_start);
+    }
+
+    free(candidates);
+    return found;
+}
+
+
+uint8_t sstv_transmission_vis_code(SstvSession *session, size_t vis_start) {
+    // A damaged VIS code, or one that a bit error turned into a code of no supported mode, is
+    // replaced by the mode that fits the line timing of the image after the header.
+    uint8_t vis_code = decode_vis_code(session, vis_start);
+    if (get_sstv_mode(vis_code) != NULL) {
+        return vis_code;
+    }
+
+    ModeCandidate candidate;
+    size_t image_start = sstv_image_start(session->wav_samples->sample_rate, vis_start, 0);
+    if (sstv_detect_mode(session, image_start, &candidate)) {
+        return candidate.mode->vis;
+    }
+    return vis_code;
+}
+
+
+void sstv_save_checkpoint(SstvSession *session, const SstvCheckpoint *checkpoint, void *context) {
+    CheckpointTarget *target = (CheckpointTarget *) context;
+    SstvIndex *index = target->index;
+
+    // The headers of an unfinished search for every header are recorded as far as it got, and a
+    // decode of only the first image can already use the first of them.
+    if (index->search != SSTV_INDEX_SEARCH_ALL && checkpoint->scan_sample > index->scan_sample) {
+        for (size_t i = index->num_transmissions; i < checkpoint->num_vis_starts; i++) {
+            size_t vis_start = checkpoint->vis_starts[i];
+            uint8_t vis_code = sstv_transmission_vis_code(session, vis_start);
+            sstv_index_add_transmission(index, vis_start, vis_code);
+        }
+        index->scan_sample = checkpoint->scan_sample;
+        if (index->num_transmissions > 0) {
+            index->search = SSTV_INDEX_SEARCH_FIRST;
+        }
+    }
+
+    // An unfinished image is recorded with its data so far, whether or not data is kept.
+    bool has_image = target->line_starts != NULL && checkpoint->image_data != NULL;
+    if (has_image && checkpoint->num_lines > 0) {
+        SstvIndexImage *image = sstv_index_find_image(index,
+                                                      target->image_start,
+                                                      target->vis_code,
+                                                      session->sync_method,
+                                                      session->preview_step);
+        if (image == NULL) {
+            image = sstv_index_add_image(index,
+                                         target->image_start,
+                                         target->vis_code,
+                                         session->sync_method,
+                                         session->preview_step);
+        }
+        if (image->data == NULL) {
+            image->data = (uint8_t *) malloc(image->data_size);
+            assert(image->data && "sstv_save_checkpoint cannot malloc image data");
+        }
+        memcpy(image->data, checkpoint->image_data, image->data_size);
+        memcpy(image->line_starts, target->line_starts, checkpoint->num_lines * sizeof(double));
+        image->num_decoded = checkpoint->num_lines;
+    }
+
+    index->modified = true;
+    if (sstv_index_save(index, target->index_path, target->input_path)) {
+        log_debug("saved checkpoint to '%s'", target->index_path);
+    }
+    else {
+        log_warn("cannot save checkpoint to '%s'", target->index_path);
+    }
+}
+
+
+bool sstv_decode_image_and_save(SstvSession *session,
+                                SstvIndex *index,
+                                uint8_t vis_code,
+                                size_t image_start,
+                                ImageSink *sink,
+                                const char *output_path)
+{
+    // From the VIS code, get the SSTV mode
+    const SstvMode *sstv_mode = get_sstv_mode(vis_code);
+    if (sstv_mode == NULL) {
+        return false;
+    }
+    log_debug("VIS mode is '%s' (%u)", sstv_mode->name, vis_code);
+
+    // An image decoded before has its line starts in the index, so its sync searches are skipped,
+    // and possibly its image data, so it is not decoded at all. An image that a checkpoint left
+    // unfinished is only of use to a decode that checkpoints too.
+    size_t preview_step = session->preview_step;
+    SstvIndexImage *image =
+        sstv_index_find_image(index, image_start, vis_code, session->sync_method, preview_step);
+    bool complete = image != NULL && image->num_decoded == image->num_lines;
+    if (complete && image->data != NULL) {
+        log_debug("using image data from the index");
+        sstv_save_image_data(image->data, sstv_mode, preview_step, sink, output_path);
+        return true;
+    }
+    session->known_starts = complete;
+    if (complete) {
+        log_debug("using line starts from the index");
+    }
+
+    // The line starts of a new image only go into the index once it is known that every line was
+    // decoded at full quality, so a deadline never makes a later decode of the image worse.
+    SstvMode image_mode = sstv_image_layout(sstv_mode, preview_step);
+    double *line_starts = complete ?
+        image->line_starts : (double *) calloc(image_mode.height, sizeof(double));
+    LineTier *line_tiers = (LineTier *) malloc(image_mode.height * sizeof(LineTier));
+    if (line_starts == NULL || line_tiers == NULL) {
+        log_fatal("cannot allocate line information for '%s'", output_path);
+    }
+
+    // With checkpoints, the decoded lines are kept up to date in the index as they are decoded,
+    // and an unfinished image resumes after its last decoded line.
+    SstvCheckpoint *checkpoint = complete ? NULL : session->checkpoint;
+    if (checkpoint != NULL) {
+        SstvMode *mode = &image_mode;
+        size_t data_size = mode->width * mode->height * mode->num_channels;
+        checkpoint->image_data = (uint8_t *) calloc(data_size, sizeof(uint8_t));
+        if (checkpoint->image_data == NULL) {
+            log_fatal("cannot allocate checkpoint image data for '%s'", output_path);
+        }
+        checkpoint->num_lines = 0;
+        if (image != NULL && image->data != NULL) {
+            memcpy(line_starts, image->line_starts, image->num_decoded * sizeof(double));
+            memcpy(checkpoint->image_data, image->data, data_size);
+            checkpoint->num_lines = image->num_decoded;
+        }
+
+        CheckpointTarget *target = (CheckpointTarget *) checkpoint->save_context;
+        target->image_start = image_start;
+        target->vis_code = vis_code;
+        target->line_starts = line_starts;
+    }
+
+    // The colors of each line are converted and encoded on another thread while the next lines
+    // are decoded, so saving the image takes little more time than decoding it.
+    PngJob png_job;
+    png_job.image_mode = image_mode;
+    png_job.sink = sink;
+    png_job.output_path = output_path;
+    png_job.line_ring = spsc_ring_create(
+        SSTV_LINE_RING_SLOTS, png_job.image_mode.width * png_job.image_mode.num_channels);
+    pthread_t png_thread;
+    if (png_job.line_ring == NULL ||
+        pthread_create(&png_thread, NULL, sstv_save_image_lines, &png_job) != 0)
+    {
+        log_fatal("cannot create image saving thread for '%s'", output_path);
+    }
+
+    // Process the sample data
+    prepare_mode_fft_plans(sstv_mode, session->wav_samples->sample_rate, &session->params);
+    session->line_starts = line_starts;
+    session->line_tiers = line_tiers;
+    session->line_ring = png_job.line_ring;
+    uint8_t *image_data = decode_image_data(session, sstv_mode, image_start);
+    session->line_starts = NULL;
+    session->line_tiers = NULL;
+    session->line_ring = NULL;
+    if (checkpoint != NULL) {
+        ((CheckpointTarget *) checkpoint->save_context)->line_starts = NULL;
+        free(checkpoint->image_data);
+        checkpoint->image_data = NULL;
+        checkpoint->num_lines = 0;
+    }
+
+    perf_counters_start(session->perf, PERF_STAGE_SAVE);
+    pthread_join(png_thread, NULL);
+    perf_counters_stop(session->perf, PERF_STAGE_SAVE);
+    spsc_ring_free(png_job.line_ring);
+    sstv_log_saved(sink, preview_step, output_path);
+
+    size_t tier_counts[SSTV_TIER_SKIPPED + 1] = {0};
+    for (size_t data_line = 0; data_line < image_mode.height; data_line++) {
+        tier_counts[line_tiers[data_line]]++;
+    }
+    bool has_deadline = session->deadline_sec > 0;
+    if (has_deadline && tier_counts[SSTV_TIER_FULL] < image_mode.height) {
+        log_warn("decoded %lu lines in full, %lu predicted, %lu reduced and %lu skipped",
+                 tier_counts[SSTV_TIER_FULL],
+                 tier_counts[SSTV_TIER_PREDICTED],
+                 tier_counts[SSTV_TIER_REDUCED],
+                 tier_counts[SSTV_TIER_SKIPPED]);
+    }
+    bool full_quality = !has_deadline || tier_counts[SSTV_TIER_FULL] == image_mode.height;
+    if (!full_quality) {
+        free(image_data);
+        image_data = NULL;
+    }
+    else if (!complete) {
+        // The image is found again, since a checkpoint may have added it and moved the others.
+        image =
+            sstv_index_find_image(index, image_start, vis_code, session->sync_method, preview_step);
+        if (image == NULL) {
+            image = sstv_index_add_image(
+                index, image_start, vis_code, session->sync_method, preview_step);
+        }
+        memcpy(image->line_starts, line_starts, image_mode.height * sizeof(double));
+        image->num_decoded = image->num_lines;
+        free(image->data);
+        image->data = NULL;
+        index->modified = true;
+    }
+    if (!complete) {
+        free(line_starts);
+    }
+    free(line_tiers);
+
+    // The index takes the image data if it is kept, and otherwise it is no longer needed.
+    if (index->keep_data && image_data != NULL) {
+        image->data = image_data;
+        index->modified = true;
+    }
+    else {
+        free(image_data);
+    }
+    return true;
+}
+
+
+bool sstv_decode_headerless_and_save(SstvSession *session,
+                                     SstvIndex *index,
+                                     ImageSink *sink,
+                                     const char *output_path)
+{
+    // Without a header, the image is taken to start in the first seconds of the samples, and its
+    // decoding starts from the first sync pulse that the detection found.
+    ModeCandidate candidate;
+    perf_counters_start(session->perf, PERF_STAGE_HEADERS);
+    bool found = sstv_detect_mode(session, 0, &candidate);
+    perf_counters_stop(session->perf, PERF_STAGE_HEADERS);
+    if (!found) {
+        return false;
+    }
+
+    log_debug("decoding headerless image from sample %lu", candidate.sync_start);
+    return sstv_decode_image_and_save(
+        session, index, candidate.mode->vis, candidate.sync_start, sink, output_path);
+}
+
+
+void sstv_find_headers(SstvSession *session, SstvIndex *index, bool find_all) {
+    perf_counters_start(session->perf, PERF_STAGE_HEADERS);
+    if (find_all && index->search != SSTV_INDEX_SEARCH_ALL) {
+        // A search that a checkpoint left unfinished resumes with the headers it found so far.
+        SstvCheckpoint *checkpoint = session->checkpoint;
+        if (checkpoint != NULL && index->scan_sample > 0) {
+            checkpoint->scan_sample = index->scan_sample;
+            checkpoint->num_vis_starts = index->num_transmissions;
+            checkpoint->vis_starts = (size_t *) malloc(index->num_transmissions * sizeof(size_t));
+            assert((checkpoint->vis_starts || index->num_transmissions == 0) &&
+                   "sstv_find_headers cannot malloc vis_starts");
+            for (size_t i = 0; i < index->num_transmissions; i++) {
+                checkpoint->vis_starts[i] = index->transmissions[i].vis_start;
+            }
+        }
+        else {
+            sstv_index_clear_transmissions(index);
+        }
+
+        size_t *vis_starts;
+        size_t num_vis_starts = find_all_vis_starts(session, &vis_starts);
+
+        // The checkpoints may have added some of the transmissions already.
+        for (size_t i = index->num_transmissions; i < num_vis_starts; i++) {
+            uint8_t vis_code = sstv_transmission_vis_code(session, vis_starts[i]);
+            sstv_index_add_transmission(index, vis_starts[i], vis_code);
+        }
+        index->search = SSTV_INDEX_SEARCH_ALL;
+        index->scan_sample = 0;
+        index->modified = true;
+        free(vis_starts);
+
+        if (checkpoint != NULL) {
+            free(checkpoint->vis_starts);
+            checkpoint->vis_starts = NULL;
+            checkpoint->num_vis_starts = 0;
+            checkpoint->scan_sample = 0;
+        }
+    }
+    else if (index->search == SSTV_INDEX_SEARCH_NONE) {
+        // When there is no first header, there are no headers at all.
+        size_t vis_start = find_vis_start(session);
+        if (vis_start == (size_t) SSTV_PROCESSING_NOT_FOUND) {
+            index->search = SSTV_INDEX_SEARCH_ALL;
+        }
+        else {
+            uint8_t vis_code = sstv_transmission_vis_code(session, vis_start);
+            sstv_index_add_transmission(index, vis_start, vis_code);
+            index->search = SSTV_INDEX_SEARCH_FIRST;
+        }
+        index->modified = true;
+    }
+    else {
+        log_debug("using header positions from the index");
+    }
+    perf_counters_stop(session->perf, PERF_STAGE_HEADERS);
+}
+
+
+bool sstv_decode_all_and_save(SstvSession *session,
+                              SstvIndex *index,
+                              const char *output_path,
+                              const DecodeOptions *options)
+{
+    sstv_find_headers(session, index, true);
+
+    // Each transmission gets its own numbered image. One with an unsupported mode is skipped
+    // rather than ending the program, so the rest of the recording is still decoded.
+    for (size_t i = 0; i < index->num_transmissions; i++) {
+        char suffix[32];
+        char transmission_path[PATH_MAX];
+        snprintf(suffix, sizeof(suffix), "%lu", i);
+        sstv_output_path_with_suffix(output_path,
+                                     suffix,
+                                     transmission_path,
+                                     sizeof(transmission_path));
+
+        size_t vis_start = index->transmissions[i].vis_start;
+        uint8_t vis_code = index->transmissions[i].vis_code;
+        log_debug("found VIS %lu in audio file at sample %lu", i, vis_start);
+        size_t image_start =
+            sstv_image_start(session->wav_samples->sample_rate, vis_start, options->align_add);
+        if (!sstv_decode_image_and_save(
+                session, index, vis_code, image_start, options->sink, transmission_path))
+        {
+            log_warn("skipping transmission %lu with unsupported VIS code %d", i, vis_code);
+        }
+    }
+
+    // A recording without any header may still be a headerless transmission, which is saved as
+    // the first one.
+    if (index->num_transmissions == 0) {
+        char transmission_path[PATH_MAX];
+        sstv_output_path_with_suffix(output_path, "0", transmission_path, PATH_MAX);
+        return sstv_decode_headerless_and_save(session, index, options->sink, transmission_path);
+    }
+    return true;
+}
+
+
+bool sstv_save_from_index(const SstvIndex *index,
                           const char *output_path,
-                          size_t align_add,
-                          int force_vis_code)
+                          const DecodeOptions *options)
 {
-    // Open the wave file and extract the samples
-    WavFile *wav_file = wav_file_open(input_path);
-    if (wav_file == NULL) {
-        log_fatal("cannot open wave audio file '%s'", input_path);
+    // The images to save are the ones that a decode would save, found the same way.
+    bool forced = options->force_vis_code >= 0;
+    bool numbered = options->decode_all && !forced;
+    size_t num_images = 0;
+    if (forced) {
+        num_images = 1;
     }
-    if (logger_verbose) {
-        log_debug("successfully opened wave audio file, header follow");
-        wav_file_print_header(wav_file);
+    else if (numbered && index->search == SSTV_INDEX_SEARCH_ALL) {
+        num_images = index->num_transmissions;
+    }
+    else if (!numbered && index->search != SSTV_INDEX_SEARCH_NONE) {
+        num_images = (index->num_transmissions > 0) ? 1 : 0;
     }
+    if (num_images == 0) {
+        return false;
+    }
+
+    // Nothing is saved unless every image has its data in the index, apart from transmissions
+    // with an unsupported mode, which a decode of every transmission skips.
+    const SstvIndexImage **images =
+        (const SstvIndexImage **) malloc(num_images * sizeof(SstvIndexImage *));
+    assert(images && "sstv_save_from_index cannot malloc images");
+    bool complete = true;
+    for (size_t i = 0; i < num_images && complete; i++) {
+        uint8_t vis_code = forced ?
+            (uint8_t) options->force_vis_code : index->transmissions[i].vis_code;
+        size_t image_start = forced ?
+            options->align_add :
+            sstv_image_start(index->sample_rate,
+                             index->transmissions[i].vis_start,
+                             options->align_add);
 
-    WavSamples *wav_samples = wav_file_get_mono_samples(wav_file);
-    if (wav_samples == NULL) {
-        log_fatal("cannot extract mono samples from wave audio file '%s'", input_path);
+        images[i] = NULL;
+        if (get_sstv_mode(vis_code) == NULL) {
+            complete = numbered;
+            continue;
+        }
+        images[i] = sstv_index_find_image(index,
+                                          image_start,
+                                          vis_code,
+                                          options->sync_method,
+                                          options->preview_step);
+        complete = images[i] != NULL && images[i]->data != NULL &&
+            images[i]->num_decoded == images[i]->num_lines;
+    }
+
+    for (size_t i = 0; i < num_images && complete; i++) {
+        if (images[i] == NULL) {
+            log_warn("skipping transmission %lu with unsupported VIS code %d",
+                     i, index->transmissions[i].vis_code);
+            continue;
+        }
+
+        char transmission_path[PATH_MAX];
+        const char *image_path = output_path;
+        if (numbered) {
+            char suffix[32];
+            snprintf(suffix, sizeof(suffix), "%lu", i);
+            sstv_output_path_with_suffix(output_path,
+                                         suffix,
+                                         transmission_path,
+                                         sizeof(transmission_path));
+            image_path = transmission_path;
+        }
+        sstv_save_image_data(images[i]->data,
+                             get_sstv_mode(images[i]->vis_code),
+                             options->preview_step,
+                             options->sink,
+                             image_path);
+    }
+
+    free(images);
+    return complete;
+}
+
+
+bool sstv_decode_samples_and_save(const WavSamples *wav_samples,
+                                  SstvIndex *index,
+                                  const char *index_path,
+                                  const char *input_path,
+                                  const char *output_path,
+                                  const DecodeOptions *options)
+{
+    SstvSession *session = sstv_session_create(wav_samples, &options->params);
+    if (session == NULL) {
+        log_fatal("cannot create decode session for '%s'", output_path);
+    }
+    session->num_scan_threads = options->num_threads;
+    session->sync_method = options->sync_method;
+    session->preview_step = options->preview_step;
+    session->deadline_sec = options->deadline_sec;
+    session->perf = options->perf;
+
+    // Most recordings without SSTV skip the much more expensive header search here, and only have
+    // their first seconds checked for a headerless transmission. A forced VIS code means there may
+    // be no header to screen for, and an index that has been searched already knows whether there
+    // is one.
+    bool find_headers = options->force_vis_code < 0;
+    bool has_leader = true;
+    if (find_headers && index->search == SSTV_INDEX_SEARCH_NONE) {
+        perf_counters_start(options->perf, PERF_STAGE_PRESCREEN);
+        has_leader = prescreen_has_leader(session, &options->prescreen);
+        perf_counters_stop(options->perf, PERF_STAGE_PRESCREEN);
+        if (!has_leader) {
+            log_warn("pre-screen found no SSTV header tones in '%s'", output_path);
+        }
+    }
+
+    // Checkpoints go into the index, which is saved each time, so a restarted decode of the same
+    // file resumes from the last one.
+    SstvCheckpoint checkpoint = {0};
+    CheckpointTarget target = {index, index_path, input_path, 0, 0, NULL};
+    if (options->checkpoint_sec > 0) {
+        checkpoint.interval_sec = options->checkpoint_sec;
+        checkpoint.last_save_sec = sstv_monotonic_time_sec();
+        checkpoint.save = sstv_save_checkpoint;
+        checkpoint.save_context = &target;
+        session->checkpoint = &checkpoint;
+    }
+
+    if (!has_leader) {
+        char transmission_path[PATH_MAX];
+        const char *image_path = output_path;
+        if (options->decode_all) {
+            sstv_output_path_with_suffix(output_path, "0", transmission_path, PATH_MAX);
+            image_path = transmission_path;
+        }
+        bool found = sstv_decode_headerless_and_save(session, index, options->sink, image_path);
+        sstv_session_free(session);
+        return found;
+    }
+
+    if (options->decode_all && find_headers) {
+        bool found = sstv_decode_all_and_save(session, index, output_path, options);
+        sstv_session_free(session);
+        return found;
     }
-    size_t sample_rate = wav_samples->sample_rate;
 
     // Decode the VIS code (or use the forced VIS code) from the audio file
     size_t image_start;
     uint8_t vis_code;
-    if (force_vis_code >= 0) {
-        vis_code = (uint8_t) force_vis_code;
-        image_start = align_add;
+    if (!find_headers) {
+        vis_code = (uint8_t) options->force_vis_code;
+        image_start = options->align_add;
         log_debug("using forced VIS code from command line");
     }
     else {
-        size_t vis_start = find_vis_start(wav_samples);
-        vis_code = decode_vis_code(wav_samples, vis_start);
-        image_start = align_add + vis_start + round(SSTV_BIT_TIME_SEC * (CHAR_BIT+1) * sample_rate);
+        sstv_find_headers(session, index, false);
+        if (index->num_transmissions == 0) {
+            bool found =
+                sstv_decode_headerless_and_save(session, index, options->sink, output_path);
+            sstv_session_free(session);
+            return found;
+        }
+        size_t vis_start = index->transmissions[0].vis_start;
+        vis_code = index->transmissions[0].vis_code;
+        image_start = sstv_image_start(wav_samples->sample_rate, vis_start, options->align_add);
         log_debug("found VIS in audio file at sample %lu", vis_start);
     }
 
-    // From the VIS code, get the SSTV mode
-    const SstvMode *sstv_mode = get_sstv_mode(vis_code);
-    if (sstv_mode == NULL) {
+    if (vis_code == SSTV_PROCESSING_INVALID_VIS) {
+        log_warn("VIS code is damaged and no supported mode fits the line timing after it");
+        sstv_session_free(session);
+        return false;
+    }
+    if (!sstv_decode_image_and_save(
+            session, index, vis_code, image_start, options->sink, output_path))
+    {
         log_fatal("sstv mode with VIS code %d is not supported", vis_code);
     }
-    log_debug("VIS mode is '%s' (%u)", sstv_mode->name, vis_code);
 
-    // Process the sample data
-    uint8_t *image_data = decode_image_data(wav_samples, sstv_mode, image_start); 
-    Pixel *pixels = png_file_y1crcby2_to_rgb(image_data, sstv_mode);  // FIXME: Assumes a PD mode
-    png_file_save(pixels, sstv_mode->width, 2 * sstv_mode->height, output_path);
+    // Clean up
+    sstv_session_free(session);
+    return true;
+}
+
+
+SstvIndex *sstv_open_index(const char *index_path,
+                           const char *input_path,
+                           const WavSamples *wav_samples,
+                           const DecodeOptions *options)
+{
+    // Without `-i`, the index only lives for this run, and an index for other samples (which
+    // should not happen while the input file is unchanged) is replaced.
+    SstvIndex *index = NULL;
+    if (options->use_index) {
+        index = sstv_index_load(index_path, input_path, &options->params);
+    }
+    if (index != NULL && (index->sample_rate != wav_samples->sample_rate ||
+                          index->num_samples != wav_samples->num_samples))
+    {
+        sstv_index_free(index);
+        index = NULL;
+    }
+    if (index == NULL) {
+        index = sstv_index_create(
+            wav_samples->sample_rate, wav_samples->num_samples, &options->params);
+        if (index == NULL) {
+            log_fatal("cannot create index for '%s'", input_path);
+        }
+    }
+
+    index->keep_data = options->index_data;
+    return index;
+}
+
+
+void sstv_close_index(SstvIndex *index,
+                      const char *index_path,
+                      const char *input_path,
+                      const DecodeOptions *options)
+{
+    if (options->use_index && index->modified) {
+        if (sstv_index_save(index, index_path, input_path)) {
+            log_debug("saved index to '%s'", index_path);
+        }
+        else {
+            log_warn("cannot save index to '%s'", index_path);
+        }
+    }
+    sstv_index_free(index);
+}
+
+
+void *sstv_decode_channel(void *arg) {
+    ChannelJob *job = (ChannelJob *) arg;
+    SstvIndex *index =
+        sstv_open_index(job->index_path, job->input_path, job->wav_samples, job->options);
+    job->found = sstv_decode_samples_and_save(job->wav_samples,
+                                              index,
+                                              job->index_path,
+                                              job->input_path,
+                                              job->output_path,
+                                              job->options);
+    sstv_close_index(index, job->index_path, job->input_path, job->options);
+    return NULL;
+}
+
+
+void sstv_index_path(const char *input_path, const char *suffix, char *buffer, size_t buffer_size) {
+    // Each channel of a file decoded separately has its own index, named like the file would be
+    // if it only had that channel.
+    char channel_path[PATH_MAX];
+    if (suffix != NULL) {
+        sstv_output_path_with_suffix(input_path, suffix, channel_path, sizeof(channel_path));
+        input_path = channel_path;
+    }
+
+    int length = snprintf(buffer, buffer_size, "%s%s", input_path, SSTV_INDEX_EXTENSION);
+    if (length < 0 || (size_t) length >= buffer_size) {
+        log_fatal("index path for '%s' is too long", input_path);
+    }
+}
+
+
+bool sstv_save_indexed_images(const char *input_path,
+                              const char *output_path,
+                              const DecodeOptions *options)
+{
+    // With every image in the index, the wave file does not need to be read at all. The channels
+    // of a file decoded separately are not known until it is read, so they always read it.
+    if (!options->use_index || !options->index_data || options->split_channels) {
+        return false;
+    }
+
+    char index_path[PATH_MAX];
+    sstv_index_path(input_path, NULL, index_path, sizeof(index_path));
+    perf_counters_start(options->perf, PERF_STAGE_SAVE);
+    SstvIndex *index = sstv_index_load(index_path, input_path, &options->params);
+    bool saved = index != NULL && sstv_save_from_index(index, output_path, options);
+    sstv_index_free(index);
+    perf_counters_stop(options->perf, PERF_STAGE_SAVE);
+    if (saved) {
+        log_debug("saved every image from index '%s'", index_path);
+    }
+    return saved;
+}
+
+
+bool sstv_decode_file_and_save(const char *input_path,
+                               WavFile *wav_file,
+                               WavSamples *wav_samples,
+                               const char *output_path,
+                               const DecodeOptions *options)
+{
+    char index_path[PATH_MAX];
+    sstv_index_path(input_path, NULL, index_path, sizeof(index_path));
+    if (logger_verbose) {
+        log_debug("successfully opened wave audio file, header follow");
+        // The header is printed as plain lines, which would break a log of JSON objects.
+        if (SSTV_LOG_LEVEL <= LOGGER_LEVEL_DEBUG && logger_format == LOGGER_FORMAT_TEXT) {
+            wav_file_print_header(wav_file);
+        }
+    }
+
+    uint16_t num_channels = wav_file->header->num_channels;
+    if (!options->split_channels || num_channels <= 1) {
+        if (wav_samples == NULL) {
+            perf_counters_start(options->perf, PERF_STAGE_READ);
+            wav_samples = wav_file_get_mono_samples(wav_file);
+            if (wav_samples == NULL) {
+                log_fatal("cannot extract mono samples from wave audio file '%s'", input_path);
+            }
+            perf_counters_stop(options->perf, PERF_STAGE_READ);
+        }
+
+        SstvIndex *index = sstv_open_index(index_path, input_path, wav_samples, options);
+        bool found = sstv_decode_samples_and_save(
+            wav_samples, index, index_path, input_path, output_path, options);
+        sstv_close_index(index, index_path, input_path, options);
+        wav_file_free_samples(wav_samples);
+        wav_file_close(wav_file);
+        return found;
+    }
+
+    // Each channel is an independent recording, so each one gets its own thread, decode session,
+    // and output file. The threads share only the read-only samples and the DFT plan cache.
+    perf_counters_start(options->perf, PERF_STAGE_READ);
+    WavSamples *channel_samples = wav_file_get_channel_samples(wav_file);
+    ChannelJob *jobs = (ChannelJob *) malloc(num_channels * sizeof(ChannelJob));
+    pthread_t *threads = (pthread_t *) malloc(num_channels * sizeof(pthread_t));
+    if (channel_samples == NULL || jobs == NULL || threads == NULL) {
+        log_fatal("cannot extract channel samples from wave audio file '%s'", input_path);
+    }
+    perf_counters_stop(options->perf, PERF_STAGE_READ);
+
+    // The channels are decoded concurrently, so their stages cannot be told apart, and their
+    // events are only counted as a whole once their threads exit.
+    DecodeOptions channel_options = *options;
+    channel_options.perf = NULL;
+    perf_counters_start(options->perf, PERF_STAGE_CHANNELS);
+
+    log_info("decoding %u channels separately", num_channels);
+    for (uint16_t channel = 0; channel < num_channels; channel++) {
+        char suffix[16];
+        snprintf(suffix, sizeof(suffix), "ch%u", channel);
+
+        ChannelJob *job = &jobs[channel];
+        job->wav_samples = &channel_samples[channel];
+        job->input_path = input_path;
+        job->options = &channel_options;
+        sstv_index_path(input_path, suffix, job->index_path, sizeof(job->index_path));
+        sstv_output_path_with_suffix(output_path,
+                                     suffix,
+                                     job->output_path,
+                                     sizeof(job->output_path));
+
+        if (pthread_create(&threads[channel], NULL, sstv_decode_channel, job) != 0) {
+            log_fatal("cannot create decoding thread for channel %u", channel);
+        }
+    }
+
+    bool found = false;
+    for (uint16_t channel = 0; channel < num_channels; channel++) {
+        pthread_join(threads[channel], NULL);
+        found |= jobs[channel].found;
+    }
+    perf_counters_stop(options->perf, PERF_STAGE_CHANNELS);
 
     // Clean up
-    free(pixels);
-    free(image_data);
-    fftw_cleanup();
-    wav_file_free_samples(wav_samples);
+    free(threads);
+    free(jobs);
+    wav_file_free_channel_samples(channel_samples);
     wav_file_close(wav_file);
+    return found;
+}
+
+
+bool sstv_decode_and_save(const char *input_path,
+                          const char *output_path,
+                          const DecodeOptions *options)
+{
+    if (sstv_save_indexed_images(input_path, output_path, options)) {
+        return true;
+    }
+
+    perf_counters_start(options->perf, PERF_STAGE_READ);
+    WavFile *wav_file = wav_file_open(input_path);
+    if (wav_file == NULL) {
+        log_fatal("cannot open wave audio file '%s'", input_path);
+    }
+    perf_counters_stop(options->perf, PERF_STAGE_READ);
+    return sstv_decode_file_and_save(input_path, wav_file, NULL, output_path, options);
+}
+
+
+void sstv_batch_output_path(const char *input_path,
+                            const char *output_path,
+                            char *buffer,
+                            size_t buffer_size)
+{
+    // The image of "dir/rec.wav" is saved to "result-rec.png", like a channel or a transmission
+    // of a single file is saved with a suffix.
+    const char *file_name = strrchr(input_path, '/');
+    file_name = (file_name == NULL) ? input_path : file_name + 1;
+    const char *extension = strrchr(file_name, '.');
+    if (extension == NULL || extension == file_name) {
+        extension = file_name + strlen(file_name);
+    }
+
+    char stem[PATH_MAX];
+    snprintf(stem, sizeof(stem), "%.*s", (int) (extension - file_name), file_name);
+    sstv_output_path_with_suffix(output_path, stem, buffer, buffer_size);
+}
+
+
+bool sstv_decode_batch_and_save(char *const *input_paths,
+                                size_t num_inputs,
+                                const char *output_path,
+                                const DecodeOptions *options)
+{
+    // Files whose every image is in their index are saved first, and the rest are read ahead
+    // while the earlier ones are decoded.
+    const char **read_paths = (const char **) malloc(num_inputs * sizeof(char *));
+    assert(read_paths && "sstv_decode_batch_and_save cannot malloc read_paths");
+    size_t num_reads = 0;
+    bool found = false;
+    for (size_t i = 0; i < num_inputs; i++) {
+        char image_path[PATH_MAX];
+        sstv_batch_output_path(input_paths[i], output_path, image_path, sizeof(image_path));
+        if (sstv_save_indexed_images(input_paths[i], image_path, options)) {
+            found = true;
+        }
+        else {
+            read_paths[num_reads++] = input_paths[i];
+        }
+    }
+    if (num_reads == 0) {
+        free(read_paths);
+        return found;
+    }
+
+    // The mono samples are converted by the reader, unless the channels of the files are split.
+    BatchReader *reader =
+        batch_reader_create(read_paths, num_reads, SSTV_BATCH_READ_AHEAD, !options->split_channels);
+    if (reader == NULL) {
+        log_fatal("cannot create reader for %lu wave audio files", num_reads);
+    }
+
+    // A deadline is given to every file in turn, counting from when the file is taken, as it is
+    // to a single file counting from the start.
+    DecodeOptions file_options = *options;
+    double first_take_sec = 0;
+    size_t num_taken = 0;
+    BatchFile *file;
+    for (;;) {
+        perf_counters_start(options->perf, PERF_STAGE_READ);
+        file = batch_reader_next(reader);
+        perf_counters_stop(options->perf, PERF_STAGE_READ);
+        if (file == NULL) {
+            break;
+        }
+        if (file->wav_file == NULL) {
+            log_error("cannot open wave audio file '%s'%s%s", file->path,
+                      (file->error != 0) ? ": " : "",
+                      (file->error != 0) ? strerror(file->error) : "");
+            continue;
+        }
+
+        double now_sec = sstv_monotonic_time_sec();
+        if (num_taken++ == 0) {
+            first_take_sec = now_sec;
+        }
+        if (options->deadline_sec > 0) {
+            file_options.deadline_sec = options->deadline_sec + (now_sec - first_take_sec);
+        }
+
+        char image_path[PATH_MAX];
+        sstv_batch_output_path(file->path, output_path, image_path, sizeof(image_path));
+        log_info("decoding '%s'", file->path);
+        found |= sstv_decode_file_and_save(
+            file->path, file->wav_file, file->wav_samples, image_path, &file_options);
+    }
+
+    batch_reader_free(reader);
+    free(read_paths);
+    return found;
+}
+
+
+void sstv_generate_wisdom(const SstvParams *params) {
+    size_t num_sample_rates = sizeof(wisdom_sample_rates) / sizeof(wisdom_sample_rates[0]);
+
+    for (size_t i = 0; i < num_sstv_modes; i++) {
+        log_info("generating wisdom for mode '%s'...", sstv_modes[i].name);
+        for (size_t j = 0; j < num_sample_rates; j++) {
+            log_debug("planning for sample rate %u Hz", wisdom_sample_rates[j]);
+            prepare_mode_fft_plans(&sstv_modes[i], wisdom_sample_rates[j], params);
+        }
+    }
+}
+
+
+bool sstv_scoreboard_decode(void *context,
+                            const WavSamples *wav_samples,
+                            const SstvParams *params,
+                            SyncMethod sync_method,
+                            ImageSink *sink)
+{
+    // Every decode is a plain one of the whole file, whatever the other options are.
+    DecodeOptions options = *(const DecodeOptions *) context;
+    options.force_vis_code = -1;
+    options.align_add = 0;
+    options.decode_all = false;
+    options.sync_method = sync_method;
+    options.params = *params;
+    options.preview_step = 1;
+    options.use_index = false;
+    options.index_data = false;
+    options.deadline_sec = 0;
+    options.checkpoint_sec = 0;
+    options.perf = NULL;
+    options.sink = sink;
+
+    SstvIndex *index =
+        sstv_index_create(wav_samples->sample_rate, wav_samples->num_samples, &options.params);
+    if (index == NULL) {
+        log_fatal("cannot create scoreboard index");
+    }
+    bool found = sstv_decode_samples_and_save(
+        wav_samples, index, "", "scoreboard", "scoreboard.png", &options);
+    sstv_index_free(index);
+    return found;
+}
+
+
+void sstv_soak_decode(void *context,
+                      SstvSession *session,
+                      ImageSink *sink,
+                      SoakReceiver *receiver)
+{
+    const DecodeOptions *options = (const DecodeOptions *) context;
+    const WavSamples *wav_samples = session->wav_samples;
+    session->sync_method = options->sync_method;
+    session->preview_step = options->preview_step;
+
+    SstvIndex *index = sstv_index_create(
+        wav_samples->sample_rate, wav_samples->num_samples, &session->params);
+    if (index == NULL) {
+        log_fatal("cannot create soak index");
+    }
+
+    // The headers are searched for over the whole recording as a phase of its own, before its
+    // samples start to arrive, and its time is kept apart from that of the decode.
+    double header_start_sec = sstv_monotonic_time_sec();
+    sstv_find_headers(session, index, true);
+    soak_receiver_add_header_time(receiver, session, sstv_monotonic_time_sec() - header_start_sec);
+    for (size_t i = 0; i < index->num_transmissions; i++) {
+        uint8_t vis_code = index->transmissions[i].vis_code;
+        size_t image_start = sstv_image_start(
+            wav_samples->sample_rate, index->transmissions[i].vis_start, options->align_add);
+        sstv_session_wait_for_sample(session, image_start);
+        if (sstv_decode_image_and_save(session, index, vis_code, image_start, sink, "soak.png")) {
+            SstvMode image_mode = sstv_image_layout(get_sstv_mode(vis_code), options->preview_step);
+            soak_receiver_add_image(receiver, image_mode.height);
+        }
+    }
+    sstv_index_free(index);
 }
 
 
 int main(int argc, char **argv) {
     char *output_path = "./result.png";
-    char *input_path = NULL;
-    size_t align_add = 0;
-    int force_vis_code = -1;
+    char *wisdom_path = NULL;
+    bool generate_wisdom = false;
+    bool found = true;
+    int exit_status = 0;
+    bool matched_sync = false;
+    const char *preset_name = SSTV_PARAMS_DEFAULT_PRESET;
+    const char *sink_spec = "png";
+    const char *generate_case_name = NULL;
+    const char *scoreboard_path = NULL;
+    bool scoreboard_update = false;
+    double soak_speed = -1;
+    size_t soak_receivers = 1;
+    double soak_time_sec = 0;
+    const char **param_sets = (const char **) malloc(argc * sizeof(char *));
+    size_t num_param_sets = 0;
+    assert(param_sets && "main cannot malloc param_sets");
+
+    DecodeOptions options;
+    options.align_add = 0;
+    options.force_vis_code = -1;
+    options.split_channels = false;
+    options.num_threads = 1;
+    options.decode_all = false;
+    options.sync_method = SSTV_SYNC_TONE;
+    options.prescreen.tone_ratio = PRESCREEN_DEFAULT_TONE_RATIO;
+    options.prescreen.leader_time_sec = PRESCREEN_DEFAULT_LEADER_TIME_SEC;
+    options.preview_step = 1;
+    options.use_index = false;
+    options.index_data = false;
+    options.deadline_sec = 0;
+    options.checkpoint_sec = 0;
+    options.perf = NULL;
+    options.sink = NULL;
+    bool count_events = false;
+
+    long num_processors = sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_processors > 1) {
+        options.num_threads = (size_t) num_processors;
+    }
+
+    // Options without a short flag are only reachable by their long name.
+    static const struct option long_options[] = {
+        {"checkpoint", required_argument, NULL, 'k'},
+        {"deadline",   required_argument, NULL, 'd'},
+        {"generate",   required_argument, NULL, 'G'},
+        {"log-format", required_argument, NULL, 'g'},
+        {"perf",       no_argument,       NULL, 'f'},
+        {"preset",     required_argument, NULL, 'r'},
+        {"preview",    required_argument, NULL, 'p'},
+        {"receivers",  required_argument, NULL, 'u'},
+        {"scoreboard", required_argument, NULL, 'b'},
+        {"set",        required_argument, NULL, 'e'},
+        {"sink",       required_argument, NULL, 'n'},
+        {"soak",       required_argument, NULL, 'y'},
+        {"soak-time",  required_argument, NULL, 'z'},
+        {"update",     no_argument,       NULL, 'q'},
+        {NULL,         0,                 NULL, 0  },
+    };
 
     int flag;
-    while ((flag = getopt(argc, argv, "a:c:ho:v")) != -1) {
+    while ((flag = getopt_long(argc, argv, "a:c:hiIj:l:mo:st:vw:Wx", long_options, NULL)) != -1) {
         switch (flag) {
         case 'a':
-            align_add = atoi(optarg);
+            options.align_add = atoi(optarg);
+            break;
+        case 'b':
+            scoreboard_path = optarg;
             break;
         case 'c':
-            force_vis_code = atoi(optarg);
+            options.force_vis_code = atoi(optarg);
+            break;
+        case 'd':
+            // The budget counts from the start of the program, so it includes reading the file
+            // and searching for the header.
+            if (atof(optarg) <= 0) {
+                usage("option `--deadline' requires a positive time");
+            }
+            options.deadline_sec = sstv_monotonic_time_sec() + atof(optarg);
+            break;
+        case 'e':
+            param_sets[num_param_sets++] = optarg;
+            break;
+        case 'f':
+            count_events = true;
+            break;
+        case 'g':
+            if (strcmp(optarg, "text") != 0 && strcmp(optarg, "json") != 0) {
+                usage("option `--log-format' requires `text' or `json'");
+            }
+            logger_set_format((optarg[0] == 'j') ? LOGGER_FORMAT_JSON : LOGGER_FORMAT_TEXT);
+            break;
+        case 'G':
+            generate_case_name = optarg;
             break;
         case 'h':
             usage(NULL);
             break;
+        case 'i':
+            options.use_index = true;
+            break;
+        case 'I':
+            options.use_index = true;
+            options.index_data = true;
+            break;
+        case 'j':
+            if (atoi(optarg) < 1) {
+                usage("option `-j' requires a positive thread count");
+            }
+            options.num_threads = atoi(optarg);
+            break;
+        case 'k':
+            if (atof(optarg) <= 0) {
+                usage("option `--checkpoint' requires a positive time");
+            }
+            options.checkpoint_sec = atof(optarg);
+            options.use_index = true;
+            break;
+        case 'l':
+            options.prescreen.leader_time_sec = atof(optarg);
+            break;
+        case 'm':
+            matched_sync = true;
+            break;
+        case 'n':
+            sink_spec = optarg;
+            break;
         case 'o':
             output_path = optarg;
             break;
+        case 'p':
+            if (atoi(optarg) < 1) {
+                usage("option `--preview' requires a positive step");
+            }
+            options.preview_step = atoi(optarg);
+            break;
+        case 'q':
+            scoreboard_update = true;
+            break;
+        case 'r':
+            preset_name = optarg;
+            break;
+        case 's':
+            options.split_channels = true;
+            break;
+        case 't':
+            options.prescreen.tone_ratio = atof(optarg);
+            break;
+        case 'u':
+            if (atoi(optarg) < 1) {
+                usage("option `--receivers' requires a positive count");
+            }
+            soak_receivers = atoi(optarg);
+            break;
         case 'v':
             logger_set_verbosity(true);
             break;
+        case 'w':
+            wisdom_path = optarg;
+            break;
+        case 'W':
+            generate_wisdom = true;
+            break;
+        case 'x':
+            options.decode_all = true;
+            break;
+        case 'y':
+            if (atof(optarg) < 0) {
+                usage("option `--soak' requires a speed of 0 or more");
+            }
+            soak_speed = atof(optarg);
+            break;
+        case 'z':
+            if (atof(optarg) <= 0) {
+                usage("option `--soak-time' requires a positive time");
+            }
+            soak_time_sec = atof(optarg);
+            break;
         default:
             usage("unknown option flag");
             break;
         }
     }
 
-    if (optind >= argc || argv[optind] == NULL) {
-        usage("missing required 'path' argument");
+    // Images on the standard output would be mixed up with the messages, which go to the standard
+    // error instead from before the first one.
+    bool soak = soak_speed >= 0;
+    if (!generate_wisdom && generate_case_name == NULL && scoreboard_path == NULL && !soak) {
+        options.sink = image_sink_open(sink_spec);
+        if (options.sink == NULL) {
+            usage("option `--sink' requires `png', `raw', `ppm' or `shm:/name'");
+        }
+        if (options.sink->stream == stdout) {
+            logger_set_stream(stderr);
+        }
     }
-    input_path = argv[optind];
 
-    sstv_decode_and_save(input_path, output_path, align_add, force_vis_code);
+    // The overrides apply to the preset wherever they are on the command line, and `-m' to the
+    // sync method of any preset.
+    const SstvPreset *preset = get_sstv_preset(preset_name);
+    if (preset == NULL) {
+        usage("option `--preset' requires one of `fast', `balanced' and `robust'");
+    }
+    options.params = preset->params;
+    options.sync_method = matched_sync ? SSTV_SYNC_MATCHED : preset->sync_method;
+    for (size_t i = 0; i < num_param_sets; i++) {
+        if (!sstv_params_set(&options.params, param_sets[i])) {
+            usage("option `--set' requires a known parameter and a positive value");
+        }
+    }
+    log_debug("using analysis parameters of preset '%s' with %lu override(s)",
+              preset->name, num_param_sets);
+    sstv_params_print(&options.params);
+
+    // A decode against a deadline leaves lines out, so there is nothing to resume it from.
+    if (options.checkpoint_sec > 0 && options.deadline_sec > 0) {
+        usage("options `--checkpoint' and `--deadline' cannot be combined");
+    }
 
-    return 0;
+    // Plans are only worth measuring if the result is kept. With a wisdom file, the planning cost
+    // is paid once per host and later runs import the plans in negligible time.
+    if (wisdom_path != NULL) {
+#ifdef SSTV_FIXED_POINT
+        usage("fixed-point builds do not use FFTW, so options `-w' and `-W' are not available");
+#else
+        set_fft_planner_flags(generate_wisdom ? FFTW_PATIENT : FFTW_MEASURE);
+#endif
+        if (import_fft_wisdom(wisdom_path)) {
+            log_debug("imported FFTW wisdom from '%s'", wisdom_path);
+        }
+        else {
+            log_debug("no FFTW wisdom imported from '%s'", wisdom_path);
+        }
+    }
+
+    // From here on, the decode threads hand their messages to a background thread, so a slow
+    // terminal or log collector does not hold them up.
+    if (!logger_start()) {
+        log_warn("cannot start the logging thread, printing messages directly");
+    }
+
+    if (generate_wisdom) {
+        if (wisdom_path == NULL) {
+            usage("option `-W' requires a wisdom file specified with `-w'");
+        }
+        sstv_generate_wisdom(&options.params);
+    }
+    else if (generate_case_name != NULL) {
+        const ScoreboardCase *test_case = get_scoreboard_case(generate_case_name);
+        if (test_case == NULL) {
+            usage("option `--generate' requires the name of a scoreboard case");
+        }
+        WavSamples *wav_samples = scoreboard_generate_every_mode(test_case);
+        if (wav_file_save(wav_samples, output_path)) {
+            log_info("saved case '%s' to '%s'", test_case->name, output_path);
+        }
+        else {
+            log_error("cannot save case '%s' to '%s'", test_case->name, output_path);
+            exit_status = 1;
+        }
+        wav_file_free_samples(wav_samples);
+    }
+    else if (scoreboard_path != NULL) {
+        // Every preset is scored, with the same overrides as the selected one.
+        if (!scoreboard_run(scoreboard_path,
+                            scoreboard_update,
+                            param_sets,
+                            num_param_sets,
+                            sstv_scoreboard_decode,
+                            &options)) {
+            exit_status = 1;
+        }
+    }
+    else if (soak) {
+        // The recording is optional, and the soak runs for one pass without a time.
+        const char *input_path = (optind < argc) ? argv[optind] : NULL;
+        if (!soak_run(input_path,
+                      soak_speed,
+                      soak_receivers,
+                      soak_time_sec,
+                      options.num_threads,
+                      &options.params,
+                      sstv_soak_decode,
+                      &options)) {
+            exit_status = 1;
+        }
+    }
+    else {
+        if (optind >= argc || argv[optind] == NULL) {
+            usage("missing required 'path' argument");
+        }
+
+        // The counters are opened before the file is read, so every thread of the decode
+        // inherits them.
+        if (count_events) {
+            options.perf = perf_counters_open();
+            if (options.perf == NULL) {
+                log_fatal("cannot allocate event counters");
+            }
+        }
+
+        if (argc - optind > 1) {
+            found = sstv_decode_batch_and_save(
+                &argv[optind], argc - optind, output_path, &options);
+        }
+        else {
+            found = sstv_decode_and_save(argv[optind], output_path, &options);
+        }
+
+        if (options.perf != NULL) {
+            perf_counters_print(options.perf);
+            perf_counters_close(options.perf);
+        }
+        image_sink_close(options.sink);
+    }
+
+    if (wisdom_path != NULL && !export_fft_wisdom(wisdom_path)) {
+        log_warn("cannot save FFTW wisdom to '%s'", wisdom_path);
+    }
+    cleanup_fft_plans();
+    free(param_sets);
+
+    if (exit_status == 0 && !found) {
+        exit_status = SSTV_EXIT_NO_SSTV;
+    }
+    return exit_status;
 }
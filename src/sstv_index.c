@@ -0,0 +1,456 @@
+#include "logger.h"
+#include "modes.h"
+#include "precision.h"
+#include "sstv_index.h"
+#include "sstv_params.h"
+#include "sstv_processing.h"
+#include <assert.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+
+/** The first bytes of every index file. */
+static const char index_magic[8] = "SSTVIDX";
+
+
+/**
+ * The sample precision of the build, since builds of different precisions decode slightly
+ * different images from the same samples.
+ */
+#if defined(SSTV_FIXED_POINT)
+#define SSTV_INDEX_PRECISION 2
+#elif defined(SSTV_SINGLE_PRECISION)
+#define SSTV_INDEX_PRECISION 1
+#else
+#define SSTV_INDEX_PRECISION 0
+#endif
+
+
+typedef struct index_file_header_s IndexFileHeader;
+
+
+/**
+ * The fixed-size start of an index file. It is followed by the transmissions, each a 64-bit
+ * {@code vis_start} and an 8-bit {@code vis_code}, then a 64-bit image count and the images.
+ * Each image is its key, its line count, decoded line count and line starts, and its data size
+ * and data.
+ *
+ * Every value is in host byte order, since an index is a cache for the host that wrote it. An
+ * index from a host of the other byte order fails the version check and is rebuilt.
+ *
+ * @var magic              The string literal "SSTVIDX" with a trailing NUL byte.
+ * @var version            The version of the file format, {@code SSTV_INDEX_VERSION}.
+ * @var precision          The sample precision of the build that wrote the index.
+ * @var input_size         The size of the input file in bytes.
+ * @var input_mtime_sec    The seconds of the modification time of the input file.
+ * @var input_mtime_nsec   The nanoseconds of the modification time of the input file.
+ * @var sample_rate        The sample rate of the samples, in Hertz.
+ * @var search             How much of the samples the header search has covered.
+ * @var num_samples        The number of samples.
+ * @var params             The analysis parameters that the index was made with.
+ * @var scan_sample        The sample that an unfinished search for every header has covered.
+ * @var num_transmissions  The number of transmissions that follow the header.
+ */
+struct index_file_header_s {
+    char magic[8];
+    uint32_t version;
+    uint32_t precision;
+    uint64_t input_size;
+    int64_t input_mtime_sec;
+    int64_t input_mtime_nsec;
+    uint32_t sample_rate;
+    uint32_t search;
+    uint64_t num_samples;
+    SstvParams params;
+    uint64_t scan_sample;
+    uint64_t num_transmissions;
+};
+
+
+/**
+ * Reads the size and modification time of the input file into an index file header.
+ *
+ * @param input_path  The path of the input file.
+ * @param header      The header to set the input fields of.
+ *
+ * @return Whether the input file could be read.
+ */
+static bool stat_input_file(const char *input_path, IndexFileHeader *header) {
+    struct stat input_stat;
+    if (stat(input_path, &input_stat) != 0) {
+        return false;
+    }
+
+    header->input_size = input_stat.st_size;
+    header->input_mtime_sec = input_stat.st_mtim.tv_sec;
+    header->input_mtime_nsec = input_stat.st_mtim.tv_nsec;
+    return true;
+}
+
+
+/**
+ * Calculates the shape of the image data of a mode decoded with a preview step.
+ *
+ * @param mode          The SSTV mode of the image.
+ * @param preview_step  The step between decoded pixels and lines.
+ * @param num_lines     A location to place the number of lines of image data at.
+ *
+ * @return The number of bytes of image data.
+ */
+static size_t image_data_size(const SstvMode *mode, size_t preview_step, size_t *num_lines) {
+    size_t data_width = (mode->width + preview_step - 1) / preview_step;
+    *num_lines = (mode->height + preview_step - 1) / preview_step;
+    return data_width * mode->num_channels * *num_lines;
+}
+
+
+/**
+ * Reads one value from an index file.
+ *
+ * @param file   The file to read from.
+ * @param value  The location to read the value into.
+ * @param size   The size of the value in bytes.
+ *
+ * @return Whether the whole value was read.
+ */
+static bool read_value(FILE *file, void *value, size_t size) {
+    return size == 0 || fread(value, size, 1, file) == 1;
+}
+
+
+/**
+ * Writes one value to an index file.
+ *
+ * @param file   The file to write to.
+ * @param value  The value to write.
+ * @param size   The size of the value in bytes.
+ *
+ * @return Whether the whole value was written.
+ */
+static bool write_value(FILE *file, const void *value, size_t size) {
+    return size == 0 || fwrite(value, size, 1, file) == 1;
+}
+
+
+/**
+ * Reads one image from an index file and adds it to an index.
+ *
+ * @param file   The file to read from.
+ * @param index  The index to add the image to.
+ *
+ * @return Whether a well-formed image was read.
+ */
+static bool read_index_image(FILE *file, SstvIndex *index) {
+    uint64_t image_start;
+    uint8_t vis_code;
+    uint8_t sync_method;
+    uint32_t preview_step;
+    uint64_t num_lines;
+    uint64_t num_decoded;
+    if (!read_value(file, &image_start, sizeof(image_start)) ||
+        !read_value(file, &vis_code, sizeof(vis_code)) ||
+        !read_value(file, &sync_method, sizeof(sync_method)) ||
+        !read_value(file, &preview_step, sizeof(preview_step)) ||
+        !read_value(file, &num_lines, sizeof(num_lines)) ||
+        !read_value(file, &num_decoded, sizeof(num_decoded)))
+    {
+        return false;
+    }
+
+    // The shape of the image follows from its mode, so any other line count or data size means
+    // the file is malformed.
+    const SstvMode *mode = get_sstv_mode(vis_code);
+    if (mode == NULL || preview_step < 1 || preview_step > mode->width ||
+        (sync_method != SSTV_SYNC_TONE && sync_method != SSTV_SYNC_MATCHED))
+    {
+        return false;
+    }
+    size_t expected_lines;
+    size_t expected_size = image_data_size(mode, preview_step, &expected_lines);
+    if (num_lines != expected_lines || num_decoded > num_lines) {
+        return false;
+    }
+
+    // An image that is not fully decoded needs its data to be resumed.
+    SstvIndexImage *image =
+        sstv_index_add_image(index, image_start, vis_code, sync_method, preview_step);
+    image->num_decoded = num_decoded;
+    uint64_t data_size;
+    if (!read_value(file, image->line_starts, num_lines * sizeof(double)) ||
+        !read_value(file, &data_size, sizeof(data_size)) ||
+        (data_size != 0 && data_size != expected_size) ||
+        (data_size == 0 && num_decoded < num_lines))
+    {
+        return false;
+    }
+
+    if (data_size > 0) {
+        image->data = (uint8_t *) malloc(data_size);
+        assert(image->data && "read_index_image cannot malloc data");
+        image->data_size = data_size;
+        if (!read_value(file, image->data, data_size)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+SstvIndex *sstv_index_create(uint32_t sample_rate, size_t num_samples, const SstvParams *params) {
+    assert(params && "sstv_index_create got NULL params");
+
+    SstvIndex *index = (SstvIndex *) malloc(sizeof(SstvIndex));
+    if (index == NULL) {
+        return NULL;
+    }
+
+    index->sample_rate = sample_rate;
+    index->num_samples = num_samples;
+    index->params = *params;
+    index->search = SSTV_INDEX_SEARCH_NONE;
+    index->scan_sample = 0;
+    index->transmissions = NULL;
+    index->num_transmissions = 0;
+    index->images = NULL;
+    index->num_images = 0;
+    index->keep_data = false;
+    index->modified = false;
+    return index;
+}
+
+
+SstvIndex *sstv_index_load(const char *index_path,
+                           const char *input_path,
+                           const SstvParams *params)
+{
+    assert(index_path && "sstv_index_load got NULL index_path");
+    assert(input_path && "sstv_index_load got NULL input_path");
+    assert(params && "sstv_index_load got NULL params");
+
+    FILE *file = fopen(index_path, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+
+    IndexFileHeader header;
+    IndexFileHeader input;
+    bool valid = read_value(file, &header, sizeof(header)) &&
+                 stat_input_file(input_path, &input) &&
+                 memcmp(header.magic, index_magic, sizeof(index_magic)) == 0 &&
+                 header.version == SSTV_INDEX_VERSION &&
+                 header.precision == SSTV_INDEX_PRECISION &&
+                 header.input_size == input.input_size &&
+                 header.input_mtime_sec == input.input_mtime_sec &&
+                 header.input_mtime_nsec == input.input_mtime_nsec &&
+                 sstv_params_equal(&header.params, params) &&
+                 header.search <= SSTV_INDEX_SEARCH_ALL &&
+                 header.scan_sample <= header.num_samples &&
+                 header.num_transmissions <= header.num_samples;
+    if (!valid) {
+        log_debug("index '%s' does not match '%s', ignoring it", index_path, input_path);
+        fclose(file);
+        return NULL;
+    }
+
+    SstvIndex *index = sstv_index_create(header.sample_rate, header.num_samples, params);
+    assert(index && "sstv_index_load cannot create index");
+    index->search = header.search;
+    index->scan_sample = header.scan_sample;
+
+    for (uint64_t i = 0; i < header.num_transmissions && valid; i++) {
+        uint64_t vis_start;
+        uint8_t vis_code;
+        valid = read_value(file, &vis_start, sizeof(vis_start)) &&
+                read_value(file, &vis_code, sizeof(vis_code)) &&
+                vis_start < header.num_samples;
+        if (valid) {
+            sstv_index_add_transmission(index, vis_start, vis_code);
+        }
+    }
+
+    uint64_t num_images = 0;
+    valid = valid && read_value(file, &num_images, sizeof(num_images));
+    for (uint64_t i = 0; i < num_images && valid; i++) {
+        valid = read_index_image(file, index);
+    }
+
+    // Anything after the last image means the counts were wrong.
+    valid = valid && fgetc(file) == EOF;
+    fclose(file);
+    if (!valid) {
+        log_warn("index '%s' is malformed, ignoring it", index_path);
+        sstv_index_free(index);
+        return NULL;
+    }
+
+    index->modified = false;
+    return index;
+}
+
+
+bool sstv_index_save(const SstvIndex *index, const char *index_path, const char *input_path) {
+    assert(index && "sstv_index_save got NULL index");
+    assert(index_path && "sstv_index_save got NULL index_path");
+    assert(input_path && "sstv_index_save got NULL input_path");
+
+    IndexFileHeader header;
+    memset(&header, 0, sizeof(header));
+    if (!stat_input_file(input_path, &header)) {
+        return false;
+    }
+    memcpy(header.magic, index_magic, sizeof(index_magic));
+    header.version = SSTV_INDEX_VERSION;
+    header.precision = SSTV_INDEX_PRECISION;
+    header.sample_rate = index->sample_rate;
+    header.search = index->search;
+    header.num_samples = index->num_samples;
+    header.params = index->params;
+    header.scan_sample = index->scan_sample;
+    header.num_transmissions = index->num_transmissions;
+
+    // The index is written next to its final path and renamed over it, so a reader never sees a
+    // partly written index (e.g. from a decode that was interrupted).
+    char temp_path[PATH_MAX];
+    int length = snprintf(temp_path, sizeof(temp_path), "%s.tmp", index_path);
+    if (length < 0 || (size_t) length >= sizeof(temp_path)) {
+        return false;
+    }
+    FILE *file = fopen(temp_path, "wb");
+    if (file == NULL) {
+        return false;
+    }
+
+    bool written = write_value(file, &header, sizeof(header));
+    for (size_t i = 0; i < index->num_transmissions && written; i++) {
+        uint64_t vis_start = index->transmissions[i].vis_start;
+        uint8_t vis_code = index->transmissions[i].vis_code;
+        written = write_value(file, &vis_start, sizeof(vis_start)) &&
+                  write_value(file, &vis_code, sizeof(vis_code));
+    }
+
+    uint64_t num_images = index->num_images;
+    written = written && write_value(file, &num_images, sizeof(num_images));
+    for (size_t i = 0; i < index->num_images && written; i++) {
+        const SstvIndexImage *image = &index->images[i];
+        uint64_t image_start = image->image_start;
+        uint8_t sync_method = image->sync_method;
+        uint32_t preview_step = image->preview_step;
+        uint64_t num_lines = image->num_lines;
+        uint64_t num_decoded = image->num_decoded;
+        uint64_t data_size = (image->data != NULL) ? image->data_size : 0;
+        written = write_value(file, &image_start, sizeof(image_start)) &&
+                  write_value(file, &image->vis_code, sizeof(image->vis_code)) &&
+                  write_value(file, &sync_method, sizeof(sync_method)) &&
+                  write_value(file, &preview_step, sizeof(preview_step)) &&
+                  write_value(file, &num_lines, sizeof(num_lines)) &&
+                  write_value(file, &num_decoded, sizeof(num_decoded)) &&
+                  write_value(file, image->line_starts, num_lines * sizeof(double)) &&
+                  write_value(file, &data_size, sizeof(data_size)) &&
+                  write_value(file, image->data, data_size);
+    }
+
+    written = (fclose(file) == 0) && written;
+    if (!written || rename(temp_path, index_path) != 0) {
+        remove(temp_path);
+        return false;
+    }
+    return true;
+}
+
+
+void sstv_index_add_transmission(SstvIndex *index, size_t vis_start, uint8_t vis_code) {
+    assert(index && "sstv_index_add_transmission got NULL index");
+
+    size_t num_transmissions = index->num_transmissions + 1;
+    index->transmissions = (SstvIndexTransmission *)
+        realloc(index->transmissions, num_transmissions * sizeof(SstvIndexTransmission));
+    assert(index->transmissions && "sstv_index_add_transmission cannot realloc transmissions");
+
+    index->transmissions[index->num_transmissions].vis_start = vis_start;
+    index->transmissions[index->num_transmissions].vis_code = vis_code;
+    index->num_transmissions = num_transmissions;
+    index->modified = true;
+}
+
+
+void sstv_index_clear_transmissions(SstvIndex *index) {
+    assert(index && "sstv_index_clear_transmissions got NULL index");
+
+    free(index->transmissions);
+    index->transmissions = NULL;
+    index->num_transmissions = 0;
+    index->search = SSTV_INDEX_SEARCH_NONE;
+    index->scan_sample = 0;
+    index->modified = true;
+}
+
+
+SstvIndexImage *sstv_index_find_image(const SstvIndex *index,
+                                      size_t image_start,
+                                      uint8_t vis_code,
+                                      SyncMethod sync_method,
+                                      size_t preview_step)
+{
+    assert(index && "sstv_index_find_image got NULL index");
+
+    for (size_t i = 0; i < index->num_images; i++) {
+        SstvIndexImage *image = &index->images[i];
+        if (image->image_start == image_start && image->vis_code == vis_code &&
+            image->sync_method == sync_method && image->preview_step == preview_step)
+        {
+            return image;
+        }
+    }
+    return NULL;
+}
+
+
+SstvIndexImage *sstv_index_add_image(SstvIndex *index,
+                                     size_t image_start,
+                                     uint8_t vis_code,
+                                     SyncMethod sync_method,
+                                     size_t preview_step)
+{
+    assert(index && "sstv_index_add_image got NULL index");
+    const SstvMode *mode = get_sstv_mode(vis_code);
+    assert(mode && "sstv_index_add_image got unsupported vis_code");
+
+    size_t num_images = index->num_images + 1;
+    index->images = (SstvIndexImage *) realloc(index->images, num_images * sizeof(SstvIndexImage));
+    assert(index->images && "sstv_index_add_image cannot realloc images");
+
+    SstvIndexImage *image = &index->images[index->num_images];
+    image->image_start = image_start;
+    image->vis_code = vis_code;
+    image->sync_method = sync_method;
+    image->preview_step = preview_step;
+    image->data_size = image_data_size(mode, preview_step, &image->num_lines);
+    image->num_decoded = 0;
+    image->line_starts = (double *) calloc(image->num_lines, sizeof(double));
+    image->data = NULL;
+    assert(image->line_starts && "sstv_index_add_image cannot calloc line_starts");
+
+    index->num_images = num_images;
+    index->modified = true;
+    return image;
+}
+
+
+void sstv_index_free(SstvIndex *index) {
+    if (index == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < index->num_images; i++) {
+        free(index->images[i].line_starts);
+        free(index->images[i].data);
+    }
+    free(index->images);
+    free(index->transmissions);
+    free(index);
+}
@@ -0,0 +1,225 @@
+#ifndef _SSTV_INDEX_H_
+#define _SSTV_INDEX_H_
+
+
+#define SSTV_INDEX_EXTENSION ".sstvidx"
+#define SSTV_INDEX_VERSION 4
+
+
+#include "sstv_params.h"
+#include "sstv_processing.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+
+typedef struct sstv_index_transmission_s SstvIndexTransmission;
+typedef struct sstv_index_image_s SstvIndexImage;
+typedef struct sstv_index_s SstvIndex;
+
+
+/**
+ * An enumerator of how much of a recording the header search has covered.
+ *
+ * @var SSTV_INDEX_SEARCH_NONE   No header search has been run.
+ * @var SSTV_INDEX_SEARCH_FIRST  The first header has been searched for ({@code find_vis_start}).
+ * @var SSTV_INDEX_SEARCH_ALL    Every header has been searched for ({@code find_all_vis_starts}),
+ *                               or the search for the first one found nothing.
+ */
+enum sstv_index_search_e {
+    SSTV_INDEX_SEARCH_NONE,
+    SSTV_INDEX_SEARCH_FIRST,
+    SSTV_INDEX_SEARCH_ALL
+};
+typedef enum sstv_index_search_e SstvIndexSearch;
+
+
+/**
+ * A transmission found by the header search.
+ *
+ * @var vis_start  The first sample after the header, as returned by {@code find_vis_start}.
+ * @var vis_code   The VIS code decoded at {@code vis_start}.
+ */
+struct sstv_index_transmission_s {
+    size_t vis_start;
+    uint8_t vis_code;
+};
+
+
+/**
+ * The decoding of one image, keyed by everything that {@code decode_image_data} depends on
+ * besides the samples.
+ *
+ * @var image_start   The sample that the image decoding started from.
+ * @var vis_code      The VIS code of the mode the image was decoded with.
+ * @var sync_method   How the sync pulse of each line was found.
+ * @var preview_step  The step between decoded pixels and lines.
+ * @var num_lines     The number of lines of image data.
+ * @var num_decoded   The number of lines decoded so far, which is less than {@code num_lines} for
+ *                    an image from a checkpoint of a decode that did not finish.
+ * @var line_starts   The start of each line of image data, in (fractional) samples, of which the
+ *                    first {@code num_decoded} are known.
+ * @var data_size     The number of bytes in {@code data}.
+ * @var data          The image data returned by {@code decode_image_data}, or {@code NULL} if it is
+ *                    not stored. It is always stored for an image that is not fully decoded.
+ */
+struct sstv_index_image_s {
+    size_t image_start;
+    uint8_t vis_code;
+    SyncMethod sync_method;
+    size_t preview_step;
+    size_t num_lines;
+    size_t num_decoded;
+    double *line_starts;
+    size_t data_size;
+    uint8_t *data;
+};
+
+
+/**
+ * An index of the transmissions and decoded images of one stream of samples.
+ *
+ * An index is saved next to the input file, so decoding the same file again can skip the header
+ * search and the sync searches, or go straight to the color conversion if the image data is
+ * stored. It is only loaded if the size and modification time of the input file are the ones it
+ * was saved with, and if it was made with the same analysis parameters.
+ *
+ * @var sample_rate        The sample rate of the samples, in Hertz.
+ * @var num_samples        The number of samples.
+ * @var params             The analysis parameters that the headers and images were found with.
+ * @var search             How much of the samples the header search has covered.
+ * @var scan_sample        The sample that a search for every header that did not finish has
+ *                         covered, with every header before it in {@code transmissions}, or 0.
+ * @var transmissions      The transmissions found by the header search, in increasing order.
+ * @var num_transmissions  The number of entries in {@code transmissions}.
+ * @var images             The decoded images.
+ * @var num_images         The number of entries in {@code images}.
+ * @var keep_data          Whether the image data of newly decoded images should be stored, rather
+ *                         than only their line starts.
+ * @var modified           Whether the index has changed since it was loaded or created.
+ */
+struct sstv_index_s {
+    uint32_t sample_rate;
+    size_t num_samples;
+    SstvParams params;
+    SstvIndexSearch search;
+    size_t scan_sample;
+    SstvIndexTransmission *transmissions;
+    size_t num_transmissions;
+    SstvIndexImage *images;
+    size_t num_images;
+    bool keep_data;
+    bool modified;
+};
+
+
+/**
+ * Creates an empty index.
+ *
+ * @param sample_rate  The sample rate of the samples to index, in Hertz.
+ * @param num_samples  The number of samples to index.
+ * @param params       The analysis parameters that the samples are decoded with.
+ *
+ * @return A pointer to the new index. If memory cannot be allocated, {@code NULL} is returned.
+ */
+SstvIndex *sstv_index_create(uint32_t sample_rate, size_t num_samples, const SstvParams *params);
+
+
+/**
+ * Loads an index saved by {@code sstv_index_save}.
+ *
+ * The index is rejected if it was saved for a different size or modification time of the input
+ * file, with different analysis parameters, by a build with a different sample precision, or by
+ * an incompatible version.
+ *
+ * @param index_path  The path of the index file.
+ * @param input_path  The path of the input file that the index was saved for.
+ * @param params      The analysis parameters that the index must have been made with.
+ *
+ * @return A pointer to the loaded index. If the index does not exist, is out of date or is
+ *         malformed, {@code NULL} is returned.
+ */
+SstvIndex *sstv_index_load(const char *index_path,
+                           const char *input_path,
+                           const SstvParams *params);
+
+
+/**
+ * Saves an index, replacing the file at {@code index_path} only once it is completely written.
+ *
+ * @param index       The index to save.
+ * @param index_path  The path of the index file.
+ * @param input_path  The path of the input file, whose size and modification time are recorded.
+ *
+ * @return Whether the index was saved.
+ */
+bool sstv_index_save(const SstvIndex *index, const char *index_path, const char *input_path);
+
+
+/**
+ * Adds a transmission to the end of an index.
+ *
+ * @param index      The index to add to.
+ * @param vis_start  The first sample after the header.
+ * @param vis_code   The VIS code decoded at {@code vis_start}.
+ */
+void sstv_index_add_transmission(SstvIndex *index, size_t vis_start, uint8_t vis_code);
+
+
+/**
+ * Removes every transmission from an index and marks it as not searched, including by a search
+ * for every header that did not finish.
+ *
+ * @param index  The index to clear.
+ */
+void sstv_index_clear_transmissions(SstvIndex *index);
+
+
+/**
+ * Finds the decoding of an image in an index.
+ *
+ * @param index         The index to search.
+ * @param image_start   The sample the image decoding starts from.
+ * @param vis_code      The VIS code of the mode of the image.
+ * @param sync_method   How the sync pulse of each line is found.
+ * @param preview_step  The step between decoded pixels and lines.
+ *
+ * @return A pointer to the image, or {@code NULL} if the index has no image with that key. It is
+ *         valid until the next image is added to the index.
+ */
+SstvIndexImage *sstv_index_find_image(const SstvIndex *index,
+                                      size_t image_start,
+                                      uint8_t vis_code,
+                                      SyncMethod sync_method,
+                                      size_t preview_step);
+
+
+/**
+ * Adds an image to an index, with room for the start of each line and without image data.
+ *
+ * @param index         The index to add to.
+ * @param image_start   The sample the image decoding starts from.
+ * @param vis_code      The VIS code of the mode of the image, which must be supported.
+ * @param sync_method   How the sync pulse of each line is found.
+ * @param preview_step  The step between decoded pixels and lines.
+ *
+ * @return A pointer to the image, with no lines decoded. It is valid until the next image is
+ *         added to the index.
+ */
+SstvIndexImage *sstv_index_add_image(SstvIndex *index,
+                                     size_t image_start,
+                                     uint8_t vis_code,
+                                     SyncMethod sync_method,
+                                     size_t preview_step);
+
+
+/**
+ * Frees an index returned by {@code sstv_index_create} or {@code sstv_index_load}, including the
+ * image data stored in it.
+ *
+ * @param index  The index to free.
+ */
+void sstv_index_free(SstvIndex *index);
+
+
+#endif  // _SSTV_INDEX_H_
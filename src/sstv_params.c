@@ -0,0 +1,168 @@
+#include "freq_processing.h"
+#include "logger.h"
+#include "sstv_params.h"
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+typedef struct param_field_s ParamField;
+
+
+/**
+ * A parameter that can be set by name.
+ *
+ * @var name    The name of the field in {@code SstvParams}.
+ * @var offset  The offset of the field in {@code SstvParams}.
+ * @var whole   Whether the field is a {@code size_t}, rather than a {@code double}.
+ */
+struct param_field_s {
+    const char *name;
+    size_t offset;
+    bool whole;
+};
+
+
+static const ParamField param_fields[] = {
+    {"header_window_sec",  offsetof(SstvParams, header_window_sec),  false},
+    {"hop_time_sec",       offsetof(SstvParams, hop_time_sec),       false},
+    {"sync_start_ratio",   offsetof(SstvParams, sync_start_ratio),   false},
+    {"sync_end_ratio",     offsetof(SstvParams, sync_end_ratio),     false},
+    {"sync_end_step",      offsetof(SstvParams, sync_end_step),      true },
+    {"sync_track_ratio",   offsetof(SstvParams, sync_track_ratio),   false},
+    {"pixel_window_scale", offsetof(SstvParams, pixel_window_scale), false},
+    {"margin_hz",          offsetof(SstvParams, margin_hz),          false},
+};
+
+
+static const size_t num_param_fields = sizeof(param_fields) / sizeof(ParamField);
+
+
+// The balanced preset is the analysis the decoder has always used. The fast preset halves the
+// frames of the header and sync searches and steps over the end of each sync pulse a few samples
+// at a time, which moves lines by up to 3 samples. The pixel windows are the same in every preset,
+// since narrower ones cannot resolve the pixel frequencies. The robust preset doubles the frames,
+// widens the sync search window, the window that a tracked sync may move in and the tone margin
+// for drifting recordings, and finds syncs with the matched filter.
+const SstvPreset sstv_presets[] = {
+    {
+        .name = "fast",
+            .sync_method = SSTV_SYNC_TONE,
+            .params = {
+                .header_window_sec  = 0.010,
+                .hop_time_sec       = 0.004,
+                .sync_start_ratio   = 0.3,
+                .sync_end_ratio     = 1.4,
+                .sync_end_step      = 4,
+                .sync_track_ratio   = 0.5,
+                .pixel_window_scale = 1.0,
+                .margin_hz          = FREQ_PROCESSING_MARGIN_HZ,
+            },
+    },
+    {
+        .name = "balanced",
+            .sync_method = SSTV_SYNC_TONE,
+            .params = {
+                .header_window_sec  = 0.010,
+                .hop_time_sec       = 0.002,
+                .sync_start_ratio   = 0.3,
+                .sync_end_ratio     = 1.4,
+                .sync_end_step      = 1,
+                .sync_track_ratio   = 0.5,
+                .pixel_window_scale = 1.0,
+                .margin_hz          = FREQ_PROCESSING_MARGIN_HZ,
+            },
+    },
+    {
+        .name = "robust",
+            .sync_method = SSTV_SYNC_MATCHED,
+            .params = {
+                .header_window_sec  = 0.010,
+                .hop_time_sec       = 0.001,
+                .sync_start_ratio   = 0.5,
+                .sync_end_ratio     = 1.4,
+                .sync_end_step      = 1,
+                .sync_track_ratio   = 1.0,
+                .pixel_window_scale = 1.0,
+                .margin_hz          = 1.5 * FREQ_PROCESSING_MARGIN_HZ,
+            },
+    },
+};
+
+
+const size_t num_sstv_presets = sizeof(sstv_presets) / sizeof(SstvPreset);
+
+
+const SstvPreset *get_sstv_preset(const char *name) {
+    for (size_t i = 0; i < num_sstv_presets; i++) {
+        if (strcmp(sstv_presets[i].name, name) == 0) {
+            return &sstv_presets[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+bool sstv_params_set(SstvParams *params, const char *assignment) {
+    const char *equals = strchr(assignment, '=');
+    if (equals == NULL) {
+        return false;
+    }
+
+    size_t name_length = equals - assignment;
+    const ParamField *field = NULL;
+    for (size_t i = 0; i < num_param_fields && field == NULL; i++) {
+        if (strlen(param_fields[i].name) == name_length &&
+            strncmp(param_fields[i].name, assignment, name_length) == 0)
+        {
+            field = &param_fields[i];
+        }
+    }
+
+    char *end;
+    double value = strtod(equals + 1, &end);
+    if (field == NULL || end == equals + 1 || *end != '\0' || !isfinite(value) || value <= 0) {
+        return false;
+    }
+
+    uint8_t *location = (uint8_t *) params + field->offset;
+    if (field->whole) {
+        if (value != floor(value)) {
+            return false;
+        }
+        *(size_t *) location = (size_t) value;
+    }
+    else {
+        *(double *) location = value;
+    }
+    return true;
+}
+
+
+bool sstv_params_equal(const SstvParams *a, const SstvParams *b) {
+    return a->header_window_sec == b->header_window_sec &&
+           a->hop_time_sec == b->hop_time_sec &&
+           a->sync_start_ratio == b->sync_start_ratio &&
+           a->sync_end_ratio == b->sync_end_ratio &&
+           a->sync_end_step == b->sync_end_step &&
+           a->sync_track_ratio == b->sync_track_ratio &&
+           a->pixel_window_scale == b->pixel_window_scale &&
+           a->margin_hz == b->margin_hz;
+}
+
+
+void sstv_params_print(const SstvParams *params) {
+    for (size_t i = 0; i < num_param_fields; i++) {
+        const uint8_t *location = (const uint8_t *) params + param_fields[i].offset;
+        if (param_fields[i].whole) {
+            log_debug("%-18s = %lu", param_fields[i].name, *(const size_t *) location);
+        }
+        else {
+            log_debug("%-18s = %g", param_fields[i].name, *(const double *) location);
+        }
+    }
+}
@@ -0,0 +1,131 @@
+#ifndef _SSTV_PARAMS_H_
+#define _SSTV_PARAMS_H_
+
+
+#define SSTV_PARAMS_DEFAULT_PRESET "balanced"
+
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+
+typedef struct sstv_params_s SstvParams;
+typedef struct sstv_preset_s SstvPreset;
+
+
+/**
+ * An enumerator of the ways to find the sync pulse of each line of an image.
+ *
+ * @var SSTV_SYNC_TONE     Search forward from each line's expected start for the sync tone, then
+ *                         for the end of the tone ({@code find_sync_start} and
+ *                         {@code find_sync_end}).
+ * @var SSTV_SYNC_MATCHED  Correlate the whole image with the sync-plus-porch template in one FFT
+ *                         pass, and take each line's sync from the peak of the correlation near
+ *                         where the previous line predicts it (see {@code SyncDetector}).
+ */
+enum sync_method_e {
+    SSTV_SYNC_TONE,
+    SSTV_SYNC_MATCHED
+};
+typedef enum sync_method_e SyncMethod;
+
+
+/**
+ * The analysis parameters of a decode, which trade its processor time for its robustness to noise
+ * and to frequency drift.
+ *
+ * @var header_window_sec   The DFT window of each block of the header search, in seconds. It
+ *                          must fit in the 10ms break of the header.
+ * @var hop_time_sec        The step between the windows of the header and tone sync searches, which
+ *                          is the frame of the STFT cache, in seconds.
+ * @var sync_start_ratio    The DFT window of the search for a sync pulse, as a fraction of the sync
+ *                          time of the mode.
+ * @var sync_end_ratio      The DFT window of the search for the end of a sync pulse, as a fraction
+ *                          of the sync time of the mode.
+ * @var sync_end_step       The step between the windows of the search for the end of a sync pulse,
+ *                          in samples.
+ * @var sync_track_ratio    How far from its predicted position the sync pulse of a line after the
+ *                          first is searched for, as a fraction of the sync time of the mode.
+ * @var pixel_window_scale  The factor that the {@code window_factor} of the mode is scaled by to
+ *                          get the DFT window of each pixel.
+ * @var margin_hz           The largest difference from the frequency of a header or sync tone that
+ *                          a window is taken to have the tone at, in Hertz.
+ */
+struct sstv_params_s {
+    double header_window_sec;
+    double hop_time_sec;
+    double sync_start_ratio;
+    double sync_end_ratio;
+    size_t sync_end_step;
+    double sync_track_ratio;
+    double pixel_window_scale;
+    double margin_hz;
+};
+
+
+/**
+ * A named set of analysis parameters and sync method.
+ *
+ * @var name         The name of the preset, as given to {@code --preset}.
+ * @var sync_method  How the sync pulse of each line is found.
+ * @var params       The analysis parameters.
+ */
+struct sstv_preset_s {
+    char name[16];
+    SyncMethod sync_method;
+    SstvParams params;
+};
+
+
+/** List of all presets, from the fastest to the most robust. */
+extern const SstvPreset sstv_presets[];
+
+
+/** The number of entries in {@code sstv_presets}. */
+extern const size_t num_sstv_presets;
+
+
+/**
+ * Gets an {@code SstvPreset} structure by name.
+ *
+ * @param name  The name of the preset.
+ *
+ * @return The preset named {@code name}, or {@code NULL} if there is none.
+ */
+const SstvPreset *get_sstv_preset(const char *name);
+
+
+/**
+ * Sets one parameter from an assignment of the form {@code name=value}, where the name is that of
+ * a field of {@code SstvParams}.
+ *
+ * @param params      The parameters to change.
+ * @param assignment  The assignment to apply.
+ *
+ * @return Whether the parameter was set, which it is not if the name is unknown or the value is
+ *         not a positive number (or, for {@code sync_end_step}, a positive integer).
+ */
+bool sstv_params_set(SstvParams *params, const char *assignment);
+
+
+/**
+ * Determines whether two sets of parameters are the same, so a decode with one gives the same
+ * results as with the other.
+ *
+ * @param a  The first set of parameters.
+ * @param b  The second set of parameters.
+ *
+ * @return Whether every parameter is equal.
+ */
+bool sstv_params_equal(const SstvParams *a, const SstvParams *b);
+
+
+/**
+ * Prints every parameter as a debug message.
+ *
+ * @param params  The parameters to print.
+ */
+void sstv_params_print(const SstvParams *params);
+
+
+#endif  // _SSTV_PARAMS_H_
@@ -1,22 +1,338 @@
 #include "freq_processing.h"
 #include "logger.h"
 #include "modes.h"
+#include "scratch_arena.h"
+#include "segment_scan.h"
 #include "sstv_processing.h"
+#include "stft_cache.h"
+#include "sync_detector.h"
 #include "wav_file.h"
 #include <assert.h>
+#include <errno.h>
 #include <limits.h>
 #include <math.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 
-size_t find_vis_start(const WavSamples *wav_samples) {
-    assert(wav_samples && "find_vis_start got NULL wav_samples");
+#define SSTV_PROCESSING_MAX_MODE_WINDOWS 5
+#define SSTV_PROCESSING_SEGMENT_TIME_SEC 1.0
+#define SSTV_PROCESSING_NUM_HEADER_BLOCKS 4
+#define SSTV_PROCESSING_DEADLINE_SYNC_LINES 2
+#define SSTV_PROCESSING_SYNC_TRACK_GAIN 0.25
+#define SSTV_PROCESSING_SYNC_END_SLACK_SEC 0.00025
+#define SSTV_PROCESSING_CHECKPOINT_SEGMENTS 4
+#define SSTV_PROCESSING_PIXEL_STEP_BITS 24
 
-    // Extract information from `wav_samples` for easier/shorter access names.
+
+typedef struct vis_search_s VisSearch;
+typedef struct sync_search_s SyncSearch;
+typedef struct line_times_s LineTimes;
+typedef struct line_sync_s LineSync;
+
+
+/**
+ * The parameters of a search for the SSTV calibration header, shared by every scan thread.
+ *
+ * @var window_size   The number of samples in the DFT window of each block.
+ * @var block_frames  The start of each block relative to the start of the header, in frames.
+ * @var block_hz      The frequency expected in each block.
+ * @var margin        The largest difference from the expected frequency that is close to it.
+ */
+struct vis_search_s {
+    size_t window_size;
+    size_t block_frames[SSTV_PROCESSING_NUM_HEADER_BLOCKS];
+    Frequency block_hz[SSTV_PROCESSING_NUM_HEADER_BLOCKS];
+    Frequency margin;
+};
+
+
+/**
+ * The parameters of a search for a sync pulse, shared by every scan thread.
+ *
+ * @var window_size  The number of samples in the DFT window.
+ * @var sync_hz      The frequency of the sync pulse.
+ * @var margin       The largest difference from the sync frequency that is close to it.
+ */
+struct sync_search_s {
+    size_t window_size;
+    Frequency sync_hz;
+    Frequency margin;
+};
+
+
+/**
+ * Calculates the time of the DFT window of each pixel of a mode.
+ *
+ * @param mode    The SSTV mode to calculate the window of.
+ * @param params  The analysis parameters, whose {@code pixel_window_scale} scales the window.
+ *
+ * @return The time of the window in seconds.
+ */
+static double pixel_window_time_sec(const SstvMode *mode, const SstvParams *params) {
+    return mode->pixel_time_sec * mode->window_factor * params->pixel_window_scale;
+}
+
+
+/**
+ * Lists the size of every DFT window used to decode a mode at a sample rate.
+ *
+ * The sizes mirror the windows computed in each of the search and decode functions below.
+ *
+ * @param mode         The SSTV mode to list window sizes for.
+ * @param sample_rate  The sample rate in Hertz.
+ * @param params       The analysis parameters that the windows are sized by.
+ * @param sizes        An array of at least {@code SSTV_PROCESSING_MAX_MODE_WINDOWS} entries to
+ *                     place the window sizes in.
+ *
+ * @return The number of window sizes placed in {@code sizes}.
+ */
+static size_t mode_window_sizes(const SstvMode *mode,
+                                uint32_t sample_rate,
+                                const SstvParams *params,
+                                size_t *sizes)
+{
+    double center_window_time = pixel_window_time_sec(mode, params) / 2.0;
+    sizes[0] = round(params->header_window_sec * sample_rate);                     // Header search
+    sizes[1] = round(SSTV_BIT_TIME_SEC * sample_rate);                            // VIS bits
+    sizes[2] = round(mode->sync_time_sec * params->sync_start_ratio * sample_rate);  // Sync start
+    sizes[3] = round(mode->sync_time_sec * params->sync_end_ratio * sample_rate);    // Sync end
+    sizes[4] = round(center_window_time * 2.0 * sample_rate);                     // Pixels
+    return SSTV_PROCESSING_MAX_MODE_WINDOWS;
+}
+
+
+/**
+ * Calculates the number of scratch arena bytes used to decode one channel of a line of a mode.
+ *
+ * The pixel windows of a channel are transformed as one batch, with the start and peak frequency
+ * of each pixel kept alongside.
+ *
+ * @param mode         The SSTV mode to size the batch for.
+ * @param sample_rate  The sample rate in Hertz.
+ * @param params       The analysis parameters that the windows are sized by.
+ *
+ * @return The number of bytes of scratch memory used by one channel of {@code decode_image_data}.
+ */
+static size_t channel_scratch_size(const SstvMode *mode,
+                                   uint32_t sample_rate,
+                                   const SstvParams *params)
+{
+    size_t sizes[SSTV_PROCESSING_MAX_MODE_WINDOWS];
+    mode_window_sizes(mode, sample_rate, params, sizes);
+    size_t pixel_size = sizes[SSTV_PROCESSING_MAX_MODE_WINDOWS - 1];
+
+    size_t size = peak_frequencies_scratch_size(pixel_size, mode->width);
+    size += mode->width * (sizeof(size_t) + sizeof(double));
+    return size + 2 * SCRATCH_ARENA_ALIGNMENT;
+}
+
+
+double sstv_monotonic_time_sec(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+
+void sstv_session_wait_for_sample(SstvSession *session, double sample) {
+    if (session->replay_rate <= 0) {
+        return;
+    }
+
+    double num_samples = session->wav_samples->num_samples;
+    if (sample > num_samples) {
+        sample = num_samples;
+    }
+    double arrival_sec = session->replay_start_sec + sample / session->replay_rate;
+    double now_sec = sstv_monotonic_time_sec();
+    if (arrival_sec <= now_sec) {
+        return;
+    }
+
+    struct timespec arrival;
+    arrival.tv_sec = (time_t) arrival_sec;
+    arrival.tv_nsec = (long) ((arrival_sec - arrival.tv_sec) * 1e9);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &arrival, NULL) == EINTR) {
+    }
+    session->replay_wait_sec += sstv_monotonic_time_sec() - now_sec;
+}
+
+
+/**
+ * Creates a decode session with a scratch arena and STFT cache of the given sizes.
+ *
+ * @param wav_samples   The samples to decode.
+ * @param params        The analysis parameters, which are copied into the session.
+ * @param scratch_size  The initial size of the scratch arena, in bytes.
+ * @param hop_size      The number of samples between the frames of the STFT cache.
+ *
+ * @return A pointer to the new session, or {@code NULL} if memory cannot be allocated.
+ */
+static SstvSession *create_session(const WavSamples *wav_samples,
+                                   const SstvParams *params,
+                                   size_t scratch_size,
+                                   size_t hop_size)
+{
+    SstvSession *session = (SstvSession *) malloc(sizeof(SstvSession));
+    ScratchArena *scratch = scratch_arena_create(scratch_size);
+    StftCache *stft_cache = stft_cache_create(wav_samples, hop_size);
+    if (session == NULL || scratch == NULL || stft_cache == NULL) {
+        free(session);
+        scratch_arena_free(scratch);
+        stft_cache_free(stft_cache);
+        return NULL;
+    }
+
+    session->wav_samples = wav_samples;
+    session->params = *params;
+    session->scratch = scratch;
+    session->stft_cache = stft_cache;
+    session->num_scan_threads = 1;
+    session->scan_threads = NULL;
+    session->sync_method = SSTV_SYNC_TONE;
+    session->preview_step = 1;
+    session->line_starts = NULL;
+    session->known_starts = false;
+    session->line_ring = NULL;
+    session->deadline_sec = 0;
+    session->line_tiers = NULL;
+    session->checkpoint = NULL;
+    session->perf = NULL;
+    session->replay_rate = 0;
+    session->replay_start_sec = 0;
+    session->replay_wait_sec = 0;
+    session->line_latencies = NULL;
+    return session;
+}
+
+
+SstvSession *sstv_session_create(const WavSamples *wav_samples, const SstvParams *params) {
+    assert(wav_samples && "sstv_session_create got NULL wav_samples");
+    if (params == NULL) {
+        params = &get_sstv_preset(SSTV_PARAMS_DEFAULT_PRESET)->params;
+    }
+
+    // The mode is not known until the VIS code is decoded, so the scratch arena is sized for the
+    // largest window or channel batch of any supported mode. This is at most about a megabyte.
+    size_t scratch_size = 0;
+    for (size_t i = 0; i < num_sstv_modes; i++) {
+        size_t sizes[SSTV_PROCESSING_MAX_MODE_WINDOWS];
+        size_t num_sizes =
+            mode_window_sizes(&sstv_modes[i], wav_samples->sample_rate, params, sizes);
+        for (size_t j = 0; j < num_sizes; j++) {
+            size_t window_scratch_size = peak_frequency_scratch_size(sizes[j]);
+            if (window_scratch_size > scratch_size) {
+                scratch_size = window_scratch_size;
+            }
+        }
+
+        size_t batch_scratch_size =
+            channel_scratch_size(&sstv_modes[i], wav_samples->sample_rate, params);
+        if (batch_scratch_size > scratch_size) {
+            scratch_size = batch_scratch_size;
+        }
+    }
+
+    // The header and sync searches slide their windows by the same hop, so they share one
+    // spectrum cache whose frames are aligned to that hop.
+    size_t hop_size = round(params->hop_time_sec * wav_samples->sample_rate);
+    if (hop_size == 0) {
+        hop_size = 1;
+    }
+    return create_session(wav_samples, params, scratch_size, hop_size);
+}
+
+
+SstvSession *sstv_session_create_helper(const SstvSession *session, size_t window_size) {
+    assert(session && "sstv_session_create_helper got NULL session");
+    return create_session(session->wav_samples,
+                          &session->params,
+                          peak_frequency_scratch_size(window_size),
+                          session->stft_cache->hop_size);
+}
+
+
+void sstv_session_free(SstvSession *session) {
+    if (session == NULL) {
+        return;
+    }
+
+    segment_scan_threads_free(session->scan_threads);
+    ScratchArena *scratch = session->scratch;
+    log_debug("scratch arena peaked at %lu B with %lu heap allocation(s)",
+              scratch->peak, scratch->num_heap_allocations);
+    StftCache *stft_cache = session->stft_cache;
+    log_debug("STFT cache answered %lu queries with %lu transform(s)",
+              stft_cache->num_queries, stft_cache->num_transforms);
+    scratch_arena_free(scratch);
+    stft_cache_free(stft_cache);
+    free(session);
+}
+
+
+/**
+ * Gets the number of scan frames in one segment of a parallel scan.
+ *
+ * @param session  The decode session to scan.
+ *
+ * @return The number of frames in {@code SSTV_PROCESSING_SEGMENT_TIME_SEC}.
+ */
+static size_t scan_segment_frames(const SstvSession *session) {
+    uint32_t sample_rate = session->wav_samples->sample_rate;
+    size_t segment_frames =
+        round(SSTV_PROCESSING_SEGMENT_TIME_SEC * sample_rate / session->stft_cache->hop_size);
+    return segment_frames > 0 ? segment_frames : 1;
+}
+
+
+/**
+ * Determines whether the SSTV calibration header starts at a frame.
+ *
+ * @param session  The decode session to test with.
+ * @param frame    The frame to test.
+ * @param context  The {@code VisSearch} parameters.
+ *
+ * @return Whether every block of the header has its expected frequency.
+ */
+static bool is_vis_start_frame(SstvSession *session, size_t frame, const void *context) {
+    const VisSearch *search = (const VisSearch *) context;
+
+    // Every block is checked, even after one fails, so that each frame of the cache is filled in
+    // the same order (and so transformed once) however the blocks turn out.
+    bool found = true;
+    for (size_t i = 0; i < SSTV_PROCESSING_NUM_HEADER_BLOCKS; i++) {
+        found &= stft_cache_is_frequency(session->stft_cache,
+                                         frame + search->block_frames[i],
+                                         search->window_size,
+                                         search->block_hz[i],
+                                         search->margin,
+                                         session->scratch);
+    }
+    return found;
+}
+
+
+/**
+ * Prepares a scan for the SSTV calibration header over all the samples of a session.
+ *
+ * @param session      The decode session to scan.
+ * @param search       The search parameters to fill in, which the scan refers to.
+ * @param scan         The scan to fill in.
+ * @param header_size  A location to place the number of samples in the header at.
+ */
+static void prepare_vis_scan(const SstvSession *session,
+                             VisSearch *search,
+                             SegmentScan *scan,
+                             size_t *header_size)
+{
+    // Extract information from the session for easier/shorter access names.
+    const WavSamples *wav_samples = session->wav_samples;
     size_t num_samples = wav_samples->num_samples;
     uint32_t sample_rate = wav_samples->sample_rate;
-    double *samples = wav_samples->samples;
+    size_t hop_size = session->stft_cache->hop_size;
 
     // We know that the header consists of four segments: a leader block, a break block, a
     // second leader, and a calibration bit before the VIS code. Graphically, this looks like the
@@ -31,65 +347,59 @@ size_t find_vis_start(const WavSamples *wav_samples) {
     // 1200 Hz . . . . .++ . . . . +--.............
     //                 10ms        30ms
     //
-    // To do this search, we define `_sample` variables for each block. These mark the relative
-    // start (in samples) compared to `current_sample` (in the for-loop below) where we expect
-    // the block to start. The search width is always `window_size`.
+    // To do this search, we define the start of each block (in frames of the STFT cache, 2ms by
+    // default) relative to the frame being tested. The search width is always `window_size`.
+    // Rounding the block offsets to whole frames moves each block by at most half a frame, and
+    // means that the frame checked for the VIS start now is the frame checked for the second
+    // leader 150 frames later and so on, so each frame is only transformed once.
 
     double header_time_sec = 2 * SSTV_LEADER_TIME_SEC + SSTV_BREAK_TIME_SEC + SSTV_BIT_TIME_SEC;
-    size_t header_size = round(header_time_sec * sample_rate);
-    size_t window_size = round(0.01 * sample_rate);  // 10ms search window for DFT
+    *header_size = round(header_time_sec * sample_rate);
+    search->window_size = round(session->params.header_window_sec * sample_rate);
 
-    size_t leader_1_sample = 0;
-    size_t break_sample = round(SSTV_LEADER_TIME_SEC * sample_rate);
-    size_t leader_2_sample = round((SSTV_BREAK_TIME_SEC + SSTV_LEADER_TIME_SEC) * sample_rate);
     double vis_start_time_sec = 2 * SSTV_LEADER_TIME_SEC + SSTV_BREAK_TIME_SEC;
-    size_t vis_start_sample = round(vis_start_time_sec * sample_rate);
+    search->block_frames[0] = 0;
+    search->block_frames[1] = round(SSTV_LEADER_TIME_SEC * sample_rate / hop_size);
+    search->block_frames[2] =
+        round((SSTV_BREAK_TIME_SEC + SSTV_LEADER_TIME_SEC) * sample_rate / hop_size);
+    search->block_frames[3] = round(vis_start_time_sec * sample_rate / hop_size);
+    search->block_hz[0] = frequency_from_double(SSTV_LEADER_HZ);
+    search->block_hz[1] = frequency_from_double(SSTV_BREAK_HZ);
+    search->block_hz[2] = frequency_from_double(SSTV_LEADER_HZ);
+    search->block_hz[3] = frequency_from_double(SSTV_BREAK_HZ);
+    search->margin = frequency_from_double(session->params.margin_hz);
 
-    // With everything defined for the four blocks, we start the search.
+    // Every frame that starts before the last `header_size` samples is tested. The segments of the
+    // scan overlap by one header, since a test reads the whole header after its frame.
+    scan->predicate = is_vis_start_frame;
+    scan->context = search;
+    scan->start_frame = 0;
+    scan->end_frame = 0;
+    if (num_samples > *header_size) {
+        scan->end_frame = (num_samples - *header_size + hop_size - 1) / hop_size;
+    }
+    scan->segment_frames = scan_segment_frames(session);
+    scan->window_size = search->window_size;
+    scan->num_threads = session->num_scan_threads;
+    scan->description = "SSTV header";
+}
 
-    size_t jump_size = round(0.002 * sample_rate);  // Shift sliding window by 2ms every iteration
 
-    // For each iteration through this loop, we get the list of samples starting at each block,
-    // then check if the dominant frequency in the block is what we expect for the header. If
-    // it is, then we return the sample we found plus the size of the header to get the sample
-    // immediately after the header.
-    for (size_t current_sample = 0;
-         current_sample < num_samples - header_size;
-         current_sample += jump_size)
-    {
-        if (current_sample % sample_rate == 0) {
-            double current_time = (double) current_sample / (double) sample_rate;
-            log_info("searching for SSTV header at time %5.1fs", current_time);
-        }
+size_t find_vis_start(SstvSession *session) {
+    assert(session && "find_vis_start got NULL session");
 
-        double *search_area = &samples[current_sample];
-
-        double *leader_1_area  = &search_area[leader_1_sample];
-        double *break_area     = &search_area[break_sample];
-        double *leader_2_area  = &search_area[leader_2_sample];
-        double *vis_start_area = &search_area[vis_start_sample];
-
-        bool leader_1_found  = is_frequency(leader_1_area,
-                                            window_size,
-                                            sample_rate,
-                                            SSTV_LEADER_HZ);
-        bool break_found     = is_frequency(break_area,
-                                            window_size,
-                                            sample_rate,
-                                            SSTV_BREAK_HZ);
-        bool leader_2_found  = is_frequency(leader_2_area,
-                                            window_size,
-                                            sample_rate,
-                                            SSTV_LEADER_HZ);
-        bool vis_start_found = is_frequency(vis_start_area,
-                                            window_size,
-                                            sample_rate,
-                                            SSTV_BREAK_HZ);
-
-        if (leader_1_found && break_found && leader_2_found && vis_start_found) {
-            log_info("found SSTV header!");
-            return current_sample + header_size;
-        }
+    VisSearch search;
+    SegmentScan scan;
+    size_t header_size;
+    prepare_vis_scan(session, &search, &scan, &header_size);
+
+    // If the header is found, we return the sample it starts at plus the size of the header to get
+    // the sample immediately after the header.
+    log_info("searching for SSTV header with %lu thread(s)", scan.num_threads);
+    size_t header_frame = segment_scan_first(session, &scan);
+    if (header_frame != (size_t) SSTV_PROCESSING_NOT_FOUND) {
+        log_info("found SSTV header!");
+        return header_frame * session->stft_cache->hop_size + header_size;
     }
 
     // If nothing was found, we return a sentinel value.
@@ -98,15 +408,130 @@ size_t find_vis_start(const WavSamples *wav_samples) {
 }
 
 
-uint8_t decode_vis_code(const WavSamples *wav_samples, size_t vis_start) {
-    assert(wav_samples && "decode_vis_code got NULL wav_samples");
+/**
+ * Saves the checkpoint of a session, if its interval has passed since the last save.
+ *
+ * @param session  The session with the checkpoint to save.
+ */
+static void save_checkpoint(SstvSession *session) {
+    SstvCheckpoint *checkpoint = session->checkpoint;
+    double now_sec = sstv_monotonic_time_sec();
+    if (now_sec - checkpoint->last_save_sec >= checkpoint->interval_sec) {
+        checkpoint->save(session, checkpoint, checkpoint->save_context);
+        checkpoint->last_save_sec = now_sec;
+    }
+}
+
+
+/**
+ * Searches for every SSTV calibration header from the position of the session's checkpoint, in
+ * chunks after each of which the checkpoint is brought up to date.
+ *
+ * @param session        The decode session with the checkpoint to resume.
+ * @param scan           The scan over every frame of the samples.
+ * @param header_size    The number of samples in the header.
+ * @param header_frames  The number of frames a header occupies.
+ */
+static void resume_vis_scan(SstvSession *session,
+                            const SegmentScan *scan,
+                            size_t header_size,
+                            size_t header_frames)
+{
+    SstvCheckpoint *checkpoint = session->checkpoint;
+    size_t hop_size = session->stft_cache->hop_size;
+
+    // Each chunk is a few segments for every thread, so a chunk keeps every thread busy and a
+    // restarted search repeats at most one chunk.
+    size_t chunk_frames = scan->segment_frames * SSTV_PROCESSING_CHECKPOINT_SEGMENTS *
+        (scan->num_threads > 0 ? scan->num_threads : 1);
+    size_t frame = (checkpoint->scan_sample + hop_size - 1) / hop_size;
+    if (frame > 0) {
+        log_info("resuming search for all SSTV headers at time %.1fs with %lu header(s) found",
+                 (double) checkpoint->scan_sample / session->wav_samples->sample_rate,
+                 checkpoint->num_vis_starts);
+    }
+
+    while (frame < scan->end_frame) {
+        SegmentScan chunk = *scan;
+        chunk.start_frame = frame;
+        chunk.end_frame = frame + chunk_frames;
+        if (chunk.end_frame > scan->end_frame) {
+            chunk.end_frame = scan->end_frame;
+        }
+
+        size_t *matches;
+        size_t num_matches = segment_scan_all(session, &chunk, header_frames, &matches);
+        checkpoint->vis_starts = (size_t *) realloc(
+            checkpoint->vis_starts, (checkpoint->num_vis_starts + num_matches) * sizeof(size_t));
+        assert((checkpoint->vis_starts || num_matches == 0) &&
+               "resume_vis_scan cannot realloc vis_starts");
+        for (size_t i = 0; i < num_matches; i++) {
+            checkpoint->vis_starts[checkpoint->num_vis_starts++] =
+                matches[i] * hop_size + header_size;
+        }
+
+        // A serial search would resume after the end of the last header, which may be past the
+        // end of the chunk.
+        frame = chunk.end_frame;
+        if (num_matches > 0 && matches[num_matches - 1] + header_frames > frame) {
+            frame = matches[num_matches - 1] + header_frames;
+        }
+        free(matches);
+
+        checkpoint->scan_sample = frame * hop_size;
+        save_checkpoint(session);
+    }
+}
+
+
+size_t find_all_vis_starts(SstvSession *session, size_t **vis_starts) {
+    assert(session && "find_all_vis_starts got NULL session");
+    assert(vis_starts && "find_all_vis_starts got NULL vis_starts");
+
+    VisSearch search;
+    SegmentScan scan;
+    size_t header_size;
+    prepare_vis_scan(session, &search, &scan, &header_size);
+
+    // A serial search for the next header would resume after the end of the last one, so matches
+    // within a header of each other are the same header.
+    size_t hop_size = session->stft_cache->hop_size;
+    size_t header_frames = (header_size + hop_size - 1) / hop_size;
+
+    log_info("searching for all SSTV headers with %lu thread(s)", scan.num_threads);
+    size_t num_headers;
+    if (session->checkpoint != NULL) {
+        resume_vis_scan(session, &scan, header_size, header_frames);
+        num_headers = session->checkpoint->num_vis_starts;
+        *vis_starts = (size_t *) malloc((num_headers + 1) * sizeof(size_t));
+        assert(*vis_starts && "find_all_vis_starts cannot malloc vis_starts");
+        for (size_t i = 0; i < num_headers; i++) {
+            (*vis_starts)[i] = session->checkpoint->vis_starts[i];
+        }
+    }
+    else {
+        num_headers = segment_scan_all(session, &scan, header_frames, vis_starts);
+        for (size_t i = 0; i < num_headers; i++) {
+            (*vis_starts)[i] = (*vis_starts)[i] * hop_size + header_size;
+        }
+    }
+
+    log_info("found %lu SSTV header(s)", num_headers);
+    return num_headers;
+}
+
+
+uint8_t decode_vis_code(SstvSession *session, size_t vis_start) {
+    assert(session && "decode_vis_code got NULL session");
 
     // Extract information to be used throughout this function.
+    const WavSamples *wav_samples = session->wav_samples;
     uint32_t sample_rate = wav_samples->sample_rate;
-    double *samples = wav_samples->samples;
+    Sample *samples = wav_samples->samples;
 
     size_t bit_size = round(SSTV_BIT_TIME_SEC * sample_rate);
     uint8_t vis_p_code = 0;  // The VIS code with parity bit that we will build bit-by-bit
+    Frequency break_hz = frequency_from_double(SSTV_BREAK_HZ);
 
     // For the number of bits in the VIS+P code, we loop through and figure out what sample
     // that bit contains. We then determine the sample area for that bit and find the peak
@@ -114,18 +539,22 @@ uint8_t decode_vis_code(const WavSamples *wav_samples, size_t vis_start) {
     // to `vis_p_code` (LSB is read first; lowest sample number).
     for (size_t i = 0; i < CHAR_BIT; i++) {
         size_t bit_sample = vis_start + i * bit_size;
-        double *bit_area = &samples[bit_sample];
-        double peak = peak_frequency(bit_area, bit_size, sample_rate);
+        Sample *bit_area = &samples[bit_sample];
+        Frequency peak = peak_frequency(bit_area, bit_size, sample_rate, session->scratch);
 
-        uint8_t bit_value = peak <= SSTV_BREAK_HZ;
+        uint8_t bit_value = peak <= break_hz;
         bit_value <<= i;
         vis_p_code |= bit_value;
     }
 
-    // Check that the parity is correct for sanity.
+    // Check that the parity is correct for sanity. A damaged header is left for the caller to
+    // recover from, e.g. by detecting the mode from the line timing.
     bool has_correct_parity = __builtin_parity(vis_p_code) == 0;
     log_debug("VIS+P code is %d", vis_p_code);
-    assert(has_correct_parity && "Incorrect parity!");
+    if (!has_correct_parity) {
+        log_warn("VIS code at sample %lu has incorrect parity", vis_start);
+        return SSTV_PROCESSING_INVALID_VIS;
+    }
 
     // Remove the parity bit (MSB) after it has been checked and return the VIS code.
     uint8_t vis_code = vis_p_code & 0x7F;
@@ -133,56 +562,324 @@ uint8_t decode_vis_code(const WavSamples *wav_samples, size_t vis_start) {
 }
 
 
-size_t find_sync_start(const WavSamples *wav_samples, const SstvMode *mode, size_t align_start) {
-    assert(wav_samples && "find_sync_end got NULL wav_samples");
-    assert(mode && "find_sync_end got NULL mode");
+/**
+ * Determines whether a frame is within a sync pulse.
+ *
+ * @param session  The decode session to test with.
+ * @param frame    The frame to test.
+ * @param context  The {@code SyncSearch} parameters.
+ *
+ * @return Whether the frame has the frequency of the sync pulse.
+ */
+static bool is_sync_start_frame(SstvSession *session, size_t frame, const void *context) {
+    const SyncSearch *search = (const SyncSearch *) context;
+    return stft_cache_is_frequency(session->stft_cache,
+                                   frame,
+                                   search->window_size,
+                                   search->sync_hz,
+                                   search->margin,
+                                   session->scratch);
+}
 
+
+/**
+ * Searches for a sample within a sync pulse, like {@code find_sync_start}, but only up to a sample.
+ *
+ * @param session      The decode session with the samples to search for a sync pulse.
+ * @param mode         The SSTV mode encoded in the samples.
+ * @param align_start  The sample to start searching from.
+ * @param search_end   The sample to stop searching at, which may be past the end of the samples.
+ *
+ * @return The index of a sample in the first sync pulse found. If no sync pulse starts before
+ *         {@code search_end}, {@code SSTV_PROCESSING_NOT_FOUND} is returned.
+ */
+static size_t find_sync_start_before(SstvSession *session,
+                                     const SstvMode *mode,
+                                     size_t align_start,
+                                     size_t search_end)
+{
     // Extract information used throughout the function.
+    const WavSamples *wav_samples = session->wav_samples;
     size_t num_samples = wav_samples->num_samples;
     uint32_t sample_rate = wav_samples->sample_rate;
-    double *samples = wav_samples->samples;
+    size_t hop_size = session->stft_cache->hop_size;
 
     // Define the size of the sync pulse and search parameters.
     size_t sync_size = round(mode->sync_time_sec * sample_rate);
-    size_t window_size = round(mode->sync_time_sec * 0.3 * sample_rate);
-    size_t jump_size = round(0.002 * sample_rate);
-
-    // Loop through all the samples starting at the specified `align_start` sample. Slide the
-    // search window by the 2ms `jump_size` for each iteration.
-    for (size_t current_sample = align_start;
-         current_sample < num_samples - sync_size;
-         current_sample += jump_size)
+    SyncSearch search;
+    double window_ratio = session->params.sync_start_ratio;
+    search.window_size = round(mode->sync_time_sec * window_ratio * sample_rate);
+    search.sync_hz = frequency_from_double(mode->sync_hz);
+    search.margin = frequency_from_double(session->params.margin_hz);
+    if (num_samples < sync_size || align_start >= num_samples - sync_size) {
+        return SSTV_PROCESSING_NOT_FOUND;
+    }
+
+    // Scan all the frames of the STFT cache starting at the first one at or after the
+    // specified `align_start` sample. Frames that were already checked (e.g. by an earlier search
+    // over the same region) are not transformed again. The sync search at the start of each line
+    // ends within the first segment, which is always scanned on this thread.
+    SegmentScan scan;
+    scan.predicate = is_sync_start_frame;
+    scan.context = &search;
+    scan.start_frame = stft_cache_frame_at(session->stft_cache, align_start);
+    scan.end_frame = (num_samples - sync_size + hop_size - 1) / hop_size;
+    if (search_end < num_samples - sync_size) {
+        scan.end_frame = (search_end + hop_size - 1) / hop_size;
+    }
+    scan.segment_frames = scan_segment_frames(session);
+    scan.window_size = search.window_size;
+    scan.num_threads = session->num_scan_threads;
+    scan.description = "sync pulse";
+
+    size_t sync_frame = segment_scan_first(session, &scan);
+    if (sync_frame == (size_t) SSTV_PROCESSING_NOT_FOUND) {
+        return SSTV_PROCESSING_NOT_FOUND;
+    }
+    return sync_frame * hop_size;
+}
+
+
+/**
+ * Searches for the end of the sync pulse of a line near where the previous lines predict it.
+ *
+ * Only the frames within {@code tolerance} of the predicted start of the pulse are searched, so
+ * the cost of the search does not depend on how noisy the line is.
+ *
+ * @param session        The decode session with the samples to search for a sync pulse.
+ * @param mode           The SSTV mode encoded in the samples.
+ * @param predicted_end  The predicted end of the sync pulse, as {@code find_sync_end} measures it,
+ *                       in (fractional) samples.
+ * @param tolerance      The number of samples that the pulse may be away from its prediction.
+ *
+ * @return The end of the sync pulse. If no sync pulse starts and ends within {@code tolerance} of
+ *         its prediction, {@code SSTV_PROCESSING_NOT_FOUND} is returned.
+ */
+static size_t track_sync_end(SstvSession *session,
+                             const SstvMode *mode,
+                             double predicted_end,
+                             double tolerance)
+{
+    double sync_size = mode->sync_time_sec * session->wav_samples->sample_rate;
+    double predicted_start = predicted_end - sync_size;
+    if (predicted_start + tolerance < 0) {
+        return SSTV_PROCESSING_NOT_FOUND;
+    }
+
+    size_t search_start = (predicted_start > tolerance) ? round(predicted_start - tolerance) : 0;
+    size_t search_end = round(predicted_start + tolerance);
+    size_t sync_start = find_sync_start_before(session, mode, search_start, search_end);
+    if (sync_start == (size_t) SSTV_PROCESSING_NOT_FOUND) {
+        return SSTV_PROCESSING_NOT_FOUND;
+    }
+
+    size_t sync_end = find_sync_end(session, mode, sync_start);
+    if (sync_end == (size_t) SSTV_PROCESSING_NOT_FOUND ||
+        fabs((double) sync_end - predicted_end) > tolerance)
     {
-        // Print some debug information about the search progress.
-        if (current_sample % sample_rate == 0) {
-            double current_time = (double) current_sample / (double) sample_rate;
-            log_info("searching for sync pulse at time %5.1fs", current_time);
+        return SSTV_PROCESSING_NOT_FOUND;
+    }
+    return sync_end;
+}
+
+
+size_t find_sync_start(SstvSession *session, const SstvMode *mode, size_t align_start) {
+    assert(session && "find_sync_start got NULL session");
+    assert(mode && "find_sync_start got NULL mode");
+
+    return find_sync_start_before(session, mode, align_start, session->wav_samples->num_samples);
+}
+
+
+/**
+ * The time measured for the lines of an image so far, for deciding the quality tier of the next
+ * line.
+ *
+ * @var sync_time_sec    The total time of the sync searches.
+ * @var num_sync_lines   The number of lines with a sync search.
+ * @var pixel_time_sec   The total time of decoding the pixels of lines, as if every pixel was
+ *                       decoded.
+ * @var num_pixel_lines  The number of lines with decoded pixels.
+ */
+struct line_times_s {
+    double sync_time_sec;
+    size_t num_sync_lines;
+    double pixel_time_sec;
+    size_t num_pixel_lines;
+};
+
+
+/**
+ * The starts of the lines of an image found so far, from which the next one is searched for.
+ *
+ * With the tone search, the sync of each line after the first is only searched for near where it
+ * is predicted, one line period plus a running correction after the previous one, and the
+ * prediction is kept when no sync is found there. The correction follows the error of each sync
+ * that is found, which tracks a sample rate that is slightly off.
+ *
+ * @var detector          The matched-filter detector of the image, or {@code NULL} to search for
+ *                        the sync tone of each line.
+ * @var known_starts      Whether the start of each line is taken from the {@code line_starts} of
+ *                        the session instead.
+ * @var line_period       The number of samples from the start of one line to the next.
+ * @var tolerance         How far from its predicted position the sync of a line is searched for,
+ *                        in samples.
+ * @var correction        The running correction of the line period, in samples.
+ * @var line_start        The first sample of the current line, as the tone search places it.
+ * @var exact_line_start  The (fractional) first sample of the current line.
+ * @var first_line_start  The (fractional) first sample of the first line.
+ */
+struct line_sync_s {
+    SyncDetector *detector;
+    bool known_starts;
+    double line_period;
+    double tolerance;
+    double correction;
+    size_t line_start;
+    double exact_line_start;
+    double first_line_start;
+};
+
+
+/**
+ * Decides the quality tier to decode the next line of an image at, before a deadline.
+ *
+ * The tier steps down while the remaining lines, at the average time measured for the current
+ * tier, would not finish before the deadline. Until a part of a line has been measured, it is
+ * assumed to take no time, so the first line is always decoded at the current tier.
+ *
+ * @param tier          The tier of the previous line.
+ * @param deadline_sec  The deadline, on the clock of {@code sstv_monotonic_time_sec}.
+ * @param num_lines     The number of lines left to decode, including the next one.
+ * @param line_times    The time measured for the lines decoded so far.
+ *
+ * @return The tier of the next line, which is {@code SSTV_TIER_SKIPPED} if the deadline passed.
+ */
+static LineTier select_line_tier(LineTier tier,
+                                 double deadline_sec,
+                                 size_t num_lines,
+                                 const LineTimes *line_times)
+{
+    double time_left_sec = deadline_sec - sstv_monotonic_time_sec();
+    if (time_left_sec <= 0) {
+        return SSTV_TIER_SKIPPED;
+    }
+
+    double sync_time_sec = (line_times->num_sync_lines > 0) ?
+        line_times->sync_time_sec / line_times->num_sync_lines : 0;
+    double pixel_time_sec = (line_times->num_pixel_lines > 0) ?
+        line_times->pixel_time_sec / line_times->num_pixel_lines : 0;
+    if (tier == SSTV_TIER_FULL && (sync_time_sec + pixel_time_sec) * num_lines > time_left_sec) {
+        tier = SSTV_TIER_PREDICTED;
+    }
+    if (tier == SSTV_TIER_PREDICTED && pixel_time_sec * num_lines > time_left_sec) {
+        tier = SSTV_TIER_REDUCED;
+    }
+    return tier;
+}
+
+
+/**
+ * Places the end of a sync pulse where a window as long as the pulse holds the most power at the
+ * sync frequency, near where the sliding window of {@code find_sync_end} stopped matching it.
+ *
+ * That window is longer than the pulse, and it keeps matching the sync frequency until well under
+ * half of it is still in the pulse, by an amount that depends on the porch and pixels after the
+ * pulse, so its center lands about a porch late. The end is instead searched for across the
+ * window, first every {@code sync_size / 16} samples and then every sample around the most power.
+ *
+ * Where the pulse follows another tone at the sync frequency, like the stop bit of the header,
+ * the power is level up to the end of the pulse. If it is already level where the search starts,
+ * the end is moved on to the last sample before the power falls by more than it would for a
+ * pulse {@code SSTV_PROCESSING_SYNC_END_SLACK_SEC} shorter, which is more than the ripple of the
+ * power along a pure tone.
+ *
+ * @param samples      The samples of the session.
+ * @param num_samples  The number of samples in {@code samples}.
+ * @param sample_rate  The sample rate in Hertz.
+ * @param mode         The SSTV mode encoded in the samples.
+ * @param stop_start   The start of the first window that did not match the sync frequency.
+ * @param sync_window  The number of samples in the window.
+ *
+ * @return The first sample that is not in the sync pulse.
+ */
+static size_t refine_sync_end(const Sample *samples,
+                              size_t num_samples,
+                              uint32_t sample_rate,
+                              const SstvMode *mode,
+                              size_t stop_start,
+                              size_t sync_window)
+{
+    size_t sync_size = round(mode->sync_time_sec * sample_rate);
+    size_t first = (stop_start > sync_size) ? stop_start : sync_size;
+    size_t last = stop_start + sync_window;
+    if (last > num_samples) {
+        last = num_samples;
+    }
+    if (sync_size == 0 || last < first) {
+        return stop_start + sync_window / 2;
+    }
+
+    // The window that ends at the end of the pulse is wholly in it, so it holds the most power.
+    size_t coarse_step = (sync_size >= 16) ? sync_size / 16 : 1;
+    Frequency sync_hz = frequency_from_double(mode->sync_hz);
+    SampleAccumulator first_power =
+        tone_power(&samples[first - sync_size], sync_size, sample_rate, sync_hz);
+    size_t best_end = first;
+    SampleAccumulator best_power = first_power;
+    for (size_t end = first + coarse_step; end <= last; end += coarse_step) {
+        SampleAccumulator power =
+            tone_power(&samples[end - sync_size], sync_size, sample_rate, sync_hz);
+        if (power > best_power) {
+            best_power = power;
+            best_end = end;
         }
+    }
 
-        // Check for the sync pulse.
-        double *sync_area = &samples[current_sample];
-        if (is_frequency(sync_area, window_size, sample_rate, mode->sync_hz)) {
-            return current_sample;
+    size_t fine_first = (best_end > first + coarse_step) ? best_end - coarse_step : first;
+    size_t fine_last = (best_end + coarse_step < last) ? best_end + coarse_step : last;
+    for (size_t end = fine_first; end <= fine_last; end++) {
+        SampleAccumulator power =
+            tone_power(&samples[end - sync_size], sync_size, sample_rate, sync_hz);
+        if (power > best_power) {
+            best_power = power;
+            best_end = end;
         }
     }
 
-    // Nothing was found.
-    return SSTV_PROCESSING_NOT_FOUND;
+    // The power is proportional to the square of the number of samples in the pulse.
+    double level_fraction = 1.0 - SSTV_PROCESSING_SYNC_END_SLACK_SEC / mode->sync_time_sec;
+    SampleAccumulator level_power = best_power * level_fraction * level_fraction;
+    if (first_power < level_power) {
+        return best_end;
+    }
+    while (best_end < last &&
+           tone_power(&samples[best_end + 1 - sync_size], sync_size, sample_rate, sync_hz) >=
+               level_power)
+    {
+        best_end++;
+    }
+    return best_end;
 }
 
 
-size_t find_sync_end(const WavSamples *wav_samples, const SstvMode *mode, size_t align_start) {
-    assert(wav_samples && "find_sync_end got NULL wav_samples");
+size_t find_sync_end(SstvSession *session, const SstvMode *mode, size_t align_start) {
+    assert(session && "find_sync_end got NULL session");
     assert(mode && "find_sync_end got NULL mode");
 
     // Extract information to be used throughout.
+    const WavSamples *wav_samples = session->wav_samples;
+    ScratchArena *scratch = session->scratch;
     size_t num_samples = wav_samples->num_samples;
     uint32_t sample_rate = wav_samples->sample_rate;
-    double *samples = wav_samples->samples;
+    Sample *samples = wav_samples->samples;
 
     // Define a size for the sync window, with some margin-of-error factor from the sync time.
     // Then, determine when the sync alignment stop should be.
-    size_t sync_window = round(mode->sync_time_sec * 1.4 * sample_rate);
+    size_t sync_window = round(mode->sync_time_sec * session->params.sync_end_ratio * sample_rate);
+    size_t sync_step = session->params.sync_end_step;
+    Frequency sync_hz = frequency_from_double(mode->sync_hz);
+    Frequency margin = frequency_from_double(session->params.margin_hz);
     size_t align_stop = num_samples - sync_window;
     if (align_stop <= align_start) {
         return SSTV_PROCESSING_NOT_FOUND;
@@ -190,99 +887,478 @@ size_t find_sync_end(const WavSamples *wav_samples, const SstvMode *mode, size_t
 
     // Search for end of the sync signal.
     size_t current_sample;
-    for (current_sample = align_start; current_sample < align_stop; current_sample++) {
-        double *sync_window_area = &samples[current_sample];
-        if (!is_frequency(sync_window_area, sync_window, sample_rate, mode->sync_hz)) {
+    for (current_sample = align_start; current_sample < align_stop; current_sample += sync_step) {
+        Sample *sync_window_area = &samples[current_sample];
+        if (!is_frequency(sync_window_area, sync_window, sample_rate, sync_hz, margin, scratch)) {
             break;
         }
     }
+    if (current_sample > align_stop) {
+        current_sample = align_stop;
+    }
 
     // Return the first sample that is not in the sync signal.
-    return current_sample + (sync_window / 2);
+    return refine_sync_end(samples, num_samples, sample_rate, mode, current_sample, sync_window);
 }
 
 
-uint8_t *decode_image_data(const WavSamples *wav_samples, const SstvMode *mode, size_t image_start)
+/**
+ * Places the start of the next line of an image, by the sync method of the session and the quality
+ * tier of the line, and records it in the {@code line_starts} and {@code line_tiers} of the
+ * session.
+ *
+ * @param session    The decode session.
+ * @param mode       The SSTV mode of the image.
+ * @param sync       The line starts found so far, which are moved on to the line.
+ * @param data_line  The line of image data.
+ * @param tier       The quality tier of the line.
+ *
+ * @return Whether the sync of the line was searched for, rather than predicted or known.
+ */
+static bool place_line_start(SstvSession *session,
+                             const SstvMode *mode,
+                             LineSync *sync,
+                             size_t data_line,
+                             LineTier tier)
 {
-    assert(wav_samples && "decode_image_data got NULL wav_samples");
+    size_t line_num = data_line * session->preview_step;
+    bool searched_sync = false;
+    if (sync->known_starts) {
+        sync->exact_line_start = session->line_starts[data_line];
+    }
+    else if (session->preview_step > 1 && line_num > 0) {
+        sync->exact_line_start = sync->first_line_start + line_num * sync->line_period;
+    }
+    else if (tier != SSTV_TIER_FULL && data_line > 0) {
+        sync->exact_line_start += sync->line_period + sync->correction;
+        sync->line_start = round(sync->exact_line_start);
+    }
+    else if (sync->detector != NULL) {
+        bool locked;
+        sync->exact_line_start = sync_detector_next_line(sync->detector, &locked);
+        searched_sync = true;
+        if (!locked) {
+            log_debug("lost sync of line %lu, using its predicted position", line_num);
+        }
+    }
+    else if (data_line > 0) {
+        double predicted_end = sync->exact_line_start + sync->line_period + sync->correction;
+        size_t sync_end = track_sync_end(session, mode, predicted_end, sync->tolerance);
+        searched_sync = true;
+        if (sync_end != (size_t) SSTV_PROCESSING_NOT_FOUND) {
+            sync->correction += SSTV_PROCESSING_SYNC_TRACK_GAIN * (sync_end - predicted_end);
+            sync->exact_line_start = sync_end;
+        }
+        else {
+            log_debug("no sync found near line %lu, using its predicted position", line_num);
+            sync->exact_line_start = predicted_end;
+        }
+        sync->line_start = round(sync->exact_line_start);
+    }
+    else if (session->deadline_sec > 0) {
+        // Where the image starts is only a guess, but a first sync that is not found within a few
+        // lines of it is left at the guess, rather than searched for through the rest of the
+        // samples.
+        size_t search_end =
+            sync->line_start + SSTV_PROCESSING_DEADLINE_SYNC_LINES * sync->line_period;
+        size_t sync_start = find_sync_start_before(session, mode, sync->line_start, search_end);
+        searched_sync = true;
+        if (sync_start != (size_t) SSTV_PROCESSING_NOT_FOUND) {
+            sync->line_start = find_sync_end(session, mode, sync_start);    // Skip sync pulse
+            sync->exact_line_start = sync->line_start;
+        }
+        sync->first_line_start = sync->exact_line_start;
+    }
+    else {
+        sync->line_start = find_sync_start(session, mode, sync->line_start);
+        sync->line_start = find_sync_end(session, mode, sync->line_start);    // Skip sync pulse
+        sync->exact_line_start = sync->line_start;
+        sync->first_line_start = sync->line_start;
+    }
+
+    if (session->line_starts != NULL) {
+        session->line_starts[data_line] = sync->exact_line_start;
+    }
+    if (session->line_tiers != NULL) {
+        session->line_tiers[data_line] = tier;
+    }
+    return searched_sync;
+}
+
+
+/**
+ * Hands a decoded line of an image on: pushes it to the line ring of the session, stores its
+ * latency and adds it to the checkpoint of the image.
+ *
+ * @param session           The decode session.
+ * @param mode              The SSTV mode of the image.
+ * @param image_data        The image data decoded so far.
+ * @param data_line         The line of image data.
+ * @param line_data_size    The number of bytes in a line of image data.
+ * @param line_start        The (fractional) first sample of the line.
+ * @param decode_start_sec  The time of {@code sstv_monotonic_time_sec} at which the decoding of
+ *                          the line started, after its samples arrived.
+ * @param checkpoint_image  Whether the image is kept in the checkpoint of the session.
+ */
+static void finish_line(SstvSession *session,
+                        const SstvMode *mode,
+                        const uint8_t *image_data,
+                        size_t data_line,
+                        size_t line_data_size,
+                        double line_start,
+                        double decode_start_sec,
+                        bool checkpoint_image)
+{
+    const uint8_t *line_data = &image_data[data_line * line_data_size];
+    if (session->line_ring != NULL) {
+        spsc_ring_push(session->line_ring, line_data);
+    }
+
+    if (session->line_latencies != NULL) {
+        // Without a replay, the last sample of the line is taken to arrive when its decoding
+        // starts.
+        double arrival_sec = decode_start_sec;
+        if (session->replay_rate > 0) {
+            double line_time_sec = mode->pixel_time_sec * mode->width * mode->num_channels;
+            double line_end = line_start +
+                (mode->porch_time_sec + line_time_sec) * session->wav_samples->sample_rate;
+            arrival_sec = session->replay_start_sec + line_end / session->replay_rate;
+        }
+        session->line_latencies[data_line] = sstv_monotonic_time_sec() - arrival_sec;
+    }
+
+    SstvCheckpoint *checkpoint = session->checkpoint;
+    if (checkpoint_image) {
+        memcpy(&checkpoint->image_data[data_line * line_data_size], line_data, line_data_size);
+        checkpoint->num_lines = data_line + 1;
+        save_checkpoint(session);
+    }
+}
+
+
+uint8_t *decode_image_data(SstvSession *session, const SstvMode *mode, size_t image_start) {
+    assert(session && "decode_image_data got NULL session");
     assert(mode && "decode_image_data got NULL mode");
 
     // Extract information from the arguments into smaller symbol names for easy use.
+    const WavSamples *wav_samples = session->wav_samples;
+    ScratchArena *scratch = session->scratch;
     size_t num_samples = wav_samples->num_samples;
     uint32_t sample_rate = wav_samples->sample_rate;
-    double *samples = wav_samples->samples;
+    Sample *samples = wav_samples->samples;
 
     size_t width = mode->width;
     size_t height = mode->height;
     uint16_t num_channels = mode->num_channels;
 
+    // A preview only decodes every `preview_step`th pixel of every `preview_step`th line, so the
+    // image data is that much smaller in both dimensions.
+    size_t preview_step = session->preview_step;
+    size_t data_width = (width + preview_step - 1) / preview_step;
+    size_t data_height = (height + preview_step - 1) / preview_step;
+
     // We use calloc here so that we can return a zero'ed out list if we don't get all the image
     // data. Any missing data will be black in the final image.
-    uint8_t *image_data = (uint8_t *) calloc(width * height * num_channels, sizeof(uint8_t));
+    uint8_t *image_data =
+        (uint8_t *) calloc(data_width * data_height * num_channels, sizeof(uint8_t));
     assert(image_data && "decode_image_data could not calloc image_data");
 
     // Calculate some information about the number of samples per pixel to check with the DFT.
     // Also, calculate some time information from the mode description.
-    double center_window_time = (mode->pixel_time_sec * mode->window_factor) / 2.0;
+    double center_window_time = pixel_window_time_sec(mode, &session->params) / 2.0;
     size_t pixel_size = round(center_window_time * 2.0 * sample_rate);
+    Frequency pixel_min = frequency_from_double(mode->pixel_min_hz);
+    Frequency pixel_range = frequency_from_double(mode->pixel_max_hz) - pixel_min;
 
     double channel_time_sec = mode->pixel_time_sec * width;
     double line_time_sec = channel_time_sec * num_channels;
+    double line_period =
+        (mode->sync_time_sec + mode->porch_time_sec + line_time_sec) * sample_rate;
+
+    // With the matched filter, the syncs of every line are found from one correlation pass over
+    // the whole image. Otherwise, each line searches for its own sync. A preview only searches
+    // for the sync of the first line, and places the others by the line time of the mode.
+    // The detector lives in the scratch arena under the marks of the lines, until the image ends.
+    LineSync sync;
+    sync.detector = NULL;
+    sync.known_starts = session->line_starts != NULL && session->known_starts;
+    sync.line_period = line_period;
+    sync.tolerance = mode->sync_time_sec * session->params.sync_track_ratio * sample_rate;
+    sync.correction = 0;
+    sync.line_start = image_start;
+    sync.exact_line_start = image_start;
+    sync.first_line_start = image_start;
+    size_t detector_mark = scratch_arena_mark(scratch);
+    if (session->sync_method == SSTV_SYNC_MATCHED && preview_step == 1 && !sync.known_starts) {
+        sstv_session_wait_for_sample(session, image_start + (height + 1) * line_period);
+        sync.detector = sync_detector_create(wav_samples, mode, image_start, height, scratch);
+        if (sync.detector == NULL) {
+            log_warn("cannot create matched-filter sync detector, searching for tones instead");
+        }
+    }
+
+    // With a deadline, the average time of the sync search and of the pixels of a line decide when
+    // the quality tier steps down. Lines that are never decoded keep the skipped tier.
+    bool has_deadline = session->deadline_sec > 0;
+    LineTier tier = SSTV_TIER_FULL;
+    LineTimes line_times = {0, 0, 0, 0};
+    if (session->line_tiers != NULL) {
+        for (size_t data_line = 0; data_line < data_height; data_line++) {
+            session->line_tiers[data_line] = SSTV_TIER_SKIPPED;
+        }
+    }
+    if (session->line_latencies != NULL) {
+        for (size_t data_line = 0; data_line < data_height; data_line++) {
+            session->line_latencies[data_line] = -1;
+        }
+    }
 
     // We loop through the dimensions and depth of the image to get pixel values. The outer loop
     // goes through each scan row between sync pulses.
-    size_t line_start = image_start;
-    for (size_t line_num = 0; line_num < height; line_num++) {
-        line_start = find_sync_start(wav_samples, mode, line_start);
-        line_start = find_sync_end(wav_samples, mode, line_start);    // Skip sync pulse
+    bool out_of_data = false;
+    size_t line_data_size = num_channels * data_width;
+    size_t num_lines_pushed = 0;
+
+    // The lines in a checkpoint of the image are not decoded again, and the search for the next
+    // sync continues after the last of them. The matched-filter detector is stepped past them so
+    // that it predicts the next sync from the last one.
+    SstvCheckpoint *checkpoint = session->checkpoint;
+    bool checkpoint_image =
+        checkpoint != NULL && checkpoint->image_data != NULL && session->line_starts != NULL;
+    size_t first_data_line = 0;
+    if (checkpoint_image && checkpoint->num_lines > 0) {
+        first_data_line = checkpoint->num_lines;
+        if (first_data_line > data_height) {
+            first_data_line = data_height;
+        }
+        memcpy(image_data, checkpoint->image_data, first_data_line * line_data_size);
+        sync.exact_line_start = session->line_starts[first_data_line - 1];
+        sync.first_line_start = session->line_starts[0];
+        sync.line_start = round(sync.exact_line_start) + round(line_time_sec * sample_rate);
+        log_info("resuming image at line %lu", first_data_line * preview_step);
+
+        for (size_t data_line = 0; data_line < first_data_line; data_line++) {
+            if (sync.detector != NULL) {
+                sync_detector_next_line(sync.detector, NULL);
+            }
+            if (session->line_tiers != NULL) {
+                session->line_tiers[data_line] = SSTV_TIER_FULL;
+            }
+            if (session->line_ring != NULL) {
+                spsc_ring_push(session->line_ring, &image_data[data_line * line_data_size]);
+            }
+        }
+        num_lines_pushed = first_data_line;
+
+        // The correction is replayed from the line starts, so the lines after the checkpoint are
+        // predicted as they would have been without it.
+        for (size_t data_line = 1; data_line < first_data_line; data_line++) {
+            double predicted_end =
+                session->line_starts[data_line - 1] + line_period + sync.correction;
+            double error = session->line_starts[data_line] - predicted_end;
+            if (fabs(error) <= sync.tolerance) {
+                sync.correction += SSTV_PROCESSING_SYNC_TRACK_GAIN * error;
+            }
+        }
+    }
+
+    for (size_t data_line = first_data_line; data_line < data_height && !out_of_data; data_line++) {
+        size_t line_num = data_line * preview_step;
+        if (has_deadline) {
+            LineTier next_tier =
+                select_line_tier(tier, session->deadline_sec, data_height - data_line, &line_times);
+            if (next_tier != tier) {
+                log_debug("decoding from line %lu at quality tier %d", line_num, next_tier);
+            }
+            tier = next_tier;
+            if (tier == SSTV_TIER_SKIPPED) {
+                log_warn("reached the deadline at line %lu, exiting early", line_num);
+                break;
+            }
+        }
 
-        if (line_num % 10 == 0) {
+        // A replay waits for the samples that the sync search reads: those up to a sync past where
+        // it is predicted, or a line period past the guess of the first one.
+        if (sync.detector == NULL && !sync.known_starts) {
+            double sync_lookahead = (data_line > 0)
+                ? sync.exact_line_start + line_period + sync.correction + sync.tolerance +
+                      mode->sync_time_sec * sample_rate
+                : sync.line_start + line_period;
+            sstv_session_wait_for_sample(session, sync_lookahead);
+        }
+        double wait_start_sec = session->replay_wait_sec;
+
+        perf_counters_start(session->perf, PERF_STAGE_SYNC);
+        double sync_start_time = sstv_monotonic_time_sec();
+        bool searched_sync = place_line_start(session, mode, &sync, data_line, tier);
+
+        // The search for the first sync starts wherever the caller guessed the image starts, so
+        // its time says little about the searches of the other lines and is not counted.
+        perf_counters_stop(session->perf, PERF_STAGE_SYNC);
+        perf_counters_start(session->perf, PERF_STAGE_PIXELS);
+        double pixel_start_time = sstv_monotonic_time_sec();
+        if (searched_sync && data_line > 0) {
+            line_times.sync_time_sec += pixel_start_time - sync_start_time;
+            line_times.num_sync_lines++;
+        }
+
+        if (data_line % 10 == 0) {
             log_info("decoding image line %3lu / %lu...", line_num, height);
         }
 
         // The middle loop goes through each color channel per line. For some modes, like PD modes,
-        // this contains channels for two lines at ones.
+        // this contains channels for two lines at ones. At the reduced tier, only every other pixel
+        // is decoded.
+        size_t pixel_stride = (tier == SSTV_TIER_REDUCED) ? 2 : 1;
+        size_t num_batch_pixels = (data_width + pixel_stride - 1) / pixel_stride;
         for (size_t channel_num = 0; channel_num < num_channels; channel_num++) {
+            // The pixels of a channel all have the same window size, so they are gathered into one
+            // batch and transformed together.
+            size_t scratch_mark = scratch_arena_mark(scratch);
+            size_t *pixel_starts =
+                (size_t *) scratch_arena_alloc(scratch, data_width * sizeof(size_t));
+            Frequency *frequencies =
+                (Frequency *) scratch_arena_alloc(scratch, data_width * sizeof(Frequency));
+            assert(pixel_starts && frequencies && "decode_image_data cannot alloc pixel batch");
+
+            // We calculate the location of the first pixel in terms of time and then sample
+            // number. The pixel location is set to be the center of a window `pixel_size` samples
+            // wide. The pixels after it are stepped to in fixed-point samples, so the inner loop
+            // only adds integers.
+            double channel_offset_sec = mode->porch_time_sec + channel_time_sec * channel_num;
+            double centered_offset_sec = channel_offset_sec - center_window_time;
+            double first_sample = sync.exact_line_start + centered_offset_sec * sample_rate;
+            double pixel_step = mode->pixel_time_sec * preview_step * pixel_stride * sample_rate;
+            int64_t pixel_sample_fixed =
+                llround(ldexp(first_sample, SSTV_PROCESSING_PIXEL_STEP_BITS));
+            int64_t pixel_step_fixed = llround(ldexp(pixel_step, SSTV_PROCESSING_PIXEL_STEP_BITS));
+
             // The inner loop goes through each pixel for each channel in a row.
-            for (size_t pixel_num = 0; pixel_num < width; pixel_num++) {
-                // We calculate the location of the pixel in terms of time and then sample number.
-                // The pixel location is set to be the center of a window `pixel_size` samples
-                // wide.
-                double channel_offset_sec = mode->porch_time_sec + channel_time_sec * channel_num;
-                double local_pixel_offset_sec = mode->pixel_time_sec * pixel_num;
-                double pixel_offset_sec = channel_offset_sec + local_pixel_offset_sec;
-                double centered_pixel_offset_sec = pixel_offset_sec - center_window_time;
-                size_t pixel_sample = round(line_start + centered_pixel_offset_sec * sample_rate);
-
-                // Check if we have run out of audio data and need to exit early.
-                if (pixel_sample >= num_samples) {
-                    log_warn("ran out of image data at line %lu, exiting early", line_num);
-                    return image_data;  // The rest is set to 0's by calloc
-                }
+            size_t num_pixels = 0;
+            for (size_t data_pixel = 0; data_pixel < data_width; data_pixel += pixel_stride) {
+                int64_t rounded_sample =
+                    pixel_sample_fixed + ((int64_t) 1 << (SSTV_PROCESSING_PIXEL_STEP_BITS - 1));
+                pixel_sample_fixed += pixel_step_fixed;
 
-                // Get the pixel data and determine the peak frequency, then convert the frequency
-                // to an integer on [0, 255] and add it to the image data.
-                double *pixel_area = &samples[pixel_sample];
-                double frequency = peak_frequency(pixel_area, pixel_size, sample_rate);
+                // Check if we have run out of audio data, in which case only the pixels before
+                // this one are decoded. A window that would start before the samples is out of
+                // them too.
+                if (rounded_sample < 0) {
+                    break;
+                }
+                size_t pixel_sample = rounded_sample >> SSTV_PROCESSING_PIXEL_STEP_BITS;
+                if (pixel_sample >= num_samples || pixel_size > num_samples - pixel_sample) {
+                    break;
+                }
+                pixel_starts[num_pixels++] = pixel_sample;
+            }
 
+            // Determine the peak frequency of every pixel, then convert the frequencies to
+            // integers on [0, 255] and add them to the image data.
+            if (num_pixels > 0) {
+                sstv_session_wait_for_sample(session, pixel_starts[num_pixels - 1] + pixel_size);
+                peak_frequencies(samples,
+                                 pixel_starts,
+                                 num_pixels,
+                                 pixel_size,
+                                 sample_rate,
+                                 frequencies,
+                                 scratch);
+            }
+            for (size_t batch_pixel = 0; batch_pixel < num_pixels; batch_pixel++) {
+                size_t data_pixel = batch_pixel * pixel_stride;
                 size_t pixel_index =
-                    line_num * num_channels * width + channel_num * width + pixel_num;
-                image_data[pixel_index] = calculate_pixel_value(frequency, mode);
+                    data_line * num_channels * data_width + channel_num * data_width + data_pixel;
+                image_data[pixel_index] =
+                    calculate_pixel_value(frequencies[batch_pixel], pixel_min, pixel_range);
+                if (pixel_stride > 1 && data_pixel + 1 < data_width) {
+                    image_data[pixel_index + 1] = image_data[pixel_index];
+                }
+            }
+            scratch_arena_release(scratch, scratch_mark);
+
+            if (num_pixels < num_batch_pixels) {
+                log_warn("ran out of image data at line %lu, exiting early", line_num);
+                out_of_data = true;  // The rest is set to 0's by calloc
+                break;
             }
         }
 
-        line_start += round(line_time_sec * sample_rate);
+        // The pixel time is kept as the time of a whole line, even when only half of it is decoded,
+        // and leaves out the time waited for the samples to arrive.
+        double line_end_time = sstv_monotonic_time_sec();
+        double pixel_time_sec =
+            line_end_time - pixel_start_time - (session->replay_wait_sec - wait_start_sec);
+        line_times.pixel_time_sec += pixel_time_sec * pixel_stride;
+        line_times.num_pixel_lines++;
+        perf_counters_stop(session->perf, PERF_STAGE_PIXELS);
+
+        sync.line_start += round(line_time_sec * sample_rate);
+        if (!out_of_data) {
+            finish_line(session,
+                        mode,
+                        image_data,
+                        data_line,
+                        line_data_size,
+                        sync.exact_line_start,
+                        sync_start_time,
+                        checkpoint_image);
+            num_lines_pushed = data_line + 1;
+        }
+    }
+
+    // The lines that were not decoded are pushed too, so the consumer always gets a whole image.
+    for (size_t data_line = num_lines_pushed;
+         session->line_ring != NULL && data_line < data_height;
+         data_line++)
+    {
+        spsc_ring_push(session->line_ring, &image_data[data_line * line_data_size]);
+    }
+
+    // The checkpoint ends with the whole image, including any lines left black.
+    if (checkpoint_image) {
+        memcpy(checkpoint->image_data, image_data, data_height * line_data_size);
+        checkpoint->num_lines = data_height;
     }
 
+    scratch_arena_release(scratch, detector_mark);
     return image_data;
 }
 
 
-static uint8_t calculate_pixel_value(double frequency, const SstvMode *mode) {
-    assert(mode && "calculate_pixel_value got NULL mode");
+void prepare_mode_fft_plans(const SstvMode *mode, uint32_t sample_rate, const SstvParams *params) {
+    assert(mode && "prepare_mode_fft_plans got NULL mode");
+    assert(params && "prepare_mode_fft_plans got NULL params");
 
-    double pixel_range_hz = mode->pixel_max_hz - mode->pixel_min_hz;
-    double pixel_value = (frequency - mode->pixel_min_hz) / pixel_range_hz * 256.0;
+    size_t sizes[SSTV_PROCESSING_MAX_MODE_WINDOWS];
+    size_t num_sizes = mode_window_sizes(mode, sample_rate, params, sizes);
+    for (size_t i = 0; i < num_sizes; i++) {
+        prepare_fft_plan(sizes[i], 1);
+    }
+
+    // The pixels of each channel are also transformed as one batch, and the matched filter of the
+    // sync pulses has plans of its own.
+    prepare_fft_plan(sizes[SSTV_PROCESSING_MAX_MODE_WINDOWS - 1], mode->width);
+    prepare_matched_filter_plans(sync_template_size(mode, sample_rate));
+}
+
+
+static uint8_t calculate_pixel_value(Frequency frequency,
+                                     Frequency pixel_min,
+                                     Frequency pixel_range)
+{
+#ifdef SSTV_FIXED_POINT
+    // Fixed-point frequencies are whole sixteenths of a Hertz, so the value is rounded with
+    // integer division.
+    int32_t offset = frequency - pixel_min;
+    if (offset <= 0) {
+        return 0;
+    }
+    int32_t pixel_value = (offset * 256 + pixel_range / 2) / pixel_range;
+    return (pixel_value > 255) ? 255 : pixel_value;
+#else
+    double pixel_value = (frequency - pixel_min) / pixel_range * 256.0;
     pixel_value = fmin(fmax(pixel_value, 0.0), 255.0);
     return round(pixel_value);
+#endif
 }
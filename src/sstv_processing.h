@@ -3,74 +3,327 @@
 
 
 #define SSTV_PROCESSING_NOT_FOUND -1
+#define SSTV_PROCESSING_INVALID_VIS 0xFF
 
 
 #include "modes.h"
+#include "perf_counters.h"
+#include "precision.h"
+#include "scratch_arena.h"
+#include "spsc_ring.h"
+#include "sstv_params.h"
+#include "stft_cache.h"
 #include "wav_file.h"
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 
 
+typedef struct sstv_session_s SstvSession;
+typedef struct sstv_checkpoint_s SstvCheckpoint;
+typedef struct scan_threads_s ScanThreads;
+
+
+/**
+ * A function that saves a checkpoint, e.g. to a file that a restarted job resumes from.
+ *
+ * @param session     The session that made the progress.
+ * @param checkpoint  The checkpoint to save.
+ * @param context     The {@code save_context} of the checkpoint.
+ */
+typedef void (*SstvCheckpointSave)(SstvSession *session,
+                                   const SstvCheckpoint *checkpoint,
+                                   void *context);
+
+
+/**
+ * An enumerator of the quality tiers that {@code decode_image_data} decodes a line at. Without a
+ * deadline, every line is decoded at {@code SSTV_TIER_FULL}. With one, the tier steps down as time
+ * runs short, and never steps back up within an image.
+ *
+ * @var SSTV_TIER_FULL       The sync pulse of the line is found with the session's sync method,
+ *                           and every pixel is decoded.
+ * @var SSTV_TIER_PREDICTED  The line is placed one line period after the previous one, without a
+ *                           sync search, and every pixel is decoded.
+ * @var SSTV_TIER_REDUCED    The line is placed like {@code SSTV_TIER_PREDICTED}, and only every
+ *                           other pixel is decoded, with each one repeated for its right neighbor.
+ * @var SSTV_TIER_SKIPPED    The line was not decoded and is black, because the deadline passed or
+ *                           the samples ran out.
+ */
+enum line_tier_e {
+    SSTV_TIER_FULL,
+    SSTV_TIER_PREDICTED,
+    SSTV_TIER_REDUCED,
+    SSTV_TIER_SKIPPED
+};
+typedef enum line_tier_e LineTier;
+
+
+/**
+ * The progress of a long search or decode, which {@code find_all_vis_starts} and
+ * {@code decode_image_data} resume from and keep up to date.
+ *
+ * The progress is handed to {@code save} whenever at least {@code interval_sec} has passed since
+ * the last time, so a job that is killed can be restarted from it rather than from the start.
+ *
+ * @var scan_sample     The sample that the search for every header resumes at.
+ * @var vis_starts      The first sample after each header before {@code scan_sample}, in
+ *                      increasing order, which is {@code NULL} if there are none. It is allocated
+ *                      with {@code malloc} and grows as headers are found.
+ * @var num_vis_starts  The number of entries in {@code vis_starts}.
+ * @var image_data      A buffer with the size of the image data of the image being decoded, or
+ *                      {@code NULL} to not checkpoint images.
+ * @var num_lines       The number of lines at the start of {@code image_data} that are decoded.
+ *                      Their starts must be in the session's {@code line_starts}.
+ * @var interval_sec    The minimum time between two saves.
+ * @var last_save_sec   The time of {@code sstv_monotonic_time_sec} of the last save.
+ * @var save            The function that saves the checkpoint.
+ * @var save_context    The context passed to {@code save}.
+ */
+struct sstv_checkpoint_s {
+    size_t scan_sample;
+    size_t *vis_starts;
+    size_t num_vis_starts;
+    uint8_t *image_data;
+    size_t num_lines;
+    double interval_sec;
+    double last_save_sec;
+    SstvCheckpointSave save;
+    void *save_context;
+};
+
+
+/**
+ * A structure holding the state for decoding one stream of samples.
+ *
+ * @var wav_samples       The samples being decoded.
+ * @var params            The analysis parameters, which are fixed when the session is created.
+ * @var scratch           The scratch arena that all temporaries in the decoding hot path come
+ *                        from.
+ * @var stft_cache        The spectrum cache shared by the header and sync searches, with frames
+ *                        of {@code params.hop_time_sec}.
+ * @var num_scan_threads  The maximum number of threads for the header and sync searches, which
+ *                        is 1 unless changed after the session is created.
+ * @var scan_threads      The helper threads of the header and sync searches, which the first
+ *                        search that needs them starts, or {@code NULL} until then.
+ * @var sync_method       How {@code decode_image_data} finds the sync pulse of each line, which
+ *                        is {@code SSTV_SYNC_TONE} unless changed after the session is created.
+ * @var preview_step      The step between the pixels and lines that {@code decode_image_data}
+ *                        decodes, which is 1 (every pixel) unless changed after the session is
+ *                        created.
+ * @var line_starts       If not {@code NULL}, an array with an entry for each line of image data
+ *                        that {@code decode_image_data} stores the start of each line in. It is
+ *                        {@code NULL} unless changed after the session is created.
+ * @var known_starts      Whether {@code line_starts} already holds the start of each line, in
+ *                        which case {@code decode_image_data} reads them instead of searching for
+ *                        the sync pulses.
+ * @var line_ring         If not {@code NULL}, a ring that {@code decode_image_data} pushes each
+ *                        line of image data to as soon as it is decoded, so a later stage can
+ *                        consume the image while it is being decoded. It is {@code NULL} unless
+ *                        changed after the session is created.
+ * @var deadline_sec      The time of {@code sstv_monotonic_time_sec} by which
+ *                        {@code decode_image_data} should return, or 0 for no deadline, which it
+ *                        is unless changed after the session is created.
+ * @var line_tiers        If not {@code NULL}, an array with an entry for each line of image data
+ *                        that {@code decode_image_data} stores the quality tier of each line in. It
+ *                        is {@code NULL} unless changed after the session is created.
+ * @var checkpoint        If not {@code NULL}, the progress that the search for every header and
+ *                        the image decoding resume from and save to. It is {@code NULL} unless
+ *                        changed after the session is created.
+ * @var perf              If not {@code NULL}, the counters that {@code decode_image_data}
+ *                        attributes the sync search and the pixels of each line to. It is
+ *                        {@code NULL} unless changed after the session is created, and must have
+ *                        been opened on the thread that decodes.
+ * @var replay_rate       The number of samples per second that arrive in a replay of the samples
+ *                        as if they were being received, which {@code decode_image_data} waits
+ *                        for before reading them, or 0 to read them at will, which it is unless
+ *                        changed after the session is created.
+ * @var replay_start_sec  The time of {@code sstv_monotonic_time_sec} at which the first sample
+ *                        arrives in a replay.
+ * @var replay_wait_sec   The total time spent waiting for samples to arrive in a replay.
+ * @var line_latencies    If not {@code NULL}, an array with an entry for each line of image data
+ *                        that {@code decode_image_data} stores the time from the arrival of the
+ *                        last sample of each line to the end of its decoding in, or -1 for a
+ *                        line that is not decoded. It is {@code NULL} unless changed after the
+ *                        session is created.
+ */
+struct sstv_session_s {
+    const WavSamples *wav_samples;
+    SstvParams params;
+    ScratchArena *scratch;
+    StftCache *stft_cache;
+    size_t num_scan_threads;
+    ScanThreads *scan_threads;
+    SyncMethod sync_method;
+    size_t preview_step;
+    double *line_starts;
+    bool known_starts;
+    SpscRing *line_ring;
+    double deadline_sec;
+    LineTier *line_tiers;
+    SstvCheckpoint *checkpoint;
+    PerfCounters *perf;
+    double replay_rate;
+    double replay_start_sec;
+    double replay_wait_sec;
+    double *line_latencies;
+};
+
+
+/**
+ * Gets the time of a monotonic clock, which deadlines are measured on.
+ *
+ * @return The time of the clock in seconds, from an arbitrary start.
+ */
+double sstv_monotonic_time_sec(void);
+
+
+/**
+ * Waits until a sample has arrived in a replay of the samples of a session, and adds the time
+ * waited to its {@code replay_wait_sec}. Without a {@code replay_rate}, it returns straight away.
+ *
+ * @param session  The decode session being replayed.
+ * @param sample   The (fractional) index of the sample, which is capped to the last sample.
+ */
+void sstv_session_wait_for_sample(SstvSession *session, double sample);
+
+
+/**
+ * Creates a decode session for a set of audio samples.
+ *
+ * The session's scratch arena is sized up front for the largest DFT window of any supported mode
+ * at the sample rate of {@code wav_samples} with {@code params}, so decoding never allocates
+ * temporaries on the heap.
+ *
+ * @param wav_samples  The samples to decode. They must outlive the session.
+ * @param params       The analysis parameters to decode with, which are copied into the session,
+ *                     or {@code NULL} for those of the {@code SSTV_PARAMS_DEFAULT_PRESET} preset.
+ *
+ * @return A pointer to the new session. If memory cannot be allocated, {@code NULL} is returned.
+ */
+SstvSession *sstv_session_create(const WavSamples *wav_samples, const SstvParams *params);
+
+
+/**
+ * Creates a decode session for a helper thread of the searches of another session.
+ *
+ * The helper decodes the same samples with the same analysis parameters and STFT hop, but its
+ * scratch arena is only sized for a DFT window of {@code window_size} samples, the largest of the
+ * search that starts the thread, and grows if a later search needs more.
+ *
+ * @param session      The session of the calling thread, which must outlive the helper.
+ * @param window_size  The number of samples in the DFT window of the search.
+ *
+ * @return A pointer to the new session. If memory cannot be allocated, {@code NULL} is returned.
+ */
+SstvSession *sstv_session_create_helper(const SstvSession *session, size_t window_size);
+
+
+/**
+ * Frees a decode session returned by {@code sstv_session_create} or
+ * {@code sstv_session_create_helper}.
+ *
+ * The samples of the session are not freed, and the helper threads of its searches are stopped
+ * first. With verbose logging, the peak scratch usage and the number of heap allocations made by
+ * the scratch arena are printed, along with the hit rate of the STFT cache.
+ *
+ * @param session  The session to free.
+ */
+void sstv_session_free(SstvSession *session);
+
+
 /**
  * Searches for the SSTV calibration header in a set of audio samples, returning the first sample
  * after the header if one is found.
  *
- * The search will begin at the first sample in the provided list. The DFT is run with a 10ms
- * window that slides 2ms for each check.
+ * The search will begin at the first sample in the provided list. The DFT is run with a
+ * {@code header_window_sec} window (10ms by default) that slides one {@code hop_time_sec} frame
+ * (2ms by default) for each check. The windows are read through the session's STFT cache, so each
+ * frame is transformed once even though every block of the header checks it.
+ *
+ * With more than one scan thread in the session, the samples are split into one second segments
+ * that are searched concurrently. The result is the same as that of a single thread.
+ *
+ * @param session  The decode session with the samples to search for an SSTV calibration header.
+ *
+ * @return The number of the first sample in {@code session->wav_samples->samples} after the
+ *         header. If no header is found, {@code SSTV_PROCESSING_NOT_FOUND} is returned.
+ */
+size_t find_vis_start(SstvSession *session);
+
+
+/**
+ * Searches for every SSTV calibration header in a set of audio samples.
+ *
+ * The search is the same as {@code find_vis_start}, but it continues after each header that is
+ * found, so every transmission in a long recording can be decoded.
+ *
+ * With a {@code checkpoint} in the session, the search resumes at its {@code scan_sample} with the
+ * headers already in it, and runs in chunks of a few segments per scan thread. The checkpoint is
+ * brought up to date after each chunk. The result is the same as that of a search from the start.
  *
- * @param wav_samples  The samples to search for an SSTV calibration header.
+ * @param session     The decode session with the samples to search for SSTV calibration headers.
+ * @param vis_starts  A location to place a pointer to the array of the first sample after each
+ *                    header at, in increasing order. The array must be freed by the caller, even
+ *                    if no header is found.
  *
- * @return The number of the first sample in {@code wav_samples->samples} after the header. If
- *         no header is found, {@code SSTV_PROCESSING_NOT_FOUND} is returned.
+ * @return The number of headers found.
  */
-size_t find_vis_start(const WavSamples *wav_samples);
+size_t find_all_vis_starts(SstvSession *session, size_t **vis_starts);
 
 
 /**
  * Searches for and decodes the VIS code in the SSTV header.
  *
- * If {@code assert} is enabled, an internal parity check will be performed. The returned code
- * does not contain the parity bit.
+ * The parity bit is checked, and the returned code does not contain it.
  *
- * @param wav_samples  The samples to search for the VIS code in.
- * @param vis_start    The start of the VIS code portion, returned by {@code find_header_sample}.
+ * @param session    The decode session with the samples to search for the VIS code in.
+ * @param vis_start  The start of the VIS code portion, returned by {@code find_vis_start}.
  *
- * @return The VIS code decoded from the samples starting at {@code vis_start}.
+ * @return The VIS code decoded from the samples starting at {@code vis_start}. If its parity is
+ *         incorrect, {@code SSTV_PROCESSING_INVALID_VIS} is returned, which is not the code of any
+ *         mode.
  */
-uint8_t decode_vis_code(const WavSamples *wav_samples, size_t vis_start);
+uint8_t decode_vis_code(SstvSession *session, size_t vis_start);
 
 
 /**
  * Searches for a sample within a sync pulse.
  *
  * The search will begin at the {@code align_start} sample. The DFT to find a sync pulse is run
- * with a window that is one third the width of the sync pulse itself. The window slides 2ms
- * for each check.
+ * with a window that is {@code sync_start_ratio} (by default 0.3) of the width of the sync pulse
+ * itself. The window slides one frame for each check, starting at the first frame of the
+ * session's STFT cache at or after {@code align_start}. Like {@code find_vis_start}, the search
+ * is split over the session's scan threads if it does not end within the first second.
  *
  * This function is not primarily used to align to a sync pulse after each scan line (see
  * {@code find_sync_end} for that behavior). This function is a substitute to {@code find_vis_start}
  * for very noisy signals in which a header cannot be recovered. The {@code align_start} sample
  * and the SSTV mode can be specified to attempt parsing without headers.
  *
- * @param wav_samples  The samples to search for a sync pulse.
+ * @param session      The decode session with the samples to search for a sync pulse.
  * @param mode         The SSTV mode encoded in the samples.
  * @param align_start  The sample to start searching from.
  *
  * @return The index of a sample in the first sync pulse found.
  */
-size_t find_sync_start(const WavSamples *wav_samples, const SstvMode *mode, size_t align_start);
+size_t find_sync_start(SstvSession *session, const SstvMode *mode, size_t align_start);
 
 
 /**
  * Searches for the end of the current/next sync signal in the provided samples.
  *
- * @param wav_samples  The samples to search for the VIS code in.
+ * The window is {@code sync_end_ratio} of the width of the sync pulse, and slides
+ * {@code sync_end_step} samples for each check. Once it stops matching the sync frequency, the end
+ * is placed where a window as wide as the sync pulse holds the most power at that frequency.
+ *
+ * @param session      The decode session with the samples to search for the sync end in.
  * @param mode         The SSTV mode encoded in the samples.
  * @param align_start  The sample to start searching from, which should ideally be in a sync pulse.
  *
  * @return The index of the first sample that is not in the sync pulse that was found.
  */
-size_t find_sync_end(const WavSamples *wav_samples, const SstvMode *mode, size_t align_start);
+size_t find_sync_end(SstvSession *session, const SstvMode *mode, size_t align_start);
 
 
 /**
@@ -78,28 +331,81 @@ size_t find_sync_end(const WavSamples *wav_samples, const SstvMode *mode, size_t
  *
  * The data is returned as a 3-dimensional array with the shape {@code [width, channels, height]}.
  * Values in the array are converted to luminance on the interval {@code [0, 255]} and ready
- * to be parsed into/written to an image file.
+ * to be parsed into/written to an image file. The sync pulse of each line is found with the
+ * session's {@code sync_method}.
+ *
+ * With a {@code preview_step} N greater than 1 in the session, only every Nth pixel of every Nth
+ * line is decoded, so the shape is {@code [ceil(width / N), channels, ceil(height / N)]}. Only
+ * the sync pulse of the first line is searched for, and the other lines are placed by the line
+ * period of the mode.
+ *
+ * With the tone sync search, the sync pulse of each line after the first is only searched for
+ * within {@code sync_track_ratio} sync times of where it is predicted: one line period after the
+ * previous line, plus a correction that follows the error of the syncs found so far. A line whose
+ * sync is not found there is placed at its prediction.
+ *
+ * With {@code line_starts} set in the session, the start of each line is stored in it, or read
+ * from it with {@code known_starts} set, so a later decode of the same image can skip the sync
+ * searches.
+ *
+ * With {@code line_ring} set in the session, every line of image data is pushed to it in order,
+ * including the lines that are left black when the samples run out. Its slots must be the size of
+ * one line, {@code ceil(width / N) * channels} bytes.
  *
- * @param wav_samples  The samples to search for the VIS code in.
+ * With a {@code deadline_sec} in the session, the time taken by the sync search and the pixels of
+ * each line is measured, and when the remaining lines would not finish in time at the current
+ * quality tier, the tier steps down (see {@code LineTier}). The search for the first sync is also
+ * limited to two line periods, so a missed sync cannot scan to the end of the samples, and
+ * predicted lines include the tracked correction. Once the deadline
+ * passes, the lines decoded so far are returned and the rest are black.
+ *
+ * With a {@code checkpoint} that has {@code image_data} in the session, the lines already in it
+ * are not decoded again, and the lines decoded since are copied into it at each save and at the
+ * end. Its line starts are read from (and the new ones stored in) the session's
+ * {@code line_starts}, which must be set.
+ *
+ * With a {@code replay_rate} in the session, the samples of each sync search and channel are
+ * waited for until they arrive (and those of the whole image, before the matched filter
+ * correlates it), so the image is decoded as it would be while being received. The time waited
+ * is not counted against a deadline.
+ *
+ * @param session      The decode session with the samples to decode the image from.
  * @param mode         The SSTV mode encoded in the samples.
  * @param image_start  The index of the first sample with image data, possibly including a sync
  *                     pulse that will be automatically skipped.
  *
  * @return The pixel data.
  */
-uint8_t *decode_image_data(const WavSamples *wav_samples, const SstvMode *mode, size_t image_start);
+uint8_t *decode_image_data(SstvSession *session, const SstvMode *mode, size_t image_start);
+
+
+/**
+ * Creates the cached DFT plans for every window size used to decode a mode at a sample rate.
+ *
+ * This includes the header and VIS windows, which are shared by all modes, as well as the sync
+ * and pixel windows and the matched filter DFTs specific to {@code mode}. With a rigorous planner
+ * set, this is how FFTW wisdom is accumulated ahead of time.
+ *
+ * @param mode         The SSTV mode to plan for.
+ * @param sample_rate  The sample rate in Hertz.
+ * @param params       The analysis parameters that the windows are sized by.
+ */
+void prepare_mode_fft_plans(const SstvMode *mode, uint32_t sample_rate, const SstvParams *params);
 
 
 /**
- * Converts a frequency value in the pixel range for the provided mode to a luminance value.
+ * Converts a frequency value in the pixel range of a mode to a luminance value.
  *
- * @param frequency  The frequency to convert.
- * @param mode       The SSTV mode being used, which defines the minimu and maximum frequencies
- *                   for the values of a channel in a pixel.
+ * @param frequency    The frequency to convert.
+ * @param pixel_min    The frequency of the lowest value of a channel in a pixel for the mode.
+ * @param pixel_range  The difference between the frequencies of the highest and lowest values of
+ *                     a channel in a pixel for the mode, which is positive.
  *
  * @return The value of the channel of the pixel on the interval {@code [0, 255]}.
  */
-static uint8_t calculate_pixel_value(double frequency, const SstvMode *mode);
+static uint8_t calculate_pixel_value(Frequency frequency,
+                                     Frequency pixel_min,
+                                     Frequency pixel_range);
 
 
 #endif  // _SSTV_PROCESSING_H_
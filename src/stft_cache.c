@@ -0,0 +1,149 @@
+#include "freq_processing.h"
+#include "scratch_arena.h"
+#include "stft_cache.h"
+#include "wav_file.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+
+StftCache *stft_cache_create(const WavSamples *wav_samples, size_t hop_size) {
+    assert(wav_samples && "stft_cache_create got NULL wav_samples");
+    assert(hop_size > 0 && "stft_cache_create got zero hop_size");
+
+    StftCache *cache = (StftCache *) calloc(1, sizeof(StftCache));
+    if (cache == NULL) {
+        return NULL;
+    }
+
+    cache->wav_samples = wav_samples;
+    cache->hop_size = hop_size;
+    return cache;
+}
+
+
+size_t stft_cache_frame_at(const StftCache *cache, size_t sample) {
+    assert(cache && "stft_cache_frame_at got NULL cache");
+    return (sample + cache->hop_size - 1) / cache->hop_size;
+}
+
+
+/**
+ * Gets the track of a cache for a window size, creating it if needed.
+ *
+ * @param cache        The cache to get the track from.
+ * @param window_size  The number of samples in the window of each frame.
+ *
+ * @return The track, or {@code NULL} if the cache has no room for another track.
+ */
+static StftTrack *stft_cache_get_track(StftCache *cache, size_t window_size) {
+    for (size_t i = 0; i < cache->num_tracks; i++) {
+        if (cache->tracks[i].window_size == window_size) {
+            return &cache->tracks[i];
+        }
+    }
+
+    if (cache->num_tracks >= STFT_CACHE_MAX_TRACKS) {
+        return NULL;
+    }
+
+    StftEntry *entries = (StftEntry *) malloc(STFT_CACHE_TRACK_FRAMES * sizeof(StftEntry));
+    if (entries == NULL) {
+        return NULL;
+    }
+    for (size_t i = 0; i < STFT_CACHE_TRACK_FRAMES; i++) {
+        entries[i].frame = SIZE_MAX;
+    }
+
+    StftTrack *track = &cache->tracks[cache->num_tracks++];
+    track->window_size = window_size;
+    track->entries = entries;
+    return track;
+}
+
+
+Frequency stft_cache_peak_frequency(StftCache *cache,
+                                    size_t frame,
+                                    size_t window_size,
+                                    ScratchArena *scratch)
+{
+    assert(cache && "stft_cache_peak_frequency got NULL cache");
+
+    const WavSamples *wav_samples = cache->wav_samples;
+    size_t frame_start = frame * cache->hop_size;
+    assert(frame_start + window_size <= wav_samples->num_samples &&
+           "stft_cache_peak_frequency got a frame past the end of the samples");
+
+    cache->num_queries++;
+
+    // If the cache has no room for the track, the frame is computed directly every time. This is
+    // slower but still correct.
+    StftTrack *track = stft_cache_get_track(cache, window_size);
+    if (track == NULL) {
+        cache->num_transforms++;
+        return peak_frequency(&wav_samples->samples[frame_start],
+                              window_size,
+                              wav_samples->sample_rate,
+                              scratch);
+    }
+
+    StftEntry *entry = &track->entries[frame % STFT_CACHE_TRACK_FRAMES];
+    if (entry->frame != frame) {
+        cache->num_transforms++;
+        entry->frame = frame;
+        entry->peak_frequency = peak_frequency(&wav_samples->samples[frame_start],
+                                               window_size,
+                                               wav_samples->sample_rate,
+                                               scratch);
+    }
+    return entry->peak_frequency;
+}
+
+
+bool stft_cache_is_frequency(StftCache *cache,
+                             size_t frame,
+                             size_t window_size,
+                             Frequency frequency,
+                             Frequency margin,
+                             ScratchArena *scratch)
+{
+    Frequency peak = stft_cache_peak_frequency(cache, frame, window_size, scratch);
+    return peak - frequency < margin && frequency - peak < margin;
+}
+
+
+void stft_cache_merge(StftCache *cache, const StftCache *other) {
+    assert(cache && other && "stft_cache_merge got NULL cache");
+    assert(cache->hop_size == other->hop_size && "stft_cache_merge got another hop size");
+
+    for (size_t i = 0; i < other->num_tracks; i++) {
+        const StftTrack *other_track = &other->tracks[i];
+        StftTrack *track = stft_cache_get_track(cache, other_track->window_size);
+        if (track == NULL) {
+            continue;
+        }
+
+        for (size_t j = 0; j < STFT_CACHE_TRACK_FRAMES; j++) {
+            const StftEntry *other_entry = &other_track->entries[j];
+            StftEntry *entry = &track->entries[j];
+            if (other_entry->frame != SIZE_MAX &&
+                (entry->frame == SIZE_MAX || entry->frame < other_entry->frame))
+            {
+                *entry = *other_entry;
+            }
+        }
+    }
+}
+
+
+void stft_cache_free(StftCache *cache) {
+    if (cache == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < cache->num_tracks; i++) {
+        free(cache->tracks[i].entries);
+    }
+    free(cache);
+}
@@ -0,0 +1,156 @@
+#ifndef _STFT_CACHE_H_
+#define _STFT_CACHE_H_
+
+
+#define STFT_CACHE_MAX_TRACKS 8
+#define STFT_CACHE_TRACK_FRAMES 1024
+
+
+#include "precision.h"
+#include "scratch_arena.h"
+#include "wav_file.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+
+typedef struct stft_entry_s StftEntry;
+typedef struct stft_track_s StftTrack;
+typedef struct stft_cache_s StftCache;
+
+
+/**
+ * A memoized peak frequency for one frame of a track.
+ *
+ * @var frame           The index of the frame the entry holds, or {@code SIZE_MAX} if empty.
+ * @var peak_frequency  The peak frequency of the frame's window.
+ */
+struct stft_entry_s {
+    size_t frame;
+    Frequency peak_frequency;
+};
+
+
+/**
+ * The memoized frames for one window size.
+ *
+ * Frames are stored in a direct-mapped ring indexed by {@code frame % STFT_CACHE_TRACK_FRAMES}.
+ * The searches only look a few hundred frames ahead of their current position, so every frame
+ * they need stays in the ring until they move past it.
+ *
+ * @var window_size  The number of samples in the window of each frame.
+ * @var entries      The ring of {@code STFT_CACHE_TRACK_FRAMES} entries.
+ */
+struct stft_track_s {
+    size_t window_size;
+    StftEntry *entries;
+};
+
+
+/**
+ * A lazily filled short-time spectrum cache over a set of samples.
+ *
+ * Frame {@code i} of every track is the window starting at sample {@code i * hop_size}. The peak
+ * frequency of a frame is computed the first time it is queried and reused afterwards, so searches
+ * that evaluate the same regions at several offsets (or repeatedly) transform each frame once.
+ *
+ * @var wav_samples      The samples the frames are taken from.
+ * @var hop_size         The number of samples between the starts of consecutive frames.
+ * @var tracks           The tracks of the cache, one per window size.
+ * @var num_tracks       The number of tracks in use.
+ * @var num_queries      The number of frames queried, for debugging.
+ * @var num_transforms   The number of frames transformed, for debugging.
+ */
+struct stft_cache_s {
+    const WavSamples *wav_samples;
+    size_t hop_size;
+    StftTrack tracks[STFT_CACHE_MAX_TRACKS];
+    size_t num_tracks;
+    size_t num_queries;
+    size_t num_transforms;
+};
+
+
+/**
+ * Creates an empty STFT cache over a set of samples.
+ *
+ * @param wav_samples  The samples to cache frames of. They must outlive the cache.
+ * @param hop_size     The number of samples between the starts of consecutive frames.
+ *
+ * @return A pointer to the new cache. If memory cannot be allocated, {@code NULL} is returned.
+ */
+StftCache *stft_cache_create(const WavSamples *wav_samples, size_t hop_size);
+
+
+/**
+ * Gets the frame index of the first frame that starts at or after a sample.
+ *
+ * @param cache   The cache to get the frame index for.
+ * @param sample  The sample index.
+ *
+ * @return The index of the first frame starting at or after {@code sample}.
+ */
+size_t stft_cache_frame_at(const StftCache *cache, size_t sample);
+
+
+/**
+ * Gets the peak frequency of a frame, computing it if it has not been computed yet.
+ *
+ * The window of the frame must lie entirely within the samples of the cache.
+ *
+ * @param cache        The cache to query.
+ * @param frame        The index of the frame, whose window starts at {@code frame * hop_size}.
+ * @param window_size  The number of samples in the window.
+ * @param scratch      The scratch arena to use if the frame must be transformed.
+ *
+ * @return The peak frequency of the frame's window.
+ */
+Frequency stft_cache_peak_frequency(StftCache *cache,
+                                    size_t frame,
+                                    size_t window_size,
+                                    ScratchArena *scratch);
+
+
+/**
+ * Determines whether the peak frequency of a frame is approximately equal to a target frequency.
+ *
+ * This is the cached equivalent of {@code is_frequency}.
+ *
+ * @param cache        The cache to query.
+ * @param frame        The index of the frame, whose window starts at {@code frame * hop_size}.
+ * @param window_size  The number of samples in the window.
+ * @param frequency    The target frequency to compare against.
+ * @param margin       The largest difference from the target frequency that is close to it.
+ * @param scratch      The scratch arena to use if the frame must be transformed.
+ *
+ * @return Whether the peak frequency of the frame is close to the target frequency.
+ */
+bool stft_cache_is_frequency(StftCache *cache,
+                             size_t frame,
+                             size_t window_size,
+                             Frequency frequency,
+                             Frequency margin,
+                             ScratchArena *scratch);
+
+
+/**
+ * Copies the frames that another cache over the same samples has computed into a cache.
+ *
+ * A frame replaces the entry of the cache that it maps to, unless that entry is a later frame,
+ * since the searches move forward through the samples.
+ *
+ * @param cache  The cache to copy the frames into.
+ * @param other  The cache to copy the frames from, with the same samples and hop size.
+ */
+void stft_cache_merge(StftCache *cache, const StftCache *other);
+
+
+/**
+ * Frees an STFT cache returned by {@code stft_cache_create}.
+ *
+ * @param cache  The cache to free.
+ */
+void stft_cache_free(StftCache *cache);
+
+
+#endif  // _STFT_CACHE_H_
@@ -0,0 +1,236 @@
+#include "freq_processing.h"
+#include "modes.h"
+#include "precision.h"
+#include "scratch_arena.h"
+#include "sync_detector.h"
+#include "wav_file.h"
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+
+/**
+ * Fills one part of the sync-plus-porch template with a phase-continuous tone sequence.
+ *
+ * @param template_part  The array to fill, with {@code sync_size + porch_size} entries.
+ * @param mode           The SSTV mode to take the sync and porch frequencies from.
+ * @param sync_size      The number of samples in the sync pulse.
+ * @param sample_rate    The sample rate in Hertz.
+ * @param phase_offset   The phase of the first sample, {@code 0} for the cosine part and
+ *                       {@code -pi / 2} for the sine part.
+ * @param template_size  The total number of samples in the template.
+ */
+static void fill_sync_template(Sample *template_part,
+                               const SstvMode *mode,
+                               size_t sync_size,
+                               uint32_t sample_rate,
+                               double phase_offset,
+                               size_t template_size)
+{
+    double phase = phase_offset;
+    for (size_t i = 0; i < template_size; i++) {
+        template_part[i] = sample_from_double(cos(phase));
+        double frequency = (i < sync_size) ? mode->sync_hz : mode->porch_hz;
+        phase += 2.0 * M_PI * frequency / sample_rate;
+    }
+}
+
+
+size_t sync_template_size(const SstvMode *mode, uint32_t sample_rate) {
+    assert(mode && "sync_template_size got NULL mode");
+
+    size_t sync_size = round(mode->sync_time_sec * sample_rate);
+    size_t porch_size = round(mode->porch_time_sec * sample_rate);
+    return sync_size + porch_size;
+}
+
+
+SyncDetector *sync_detector_create(const WavSamples *wav_samples,
+                                   const SstvMode *mode,
+                                   size_t start,
+                                   size_t num_lines,
+                                   ScratchArena *scratch)
+{
+    assert(wav_samples && "sync_detector_create got NULL wav_samples");
+    assert(mode && "sync_detector_create got NULL mode");
+    assert(scratch && "sync_detector_create got NULL scratch");
+
+    uint32_t sample_rate = wav_samples->sample_rate;
+    size_t num_samples = wav_samples->num_samples;
+
+    size_t sync_size = round(mode->sync_time_sec * sample_rate);
+    size_t template_size = sync_template_size(mode, sample_rate);
+    double channel_time_sec = mode->pixel_time_sec * mode->width;
+    double line_time_sec =
+        mode->sync_time_sec + mode->porch_time_sec + channel_time_sec * mode->num_channels;
+    double line_period = line_time_sec * sample_rate;
+    double tolerance = sync_size / 2.0;
+
+    // The correlation starts a little early, in case the first sync begins just before `start`,
+    // and covers every line, plus the search tolerance and the template itself past the last sync.
+    start = (start > sync_size) ? start - sync_size / 2 : 0;
+    size_t end = start + (size_t) ceil(num_lines * line_period + tolerance) + template_size;
+    if (end > num_samples) {
+        end = num_samples;
+    }
+    if (template_size == 0 || start >= end || end - start < template_size) {
+        return NULL;
+    }
+
+    // The detector and its correlation stay in the arena, and the templates are released on top
+    // of them once the correlation is done.
+    size_t detector_mark = scratch_arena_mark(scratch);
+    SyncDetector *detector = (SyncDetector *) scratch_arena_alloc(scratch, sizeof(SyncDetector));
+    size_t num_positions = end - start - template_size + 1;
+    Sample *correlation = (Sample *) scratch_arena_alloc(scratch, num_positions * sizeof(Sample));
+    size_t template_mark = scratch_arena_mark(scratch);
+    Sample *template_real = (Sample *) scratch_arena_alloc(scratch, template_size * sizeof(Sample));
+    Sample *template_imaginary =
+        (Sample *) scratch_arena_alloc(scratch, template_size * sizeof(Sample));
+    if (detector == NULL || template_real == NULL || template_imaginary == NULL ||
+        correlation == NULL)
+    {
+        scratch_arena_release(scratch, detector_mark);
+        return NULL;
+    }
+
+    fill_sync_template(template_real, mode, sync_size, sample_rate, 0.0, template_size);
+    fill_sync_template(template_imaginary, mode, sync_size, sample_rate, -M_PI / 2, template_size);
+    matched_filter(&wav_samples->samples[start],
+                   end - start,
+                   template_real,
+                   template_imaginary,
+                   template_size,
+                   correlation,
+                   scratch);
+    scratch_arena_release(scratch, template_mark);
+
+    detector->correlation = correlation;
+    detector->start = start;
+    detector->num_positions = num_positions;
+    detector->sync_size = sync_size;
+    detector->line_period = line_period;
+    detector->tolerance = tolerance;
+    detector->next_sync = -1.0;
+    return detector;
+}
+
+
+/**
+ * Interpolates the position of a correlation peak with a parabola through it and its neighbors.
+ *
+ * @param correlation    The correlation curve.
+ * @param num_positions  The number of entries in {@code correlation}.
+ * @param index          The index of the largest value.
+ *
+ * @return The (fractional) position of the peak.
+ */
+static double interpolate_correlation_peak(const Sample *correlation,
+                                           size_t num_positions,
+                                           size_t index)
+{
+    if (index == 0 || index + 1 >= num_positions) {
+        return index;
+    }
+
+    double left = correlation[index - 1];
+    double center = correlation[index];
+    double right = correlation[index + 1];
+    double denominator = left - 2.0 * center + right;
+    if (denominator == 0) {
+        return index;
+    }
+
+    double offset = 0.5 * (left - right) / denominator;
+    return index + fmin(fmax(offset, -0.5), 0.5);
+}
+
+
+/**
+ * Finds the first correlation peak above the lock threshold in a range.
+ *
+ * The first line's sync may be anywhere in the first line period, and is usually the first strong
+ * peak rather than the strongest one (the start of a recording can cut it short).
+ *
+ * @param detector  The detector to search.
+ * @param from      The first position to search.
+ * @param to        The position after the last one to search.
+ *
+ * @return The index of the first peak above the threshold, or of the largest value in the range
+ *         if there is none.
+ */
+static size_t find_first_sync_peak(const SyncDetector *detector, size_t from, size_t to) {
+    const Sample *correlation = detector->correlation;
+
+    size_t peak_index = from;
+    for (size_t i = from; i < to; i++) {
+        if (sample_to_double(correlation[i]) >= SYNC_DETECTOR_LOCK_THRESHOLD) {
+            // Climb to the top of the peak, which is at most one sync pulse later.
+            size_t climb_end = i + detector->sync_size;
+            if (climb_end > detector->num_positions) {
+                climb_end = detector->num_positions;
+            }
+            size_t top_index = i;
+            for (size_t j = i + 1; j < climb_end; j++) {
+                if (correlation[j] > correlation[top_index]) {
+                    top_index = j;
+                }
+            }
+            return top_index;
+        }
+
+        if (correlation[i] > correlation[peak_index]) {
+            peak_index = i;
+        }
+    }
+    return peak_index;
+}
+
+
+double sync_detector_next_line(SyncDetector *detector, bool *locked) {
+    assert(detector && "sync_detector_next_line got NULL detector");
+
+    // The first sync may be anywhere in the first line. Later ones are searched for around the
+    // position predicted by the previous line.
+    bool first_line = detector->next_sync < 0;
+    double search_start = first_line ? 0.0 : detector->next_sync - detector->tolerance;
+    double search_end = first_line ?
+        detector->line_period + detector->sync_size :
+        detector->next_sync + detector->tolerance + 1;
+    size_t from = (size_t) fmax(search_start, 0.0);
+    size_t to = (size_t) fmin(search_end, (double) detector->num_positions);
+
+    double sync = detector->next_sync;
+    bool found = false;
+    if (from < to) {
+        size_t peak_index = from;
+        if (first_line) {
+            peak_index = find_first_sync_peak(detector, from, to);
+        }
+        else {
+            for (size_t i = from + 1; i < to; i++) {
+                if (detector->correlation[i] > detector->correlation[peak_index]) {
+                    peak_index = i;
+                }
+            }
+        }
+
+        double peak = sample_to_double(detector->correlation[peak_index]);
+        found = first_line || peak >= SYNC_DETECTOR_LOCK_THRESHOLD;
+        if (found) {
+            sync = interpolate_correlation_peak(detector->correlation,
+                                                detector->num_positions,
+                                                peak_index);
+        }
+    }
+    if (sync < 0) {
+        sync = 0;
+    }
+
+    if (locked != NULL) {
+        *locked = found;
+    }
+    detector->next_sync = sync + detector->line_period;
+    return detector->start + sync + detector->sync_size;
+}
@@ -0,0 +1,98 @@
+#ifndef _SYNC_DETECTOR_H_
+#define _SYNC_DETECTOR_H_
+
+
+#define SYNC_DETECTOR_LOCK_THRESHOLD 0.5
+
+
+#include "modes.h"
+#include "precision.h"
+#include "scratch_arena.h"
+#include "wav_file.h"
+#include <stdbool.h>
+#include <stdlib.h>
+
+
+typedef struct sync_detector_s SyncDetector;
+
+
+/**
+ * A matched-filter detector for the sync pulses of every line of an image.
+ *
+ * The samples of the whole image are correlated with the mode's sync pulse followed by its porch
+ * in a single FFT pass. Each line's sync is then the peak of the correlation curve near where the
+ * previous line predicts it, interpolated to a fraction of a sample. A peak below
+ * {@code SYNC_DETECTOR_LOCK_THRESHOLD} is treated as a sync lost in noise, and the predicted
+ * position is used instead, so one bad line does not throw off the rest of the image.
+ *
+ * @var correlation     The normalized correlation with the template at each position.
+ * @var start           The sample that {@code correlation[0]} corresponds to.
+ * @var num_positions   The number of entries in {@code correlation}.
+ * @var sync_size       The number of samples in a sync pulse.
+ * @var line_period     The number of samples from one sync pulse to the next.
+ * @var tolerance       The number of samples a sync may be away from its predicted position.
+ * @var next_sync       The predicted start of the next sync pulse, relative to {@code start}, or
+ *                      a negative value before the first sync has been found.
+ */
+struct sync_detector_s {
+    Sample *correlation;
+    size_t start;
+    size_t num_positions;
+    size_t sync_size;
+    double line_period;
+    double tolerance;
+    double next_sync;
+};
+
+
+/**
+ * Calculates the number of samples in the sync-plus-porch template of a mode.
+ *
+ * @param mode         The SSTV mode.
+ * @param sample_rate  The sample rate in Hertz.
+ *
+ * @return The number of samples in the template that {@code sync_detector_create} correlates with.
+ */
+size_t sync_template_size(const SstvMode *mode, uint32_t sample_rate);
+
+
+/**
+ * Creates a sync detector for an image, computing the correlation curve of all its lines.
+ *
+ * The detector, its correlation curve and every temporary of the correlation are allocated from
+ * {@code scratch}. The temporaries are released before returning, and the detector stays valid
+ * until the arena is released to a mark taken before this call.
+ *
+ * @param wav_samples  The samples of the image.
+ * @param mode         The SSTV mode of the image.
+ * @param start        The first sample to search, which should be at or shortly before the sync
+ *                     pulse of the first line.
+ * @param num_lines    The number of lines to cover.
+ * @param scratch      The scratch arena to allocate from.
+ *
+ * @return A pointer to the new detector. If the samples are too short for one sync pulse or
+ *         memory cannot be allocated, {@code NULL} is returned.
+ */
+SyncDetector *sync_detector_create(const WavSamples *wav_samples,
+                                   const SstvMode *mode,
+                                   size_t start,
+                                   size_t num_lines,
+                                   ScratchArena *scratch);
+
+
+/**
+ * Finds the next line's sync pulse and returns the first sample after it.
+ *
+ * The first call searches one line period from the start of the detector. Every later call
+ * searches around one line period after the previous sync.
+ *
+ * @param detector  The detector to search with.
+ * @param locked    A location to place whether the sync was found, rather than predicted, at. May
+ *                  be {@code NULL}.
+ *
+ * @return The (fractional) index of the first sample after the sync pulse.
+ */
+double sync_detector_next_line(SyncDetector *detector, bool *locked);
+
+
+#endif  // _SYNC_DETECTOR_H_
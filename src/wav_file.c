@@ -3,67 +3,108 @@
 #include <assert.h>
 #include <limits.h>
 #include <math.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 
 
-WavFile *wav_file_open(const char *path) {
-    FILE *file = fopen(path, "rb");
-    if (file == NULL) {
+WavFile *wav_file_parse(uint8_t *contents, size_t size) {
+    assert(contents && "wav_file_parse got NULL contents");
+
+    // The canonical fields of the riff header and the format section are at fixed offsets.
+    if (size < WAV_FILE_CANONICAL_HEADER_SIZE) {
+        log_warn("wave file is too short for a header (%lu B)", size);
         return NULL;
     }
 
-    // Allocate memory for the wave file data. If the `malloc` calls fail, then we cannot recover,
-    // so we free any allocated memory and exit.
     WavFile *wav_file = (WavFile *) malloc(sizeof(WavFile));
     WavHeader *header = (WavHeader *) malloc(sizeof(WavHeader));
     if (wav_file == NULL || header == NULL) {
         free(wav_file);
         free(header);
-        fclose(file);
         return NULL;
     }
 
-    // The basic canonical fields of the riff header are read directly into their struct members.
-    fread(header->riff_marker,      sizeof(header->riff_marker),     1, file);
-    fread(&header->size,            sizeof(header->size),            1, file);
-    fread(header->wave_marker,      sizeof(header->wave_marker),     1, file);
-    fread(header->fmt_marker,       sizeof(header->fmt_marker),      1, file);
-    fread(&header->fmt_size,        sizeof(header->fmt_size),        1, file);
-    fread(&header->fmt_type,        sizeof(header->fmt_type),        1, file);
-    fread(&header->num_channels,    sizeof(header->num_channels),    1, file);
-    fread(&header->sample_rate,     sizeof(header->sample_rate),     1, file);
-    fread(&header->byte_rate,       sizeof(header->byte_rate),       1, file);
-    fread(&header->block_align,     sizeof(header->block_align),     1, file);
-    fread(&header->bits_per_sample, sizeof(header->bits_per_sample), 1, file);
-
-    if (header->fmt_type != 1) {
-        log_fatal("wave file is not PCM-integer-encoded (fmt_type is %u)", header->fmt_type);
+    memcpy(header->riff_marker,      &contents[0],  sizeof(header->riff_marker));
+    memcpy(&header->size,            &contents[4],  sizeof(header->size));
+    memcpy(header->wave_marker,      &contents[8],  sizeof(header->wave_marker));
+    memcpy(header->fmt_marker,       &contents[12], sizeof(header->fmt_marker));
+    memcpy(&header->fmt_size,        &contents[16], sizeof(header->fmt_size));
+    memcpy(&header->fmt_type,        &contents[20], sizeof(header->fmt_type));
+    memcpy(&header->num_channels,    &contents[22], sizeof(header->num_channels));
+    memcpy(&header->sample_rate,     &contents[24], sizeof(header->sample_rate));
+    memcpy(&header->byte_rate,       &contents[28], sizeof(header->byte_rate));
+    memcpy(&header->block_align,     &contents[32], sizeof(header->block_align));
+    memcpy(&header->bits_per_sample, &contents[34], sizeof(header->bits_per_sample));
+
+    if (header->fmt_type != 1 || header->num_channels == 0 || header->bits_per_sample < CHAR_BIT) {
+        log_warn("wave file is not PCM-integer-encoded (fmt_type %u, %u channel(s) of %u b)",
+                 header->fmt_type, header->num_channels, header->bits_per_sample);
+        free(header);
+        free(wav_file);
+        return NULL;
     }
 
     // For the data segment, we must deal with non-canonical riff data. Some files place additional
     // chunks (e.g. "LIST") immediately before the "data" segment. Each chunk will have a 4-byte
-    // size following it that we can use to skip the chunk. We do this until we find "data"
-    fread(header->data_marker, sizeof(header->data_marker), 1, file);
-    while (memcmp(header->data_marker, "data", sizeof(header->data_marker)) != 0) {
+    // size following it that we can use to skip the chunk. We do this until we find "data". A
+    // data segment that is cut short by the end of the file is taken as far as it goes.
+    size_t offset = 20 + (size_t) header->fmt_size;
+    bool has_data = false;
+    while (!has_data && offset + 8 <= size) {
         uint32_t chunk_size = 0;
-        fread(&chunk_size, sizeof(chunk_size), 1, file);
-        fseek(file, chunk_size, SEEK_CUR);
-        fread(header->data_marker, sizeof(header->data_marker), 1, file);
+        memcpy(header->data_marker, &contents[offset], sizeof(header->data_marker));
+        memcpy(&chunk_size, &contents[offset + 4], sizeof(chunk_size));
+        offset += 8;
+        if (memcmp(header->data_marker, "data", sizeof(header->data_marker)) == 0) {
+            header->data_size = (chunk_size < size - offset) ? chunk_size : size - offset;
+            has_data = true;
+        }
+        else {
+            offset += chunk_size;
+        }
+    }
+    if (!has_data) {
+        log_warn("wave file has no data segment");
+        free(header);
+        free(wav_file);
+        return NULL;
     }
 
-    fread(&header->data_size, sizeof(header->data_size), 1, file);
+    // The data is moved to the start of the contents, which the wave file then owns.
+    memmove(contents, &contents[offset], header->data_size);
+    wav_file->header = header;
+    wav_file->data = contents;
+    return wav_file;
+}
 
-    // The rest of the file data is allocated and the samples are read.
-    uint8_t *data = (uint8_t *) malloc(header->data_size);
-    fread(data, sizeof(uint8_t), header->data_size, file);
 
+WavFile *wav_file_open(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+
+    // The whole file is read at once and parsed in memory, rather than a field at a time.
+    long size = -1;
+    if (fseek(file, 0, SEEK_END) == 0) {
+        size = ftell(file);
+        rewind(file);
+    }
+    uint8_t *contents = (size > 0) ? (uint8_t *) malloc(size) : NULL;
+    if (contents == NULL || fread(contents, sizeof(uint8_t), size, file) != (size_t) size) {
+        free(contents);
+        fclose(file);
+        return NULL;
+    }
     fclose(file);
 
-    wav_file->header = header;
-    wav_file->data = data;
+    WavFile *wav_file = wav_file_parse(contents, size);
+    if (wav_file == NULL) {
+        free(contents);
+    }
     return wav_file;
 }
 
@@ -84,13 +125,13 @@ WavSamples *wav_file_get_mono_samples(const WavFile *wav_file) {
     uint32_t bytes_per_row = bytes_per_sample * header->num_channels;
     uint32_t num_rows = header->data_size / bytes_per_row;
 
-    double *samples = (double *) malloc(num_rows * sizeof(double));
+    Sample *samples = (Sample *) malloc(num_rows * sizeof(Sample));
     assert(samples && "wav_file_get_mono_samples could not malloc samples");
 
     // The outer loop goes through each row (the samples in all channels for a time point in the
     // original audio, and a single sample for a single time point in the `samples` list).
     for (size_t row = 0; row < num_rows; row++) {
-        double channel_aggregate = 0.0;  // We will take the average to make it mono later.
+        SampleAccumulator channel_aggregate = 0;  // We will take the average to make it mono later.
 
         // The channel loop goes through each channel for the current row/time point.
         for (size_t channel = 0; channel < header->num_channels; channel++) {
@@ -109,8 +150,7 @@ WavSamples *wav_file_get_mono_samples(const WavFile *wav_file) {
         }
 
         // Take the average of all channels to get a single mono sample for this time point.
-        double channel_average = channel_aggregate / header->num_channels;
-        samples[row] = channel_average;
+        samples[row] = channel_aggregate / header->num_channels;
     }
 
     // With the samples determined and normalized, we can place them into a nice structure.
@@ -124,7 +164,54 @@ WavSamples *wav_file_get_mono_samples(const WavFile *wav_file) {
 }
 
 
-static double wav_file_normalize_sample(uint32_t raw_sample, uint32_t bits_per_sample) {
+WavSamples *wav_file_get_channel_samples(const WavFile *wav_file) {
+    assert(wav_file && "wav_file_get_channel_samples got NULL wav_file");
+
+    WavHeader *header = wav_file->header;
+    uint8_t *data = wav_file->data;
+
+    // The layout values are the same as for the mono samples, except that every channel keeps
+    // its own `num_rows` samples instead of being averaged.
+    uint16_t num_channels = header->num_channels;
+    uint32_t bytes_per_sample = header->bits_per_sample / CHAR_BIT;
+    uint32_t bytes_per_row = bytes_per_sample * num_channels;
+    uint32_t num_rows = header->data_size / bytes_per_row;
+
+    // All channels share a single planar block. Each channel's `WavSamples` is a view of its own
+    // contiguous slice of the block, so no per-channel copies are made and the DFT windows of
+    // each channel remain contiguous in memory.
+    Sample *samples = (Sample *) malloc((size_t) num_rows * num_channels * sizeof(Sample));
+    WavSamples *channel_samples = (WavSamples *) malloc(num_channels * sizeof(WavSamples));
+    assert(samples && "wav_file_get_channel_samples could not malloc samples");
+    assert(channel_samples && "wav_file_get_channel_samples could not malloc channel_samples");
+
+    // The interleaved data is read once, in order, and each sample is written with a stride of
+    // `num_rows` into the slice of its channel.
+    for (size_t row = 0; row < num_rows; row++) {
+        for (size_t channel = 0; channel < num_channels; channel++) {
+            uint32_t raw_sample = 0;
+            for (size_t byte_in_sample = 0; byte_in_sample < bytes_per_sample; byte_in_sample++) {
+                size_t index = row * bytes_per_row + channel * bytes_per_sample + byte_in_sample;
+                uint32_t byte_data = data[index];
+                byte_data <<= byte_in_sample * CHAR_BIT;
+                raw_sample |= byte_data;
+            }
+
+            samples[channel * num_rows + row] =
+                wav_file_normalize_sample(raw_sample, header->bits_per_sample);
+        }
+    }
+
+    for (size_t channel = 0; channel < num_channels; channel++) {
+        channel_samples[channel].num_samples = num_rows;
+        channel_samples[channel].sample_rate = header->sample_rate;
+        channel_samples[channel].samples = &samples[channel * num_rows];
+    }
+    return channel_samples;
+}
+
+
+static Sample wav_file_normalize_sample(uint32_t raw_sample, uint32_t bits_per_sample) {
     // We will use two masks to interpret the bits of the raw sample as a signed integer and
     // sign-extend to an INT32 if needed. The `value_mask` masks the bits of the raw sample
     // (assuming it has `bits_per_sample` bits). Thus, the bitwise inverse of this will be used
@@ -139,9 +226,17 @@ static double wav_file_normalize_sample(uint32_t raw_sample, uint32_t bits_per_s
     }
 
     // After sign extension, we can interpret the value as an INT32. Finally, we can normalize
-    // it from the range of an integer with `bits_per_sample` bits to a float on [-1, 1].
+    // it from the range of an integer with `bits_per_sample` bits to a float on [-1, 1], or to a
+    // Q15 fixed-point sample by shifting it to 16 bits.
     int32_t signed_raw_sample = (int32_t) raw_sample;
-    return (double) signed_raw_sample / pow(2.0, bits_per_sample - 1);
+#ifdef SSTV_FIXED_POINT
+    if (bits_per_sample > 16) {
+        return (Sample) (signed_raw_sample >> (bits_per_sample - 16));
+    }
+    return (Sample) (signed_raw_sample * (1 << (16 - bits_per_sample)));
+#else
+    return (Sample) ((double) signed_raw_sample / pow(2.0, bits_per_sample - 1));
+#endif
 }
 
 
@@ -155,37 +250,100 @@ void wav_file_free_samples(WavSamples *wav_samples) {
 }
 
 
+void wav_file_free_channel_samples(WavSamples *channel_samples) {
+    if (channel_samples == NULL) {
+        return;
+    }
+
+    // The first channel's view starts at the beginning of the shared block.
+    free(channel_samples[0].samples);
+    free(channel_samples);
+}
+
+
+bool wav_file_save(const WavSamples *wav_samples, const char *path) {
+    assert(wav_samples && "wav_file_save got NULL wav_samples");
+
+    uint32_t data_size = (uint32_t) (wav_samples->num_samples * sizeof(int16_t));
+    uint32_t size = WAV_FILE_CANONICAL_HEADER_SIZE + data_size;
+    uint32_t fmt_size = 16;
+    uint16_t fmt_type = 1;
+    uint16_t num_channels = 1;
+    uint32_t byte_rate = wav_samples->sample_rate * sizeof(int16_t);
+    uint16_t block_align = sizeof(int16_t);
+    uint16_t bits_per_sample = 16;
+
+    // The canonical header is written at the offsets that wav_file_parse reads it from.
+    uint8_t header[WAV_FILE_CANONICAL_HEADER_SIZE + 8];
+    memcpy(&header[0],  "RIFF",                    4);
+    memcpy(&header[4],  &size,                     sizeof(size));
+    memcpy(&header[8],  "WAVE",                    4);
+    memcpy(&header[12], "fmt ",                    4);
+    memcpy(&header[16], &fmt_size,                 sizeof(fmt_size));
+    memcpy(&header[20], &fmt_type,                 sizeof(fmt_type));
+    memcpy(&header[22], &num_channels,             sizeof(num_channels));
+    memcpy(&header[24], &wav_samples->sample_rate, sizeof(wav_samples->sample_rate));
+    memcpy(&header[28], &byte_rate,                sizeof(byte_rate));
+    memcpy(&header[32], &block_align,              sizeof(block_align));
+    memcpy(&header[34], &bits_per_sample,          sizeof(bits_per_sample));
+    memcpy(&header[36], "data",                    4);
+    memcpy(&header[40], &data_size,                sizeof(data_size));
+
+    // Each sample is scaled the way that wav_file_normalize_sample scales it back.
+    int16_t *data = (int16_t *) malloc(data_size);
+    assert(data && "wav_file_save cannot malloc data");
+    for (size_t i = 0; i < wav_samples->num_samples; i++) {
+        double value = round(sample_to_double(wav_samples->samples[i]) * -INT16_MIN);
+        data[i] = (int16_t) fmin(fmax(value, INT16_MIN), INT16_MAX);
+    }
+
+    size_t num_samples = wav_samples->num_samples;
+    FILE *file = fopen(path, "wb");
+    bool saved = file != NULL
+        && fwrite(header, sizeof(header), 1, file) == 1
+        && fwrite(data, sizeof(int16_t), num_samples, file) == num_samples;
+    if (file != NULL && fclose(file) != 0) {
+        saved = false;
+    }
+    free(data);
+    return saved;
+}
+
+
 void wav_file_print_header(const WavFile *wav_file) {
+    // The messages logged before are printed first, so the header follows them.
+    logger_flush();
+
     // Top-level message declaring this is a wave file structure.
-    printf("WavFile:\n");
+    fprintf(LOGGER_STREAM, "WavFile:\n");
     if (wav_file == NULL) {
-        printf("[NULL]\n");
+        fprintf(LOGGER_STREAM, "[NULL]\n");
         return;
     }
 
     // Top-level message for the header data.
-    printf(" Header:\n");
+    fprintf(LOGGER_STREAM, " Header:\n");
     WavHeader *header = wav_file->header;
     if (wav_file->header == NULL) {
-        printf("  [NULL]\n");
+        fprintf(LOGGER_STREAM, "  [NULL]\n");
         return;
     }
 
     // Header data printed out in a human-readable format. For the 'string' types (e.g. char[]),
     // there are no trailing NUL bytes, so we tell `printf` exactly how many characters to print.
-    printf("  RIFF marker: %.4s\n",  header->riff_marker);
-    printf("  Size:        %d B\n",  header->size);
-    printf("  WAVE marker: %.4s\n",  header->wave_marker);
-    printf("  fmt  marker: %.4s\n",  header->fmt_marker);
-    printf("  Format size: %d B\n",  header->fmt_size);
-    printf("  Format type: %d\n",    header->fmt_type);
-    printf("  Channels:    %d\n",    header->num_channels);
-    printf("  Sample rate: %d Hz\n", header->sample_rate);
-    printf("  Byte rate:   %d B\n",  header->byte_rate);
-    printf("  Block align: %d B\n",  header->block_align);
-    printf("  Bits/sample: %d b\n",  header->bits_per_sample);
-    printf("  data marker: %.4s\n",  header->data_marker);
-    printf("  Data size:   %d B\n",  header->data_size);
+    fprintf(LOGGER_STREAM, "  RIFF marker: %.4s\n",  header->riff_marker);
+    fprintf(LOGGER_STREAM, "  Size:        %d B\n",  header->size);
+    fprintf(LOGGER_STREAM, "  WAVE marker: %.4s\n",  header->wave_marker);
+    fprintf(LOGGER_STREAM, "  fmt  marker: %.4s\n",  header->fmt_marker);
+    fprintf(LOGGER_STREAM, "  Format size: %d B\n",  header->fmt_size);
+    fprintf(LOGGER_STREAM, "  Format type: %d\n",    header->fmt_type);
+    fprintf(LOGGER_STREAM, "  Channels:    %d\n",    header->num_channels);
+    fprintf(LOGGER_STREAM, "  Sample rate: %d Hz\n", header->sample_rate);
+    fprintf(LOGGER_STREAM, "  Byte rate:   %d B\n",  header->byte_rate);
+    fprintf(LOGGER_STREAM, "  Block align: %d B\n",  header->block_align);
+    fprintf(LOGGER_STREAM, "  Bits/sample: %d b\n",  header->bits_per_sample);
+    fprintf(LOGGER_STREAM, "  data marker: %.4s\n",  header->data_marker);
+    fprintf(LOGGER_STREAM, "  Data size:   %d B\n",  header->data_size);
 }
 
 
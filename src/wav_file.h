@@ -2,6 +2,11 @@
 #define _WAV_FILE_H_
 
 
+#define WAV_FILE_CANONICAL_HEADER_SIZE 36
+
+
+#include "precision.h"
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 
@@ -71,17 +76,32 @@ struct wav_file_s {
 struct wav_samples_s {
     size_t num_samples;
     uint32_t sample_rate;
-    double *samples;
+    Sample *samples;
 };
 
 
+/**
+ * Parses the contents of a whole {@code .wav} file that has been read into memory.
+ *
+ * @param contents  The contents of the file, allocated with {@code malloc}. If the file is
+ *                  parsed, the returned structure takes ownership of them, and the data is moved
+ *                  to their start.
+ * @param size      The number of bytes in {@code contents}.
+ *
+ * @return A pointer to a {@code WavFile} structure describing the data in the file. If the file
+ *         is not a PCM-integer wave file or memory cannot be allocated, {@code NULL} is returned
+ *         and {@code contents} is left to the caller.
+ */
+WavFile *wav_file_parse(uint8_t *contents, size_t size);
+
+
 /**
  * Opens a {@code .wav} file.
  *
  * @param path  The path to the {@code .wav} file. Relative paths are relative to the CWD.
  *
  * @return A pointer to a {@code WavFile} structure describing the data in the file. If the file
- *         cannot be opened {@code NULL} is returned.
+ *         cannot be opened or parsed (see {@code wav_file_parse}), {@code NULL} is returned.
  */
 WavFile *wav_file_open(const char *path);
 
@@ -100,6 +120,21 @@ WavFile *wav_file_open(const char *path);
 WavSamples *wav_file_get_mono_samples(const WavFile *wav_file);
 
 
+/**
+ * Creates one list of audio samples per channel of a wave file, normalized on {@code [-1, 1]}.
+ *
+ * The interleaved data is converted in a single pass into one planar block. Each returned
+ * {@code WavSamples} structure is a view of one channel's contiguous slice of that block.
+ *
+ * @param wav_file  The wave file to get the normalized samples from.
+ *
+ * @return An array of {@code wav_file->header->num_channels} structures, one per channel in the
+ *         order they are interleaved in the file. The array must be freed with
+ *         {@code wav_file_free_channel_samples}.
+ */
+WavSamples *wav_file_get_channel_samples(const WavFile *wav_file);
+
+
 /**
  * Normalizes a single sample in a wave file.
  *
@@ -108,7 +143,7 @@ WavSamples *wav_file_get_mono_samples(const WavFile *wav_file);
  *
  * @return The normalized value of the raw sample.
  */
-static double wav_file_normalize_sample(uint32_t raw_sample, uint32_t bits_per_sample);
+static Sample wav_file_normalize_sample(uint32_t raw_sample, uint32_t bits_per_sample);
 
 
 /**
@@ -119,10 +154,29 @@ static double wav_file_normalize_sample(uint32_t raw_sample, uint32_t bits_per_s
 void wav_file_free_samples(WavSamples *wav_samples);
 
 
+/**
+ * Frees the array of per-channel samples returned by {@code wav_file_get_channel_samples}.
+ *
+ * @param channel_samples  The array of {@code WavSamples} structures to free.
+ */
+void wav_file_free_channel_samples(WavSamples *channel_samples);
+
+
+/**
+ * Saves a list of audio samples as a mono, 16-bit PCM-integer {@code .wav} file.
+ *
+ * @param wav_samples  The samples to save, which are clipped to {@code [-1, 1]}.
+ * @param path         The path to the {@code .wav} file. Relative paths are relative to the CWD.
+ *
+ * @return {@code true} if the file was written, or {@code false} if it could not be.
+ */
+bool wav_file_save(const WavSamples *wav_samples, const char *path);
+
+
 /**
  * Pretty-prints the header metadata in the provided structure.
  *
- * Information is printed in a human-readable format to the standard output. If the wave file
+ * Information is printed in a human-readable format to the stream of the logger. If the wave file
  * pointer is {@code NULL}, the string {@code "[NULL]"} is printed.
  *
  * @param wav_file  The wave file structure to print.
@@ -0,0 +1,31 @@
+# Decodes the generated transmissions of several scoreboard cases with the floating-point build
+# (SSTV) and the fixed-point build (SSTV_FIXED), and fails if the images of any case differ by
+# more than the error bound of the fixed-point build. The cases cover clean recordings at both
+# sample rates, where the pixel windows are shortest, a transmitter clock that drifts either way,
+# and heavy noise.
+set(CASES clean-11025 clean-22050 slow500-11025 fast500-11025 snr3-11025)
+set(MAX_MEAN_LEVELS 0.25)
+
+foreach (case ${CASES})
+  execute_process(COMMAND ${SSTV} --generate ${case} -o ${case}.wav RESULT_VARIABLE result)
+  if (NOT result EQUAL 0)
+    message(FATAL_ERROR "cannot generate case ${case}")
+  endif()
+  foreach (build SSTV SSTV_FIXED)
+    execute_process(
+        COMMAND ${${build}} -x --sink ppm ${case}.wav
+        OUTPUT_FILE ${case}-${build}.ppm
+        RESULT_VARIABLE result
+    )
+    if (NOT result EQUAL 0)
+      message(FATAL_ERROR "${build} cannot decode case ${case}")
+    endif()
+  endforeach()
+  execute_process(
+      COMMAND ${IMAGE_DIFF} ${case}-SSTV.ppm ${case}-SSTV_FIXED.ppm ${MAX_MEAN_LEVELS}
+      RESULT_VARIABLE result
+  )
+  if (NOT result EQUAL 0)
+    message(FATAL_ERROR "the fixed-point build is beyond its error bound in case ${case}")
+  endif()
+endforeach()
@@ -0,0 +1,90 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+
+/**
+ * Reads the header of the next binary PPM image in a stream, as the {@code ppm} sink writes it.
+ *
+ * @param file    The stream to read from.
+ * @param width   Set to the width of the image, in pixels.
+ * @param height  Set to the height of the image, in pixels.
+ *
+ * @return {@code true} if a header was read, or {@code false} at the end of the stream.
+ */
+static bool read_ppm_header(FILE *file, size_t *width, size_t *height) {
+    unsigned int max_value;
+    if (fscanf(file, " P6 %zu %zu %u", width, height, &max_value) != 3 || max_value != 255) {
+        return false;
+    }
+    return fgetc(file) != EOF;
+}
+
+
+/**
+ * Compares the images of two streams of binary PPM images, such as the output of two builds with
+ * {@code --sink ppm}, and fails if they differ by more than a mean number of levels.
+ *
+ * usage: image_diff expected.ppm actual.ppm max_mean_levels
+ */
+int main(int argc, char **argv) {
+    if (argc != 4) {
+        fprintf(stderr, "usage: image_diff expected.ppm actual.ppm max_mean_levels\n");
+        return 1;
+    }
+    FILE *expected = fopen(argv[1], "rb");
+    FILE *actual = fopen(argv[2], "rb");
+    double max_mean_levels = atof(argv[3]);
+    if (expected == NULL || actual == NULL) {
+        fprintf(stderr, "cannot open `%s' or `%s'\n", argv[1], argv[2]);
+        return 1;
+    }
+
+    size_t num_images = 0;
+    bool passed = true;
+    size_t width, height, actual_width, actual_height;
+    while (read_ppm_header(expected, &width, &height)) {
+        if (!read_ppm_header(actual, &actual_width, &actual_height)
+            || actual_width != width
+            || actual_height != height)
+        {
+            fprintf(stderr, "image %zu is missing or has another size in `%s'\n", num_images,
+                    argv[2]);
+            passed = false;
+            break;
+        }
+
+        // Each channel value counts on its own, so the mean is in levels of one channel.
+        size_t num_values = width * height * 3;
+        size_t num_differing = 0;
+        unsigned long total_levels = 0;
+        int max_levels = 0;
+        for (size_t i = 0; i < num_values; i++) {
+            int levels = abs(fgetc(expected) - fgetc(actual));
+            total_levels += levels;
+            num_differing += (levels > 1);
+            max_levels = (levels > max_levels) ? levels : max_levels;
+        }
+        double mean_levels = (double) total_levels / num_values;
+        printf("image %zu: mean %.3f levels, max %d levels, %.3f%% of values off by more than 1\n",
+               num_images, mean_levels, max_levels, 100.0 * num_differing / num_values);
+        if (mean_levels > max_mean_levels) {
+            fprintf(stderr, "image %zu differs by a mean of %.3f levels, more than %.3f\n",
+                    num_images, mean_levels, max_mean_levels);
+            passed = false;
+        }
+        num_images++;
+    }
+    if (num_images == 0) {
+        fprintf(stderr, "no images in `%s'\n", argv[1]);
+        passed = false;
+    }
+    else if (passed && read_ppm_header(actual, &actual_width, &actual_height)) {
+        fprintf(stderr, "`%s' has more images than `%s'\n", argv[2], argv[1]);
+        passed = false;
+    }
+
+    fclose(expected);
+    fclose(actual);
+    return passed ? 0 : 1;
+}